@@ -3,8 +3,12 @@
 Purpose: Simulate Interrupts and ISRs in C++ for firmware learning.
          Demonstrates:
          - ISR simulation using threads
-         - Flag-based communication
+         - Deferred work: ISRs post typed events into a lock-free queue
          - Timer-based interrupt simulation
+         - A main loop that sleeps until work arrives and drains it in batches
+         - Per-IRQ latency/jitter histograms (fw_latency.h)
+         - Nested interrupts and PRIMASK/BASEPRI critical sections (fw_irq.h)
+         - A Chrome/Perfetto timeline of ISRs and critical sections (fw_trace.h)
 Author: Sankalpa Hota
 How to compile:
   g++ 08_interrupts_isrs.cpp -o interrupts_demo -std=c++11 -pthread
@@ -14,24 +18,140 @@ This code teaches:
 - How firmware responds to asynchronous events
 - How ISRs communicate with the main program
 - How to safely simulate hardware interrupts in C++
+- Why "one flag per interrupt" loses events under bursts
 ===============================================================================
 */
 
 #include <iostream>     // For console input/output
+#include <iomanip>      // For report formatting
 #include <thread>       // For creating threads to simulate asynchronous events
 #include <atomic>       // For atomic flags (safe communication between threads)
 #include <chrono>       // For timing and delays
+#include <mutex>        // Wake-up line of the sleeping main loop
+#include <condition_variable>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <fstream>
+#include "fw_latency.h" // ISR entry/exit and handler timestamps, histograms
+#include "fw_irq.h"     // Simulated NVIC: priorities, nesting, masking
+#include "fw_trace.h"   // Timeline export
 using namespace std;
 
 // -----------------------------------------------------------------------------
-// SECTION 1: GLOBAL FLAGS
+// SECTION 1: EVENTS AND THE DEFERRED WORK QUEUE
 // -----------------------------------------------------------------------------
 /*
-  In firmware, ISRs and main program often share a flag or variable.
-  atomic<bool> ensures thread-safe access (no race condition).
+  A single atomic<bool> per interrupt cannot count: three button presses
+  before the main loop looks collapse into one, and the payload (which
+  pin, which ADC value) is lost. Instead every ISR posts an Event into a
+  queue and the main loop (the "bottom half") handles them in order.
+
+  The queue is a ring of WORKQ_SLOTS slots, each with a sequence number:
+    - ISR (producer): take a ticket with one fetch_add on `tail`, write
+      the event into slot[ticket], then publish it by storing
+      seq = ticket + 1. No loops, no locks: wait-free, so an ISR can
+      never be held up by the main loop or by another ISR.
+    - Main loop (single consumer): slot[head] is ready when its seq is
+      head + 1; copy it out and advance head.
+  When the queue is full the ISR drops the event and counts it; an ISR
+  must never wait. The full check happens before the ticket is taken,
+  so several ISRs passing it at once can overshoot `capacity` by at most
+  one slot each; WORKQ_MAX_PRODUCERS slots of headroom absorb that.
 */
-atomic<bool> buttonPressed(false);   // Flag set by ISR when button is pressed
-atomic<bool> timerElapsed(false);    // Flag set by ISR when timer interrupt occurs
+#define WORKQ_SLOTS          1024  // Physical ring size (power of two)
+#define WORKQ_MAX_PRODUCERS  8     // Contexts that may post at the same time
+#define WORKQ_BATCH          32    // Events the main loop takes per wake-up
+
+enum EventType : uint8_t { EVT_BUTTON, EVT_TIMER, EVT_ADC, EVT_SHUTDOWN, EVT_TYPES };
+const char *EVT_NAMES[EVT_TYPES] = {"button", "timer", "adc", "shutdown"};
+
+struct Event {
+    EventType type;
+    uint32_t payload;       // Pin, tick count, sample... depends on type
+    uint64_t irqEntryNs;    // When the posting ISR was entered
+};
+
+uint64_t nowNs() { return FwLat_NowNs(); }
+
+struct WorkQueue {
+    struct Slot {
+        atomic<uint64_t> seq;
+        Event ev;
+    };
+    Slot slots[WORKQ_SLOTS];
+    atomic<uint64_t> tail;          // Next ticket (ISRs)
+    atomic<uint64_t> head;          // Next event to handle (main loop)
+    atomic<uint64_t> lost;          // Dropped because the queue was full
+    uint32_t capacity;              // Usable depth
+
+    // Wake-up line: on hardware any interrupt ends WFI; here the posting
+    // thread has to poke the sleeping main thread
+    atomic<bool> sleeping;
+    mutex wakeLock;
+    condition_variable wake;
+};
+
+WorkQueue isrQueue;
+
+void WorkQueue_Reset(WorkQueue &q, uint32_t capacity) {
+    for (int i = 0; i < WORKQ_SLOTS; i++) q.slots[i].seq.store(0);
+    q.tail.store(0);
+    q.head.store(0);
+    q.lost.store(0);
+    q.sleeping.store(false);
+    const uint32_t usable = WORKQ_SLOTS - WORKQ_MAX_PRODUCERS;
+    q.capacity = capacity < usable ? capacity : usable;
+}
+
+// ISR side: returns false if the event had to be dropped
+bool ISR_Post(WorkQueue &q, EventType type, uint32_t payload, uint64_t irqEntryNs) {
+    if (q.tail.load(memory_order_relaxed) - q.head.load(memory_order_acquire) >= q.capacity) {
+        q.lost.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+    uint64_t ticket = q.tail.fetch_add(1, memory_order_relaxed);
+    WorkQueue::Slot &s = q.slots[ticket & (WORKQ_SLOTS - 1)];
+    s.ev.type = type;
+    s.ev.payload = payload;
+    s.ev.irqEntryNs = irqEntryNs;
+    s.seq.store(ticket + 1);                         // publish
+    if (q.sleeping.load()) {                         // raise the wake-up line
+        lock_guard<mutex> lock(q.wakeLock);
+        q.wake.notify_one();
+    }
+    return true;
+}
+
+// Main loop side: take up to `max` ready events without blocking
+int WorkQueue_Drain(WorkQueue &q, Event *out, int max) {
+    uint64_t h = q.head.load(memory_order_relaxed);
+    int n = 0;
+    while (n < max) {
+        WorkQueue::Slot &s = q.slots[h & (WORKQ_SLOTS - 1)];
+        if (s.seq.load() != h + 1) break;            // empty, or ISR mid-write
+        out[n++] = s.ev;
+        h++;
+    }
+    q.head.store(h, memory_order_release);           // slots free again
+    return n;
+}
+
+/*
+  Sleep until at least one event is ready (WFI), then take a batch.
+  `sleeping` is set before the final check and read by ISR_Post after
+  publishing, so either the check sees the event or the ISR sees the
+  sleeper and wakes it: no lost wake-ups.
+*/
+int WorkQueue_Wait(WorkQueue &q, Event *out, int max) {
+    int n = WorkQueue_Drain(q, out, max);
+    if (n) return n;
+    unique_lock<mutex> lock(q.wakeLock);
+    q.sleeping.store(true);
+    while ((n = WorkQueue_Drain(q, out, max)) == 0) q.wake.wait(lock);
+    q.sleeping.store(false);
+    return n;
+}
 
 // -----------------------------------------------------------------------------
 // SECTION 2: INTERRUPT SERVICE ROUTINES (ISR)
@@ -40,19 +160,30 @@ atomic<bool> timerElapsed(false);    // Flag set by ISR when timer interrupt occ
   ISR for button press.
   In real firmware, the CPU jumps here automatically when the button is pressed.
   In this simulation, we call it from a separate thread.
+  The ISR only records what happened; the work is deferred.
+  Entry and exit are timestamped; the entry time travels with the event
+  so the main loop can record how long the work waited.
 */
-void buttonISR() {
+FwLatIrq buttonIrq("EXTI13 button");
+FwLatIrq timerIrq("TIM2 timer");
+FwLatIrq *const EVT_IRQS[EVT_TYPES] = {&buttonIrq, &timerIrq, nullptr, nullptr};
+
+void buttonISR(uint32_t pin) {
+    uint64_t entry = FwLat_IsrEnter(buttonIrq);
     cout << "[ISR] Button Press Detected!" << endl;
-    buttonPressed = true; // Set the flag for main program
+    ISR_Post(isrQueue, EVT_BUTTON, pin, entry);
+    FwLat_IsrExit(buttonIrq, entry);
 }
 
 /*
   ISR for timer overflow.
   In real firmware, hardware timer triggers this.
 */
-void timerISR() {
+void timerISR(uint32_t tick) {
+    uint64_t entry = FwLat_IsrEnter(timerIrq);
     cout << "[ISR] Timer Interrupt Triggered!" << endl;
-    timerElapsed = true; // Set the flag for main program
+    ISR_Post(isrQueue, EVT_TIMER, tick, entry);
+    FwLat_IsrExit(timerIrq, entry);
 }
 
 // -----------------------------------------------------------------------------
@@ -60,30 +191,39 @@ void timerISR() {
 // -----------------------------------------------------------------------------
 /*
   This simulates the main firmware loop.
-  It continuously checks flags set by ISRs and handles tasks.
+  It sleeps until ISRs post work, then handles every event in the batch.
   Heavy processing is done here instead of inside ISR.
 */
-void mainLoop() {
-    int loopCounter = 0;
+void handleButton(const Event &e) {
+    cout << "[MAIN LOOP] Handling Button Press on pin " << e.payload << endl;
+}
 
-    while (loopCounter < 10) {  // Limit for demo purposes
-        // Handle button press event
-        if (buttonPressed) {
-            cout << "[MAIN LOOP] Handling Button Press" << endl;
-            buttonPressed = false; // Clear flag after handling
-        }
+void handleTimer(const Event &e) {
+    cout << "[MAIN LOOP] Handling Timer Event #" << e.payload << endl;
+}
 
-        // Handle timer event
-        if (timerElapsed) {
-            cout << "[MAIN LOOP] Handling Timer Event" << endl;
-            timerElapsed = false; // Clear flag after handling
-        }
+void handleAdc(const Event &) {}
+
+void (*const EVT_HANDLERS[EVT_TYPES])(const Event &) = {
+    handleButton, handleTimer, handleAdc, nullptr
+};
 
+void mainLoop() {
+    Event batch[WORKQ_BATCH];
+    bool running = true;
+
+    while (running) {
+        int n = WorkQueue_Wait(isrQueue, batch, WORKQ_BATCH);   // sleep here
+        for (int i = 0; i < n; i++) {
+            const Event &e = batch[i];
+            if (e.type == EVT_SHUTDOWN) { running = false; continue; }
+            FwLatIrq *irq = EVT_IRQS[e.type];
+            if (irq) FwLat_HandlerStart(*irq, e.irqEntryNs);
+            EVT_HANDLERS[e.type](e);
+            if (irq) FwLat_HandlerDone(*irq, e.irqEntryNs);
+        }
         // Simulate other main tasks
         cout << "[MAIN LOOP] Performing regular tasks..." << endl;
-
-        this_thread::sleep_for(chrono::milliseconds(200)); // Simulate task delay
-        loopCounter++;
     }
 }
 
@@ -99,22 +239,238 @@ void mainLoop() {
 // Simulate a button press after a delay
 void simulateButtonPress() {
     this_thread::sleep_for(chrono::milliseconds(500)); // Wait 500ms
-    buttonISR(); // Call ISR as if hardware triggered
+    buttonISR(13); // Call ISR as if hardware triggered (PC13)
 }
 
 // Simulate a timer interrupt periodically
 void simulateTimerInterrupt() {
     for (int i = 0; i < 3; i++) { // Simulate 3 timer events
         this_thread::sleep_for(chrono::milliseconds(300)); // Wait 300ms
-        timerISR(); // Call ISR as if timer triggered
+        timerISR(i + 1); // Call ISR as if timer triggered
+    }
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 5: BURST BENCHMARK
+// -----------------------------------------------------------------------------
+/*
+  Three interrupt sources fire in bursts: 64 events back to back, then a
+  random 0.2-1 ms gap, 20000 events each. The main loop spends 1 us per
+  event. Reported per queue depth:
+    lost      events dropped by ISR_Post (queue full)
+    p50/p99   ISR entry → handler start latency
+    batch     average events handled per wake-up
+  The last row is the old scheme, one atomic<bool> per source polled as
+  fast as possible: every event that arrives while the flag is still set
+  is silently merged into the previous one.
+*/
+const int BENCH_SOURCES = 3;
+const int BENCH_EVENTS = 20000;
+const int BENCH_BURST = 64;
+
+void spinNs(uint64_t ns) {
+    uint64_t end = nowNs() + ns;
+    while (nowNs() < end) {}
+}
+
+void burstSource(int id, bool useFlags, atomic<bool> *flags, atomic<uint64_t> *flagPostNs) {
+    mt19937 rng(id + 1);
+    uniform_int_distribution<int> gapUs(200, 1000);
+    for (int sent = 0; sent < BENCH_EVENTS; ) {
+        for (int i = 0; i < BENCH_BURST && sent < BENCH_EVENTS; i++, sent++) {
+            if (useFlags) {
+                flagPostNs[id].store(nowNs());
+                flags[id].store(true);
+            } else {
+                ISR_Post(isrQueue, (EventType)id, (uint32_t)sent, nowNs());
+            }
+        }
+        this_thread::sleep_for(chrono::microseconds(gapUs(rng)));
     }
 }
 
+void printBenchRow(const char *name, uint64_t posted, uint64_t handled,
+                   const FwLatHistogram &lat, double batch) {
+    cout << left << setw(14) << name << right << setw(9) << posted << setw(9) << handled
+         << fixed << setprecision(2) << setw(8) << 100.0 * (posted - handled) / posted << "%"
+         << setw(10) << lat.percentile(50) / 1000.0
+         << setw(10) << lat.percentile(99) / 1000.0
+         << setw(8) << setprecision(1) << batch << endl;
+}
+
+void deferredWorkBenchmark() {
+    const uint64_t handlerNs = 1000;
+    const uint32_t depths[] = {16, 64, 256, 1016};
+    const uint64_t posted = (uint64_t)BENCH_SOURCES * BENCH_EVENTS;
+    static FwLatHistogram latency;      // 11 KB: keep it off the stack
+
+    cout << "\n---- Burst load: " << BENCH_SOURCES << " sources x " << BENCH_EVENTS
+         << " events, bursts of " << BENCH_BURST << ", 1 us handler ----" << endl;
+    cout << left << setw(14) << "Scheme" << right << setw(9) << "posted" << setw(9) << "handled"
+         << setw(9) << "lost" << setw(10) << "p50 us" << setw(10) << "p99 us"
+         << setw(8) << "batch" << endl;
+
+    for (uint32_t depth : depths) {
+        WorkQueue_Reset(isrQueue, depth);
+        latency.reset();
+        uint64_t handled = 0, wakeups = 0;
+
+        thread consumer([&] {
+            Event batch[WORKQ_BATCH];
+            for (bool running = true; running; ) {
+                int n = WorkQueue_Wait(isrQueue, batch, WORKQ_BATCH);
+                wakeups++;
+                for (int i = 0; i < n; i++) {
+                    if (batch[i].type == EVT_SHUTDOWN) { running = false; continue; }
+                    latency.record(nowNs() - batch[i].irqEntryNs);
+                    spinNs(handlerNs);
+                    handled++;
+                }
+            }
+        });
+        vector<thread> sources;
+        for (int s = 0; s < BENCH_SOURCES; s++)
+            sources.push_back(thread(burstSource, s, false, nullptr, nullptr));
+        for (thread &t : sources) t.join();
+        while (!ISR_Post(isrQueue, EVT_SHUTDOWN, 0, nowNs())) this_thread::yield();
+        consumer.join();
+
+        char name[24];
+        snprintf(name, sizeof(name), "queue[%u]", depth);
+        printBenchRow(name, posted, handled, latency, (double)handled / wakeups);
+    }
+
+    // Old scheme: one flag per source
+    atomic<bool> flags[BENCH_SOURCES];
+    atomic<uint64_t> flagPostNs[BENCH_SOURCES];
+    for (int s = 0; s < BENCH_SOURCES; s++) { flags[s].store(false); flagPostNs[s].store(0); }
+    atomic<bool> done(false);
+    latency.reset();
+    uint64_t handled = 0;
+    thread consumer([&] {
+        while (!done.load()) {
+            bool any = false;
+            for (int s = 0; s < BENCH_SOURCES; s++) {
+                if (!flags[s].exchange(false)) continue;
+                latency.record(nowNs() - flagPostNs[s].load());
+                spinNs(handlerNs);
+                handled++;
+                any = true;
+            }
+            if (!any) this_thread::yield();
+        }
+    });
+    vector<thread> sources;
+    for (int s = 0; s < BENCH_SOURCES; s++)
+        sources.push_back(thread(burstSource, s, true, flags, flagPostNs));
+    for (thread &t : sources) t.join();
+    this_thread::sleep_for(chrono::milliseconds(5));
+    done.store(true);
+    consumer.join();
+    printBenchRow("flags", posted, handled, latency, 1.0);
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 6: NESTED INTERRUPTS AND CRITICAL SECTIONS
+// -----------------------------------------------------------------------------
+/*
+  The threads above cannot show what really decides interrupt latency on
+  a microcontroller: priorities, preemption and the time interrupts are
+  masked. This part runs on the simulated NVIC of fw_irq.h instead, one
+  deterministic CPU in simulated time.
+
+  IRQ          prio  rate      handler
+  UART1_RX     1     86.8 us   1.5 us   one byte at 115200 baud, no FIFO:
+                                        must be read before the next one
+  TIM2_CTRL    2     1 kHz     25 us    control loop
+  SysTick      3     1 kHz     3 us
+  ADC_DMA      4     4 kHz     5 us     swaps buffers under PRIMASK
+
+  The main loop pops the UART ring under PRIMASK, runs sensor fusion with
+  BASEPRI = 3 (SysTick and ADC held off, UART and control loop not) and
+  every 20 ms writes a flash page for 180 us. The first run protects the
+  flash write with PRIMASK, the second with BASEPRI = 2, which still lets
+  UART RX in. The report names the code path behind each worst case.
+*/
+void uartRxHandler()      { CPU_Run(1500); }
+void controlLoopHandler() { CPU_Run(25000); }
+void sysTickHandler()     { CPU_Run(3000); }
+
+void adcDmaHandler() {
+    CPU_Run(4200);
+    IRQ_CriticalSection cs("adc_buffer_swap");   // DMA must not see half a swap
+    CPU_Run(800);
+}
+
+void firmwareMainLoop(uint64_t runNs, bool flashUsesBasepri) {
+    uint64_t nextFlashNs = 20000000;
+    while (NVIC.nowNs < runNs) {
+        {
+            IRQ_CriticalSection cs("uart_rx_ring_pop");
+            CPU_Run(400);
+        }
+        CPU_Run(30000);                          // protocol handling
+        {
+            IRQ_BasepriSection bs(3, "sensor_fusion");
+            CPU_Run(60000);
+        }
+        if (NVIC.nowNs >= nextFlashNs) {
+            nextFlashNs += 20000000;
+            if (flashUsesBasepri) {
+                IRQ_BasepriSection bs(2, "flash_page_write");
+                CPU_Run(180000);
+            } else {
+                IRQ_CriticalSection cs("flash_page_write");
+                CPU_Run(180000);
+            }
+        }
+    }
+}
+
+void registerDemoIrqs() {
+    NVIC_Reset();
+    NVIC_Register("UART1_RX", 1, uartRxHandler, 86800, 1000);
+    NVIC_Register("TIM2_CTRL", 2, controlLoopHandler, 1000000, 50000);
+    NVIC_Register("SysTick", 3, sysTickHandler, 1000000, 0);
+    NVIC_Register("ADC_DMA", 4, adcDmaHandler, 250000, 50000);
+}
+
+void nestedInterruptDemo() {
+    for (int fix = 0; fix <= 1; fix++) {
+        registerDemoIrqs();
+        firmwareMainLoop(1000000000ULL, fix);
+
+        cout << "\n---- Simulated NVIC, 1 s: flash write under "
+             << (fix ? "BASEPRI = 2" : "PRIMASK") << " ----" << endl;
+        NVIC_Report(cout);
+    }
+}
+
+/*
+  The same firmware with the flash write under PRIMASK, traced for the
+  first 50 ms (two flash writes). In the viewer, the UART1_RX track
+  shows each long "pending" slice and its blocked_by argument; the CPU
+  track shows what ran meanwhile, handlers nested inside what they
+  preempted.
+*/
+void traceNestedInterrupts() {
+    registerDemoIrqs();
+    FwTrace_Start();
+    firmwareMainLoop(50000000ULL, false);
+    FwTrace_Stop();
+    ofstream json("trace_08.json");
+    FwTrace_WriteJson(json);
+    cout << "Timeline of 50 ms (" << FwTrace_EventCount()
+         << " events) written to trace_08.json (open in ui.perfetto.dev)" << endl;
+}
+
 // -----------------------------------------------------------------------------
-// SECTION 5: MAIN FUNCTION
+// SECTION 7: MAIN FUNCTION
 // -----------------------------------------------------------------------------
 int main() {
     cout << "==== Firmware Interrupt Simulation Demo ====" << endl;
+    FwLat_Init();
+    WorkQueue_Reset(isrQueue, 64);
 
     // Start the main loop in a separate thread (like the main firmware loop)
     thread main_thread(mainLoop);
@@ -127,8 +483,19 @@ int main() {
     button_thread.join();
     timer_thread.join();
 
-    // Detach main loop (in real firmware it runs forever)
-    main_thread.detach();
+    // In real firmware the main loop runs forever; here we tell it to stop
+    ISR_Post(isrQueue, EVT_SHUTDOWN, 0, nowNs());
+    main_thread.join();
+
+    cout << "\n---- Interrupt latency (" << FwLat_ClockName() << ") ----" << endl;
+    FwLat_PrintSummary(cout);
+    ofstream json("irq_latency_08.json");
+    FwLat_DumpJson(json);
+    cout << "Histograms written to irq_latency_08.json" << endl;
+
+    deferredWorkBenchmark();
+    nestedInterruptDemo();
+    traceNestedInterrupts();
 
     cout << "==== Demo Complete ====" << endl;
     return 0;
@@ -146,17 +513,35 @@ Key Learnings:
    - Often sets a flag or copies data
    - Avoid heavy processing
 
-3. Main Loop: Performs heavy or time-consuming tasks after ISR sets flags.
+3. Main Loop: Performs heavy or time-consuming tasks after ISR posts work.
 
-4. atomic<bool>: Ensures safe communication between ISR and main program.
+4. atomic<bool>: Ensures safe communication between ISR and main program,
+   but a flag can only say "at least once" — bursts merge into one event.
 
 5. Thread Simulation: Used here to mimic asynchronous hardware events for learning.
 
 6. Timer-based Interrupts: Show how firmware handles periodic events without
    continuously polling in main loop.
 
+7. Deferred work queue (bottom half): ISRs post typed events with payloads
+   into a wait-free MPSC ring; the main loop sleeps until work arrives and
+   drains it in batches. Queue depth is sized for the worst burst.
+
+8. Latency instrumentation: timestamp ISR entry/exit and handler start/end,
+   keep per-IRQ histograms and look at p99/max and jitter, not averages.
+   Even a cout inside an ISR shows up as tens of microseconds.
+
+9. Nested interrupts: a more urgent (lower number) IRQ preempts a running
+   handler. PRIMASK masks everything; BASEPRI masks only priorities at or
+   below a threshold, so urgent IRQs keep their latency while the critical
+   section still excludes the handlers it shares data with. Worst-case
+   latency = longest section that masks the IRQ + higher-priority handlers.
+
+10. A timeline beats a table for finding the cause: the trace shows the
+    interrupt pending and, right above it, the section that masked it.
+
 This code gives a **firmware-style pattern**:
-- ISR triggers → set flag → main loop handles processing.
+- ISR triggers → post event → main loop handles processing.
 - This pattern is widely used in embedded systems, including Apple firmware.
 ===============================================================================
 */
@@ -10,6 +10,12 @@ This simulation teaches:
 - Timer interrupts
 - Task scheduling (RTOS)
 - Task priorities
+- Measuring timer interrupt latency and jitter (fw_latency.h)
+- Tickless idle: the scheduler sleeps until the next deadline or interrupt
+- A Chrome/Perfetto timeline of tasks, the ISR and mutex waits (fw_trace.h)
+- Reproducible task interleavings: FW_SCHED_SEED=n runs the task demo
+  on the deterministic scheduler (fw_sched.h), FW_SCHED_RECORD /
+  FW_SCHED_REPLAY save and repeat one run exactly
 ===============================================================================
 */
 
@@ -18,53 +24,117 @@ This simulation teaches:
 #include <atomic>
 #include <chrono>
 #include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include "fw_latency.h" // ISR entry/exit and handler timestamps, histograms
+#include "fw_trace.h"   // Timeline export
+#include "fw_sched.h"   // Deterministic runs (FW_SCHED_SEED=n)
 using namespace std;
 
 // -----------------------------------------------------------------------------
 // SECTION 1: GLOBAL FLAGS AND MUTEX
 // -----------------------------------------------------------------------------
 atomic<bool> timerFlag(false);      // Flag set by timer ISR
-mutex uartMutex;                     // Simulate UART shared resource
+atomic<uint64_t> timerEntryNs(0);   // When the timer ISR was entered
+FwLatIrq timerIrq("TIM2 timer");    // Latency statistics for the timer IRQ
+FwMutex uartMutex;                   // Simulate UART shared resource
+FwMutex wakeMutex;                   // Wake-up line of the idle scheduler
+FwCondVar wakeLine;
+
+// Timeline tracks, one per task (set up when tracing starts)
+int trLed, trUart, trTimerIsr, trScheduler;
 
 // -----------------------------------------------------------------------------
 // SECTION 2: ISR SIMULATION (TIMER)
 // -----------------------------------------------------------------------------
 void timerISR() {
+    FwTraceScope trace(trTimerIsr, "TIM2 ISR", "isr");
+    uint64_t entry = FwLat_IsrEnter(timerIrq);
     cout << "[TIMER ISR] Timer event occurred!" << endl;
+    timerEntryNs = entry;
     timerFlag = true; // Set flag for main task
+    {
+        lock_guard<FwMutex> lock(wakeMutex);         // any IRQ ends WFI
+        wakeLine.notify_one();
+    }
+    FwLat_IsrExit(timerIrq, entry);
 }
 
 // -----------------------------------------------------------------------------
 // SECTION 3: TASKS (RTOS SIMULATION)
 // -----------------------------------------------------------------------------
+/*
+  Both tasks report over the same UART, so the LED task has to take
+  uartMutex too. The UART task holds it for a whole 700 ms transmission:
+  the LED task's toggles slip behind it, a stall that shows up in the
+  trace as "mutex wait" slices on the LED task's track.
+*/
 void ledTask() {
     for(int i=0;i<5;i++) {
-        cout << "[LED TASK] Toggling LED..." << endl;
-        this_thread::sleep_for(chrono::milliseconds(500)); // Simulate work
+        {
+            FwTraceLock<FwMutex> lock(uartMutex, "uartMutex", trLed);
+            FwTraceScope trace(trLed, "toggle LED", "task");
+            cout << "[LED TASK] Toggling LED..." << endl;
+        }
+        FwTraceScope trace(trLed, "delay", "blocked");
+        FwSleepFor(chrono::milliseconds(500)); // Simulate work
     }
 }
 
 void uartTask() {
     for(int i=0;i<3;i++) {
-        lock_guard<mutex> lock(uartMutex); // Simulate resource protection
+        FwTraceLock<FwMutex> lock(uartMutex, "uartMutex", trUart); // Simulate resource protection
+        FwTraceScope trace(trUart, "send", "task");
         cout << "[UART TASK] Sending data over UART..." << endl;
-        this_thread::sleep_for(chrono::milliseconds(700)); // Simulate work
+        FwSleepFor(chrono::milliseconds(700)); // Simulate work
     }
 }
 
+/*
+  Tickless scheduler. Instead of waking on a 200 ms tick to look for
+  work, it computes the next software-timer deadline (the watchdog
+  refresh, or the end of the demo) and sleeps until then. The timer ISR
+  ends the sleep early. A periodic tick would have woken it 10 times in
+  these 2 s whether there was work or not.
+*/
+const chrono::milliseconds RTOS_RUN_TIME(2000);
+const chrono::milliseconds WATCHDOG_PERIOD(800);
+
 void mainRTOSLoop() {
-    int loopCounter = 0;
-    while(loopCounter < 10) { // Limit for demo
+    FwClock::time_point start = FwClock::now();
+    FwClock::time_point end = start + RTOS_RUN_TIME;
+    FwClock::time_point nextKick = start + WATCHDOG_PERIOD;
+    int wakeups = 0;
+
+    while (true) {
         // Check timer flag
         if(timerFlag) {
+            FwTraceScope trace(trScheduler, "timer event", "task");
+            uint64_t entry = timerEntryNs;
+            FwLat_HandlerStart(timerIrq, entry);
             cout << "[MAIN LOOP] Handling Timer Event" << endl;
             timerFlag = false;
+            FwLat_HandlerDone(timerIrq, entry);
+        }
+
+        FwClock::time_point now = FwClock::now();
+        if (now >= nextKick) {
+            FwTrace_Instant(trScheduler, "watchdog refresh", "task", FwTrace_NowNs());
+            cout << "[MAIN LOOP] Watchdog refreshed" << endl;
+            nextKick += WATCHDOG_PERIOD;
         }
+        if (now >= end) break;
 
-        // Simulate main RTOS scheduler tasks
-        this_thread::sleep_for(chrono::milliseconds(200));
-        loopCounter++;
+        // Idle until the next deadline or an interrupt
+        FwClock::time_point deadline = min(nextKick, end);
+        FwTraceScope trace(trScheduler, "idle", "idle");
+        unique_lock<FwMutex> lock(wakeMutex);
+        wakeLine.wait_until(lock, deadline, [] { return timerFlag.load(); });
+        wakeups++;
     }
+    cout << "[MAIN LOOP] Tickless idle: " << wakeups << " wake-ups in "
+         << RTOS_RUN_TIME.count() << " ms (a 200 ms tick: "
+         << RTOS_RUN_TIME.count() / 200 << ")" << endl;
 }
 
 // -----------------------------------------------------------------------------
@@ -72,22 +142,81 @@ void mainRTOSLoop() {
 // -----------------------------------------------------------------------------
 void simulateHardwareTimer() {
     for(int i=0;i<3;i++) {
-        this_thread::sleep_for(chrono::milliseconds(600)); // Timer interval
+        FwSleepFor(chrono::milliseconds(600)); // Timer interval
         timerISR();
     }
 }
 
 // -----------------------------------------------------------------------------
-// SECTION 5: MAIN FUNCTION
+// SECTION 5: TIMER LATENCY MEASUREMENT
+// -----------------------------------------------------------------------------
+/*
+  A 1 kHz timer (absolute deadlines, so errors do not accumulate) sets a
+  flag 500 times while the main loop polls it every pollUs. The latency
+  histogram shows the polling interval directly: p50 is about half of
+  it, the max about all of it. The period histogram shows the timer's
+  own jitter (OS wake-up noise stands in for interrupt masking).
+  pollUs = 0 is the tickless variant: the loop sleeps until the timer
+  raises its wake-up line, so it wakes once per event and still reacts
+  without a polling delay.
+*/
+void measureTimerLatency(FwLatIrq &irq, int pollUs) {
+    atomic<bool> flag(false), done(false);
+    atomic<uint64_t> entryNs(0);
+    mutex lineLock;
+    condition_variable line;
+
+    thread timer([&] {
+        chrono::steady_clock::time_point next = chrono::steady_clock::now();
+        for (int i = 0; i < 500; i++) {
+            next += chrono::milliseconds(1);
+            this_thread::sleep_until(next);
+            uint64_t entry = FwLat_IsrEnter(irq);
+            entryNs = entry;
+            flag = true;
+            if (!pollUs) { lock_guard<mutex> lock(lineLock); line.notify_one(); }
+            FwLat_IsrExit(irq, entry);
+        }
+        lock_guard<mutex> lock(lineLock);
+        done = true;
+        line.notify_one();
+    });
+
+    while (!done || flag) {
+        if (flag.exchange(false)) {
+            uint64_t entry = entryNs;
+            FwLat_HandlerStart(irq, entry);
+            FwLat_HandlerDone(irq, entry);
+        }
+        if (pollUs) {
+            this_thread::sleep_for(chrono::microseconds(pollUs));
+        } else {
+            unique_lock<mutex> lock(lineLock);
+            line.wait(lock, [&] { return flag.load() || done.load(); });
+        }
+    }
+    timer.join();
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 6: MAIN FUNCTION
 // -----------------------------------------------------------------------------
 int main() {
     cout << "==== Firmware Timers & RTOS Simulation ====" << endl;
+    FwLat_Init();
+
+    // Record a timeline of the task demo
+    FwTrace_Start();
+    trLed = FwTrace_Track("09 RTOS", "LED task");
+    trUart = FwTrace_Track("09 RTOS", "UART task");
+    trTimerIsr = FwTrace_Track("09 RTOS", "TIM2 ISR");
+    trScheduler = FwTrace_Track("09 RTOS", "scheduler");
 
     // Start tasks (threads)
-    thread led_thread(ledTask);       // LED task
-    thread uart_thread(uartTask);     // UART task
-    thread timer_thread(simulateHardwareTimer); // Timer interrupt
-    thread rtos_loop(mainRTOSLoop);  // RTOS main loop
+    FwThread led_thread(ledTask);       // LED task
+    FwThread uart_thread(uartTask);     // UART task
+    FwThread timer_thread(simulateHardwareTimer); // Timer interrupt
+    FwThread rtos_loop(mainRTOSLoop);  // RTOS main loop
 
     // Join threads for demo purposes
     led_thread.join();
@@ -95,6 +224,22 @@ int main() {
     timer_thread.join();
     rtos_loop.join();
 
+    FwTrace_Stop();
+    ofstream trace("trace_09.json");
+    FwTrace_WriteJson(trace);
+    cout << "Timeline written to trace_09.json (open in ui.perfetto.dev)" << endl;
+
+    FwLatIrq poll1ms("TIM6 poll 1ms"), poll100us("TIM6 poll 100us"), tickless("TIM6 tickless");
+    measureTimerLatency(poll1ms, 1000);
+    measureTimerLatency(poll100us, 100);
+    measureTimerLatency(tickless, 0);
+
+    cout << "\n---- Timer latency (" << FwLat_ClockName() << ") ----" << endl;
+    FwLat_PrintSummary(cout);
+    ofstream json("irq_latency_09.json");
+    FwLat_DumpJson(json);
+    cout << "Histograms written to irq_latency_09.json" << endl;
+
     cout << "==== Demo Complete ====" << endl;
     return 0;
 }
@@ -112,13 +257,31 @@ Key Concepts Demonstrated:
    - Each thread simulates a separate RTOS task
    - Tasks can run concurrently
    - Mutex protects shared resources (UART)
+   - A task holding a mutex for long stalls every other task that needs
+     it; a per-task timeline shows who waited, for how long, and why
 
 3. Main RTOS Loop:
    - Scheduler checks flags and executes tasks
    - Mimics priority-based task execution
+   - Tickless: sleeps until the next timer deadline, wakes early on an
+     interrupt, instead of waking on every tick just to find nothing to do
 
 4. atomic & mutex:
    - Safe communication between ISR and tasks
    - Prevent race conditions
+
+5. Latency & jitter:
+   - Timestamp ISR entry, exit and handler completion
+   - A polled flag adds up to one polling interval of latency
+   - Judge real-time behaviour by p99/max, not by the average
+
+6. Reproducing a task race:
+   - Which task gets the mutex first depends on OS timing, so a bug
+     that needs one particular order shows up once in a hundred runs
+   - Under FW_SCHED_SEED each seed is one fixed order, on a virtual
+     clock; a failing seed fails every time, and FW_SCHED_RECORD keeps
+     the exact decisions for FW_SCHED_REPLAY
+   - The latency measurement (section 5) stays on real threads: it
+     measures the OS, which a simulated clock cannot
 ===============================================================================
 */
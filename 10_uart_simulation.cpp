@@ -5,18 +5,39 @@ Purpose: Demonstrate UART (Universal Asynchronous Receiver/Transmitter)
          - Shows TX/RX buffers
          - Simulates wire transfer delay
          - Uses mutex for safe register access (as if hardware registers)
+         - Fixed-depth RX FIFO with watermark interrupt and overrun counter
+         - RTS/CTS hardware flow control between two UART endpoints
+         - Two-node link over a simulated cable (latency, bit errors,
+           baud mismatch) running a request/response protocol
+         - Buffered asynchronous logging on the hot paths (fw_log.h),
+           sent as binary ids + arguments and decoded on the host
+         - Deterministic, replayable runs of the wire thread (fw_sched.h)
 
 How to compile & run:
   g++ 10_uart_simulation.cpp -o uart_demo -std=c++11 -pthread
   ./uart_demo
+  FW_SCHED_SEED=7 FW_SCHED_RECORD=uart.sched ./uart_demo   // reproducible
+  FW_SCHED_REPLAY=uart.sched ./uart_demo                   // same run again
 ===============================================================================
 */
 
 #include <iostream>   // For printing to console
-#include <queue>      // To simulate hardware transmit/receive FIFOs
+#include <iomanip>    // For formatting the benchmark table
+#include <queue>      // To simulate hardware transmit FIFO
+#include <deque>      // Bytes "in flight" on the simulated cable
+#include <vector>     // Protocol frames and RTT samples
+#include <algorithm>  // For sorting RTT samples
+#include <random>     // Bit-error injection on the cable
+#include <atomic>     // Stop flag for the wire thread
 #include <thread>     // To simulate concurrent hardware behavior
 #include <chrono>     // To add timing delays
 #include <mutex>      // To safely access shared "registers"
+#include <cstdint>    // For fixed-width integer types
+#include <fstream>    // Log sink for the logging cost benchmark
+#include <sstream>    // Captured debug-UART bytes and log dictionary
+#include <cstdio>     // remove() for the benchmark's log file
+#include "fw_log.h"   // Deferred, per-thread buffered logging
+#include "fw_sched.h" // Deterministic runs (FW_SCHED_SEED=n)
 using namespace std;
 
 // -----------------------------------------------------------------------------
@@ -29,14 +50,86 @@ In real hardware, UART has memory-mapped registers such as:
   - STATUS  (flags)
   - CTRL    (configuration)
 We simulate those here with C++ variables.
+
+The RX side is a fixed-depth FIFO, like a 16550 (16 bytes) or a 16750
+(64 bytes). When a byte arrives and the FIFO is full, the byte is lost
+and the OVERRUN counter goes up — exactly what happens on real silicon
+when firmware reads too slowly.
 */
+#define UART_RX_FIFO_MAX 64     // Largest RX FIFO depth we support
+
+struct UART_RxFifo {
+    char data[UART_RX_FIFO_MAX];  // Ring buffer storage
+    int head = 0;                 // Next slot to read
+    int tail = 0;                 // Next slot to write
+    int count = 0;                // Bytes currently stored
+    int depth = 16;               // Configured depth (16 or 64)
+
+    bool push(char c) {           // false = FIFO full (overrun)
+        if (count == depth) return false;
+        data[tail] = c;
+        tail = (tail + 1) % depth;
+        count++;
+        return true;
+    }
+    bool pop(char &c) {           // false = FIFO empty
+        if (count == 0) return false;
+        c = data[head];
+        head = (head + 1) % depth;
+        count--;
+        return true;
+    }
+    void reset(int newDepth) {    // Like writing FCR: clears FIFO, sets depth
+        depth = newDepth < 1 ? 1 : newDepth < UART_RX_FIFO_MAX ? newDepth : UART_RX_FIFO_MAX;
+        head = tail = count = 0;
+    }
+};
+
 struct UART_Registers {
     queue<char> txBuffer;   // Simulates transmit FIFO (TX register)
-    queue<char> rxBuffer;   // Simulates receive FIFO (RX register)
+    UART_RxFifo rxBuffer;   // Simulates receive FIFO (RX register), fixed depth
     bool txReady = true;    // True means hardware is ready to send next byte
     bool rxReady = false;   // True means new data has arrived
-    mutex uartLock;         // Protects access to buffers, like disabling IRQs
-} UART;                     // Create global UART object (one peripheral)
+    uint32_t baudRate = 115200; // Line rate (bits per second)
+
+    // Flow control (MCR/MSR bits on a 16550-style UART)
+    bool flowControl = false;       // Auto RTS/CTS enabled
+    bool RTS = true;                // Our RTS output: true = "peer may send"
+    const bool *CTS = nullptr;      // Our CTS input, wired to peer's RTS
+    int rtsMargin = 2;              // Drop RTS when free space <= margin
+
+    // RX watermark interrupt (FCR trigger level)
+    int rxWatermark = 8;                            // IRQ when level reaches this
+    void (*rxWatermarkISR)(UART_Registers &) = nullptr;
+
+    // Line status counters (LSR error bits, accumulated)
+    unsigned long rxBytes = 0;      // Bytes stored in RX FIFO
+    unsigned long rxOverruns = 0;   // Bytes lost because RX FIFO was full
+    unsigned long rxFramingErrors = 0; // Stop bit sampled low (FE bit)
+    unsigned long txBytes = 0;      // Bytes shifted out on TX line
+    unsigned long rxWatermarkIrqs = 0;
+
+    FwMutex uartLock;       // Protects access to buffers, like disabling IRQs
+};                          // One object per peripheral instance (UART0, UART1...)
+
+/*
+UART_UpdateRTS() recomputes our RTS output from the RX FIFO level.
+RTS drops when only rtsMargin bytes of space remain (the margin covers
+a byte already in flight on the wire) and comes back once firmware has
+drained the FIFO below the watermark. Caller must hold uartLock.
+*/
+void UART_UpdateRTS(UART_Registers &u) {
+    if (!u.flowControl) { u.RTS = true; return; }
+    int freeSpace = u.rxBuffer.depth - u.rxBuffer.count;
+    if (freeSpace <= u.rtsMargin)              u.RTS = false;
+    else if (u.rxBuffer.count < u.rxWatermark) u.RTS = true;
+}
+
+// Connect two endpoints with a null-modem cable (RTS of one → CTS of other)
+void UART_ConnectFlowControl(UART_Registers &a, UART_Registers &b) {
+    a.CTS = &b.RTS;
+    b.CTS = &a.RTS;
+}
 
 // -----------------------------------------------------------------------------
 // SECTION 2: UART Transmit Function
@@ -44,16 +137,21 @@ struct UART_Registers {
 /*
 UART_SendChar() imitates writing a byte into TX register.
 When firmware calls this, data is enqueued and hardware
-would normally start shifting bits out.
+would normally start shifting bits out. UART_TxTimeMs is how long the
+"hardware" stays busy; tests and fuzzers set it to 0 so that thousands
+of calls per second need no sleeping.
 */
-void UART_SendChar(char data) {
-    lock_guard<mutex> lock(UART.uartLock);     // ① ensure exclusive access
-    if(UART.txReady) {                         // ② if transmitter idle
-        UART.txBuffer.push(data);              // ③ put byte into TX FIFO
-        UART.txReady = false;                  // ④ mark busy
-        cout << "[UART] Sending char: " << data << endl;
-        this_thread::sleep_for(chrono::milliseconds(100)); // ⑤ simulate TX time
-        UART.txReady = true;                   // ⑥ mark ready again
+uint32_t UART_TxTimeMs = 100;
+
+void UART_SendChar(UART_Registers &uart, char data) {
+    lock_guard<FwMutex> lock(uart.uartLock);   // ① ensure exclusive access
+    if(uart.txReady) {                         // ② if transmitter idle
+        uart.txBuffer.push(data);              // ③ put byte into TX FIFO
+        uart.txReady = false;                  // ④ mark busy
+        FW_LOG_INFO("[UART] Sending char: %c", data);
+        if (UART_TxTimeMs)                     // ⑤ simulate TX time
+            FwSleepFor(chrono::milliseconds(UART_TxTimeMs));
+        uart.txReady = true;                   // ⑥ mark ready again
     }
 }
 
@@ -63,14 +161,15 @@ void UART_SendChar(char data) {
 /*
 UART_ReadChar() imitates reading from RX register.
 Returns next received character or 0 if no data.
+Reading frees FIFO space, so RTS may be re-asserted here.
 */
-char UART_ReadChar() {
-    lock_guard<mutex> lock(UART.uartLock);     // ① lock RX access
-    if(!UART.rxBuffer.empty()) {               // ② data available?
-        char data = UART.rxBuffer.front();     // ③ get next byte
-        UART.rxBuffer.pop();                   // ④ remove it from FIFO
-        UART.rxReady = !UART.rxBuffer.empty(); // ⑤ update status flag
-        cout << "[UART] Received char: " << data << endl;
+char UART_ReadChar(UART_Registers &uart) {
+    lock_guard<FwMutex> lock(uart.uartLock);   // ① lock RX access
+    char data;
+    if(uart.rxBuffer.pop(data)) {              // ② get next byte, if any
+        uart.rxReady = uart.rxBuffer.count > 0; // ③ update status flag
+        UART_UpdateRTS(uart);                  // ④ space freed → maybe RTS on
+        FW_LOG_INFO("[UART] Received char: %c", data);
         return data;
     }
     return 0; // no data present (like polling RXREADY=0)
@@ -79,49 +178,636 @@ char UART_ReadChar() {
 // -----------------------------------------------------------------------------
 // SECTION 4: Simulated Physical Wire
 // -----------------------------------------------------------------------------
+/*
+UART_WireShiftByte() moves one byte from the TX FIFO of `from` into the
+RX FIFO of `to`, i.e. one character time on the wire. The transmitter
+only starts a byte while its CTS input is asserted. If the receiver's
+FIFO is full the byte is dropped and counted as an overrun.
+Returns true if the receiver's watermark interrupt should fire; the
+caller runs the ISR after releasing the locks (ISRs may read the FIFO).
+*/
+bool UART_WireShiftByte(UART_Registers &from, UART_Registers &to) {
+    if (from.txBuffer.empty()) return false;             // line idle
+    if (from.flowControl && from.CTS && !*from.CTS) return false; // CTS off
+
+    char data = from.txBuffer.front();
+    from.txBuffer.pop();
+    from.txBytes++;
+
+    if (!to.rxBuffer.push(data)) {                       // FIFO full?
+        to.rxOverruns++;                                 // OE bit in LSR
+        return false;
+    }
+    to.rxBytes++;
+    to.rxReady = true;
+    UART_UpdateRTS(to);
+    if (to.rxBuffer.count == to.rxWatermark && to.rxWatermarkISR) { // level crossed
+        to.rxWatermarkIrqs++;
+        return true;
+    }
+    return false;
+}
+
 /*
 In reality, UART hardware shifts bits from TX line to RX line.
 Here we model that as a background thread that periodically
-moves bytes from TX buffer to RX buffer.
-*/
-void UART_TransferWire() {
-    while(true) {                                       // runs "forever"
-        this_thread::sleep_for(chrono::milliseconds(150)); // simulate baud delay
-        lock_guard<mutex> lock(UART.uartLock);          // protect both buffers
-        if(!UART.txBuffer.empty()) {                    // any data to send?
-            char data = UART.txBuffer.front();          // read byte from TX FIFO
-            UART.txBuffer.pop();                        // remove from TX FIFO
-            UART.rxBuffer.push(data);                   // deliver to RX FIFO
-            UART.rxReady = true;                        // set RX flag
-            cout << "[WIRE] Transferred: " << data << endl;
+moves bytes from one UART's TX buffer to the other's RX buffer,
+in both directions, until `stop` is set.
+*/
+void UART_TransferWireOneWay(UART_Registers &from, UART_Registers &to) {
+    bool fireIrq = false;
+    {
+        unique_lock<FwMutex> lockFrom(from.uartLock, defer_lock);
+        unique_lock<FwMutex> lockTo(to.uartLock, defer_lock);
+        lock(lockFrom, lockTo);                     // protect both buffers
+        size_t before = from.txBuffer.size();
+        char data = before ? from.txBuffer.front() : 0;
+        fireIrq = UART_WireShiftByte(from, to);     // TX pin → RX pin
+        if (from.txBuffer.size() != before)
+            FW_LOG_INFO("[WIRE] Transferred: %c", data);
+    }
+    if (fireIrq) to.rxWatermarkISR(to);
+}
+
+void UART_TransferWire(UART_Registers &a, UART_Registers &b, atomic<bool> &stop) {
+    while(!stop) {                                      // runs until powered off
+        FwSleepFor(chrono::milliseconds(150));         // simulate baud delay
+        UART_TransferWireOneWay(a, b);
+        UART_TransferWireOneWay(b, a);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 5: Flow Control & Overrun Benchmark (simulated time)
+// -----------------------------------------------------------------------------
+/*
+Two UART endpoints A → B joined by a null-modem cable. A transmits a
+block of data at full line rate. B's firmware is woken by the RX
+watermark interrupt (or a 4-character RX timeout, like a 16550) and
+then drains the FIFO, spending `consumerNsPerByte` per byte.
+
+Time is simulated in nanoseconds, so the experiment is deterministic
+and runs in microseconds of real time regardless of baud rate.
+*/
+struct UART_FlowResult {
+    unsigned long delivered;    // Bytes read by consumer
+    unsigned long dropped;      // RX overruns
+    unsigned long irqs;         // Watermark interrupts taken
+    double seconds;             // Simulated time to finish
+};
+
+static void UART_NoteWatermark(UART_Registers &) {}   // wake-up marker ISR
+
+UART_FlowResult UART_RunFlowControlBenchmark(int fifoDepth, bool flowControl,
+                                             double consumerSpeed,
+                                             unsigned long totalBytes) {
+    UART_Registers a, b;
+    a.flowControl = b.flowControl = flowControl;
+    b.rxBuffer.reset(fifoDepth);
+    b.rxWatermark = fifoDepth / 2;
+    b.rxWatermarkISR = UART_NoteWatermark;
+    UART_ConnectFlowControl(a, b);
+    for (unsigned long i = 0; i < totalBytes; i++) a.txBuffer.push((char)i);
+
+    // 10 bits per character: start + 8 data + stop
+    const uint64_t charNs = 10ULL * 1000000000ULL / a.baudRate;
+    const uint64_t consumerNsPerByte = (uint64_t)(charNs / consumerSpeed);
+    const uint64_t rxTimeoutNs = 4 * charNs;
+
+    uint64_t now = 0;
+    uint64_t nextChar = charNs;          // end of current character slot
+    uint64_t nextRead = UINT64_MAX;      // consumer idle until woken
+    uint64_t lastRx = 0;                 // for the RX timeout interrupt
+    unsigned long delivered = 0;
+
+    while (delivered + b.rxOverruns < totalBytes) {
+        if (nextRead == UINT64_MAX && b.rxBuffer.count > 0 &&
+            lastRx + rxTimeoutNs <= nextChar) {
+            nextRead = lastRx + rxTimeoutNs;             // RX timeout IRQ
+        }
+        if (nextChar <= nextRead) {                      // wire event
+            now = nextChar;
+            unsigned long before = b.rxBytes + b.rxOverruns;
+            if (UART_WireShiftByte(a, b) && nextRead == UINT64_MAX)
+                nextRead = now;                          // watermark IRQ
+            if (b.rxBytes + b.rxOverruns != before) lastRx = now;
+            nextChar += charNs;
+        } else {                                         // consumer event
+            now = nextRead;
+            char c;
+            if (b.rxBuffer.pop(c)) {
+                delivered++;
+                UART_UpdateRTS(b);
+                nextRead = now + consumerNsPerByte;
+            } else {
+                nextRead = UINT64_MAX;                   // back to sleep
+            }
+        }
+    }
+
+    UART_FlowResult r;
+    r.delivered = delivered;
+    r.dropped = b.rxOverruns;
+    r.irqs = b.rxWatermarkIrqs;
+    r.seconds = now / 1e9;
+    return r;
+}
+
+void UART_FlowControlReport() {
+    const unsigned long total = 20000;
+    const double lineRate = 115200 / 10.0;   // bytes per second
+    cout << "\n---- RX FIFO / RTS-CTS benchmark (115200 8N1, "
+         << total << " bytes) ----" << endl;
+    cout << left << setw(7) << "FIFO" << setw(9) << "RTS/CTS"
+         << setw(10) << "Consumer" << setw(12) << "Bytes/s"
+         << setw(10) << "Line %" << setw(10) << "Drop %"
+         << "IRQs" << endl;
+
+    const int depths[] = {16, 64};
+    const double speeds[] = {1.5, 0.8, 0.5};   // consumer speed vs line rate
+    for (int depth : depths) {
+        for (double speed : speeds) {
+            for (int fc = 0; fc < 2; fc++) {
+                UART_FlowResult r = UART_RunFlowControlBenchmark(depth, fc, speed, total);
+                double bps = r.delivered / r.seconds;
+                cout << left << setw(7) << depth << setw(9) << (fc ? "on" : "off")
+                     << setw(10) << speed << setw(12) << fixed << setprecision(0) << bps
+                     << setw(10) << setprecision(1) << 100.0 * bps / lineRate
+                     << setw(10) << 100.0 * r.dropped / total
+                     << r.irqs << endl;
+            }
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 6: Two-Node Link over a Simulated Cable
+// -----------------------------------------------------------------------------
+/*
+UART_Cable joins the TX pin of one UART_Registers instance to the RX pin
+of another (and back). It models what goes wrong on real cables:
+  - latencyNs:     propagation + transceiver/isolator delay
+  - bitErrorRate:  probability that any single bit on the wire flips
+  - baud mismatch: each endpoint uses its own baudRate; the receiver
+                   samples every bit at its own mid-bit time, so clock
+                   error accumulates across the frame and eventually the
+                   stop bit is sampled in the wrong place (framing error)
+Time is simulated in nanoseconds, like Section 5.
+*/
+struct UART_WireFrame {
+    uint64_t arriveNs;      // When the receiver finishes sampling the frame
+    char data;              // Byte as the receiver sampled it
+    bool framingError;      // Stop bit sampled low
+};
+
+struct UART_CableDirection {
+    UART_Registers *tx = nullptr;   // Transmitting endpoint
+    UART_Registers *rx = nullptr;   // Receiving endpoint
+    uint64_t txBusyUntil = 0;       // TX shift register busy until this time
+    deque<UART_WireFrame> inFlight; // Frames on the wire, oldest first
+};
+
+struct UART_Cable {
+    uint64_t latencyNs = 0;         // One-way delay
+    double bitErrorRate = 0.0;      // Per-bit flip probability
+    mt19937 rng;                    // Deterministic noise source
+    unsigned long bitsFlipped = 0;
+    UART_CableDirection aToB, bToA;
+};
+
+void UART_CableConnect(UART_Cable &cable, UART_Registers &a, UART_Registers &b,
+                       uint32_t seed = 1) {
+    cable.aToB.tx = &a; cable.aToB.rx = &b;
+    cable.bToA.tx = &b; cable.bToA.rx = &a;
+    cable.rng.seed(seed);
+    UART_ConnectFlowControl(a, b);
+}
+
+uint64_t UART_CharTimeNs(const UART_Registers &u) {
+    return 10ULL * 1000000000ULL / u.baudRate;     // 8N1 = 10 bits
+}
+
+/*
+UART_SampleFrame() builds the 10-bit 8N1 waveform for one byte, applies
+bit errors, then samples it the way the receiver does: bit k is read at
+(k + 0.5) receiver bit-times after the start edge. With mismatched baud
+rates that instant can fall into a neighbouring bit. Past the end of the
+frame the line holds the next start bit (streaming) or idle-high.
+*/
+UART_WireFrame UART_SampleFrame(UART_Cable &cable, char data, uint32_t txBaud,
+                                uint32_t rxBaud, bool nextFrameFollows) {
+    int bits[10];
+    bits[0] = 0;                                        // start bit
+    for (int i = 0; i < 8; i++) bits[1 + i] = ((uint8_t)data >> i) & 1; // LSB first
+    bits[9] = 1;                                        // stop bit
+
+    if (cable.bitErrorRate > 0) {
+        uniform_real_distribution<double> coin(0.0, 1.0);
+        for (int i = 0; i < 10; i++) {
+            if (coin(cable.rng) < cable.bitErrorRate) {
+                bits[i] ^= 1;
+                cable.bitsFlipped++;
+            }
+        }
+    }
+
+    int sampled[10];
+    for (int k = 0; k < 10; k++) {
+        int idx = (int)((k + 0.5) * txBaud / rxBaud);   // which TX bit we hit
+        sampled[k] = idx < 10 ? bits[idx] : (nextFrameFollows ? 0 : 1);
+    }
+
+    UART_WireFrame f;
+    f.arriveNs = 0;
+    uint8_t byte = 0;
+    for (int i = 0; i < 8; i++) byte |= sampled[1 + i] << i;
+    f.data = (char)byte;
+    f.framingError = sampled[0] != 0 || sampled[9] != 1;
+    return f;
+}
+
+/*
+UART_CableStep() advances one direction of the cable to time `now`:
+frames whose last bit has arrived are pushed into the receiver's FIFO,
+then the transmitter starts its next byte if idle (and CTS allows).
+Returns the time of the next event on this direction.
+*/
+uint64_t UART_CableStep(UART_Cable &cable, UART_CableDirection &dir, uint64_t now) {
+    UART_Registers &tx = *dir.tx;
+    UART_Registers &rx = *dir.rx;
+
+    while (!dir.inFlight.empty() && dir.inFlight.front().arriveNs <= now) {
+        UART_WireFrame f = dir.inFlight.front();
+        dir.inFlight.pop_front();
+        if (f.framingError) rx.rxFramingErrors++;
+        if (!rx.rxBuffer.push(f.data)) { rx.rxOverruns++; continue; }
+        rx.rxBytes++;
+        rx.rxReady = true;
+        UART_UpdateRTS(rx);
+    }
+
+    if (now >= dir.txBusyUntil && !tx.txBuffer.empty() &&
+        !(tx.flowControl && tx.CTS && !*tx.CTS)) {
+        char data = tx.txBuffer.front();
+        tx.txBuffer.pop();
+        tx.txBytes++;
+        UART_WireFrame f = UART_SampleFrame(cable, data, tx.baudRate, rx.baudRate,
+                                            !tx.txBuffer.empty());
+        dir.txBusyUntil = now + UART_CharTimeNs(tx);
+        f.arriveNs = now + 95 * UART_CharTimeNs(rx) / 100 + cable.latencyNs;
+        dir.inFlight.push_back(f);
+    }
+
+    uint64_t next = UINT64_MAX;
+    if (!tx.txBuffer.empty()) next = max(dir.txBusyUntil, now + 1);
+    if (!dir.inFlight.empty()) next = min(next, dir.inFlight.front().arriveNs);
+    return next;
+}
+
+/*
+Request/response protocol used for the end-to-end benchmark.
+Frame: [SOF 0x7E][LEN][SEQ][payload x LEN][CRC-8 over LEN..payload]
+UART_FrameParser is the receive-side state machine: feed it one byte at
+a time from the RX FIFO; it resynchronises on SOF after any error.
+*/
+#define UART_FRAME_SOF      0x7E
+#define UART_FRAME_MAX_LEN  128
+
+uint8_t UART_Crc8(const uint8_t *data, size_t len) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+}
+
+void UART_BuildFrame(vector<uint8_t> &out, uint8_t seq, const uint8_t *payload,
+                     uint8_t len) {
+    out.clear();
+    out.push_back(UART_FRAME_SOF);
+    out.push_back(len);
+    out.push_back(seq);
+    out.insert(out.end(), payload, payload + len);
+    out.push_back(UART_Crc8(&out[1], out.size() - 1));
+}
+
+struct UART_FrameParser {
+    enum State { WAIT_SOF, LEN, SEQ, PAYLOAD, CRC } state = WAIT_SOF;
+    uint8_t buf[2 + UART_FRAME_MAX_LEN];  // LEN, SEQ, payload (CRC input)
+    uint8_t len = 0;
+    uint8_t got = 0;
+    unsigned long frames = 0;
+    unsigned long crcErrors = 0;
+
+    uint8_t seq() const { return buf[1]; }
+    const uint8_t *payload() const { return &buf[2]; }
+
+    // Returns true when a complete, CRC-valid frame has been received.
+    bool feed(uint8_t byte) {
+        switch (state) {
+        case WAIT_SOF:
+            if (byte == UART_FRAME_SOF) state = LEN;
+            return false;
+        case LEN:
+            if (byte > UART_FRAME_MAX_LEN) { state = WAIT_SOF; return false; }
+            len = byte; buf[0] = byte; state = SEQ;
+            return false;
+        case SEQ:
+            buf[1] = byte; got = 0;
+            state = len ? PAYLOAD : CRC;
+            return false;
+        case PAYLOAD:
+            buf[2 + got++] = byte;
+            if (got == len) state = CRC;
+            return false;
+        case CRC:
+            state = WAIT_SOF;
+            if (UART_Crc8(buf, 2 + len) != byte) { crcErrors++; return false; }
+            frames++;
+            return true;
         }
+        return false;
     }
+};
+
+struct UART_LinkConfig {
+    const char *name;
+    uint32_t baudA, baudB;          // Baud mismatch = baudA != baudB
+    uint64_t latencyNs;
+    double bitErrorRate;
+};
+
+struct UART_LinkResult {
+    unsigned long completed;        // Request/response pairs that succeeded
+    unsigned long failed;           // Transactions abandoned after maxAttempts
+    unsigned long retries;          // Requests re-sent after a timeout
+    unsigned long framingErrors;
+    unsigned long crcErrors;
+    double seconds;                 // Simulated time
+    double goodputBps;              // Payload bytes per second, both ways
+    double rttMeanUs, rttP50Us, rttP99Us;
+};
+
+/*
+UART_RunLinkBenchmark(): node A (client) sends a request with reqLen
+payload bytes and waits for a respLen-byte response from node B
+(server), which answers after `turnaroundNs` of processing. Lost or
+corrupted frames are recovered by timeout and retransmission; after
+maxAttempts tries the transaction is abandoned and counted as failed.
+*/
+UART_LinkResult UART_RunLinkBenchmark(const UART_LinkConfig &cfg, int transactions,
+                                      uint8_t reqLen, uint8_t respLen,
+                                      uint64_t turnaroundNs, int maxAttempts = 8) {
+    UART_Registers a, b;                      // Two independent peripherals
+    a.baudRate = cfg.baudA;
+    b.baudRate = cfg.baudB;
+    a.rxBuffer.reset(UART_RX_FIFO_MAX);
+    b.rxBuffer.reset(UART_RX_FIFO_MAX);
+    UART_Cable cable;
+    cable.latencyNs = cfg.latencyNs;
+    cable.bitErrorRate = cfg.bitErrorRate;
+    UART_CableConnect(cable, a, b);
+
+    UART_FrameParser clientRx, serverRx;
+    vector<uint8_t> frame;
+    vector<double> rttUs;
+    uint8_t reqPayload[UART_FRAME_MAX_LEN], respPayload[UART_FRAME_MAX_LEN];
+    for (int i = 0; i < UART_FRAME_MAX_LEN; i++) {
+        reqPayload[i] = (uint8_t)i;
+        respPayload[i] = (uint8_t)(0xFF - i);
+    }
+
+    // Timeout: both frames on the wire, both latencies, turnaround, x2 margin
+    const uint64_t timeoutNs = 2 * ((reqLen + respLen + 8) *
+        max(UART_CharTimeNs(a), UART_CharTimeNs(b)) + 2 * cfg.latencyNs + turnaroundNs);
+
+    uint64_t now = 0;
+    uint8_t seq = 0;
+    uint64_t requestStart = 0, requestDeadline = 0;
+    uint64_t responseDue = UINT64_MAX;        // Server's pending reply time
+    uint8_t responseSeq = 0;
+    bool waiting = false;
+    int attempts = 0;
+    unsigned long completed = 0, failed = 0, retries = 0;
+
+    while ((int)(completed + failed) < transactions) {
+        // Client firmware: give up on a request that keeps timing out
+        if (waiting && now >= requestDeadline && attempts == maxAttempts) {
+            failed++;
+            seq++;
+            waiting = false;
+            continue;
+        }
+        // Client firmware: issue (or re-issue) the current request
+        if (!waiting || now >= requestDeadline) {
+            if (waiting) retries++;
+            else { requestStart = now; attempts = 0; }
+            attempts++;
+            UART_BuildFrame(frame, seq, reqPayload, reqLen);
+            for (uint8_t byte : frame) a.txBuffer.push((char)byte);
+            requestDeadline = now + timeoutNs;
+            waiting = true;
+        }
+        // Server firmware: reply once processing time has elapsed
+        if (now >= responseDue) {
+            UART_BuildFrame(frame, responseSeq, respPayload, respLen);
+            for (uint8_t byte : frame) b.txBuffer.push((char)byte);
+            responseDue = UINT64_MAX;
+        }
+
+        uint64_t next = min(UART_CableStep(cable, cable.aToB, now),
+                            UART_CableStep(cable, cable.bToA, now));
+
+        // Both firmwares drain their RX FIFOs (RX interrupt handlers)
+        char c;
+        while (b.rxBuffer.pop(c)) {
+            if (serverRx.feed((uint8_t)c) && serverRx.len == reqLen) {
+                responseSeq = serverRx.seq();
+                responseDue = now + turnaroundNs;
+            }
+        }
+        while (a.rxBuffer.pop(c)) {
+            if (clientRx.feed((uint8_t)c) && waiting && clientRx.seq() == seq &&
+                clientRx.len == respLen) {
+                rttUs.push_back((now - requestStart) / 1e3);
+                completed++;
+                seq++;
+                waiting = false;
+            }
+        }
+        UART_UpdateRTS(a);
+        UART_UpdateRTS(b);
+
+        if (!waiting) continue;               // Issue next request right away
+        next = min(next, min(requestDeadline, responseDue));
+        now = max(next, now + 1);
+    }
+
+    UART_LinkResult r;
+    r.completed = completed;
+    r.failed = failed;
+    r.retries = retries;
+    r.framingErrors = a.rxFramingErrors + b.rxFramingErrors;
+    r.crcErrors = clientRx.crcErrors + serverRx.crcErrors;
+    r.seconds = now / 1e9;
+    r.goodputBps = completed * (double)(reqLen + respLen) / r.seconds;
+    double sum = 0;
+    for (double v : rttUs) sum += v;
+    sort(rttUs.begin(), rttUs.end());
+    r.rttMeanUs = rttUs.empty() ? 0 : sum / rttUs.size();
+    r.rttP50Us = rttUs.empty() ? 0 : rttUs[rttUs.size() / 2];
+    r.rttP99Us = rttUs.empty() ? 0 : rttUs[rttUs.size() * 99 / 100];
+    return r;
+}
+
+void UART_LinkReport() {
+    const int transactions = 2000;
+    const uint8_t reqLen = 16, respLen = 64;
+    const UART_LinkConfig configs[] = {
+        {"ideal",          115200, 115200,       0, 0.0},
+        {"latency 2ms",    115200, 115200, 2000000, 0.0},
+        {"BER 1e-5",       115200, 115200,       0, 1e-5},
+        {"BER 1e-4",       115200, 115200,       0, 1e-4},
+        {"baud +3%",       115200, 118656,       0, 0.0},
+        {"baud -4%",       115200, 110592,       0, 0.0},
+        {"baud -6%",       115200, 108288,       0, 0.0},
+        {"921600 ideal",   921600, 921600,       0, 0.0},
+    };
+
+    cout << "\n---- Two-node link: " << (int)reqLen << "B request / "
+         << (int)respLen << "B response, " << transactions << " transactions ----" << endl;
+    cout << left << setw(14) << "Cable" << setw(10) << "RTT avg"
+         << setw(10) << "RTT p50" << setw(10) << "RTT p99" << setw(12) << "Goodput"
+         << setw(9) << "Retries" << setw(8) << "Failed" << setw(8) << "FE"
+         << "CRC err" << endl;
+    for (const UART_LinkConfig &cfg : configs) {
+        UART_LinkResult r = UART_RunLinkBenchmark(cfg, transactions, reqLen, respLen, 50000);
+        cout << left << setw(14) << cfg.name << fixed << setprecision(0)
+             << setw(10) << r.rttMeanUs << setw(10) << r.rttP50Us
+             << setw(10) << r.rttP99Us << setw(12) << r.goodputBps
+             << setw(9) << r.retries << setw(8) << r.failed << setw(8) << r.framingErrors
+             << r.crcErrors << endl;
+    }
+    cout << "(RTT in us, goodput in payload bytes/s of simulated time)" << endl;
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 7: Cost of a Log Call on the Hot Path
+// -----------------------------------------------------------------------------
+/*
+The demo above logs while holding uartLock, so whatever a log call costs
+is added to the time every other thread waits for the UART. Compare one
+"[UART] Sending char" line written four ways, all into a file so the
+terminal's speed does not count:
+  - cout-style with endl: format + write + flush per line
+  - '\n' without flush: format into the stream buffer
+  - FW_LOG_INFO: timestamp + raw args into this thread's ring
+  - FW_LOG_TRACE: below FW_LOG_LEVEL, compiled out
+*/
+template <typename F>
+static double UART_NsPerCall(int calls, F body) {
+    uint64_t t0 = FwLat_NowNs();
+    for (int i = 0; i < calls; i++) body(i);
+    return double(FwLat_NowNs() - t0) / calls;
+}
+
+void UART_LogCostReport() {
+    const int calls = 2000;            // Fits one ring, nothing is dropped
+    const char *path = "uart_log_bench.txt";
+    ofstream sink(path);
+    char data = 'A';
+
+    double endlNs = UART_NsPerCall(calls, [&](int i) {
+        sink << "[UART] Sending char: " << char(data + i % 26) << endl;
+    });
+    double newlineNs = UART_NsPerCall(calls, [&](int i) {
+        sink << "[UART] Sending char: " << char(data + i % 26) << '\n';
+    });
+    sink.flush();
+
+    FwLog_Flush();                     // Ring empty before timing it
+    ostream *demoOut = FwLog_Redirect(sink);
+    double asyncNs = UART_NsPerCall(calls, [&](int i) {
+        FW_LOG_INFO("[UART] Sending char: %c", char(data + i % 26));
+    });
+    FwLog_Flush();
+    FwLog_Redirect(*demoOut);
+    double offNs = UART_NsPerCall(calls, [&](int i) {
+        (void)i;                       // unused when TRACE is compiled out
+        FW_LOG_TRACE("[UART] Sending char: %c", char(data + i % 26));
+    });
+    sink.close();
+    remove(path);
+
+    cout << "\n---- Log call cost (" << calls << " calls, file sink) ----" << endl;
+    cout << left << setw(24) << "Method" << "ns/call" << endl;
+    cout << fixed << setprecision(1)
+         << setw(24) << "ostream + endl" << endlNs << "\n"
+         << setw(24) << "ostream + '\\n'" << newlineNs << "\n"
+         << setw(24) << "FW_LOG_INFO (async)" << asyncNs << "\n"
+         << setw(24) << "FW_LOG_TRACE (off)" << offNs << endl;
+    cout << "(dropped records: " << FwLog_Dropped() << ")" << endl;
+}
+
+/*
+UART_HostDecode() is the host's half of binary logging: with only the
+captured bytes and the dictionary it rebuilds the text the firmware
+would have printed, then compares the sizes at 115200 baud.
+*/
+void UART_HostDecode(const string &wire) {
+    stringstream dict;
+    FwLog_WriteDictionary(dict);
+    FwLog_Decode(wire, FwLog_LoadDictionary(dict), cout);
+    FwLog_SizeReport(cout, 115200);
 }
 
 // -----------------------------------------------------------------------------
-// SECTION 5: MAIN FUNCTION (Firmware Entry Point)
+// SECTION 8: MAIN FUNCTION (Firmware Entry Point)
 // -----------------------------------------------------------------------------
 int main() {
     cout << "==== UART Firmware Simulation ====" << endl;
+    // Logs leave the device in binary (format id + packed arguments);
+    // the host decodes them with the dictionary
+    ostringstream debugUart;
+    FwLog_Start(debugUart, FWLOG_BINARY, true);   // sized as text too
+
+    // Two independent peripherals, e.g. MCU UART0 and a modem's UART
+    UART_Registers uart0, uart1;
 
     // Start "hardware wire" thread — runs concurrently
-    thread wire(UART_TransferWire);
+    atomic<bool> stopWire(false);
+    FwThread wire(UART_TransferWire, ref(uart0), ref(uart1), ref(stopWire));
 
     // Firmware sends three characters (like printf over UART)
-    UART_SendChar('H');
-    UART_SendChar('i');
-    UART_SendChar('!');
+    UART_SendChar(uart0, 'H');
+    UART_SendChar(uart0, 'i');
+    UART_SendChar(uart0, '!');
 
     // Give time for the wire to transfer them
-    this_thread::sleep_for(chrono::milliseconds(500));
+    FwSleepFor(chrono::milliseconds(500));
+
+    // The peer checks its RX register for incoming data
+    UART_ReadChar(uart1);
+    UART_ReadChar(uart1);
+    UART_ReadChar(uart1);
+
+    // Power off the wire (end simulation)
+    stopWire = true;
+    wire.join();
+    FwLog_Flush();                     // Demo log out before the tables
+    UART_HostDecode(debugUart.str());
+
+    // Throughput and drop rates when the reader is slower than the line
+    UART_FlowControlReport();
+
+    // Round-trip time and goodput of a request/response protocol
+    UART_LinkReport();
 
-    // Firmware checks RX register for incoming data
-    UART_ReadChar();
-    UART_ReadChar();
-    UART_ReadChar();
+    // What logging inside uartLock costs
+    UART_LogCostReport();
+    FwLog_Stop();
 
-    // Detach wire thread (end simulation)
-    wire.detach();
     cout << "==== UART Demo Complete ====" << endl;
     return 0;
 }
@@ -136,6 +822,24 @@ SUMMARY / LEARNING POINTS
 4. A background process (hardware or ISR) moves bits to RX.
 5. Firmware reads RX register when RXREADY flag is set.
 6. Mutex here acts like interrupt disable/enable around critical sections.
+7. RX FIFOs have a fixed depth. If firmware falls behind, new bytes are
+   dropped and the overrun error (OE) is flagged.
+8. The RX watermark (trigger level) interrupt lets firmware read in
+   bursts: a deeper FIFO means fewer interrupts per byte.
+9. RTS/CTS flow control lets a slow receiver pause the sender, trading
+   throughput for zero data loss.
+10. Each peripheral is its own UART_Registers instance, so two nodes can
+    talk over a cable. Baud mismatch beyond ~5% moves the stop-bit sample
+    outside the frame → framing errors; bit errors corrupt payloads, and
+    the protocol's CRC + timeout/retry turns both into lost goodput.
+11. Logging inside a critical section adds its cost to every waiter.
+    endl flushes each line; deferring formatting to a writer thread
+    leaves only a timestamp and a few stores on the hot path.
+12. Sending the format id and raw arguments instead of text, and
+    formatting on the host, cuts the debug UART's load several times.
+13. The wire thread and firmware race for uartLock. FW_SCHED_SEED=n
+    serialises them on a virtual clock (fw_sched.h): one seed, one
+    interleaving, and the demo's 150 ms wire delays take no real time.
 
 Real-world analogy:
    MCU TX pin → Serial cable → Peripheral RX pin.
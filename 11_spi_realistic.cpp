@@ -1,7 +1,17 @@
 /******************************************************
  * Purpose: Simulate realistic SPI communication between
- *          master and slave, bit-by-bit transfer, with
- *          echo back. Demonstrates shift register behavior.
+ *          master and slave, bit-by-bit transfer in all
+ *          four CPOL/CPHA modes, with echo back. The slave
+ *          is a shift register clocked by the master's edges.
+ *          Also models a JEDEC SPI NOR flash (file-backed
+ *          via mmap) with realistic timing in simulated time,
+ *          1/2/4-line (dual/quad) transfers with an XIP window,
+ *          and a multi-slave controller with per-device chip
+ *          selects, contention detection and daisy chains.
+ *          Driver logs leave the "device" as binary format ids
+ *          plus arguments and are decoded on the host side.
+ *          The shared-bus benchmark is exported as a timeline
+ *          (trace_11.json) of CS cycles and bus waits.
  *
  * Compile:
  *   g++ 11_spi_realistic.cpp -o spi_demo -std=c++11 -pthread
@@ -9,129 +19,1196 @@
  ******************************************************/
 
 #include <iostream>
-#include <thread>
-#include <mutex>
 #include <chrono>
+#include <bitset>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <fcntl.h>      // open()
+#include <unistd.h>     // ftruncate(), close()
+#include <sys/mman.h>   // mmap(): flash array lives in a file, not the heap
+#include <sstream>
+#include <fstream>      // Timeline export
+#include "fw_log.h"     // Buffered binary logging from inside the bus
+#include "fw_trace.h"   // Timeline of CS cycles and bus waits
 using namespace std;
 
 // -----------------------------------------------------------------------------
 // SECTION 1: SPI Bus Simulation
 // -----------------------------------------------------------------------------
+/*
+The four wires of the bus plus the clock mode both sides agreed on:
+  CPOL = idle level of SCLK (0 = idle low, 1 = idle high)
+  CPHA = 0: data sampled on the leading (first) edge, changed on trailing
+  CPHA = 1: data changed on the leading edge, sampled on trailing
+Mode number = CPOL << 1 | CPHA (mode 0..3).
+
+There are no threads: the master drives every edge itself and the slave
+reacts synchronously inside SPI_SetSCLK(), just as a hardware shift
+register reacts to the clock pin. Nothing is shared across threads, so
+there is nothing to lock and no data race.
+*/
+class SPIShiftSlave;
+
 struct SPIBus {
     uint8_t MOSI = 0;    // Master Out Slave In
-    uint8_t MISO = 0;    // Master In Slave Out
+    uint8_t MISO = 1;    // Master In Slave Out (idle high)
     bool CS = true;      // Chip select (active low)
     bool SCLK = false;   // Clock signal
-    mutex spiLock;       // Protect shared bus access
-} SPI;
+    int mode = 0;        // SPI mode 0..3
+    SPIShiftSlave *slave = nullptr;   // Device wired to this bus
+    unsigned long edges = 0;          // SCLK transitions driven so far
+};
+
+/*
+One SPI peripheral instance: the bus, its clock and counters. The
+driver code names the selected instance SPI, SPI_NowNs, SPI_ClockHz and
+QSPI_LineMismatches, the way a CMSIS device header makes SPI1 mean
+((SPI_TypeDef *)SPI1_BASE). Every thread starts on SPI_Default, so a
+process is one device; SPI_Use() points the calling thread at another
+instance, which is how the device farm (18_device_farm.cpp) runs
+thousands of devices, each with its own bus, on a pool of threads.
+*/
+struct SPIPeripheral {
+    SPIBus bus;
+    uint64_t nowNs = 0;                 // Simulated time since power-on
+    uint32_t clockHz = 50000000;        // SCLK frequency (50 MHz)
+    unsigned long qspiLineMismatches = 0;   // Section 7
+};
+
+SPIPeripheral SPI_Default;
+thread_local SPIPeripheral *SPI_Active = &SPI_Default;
+
+#define SPI                 (SPI_Active->bus)
+#define SPI_NowNs           (SPI_Active->nowNs)
+#define SPI_ClockHz         (SPI_Active->clockHz)
+#define QSPI_LineMismatches (SPI_Active->qspiLineMismatches)
+
+// Select the instance this thread's SPI calls act on (null: SPI_Default)
+void SPI_Use(SPIPeripheral *p) { SPI_Active = p ? p : &SPI_Default; }
+
+bool SPI_CPOL() { return (SPI.mode >> 1) & 1; }
+bool SPI_CPHA() { return SPI.mode & 1; }
 
 // -----------------------------------------------------------------------------
-// SECTION 2: SPI Slave (bit-by-bit shift)
+// SECTION 2: SPI Slave (edge-triggered shift register)
 // -----------------------------------------------------------------------------
-void SPISlave(uint8_t &received_byte) {
-    /*
-      Simulate a hardware SPI slave that receives one byte
-      from master, MSB first, and can optionally echo it back.
-    */
-    received_byte = 0; // initialize received byte
+/*
+Models the slave's 8-bit shift register. It is "clocked" by callbacks:
+  onSelect()      CS falling edge
+  onClock(level)  every SCLK transition
+  onDeselect()    CS rising edge
+With CPHA = 0 the first bit must already be on MISO when CS falls,
+because the master samples it on the very first edge.
+
+After each complete byte, respond() decides the next byte to shift
+out. The default is an echo: whatever was received is sent back during
+the next byte, exactly what a single shift register wired MISO→MOSI does.
+*/
+class SPIShiftSlave {
+public:
+    virtual ~SPIShiftSlave() {}
 
-    // Wait for CS low (start of transaction)
-    while (SPI.CS) {
-        this_thread::sleep_for(chrono::milliseconds(1));
+    void onSelect() {
+        bitsIn = 0;
+        outIndex = 0;
+        txByte = respond(lastReceived);
+        if (!SPI_CPHA()) driveNextBit();          // bit 7 valid before 1st edge
     }
 
-    cout << "[SLAVE] Transaction started" << endl;
+    void onClock(bool level) {
+        bool leading = level != SPI_CPOL();       // first edge after idle
+        bool sampleEdge = SPI_CPHA() ? !leading : leading;
+        if (sampleEdge) {
+            rxShift = (uint8_t)((rxShift << 1) | (SPI.MOSI & 1));   // MSB first
+            if (++bitsIn == 8) {
+                lastReceived = rxShift;
+                bytesReceived++;
+                if (logBytes) FW_LOG_DEBUG("[SPI] Byte received: 0x%02x", lastReceived);
+                bitsIn = 0;
+                txByte = respond(lastReceived);   // load next byte to send
+                outIndex = 0;
+            }
+        } else {
+            driveNextBit();                       // shift edge
+        }
+    }
+
+    void onDeselect() { SPI.MISO = 1; }           // MISO released (tri-state)
+
+    uint8_t lastReceived = 0;
+    unsigned long bytesReceived = 0;
+    bool logBytes = false;                        // Debug log per byte
+
+protected:
+    virtual uint8_t respond(uint8_t received) { return received; }   // echo
+
+private:
+    void driveNextBit() {
+        if (outIndex < 8) SPI.MISO = (txByte >> (7 - outIndex++)) & 1;
+    }
+
+    uint8_t rxShift = 0;
+    uint8_t txByte = 0;
+    int bitsIn = 0;
+    int outIndex = 0;
+};
+
+// -----------------------------------------------------------------------------
+// SECTION 3: SPI Master (bit-banged, drives every edge)
+// -----------------------------------------------------------------------------
+void SPI_SetSCLK(bool level) {
+    SPI.SCLK = level;
+    SPI.edges++;
+    SPI_NowNs += 500000000ULL / SPI_ClockHz;      // half an SCLK period
+    if (!SPI.CS && SPI.slave) SPI.slave->onClock(level);
+}
+
+void SPI_SetCS(bool level) {
+    SPI.CS = level;
+    if (!SPI.slave) return;
+    if (!level) SPI.slave->onSelect();
+    else        SPI.slave->onDeselect();
+}
 
-    // Receive 8 bits (MSB first)
+/*
+Exchange one byte, MSB first, honouring CPOL/CPHA:
+  CPHA = 0: MOSI set before the leading edge, both sides sample on it
+  CPHA = 1: MOSI set on the leading edge, both sides sample on trailing
+*/
+uint8_t SPI_MasterTransfer(uint8_t data_out) {
+    uint8_t received_byte = 0;
+    bool idle = SPI_CPOL();
     for (int i = 7; i >= 0; i--) {
-        // Wait for SCLK rising edge
-        while (!SPI.SCLK) this_thread::sleep_for(chrono::milliseconds(1));
+        uint8_t bit = (data_out >> i) & 1;
+        if (!SPI_CPHA()) {
+            SPI.MOSI = bit;                                  // setup
+            SPI_SetSCLK(!idle);                              // leading: sample
+            received_byte |= (uint8_t)((SPI.MISO & 1) << i);
+            SPI_SetSCLK(idle);                               // trailing: shift
+        } else {
+            SPI_SetSCLK(!idle);                              // leading: shift
+            SPI.MOSI = bit;
+            SPI_SetSCLK(idle);                               // trailing: sample
+            received_byte |= (uint8_t)((SPI.MISO & 1) << i);
+        }
+    }
+    return received_byte;
+}
 
-        {
-            lock_guard<mutex> lock(SPI.spiLock);
+/*
+The debug log is captured as the bytes a binary logger would put on the
+debug UART. SPI_HostDecode() plays the host: with those bytes and the
+format dictionary it prints what the firmware logged since last time.
+*/
+ostringstream SPI_DebugUart;
 
-            // Read master bit (MOSI) and store in correct position
-            received_byte |= ((SPI.MOSI & 1) << i);
+void SPI_HostDecode() {
+    FwLog_Flush();
+    stringstream dict;
+    FwLog_WriteDictionary(dict);
+    FwLog_Decode(SPI_DebugUart.str(), FwLog_LoadDictionary(dict), cout);
+    SPI_DebugUart.str("");
+}
 
-            // Echo bit back: here we just send the same bit
-            SPI.MISO = (SPI.MOSI & 1);
+void SPIMaster(const uint8_t *data_out, uint8_t *data_in, int len) {
+    SPI.SCLK = SPI_CPOL();                 // idle level before CS falls
+    SPI_SetCS(false);                      // start transaction
+    for (int i = 0; i < len; i++) data_in[i] = SPI_MasterTransfer(data_out[i]);
+    SPI_SetCS(true);                       // end transaction
+}
+
+/*
+SPI_BitAccurateDemo(): send three bytes in each SPI mode and show the
+echo arriving one byte later. Then time a 1 MB bit-accurate transfer
+(16 edges and 16 slave callbacks per byte) in real time. The old
+polling model slept 2 x 50 ms per bit, i.e. 800 ms per byte.
+*/
+void SPI_BitAccurateDemo() {
+    SPIShiftSlave echo;
+    SPI.slave = &echo;
+    echo.logBytes = true;
+
+    const uint8_t tx[3] = {0b10101100, 0x3C, 0xF0};
+    for (int mode = 0; mode < 4; mode++) {
+        SPI.mode = mode;
+        uint8_t rx[3];
+        SPIMaster(tx, rx, 3);
+        SPI_HostDecode();
+        cout << "[MASTER] Mode " << mode << " sent 0b" << bitset<8>(tx[0])
+             << " 0x" << hex << (int)tx[1] << " 0x" << (int)tx[2]
+             << " | received 0x" << (int)rx[0] << " 0x" << (int)rx[1]
+             << " 0x" << (int)rx[2] << dec
+             << ((rx[1] == tx[0] && rx[2] == tx[1]) ? "  (echo OK)" : "  (ECHO WRONG)")
+             << endl;
+    }
+    cout << "[SLAVE] Last byte received: 0b" << bitset<8>(echo.lastReceived) << endl;
+    echo.logBytes = false;                 // 1 MB below: no per-byte log
+
+    const int total = 1024 * 1024;
+    vector<uint8_t> out(total), in(total);
+    for (int i = 0; i < total; i++) out[i] = (uint8_t)(i * 7);
+    SPI.mode = 3;
+    auto start = chrono::steady_clock::now();
+    SPIMaster(out.data(), in.data(), total);
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    bool ok = true;
+    for (int i = 1; i < total; i++) ok = ok && in[i] == out[i - 1];
+
+    cout << fixed << setprecision(1)
+         << "[BENCH] 1 MB bit-accurate transfer: " << ns / 1e6 << " ms real time, "
+         << ns / total << " ns/byte, " << SPI.edges << " edges, "
+         << (ok ? "echo verified" : "ECHO MISMATCH") << endl;
+    cout << "[BENCH] Polling model: 800 ms/byte → speedup ~"
+         << scientific << setprecision(1) << 800e6 / (ns / total) << "x" << endl;
+    cout << defaultfloat;
+    SPI.slave = nullptr;
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 4: Byte-Level SPI Devices and Simulated Time
+// -----------------------------------------------------------------------------
+/*
+Bit-by-bit edges (Sections 2-3) show the wire protocol; peripheral
+models below work one byte at a time for speed:
+the master exchanges a byte with the selected device and advances a
+simulated clock by the number of SCLK cycles that byte takes on the bus.
+
+A device may move data on 1, 2 or 4 lines depending on the current
+phase of its command (e.g. quad-output read); dataLines() tells the
+master how many, so 8 bits cost 8, 4 or 2 clocks.
+*/
+class SPIDevice {
+public:
+    virtual ~SPIDevice() {}
+    virtual void select() {}                       // CS falling edge
+    virtual uint8_t transfer(uint8_t mosi) = 0;    // Exchange one byte
+    virtual void deselect() {}                     // CS rising edge
+    virtual int dataLines() const { return 1; }    // Lines used by next byte
+};
+
+void SPI_Select(SPIDevice &dev) {
+    dev.select();
+}
+
+// 8 bits on 1, 2 or 4 lines = 8, 4 or 2 SCLK cycles
+uint64_t SPI_ByteTimeNs(int lines) {
+    return (8 / lines) * 1000000000ULL / SPI_ClockHz;
+}
+
+uint8_t SPI_TransferByte(SPIDevice &dev, uint8_t out) {
+    SPI_NowNs += SPI_ByteTimeNs(dev.dataLines());
+    return dev.transfer(out);
+}
+
+void SPI_Deselect(SPIDevice &dev) {
+    dev.deselect();
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 5: SPI NOR Flash Model (JEDEC command set, file-backed)
+// -----------------------------------------------------------------------------
+/*
+Models a W25Q-style serial NOR flash:
+  0x9F RDID        JEDEC ID (manufacturer, memory type, capacity)
+  0x05 RDSR        Status register (bit0 WIP = busy, bit1 WEL)
+  0x06 / 0x04      Write enable / write disable
+  0x03 READ        Read, no dummy cycles
+  0x0B FAST_READ   Read, 8 dummy clocks
+  0x3B / 0x6B      Dual / quad output read (1-1-2 / 1-1-4)
+  0xBB / 0xEB      Dual / quad I/O read (1-2-2 / 1-4-4): address, mode
+                   byte and dummy clocks also on 2 / 4 lines
+  0x35 / 0x31      Read / write status register 2 (bit1 QE = quad enable)
+  0x02 PP          Page program (256-byte page, can only clear bits)
+  0x20 / 0xD8      4 KB sector / 64 KB block erase
+  0xC7             Chip erase
+
+The array lives in a file mapped with mmap(), so a 16 MB chip costs no
+heap and only the pages actually touched get loaded by the kernel.
+Bytes are stored inverted: a freshly created (sparse, all-zero) file
+reads back as 0xFF, which is what an erased NOR flash looks like.
+
+Program and erase run "inside the chip" after CS goes high: WIP stays
+set for a realistic time on the simulated clock, and every command
+except RDSR is ignored until it clears.
+
+Quad commands are ignored unless QE is set. For the I/O reads, a mode
+byte of 0x20 (M5-4 = 10) enters continuous read mode: the next CS cycle
+starts directly with the address, no command byte — this is how
+execute-in-place controllers keep per-fetch overhead low.
+*/
+#define FLASH_PAGE_SIZE     256
+#define FLASH_SECTOR_SIZE   4096
+#define FLASH_BLOCK_SIZE    65536
+
+#define FLASH_SR_WIP        0x01
+#define FLASH_SR_WEL        0x02
+#define FLASH_SR2_QE        0x02
+#define FLASH_MODE_CONTINUOUS 0x20
+
+#define FLASH_CMD_RDID      0x9F
+#define FLASH_CMD_RDSR      0x05
+#define FLASH_CMD_WREN      0x06
+#define FLASH_CMD_WRDI      0x04
+#define FLASH_CMD_READ      0x03
+#define FLASH_CMD_FAST_READ 0x0B
+#define FLASH_CMD_DOR       0x3B
+#define FLASH_CMD_QOR       0x6B
+#define FLASH_CMD_DIOR      0xBB
+#define FLASH_CMD_QIOR      0xEB
+#define FLASH_CMD_RDSR2     0x35
+#define FLASH_CMD_WRSR2     0x31
+#define FLASH_CMD_PP        0x02
+#define FLASH_CMD_SE        0x20
+#define FLASH_CMD_BE        0xD8
+#define FLASH_CMD_CE        0xC7
+
+// Typical datasheet timings (W25Q128JV)
+#define FLASH_T_PP_NS       700000ULL        // 0.7 ms page program
+#define FLASH_T_SE_NS       45000000ULL      // 45 ms sector erase
+#define FLASH_T_BE_NS       150000000ULL     // 150 ms block erase
+#define FLASH_T_CE_NS       40000000000ULL   // 40 s chip erase
+#define FLASH_T_W_NS        10000000ULL      // 10 ms status register write
+
+class SPIFlash : public SPIDevice {
+public:
+    ~SPIFlash() { close(); }
+
+    // Map `path` as the flash array, creating/growing it to sizeBytes.
+    // Without a path the array is anonymous memory: nothing persists,
+    // but thousands of chips need no file descriptors.
+    bool open(const char *path, uint32_t sizeBytes) {
+        if (!path) {
+            void *p = mmap(nullptr, sizeBytes, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (p == MAP_FAILED) return false;
+            mem = static_cast<uint8_t *>(p);
+            size = sizeBytes;
+            return true;
+        }
+        fd = ::open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            cout << "[FLASH] Cannot open " << path << ": " << strerror(errno) << endl;
+            return false;
+        }
+        if (ftruncate(fd, sizeBytes) != 0) {
+            cout << "[FLASH] Cannot size " << path << ": " << strerror(errno) << endl;
+            close();
+            return false;
         }
+        void *p = mmap(nullptr, sizeBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            cout << "[FLASH] mmap failed: " << strerror(errno) << endl;
+            close();
+            return false;
+        }
+        mem = static_cast<uint8_t *>(p);
+        size = sizeBytes;
+        return true;
+    }
+
+    void close() {
+        if (mem) munmap(mem, size);
+        if (fd >= 0) ::close(fd);
+        mem = nullptr;
+        fd = -1;
+    }
+
+    uint32_t capacity() const { return size; }
+    bool busy() const { return SPI_NowNs < busyUntilNs; }
 
-        // Wait for clock to go low (falling edge) before next bit
-        while (SPI.SCLK) this_thread::sleep_for(chrono::milliseconds(1));
+    void select() override {
+        phase = CMD;
+        addr = 0;
+        addrBytesLeft = 0;
+        dummyLeft = 0;
+        dataCount = 0;
+        if (continuousRead && !busy()) {       // command byte is implied
+            phase = ADDR;
+            addrBytesLeft = 3;
+            modePending = true;
+            dummyLeft = opcode == FLASH_CMD_QIOR ? 2 : 0;
+        }
     }
 
-    cout << "[SLAVE] Byte received: 0b"
-         << bitset<8>(received_byte) << endl;
+    uint8_t transfer(uint8_t mosi) override {
+        switch (phase) {
+        case CMD:     return decodeCommand(mosi);
+        case ADDR:
+            addr = (addr << 8) | mosi;
+            if (--addrBytesLeft == 0) {
+                addr %= size;
+                phase = modePending ? MODE : dummyLeft ? DUMMY : DATA;
+            }
+            return 0xFF;
+        case MODE:
+            continuousRead = (mosi & 0x30) == FLASH_MODE_CONTINUOUS;
+            modePending = false;
+            phase = dummyLeft ? DUMMY : DATA;
+            return 0xFF;
+        case DUMMY:
+            if (--dummyLeft == 0) phase = DATA;
+            return 0xFF;
+        case DATA:    return dataPhase(mosi);
+        case IGNORE:  return 0xFF;
+        }
+        return 0xFF;
+    }
+
+    void deselect() override {
+        // Program/erase only start if the command was complete (CS high
+        // after the last address byte), exactly like real parts.
+        if (phase != DATA && opcode != FLASH_CMD_CE) return;
+        switch (opcode) {
+        case FLASH_CMD_PP:
+            if (dataCount == 0) break;
+            for (uint32_t i = 0; i < FLASH_PAGE_SIZE; i++) {
+                if (pageMask[i]) cell(pageBase + i) &= pageLatch[i];   // 1 → 0 only
+            }
+            startInternal(FLASH_T_PP_NS);
+            programs++;
+            break;
+        case FLASH_CMD_SE: eraseRange(addr & ~(FLASH_SECTOR_SIZE - 1), FLASH_SECTOR_SIZE, FLASH_T_SE_NS); break;
+        case FLASH_CMD_BE: eraseRange(addr & ~(FLASH_BLOCK_SIZE - 1), FLASH_BLOCK_SIZE, FLASH_T_BE_NS); break;
+        case FLASH_CMD_CE: if (phase == DATA) eraseRange(0, size, FLASH_T_CE_NS); break;
+        case FLASH_CMD_WRSR2:
+            if (dataCount == 0) break;
+            sr2 = sr2Latch & FLASH_SR2_QE;
+            startInternal(FLASH_T_W_NS);
+            break;
+        default: break;
+        }
+        phase = IGNORE;
+    }
+
+    int dataLines() const override {
+        if (phase == CMD || phase == IGNORE) return 1;
+        if (phase == DATA) return dataWidth;
+        return ioWidth;                        // address, mode and dummy
+    }
+
+    unsigned long programs = 0;     // Page programs performed
+    unsigned long erases = 0;       // Sector/block/chip erases performed
+
+private:
+    enum Phase { CMD, ADDR, MODE, DUMMY, DATA, IGNORE };
+
+    // Stored inverted so an all-zero sparse file reads as erased (0xFF)
+    struct Cell {
+        uint8_t &raw;
+        operator uint8_t() const { return (uint8_t)~raw; }
+        Cell &operator&=(uint8_t v) { raw = (uint8_t)~((uint8_t)~raw & v); return *this; }
+    };
+    Cell cell(uint32_t a) { Cell c = {mem[a]}; return c; }
+
+    uint8_t decodeCommand(uint8_t op) {
+        opcode = op;
+        ioWidth = dataWidth = 1;
+        if (busy() && op != FLASH_CMD_RDSR) { phase = IGNORE; return 0xFF; }
+        bool quad = sr2 & FLASH_SR2_QE;
+        switch (op) {
+        case FLASH_CMD_RDID:
+        case FLASH_CMD_RDSR:
+        case FLASH_CMD_RDSR2:     phase = DATA; break;
+        case FLASH_CMD_WRSR2:     phase = wel ? DATA : IGNORE; break;
+        case FLASH_CMD_WREN:      wel = true;  phase = IGNORE; break;
+        case FLASH_CMD_WRDI:      wel = false; phase = IGNORE; break;
+        case FLASH_CMD_READ:      phase = ADDR; addrBytesLeft = 3; break;
+        case FLASH_CMD_FAST_READ: phase = ADDR; addrBytesLeft = 3; dummyLeft = 1; break;
+        case FLASH_CMD_DOR:
+            phase = ADDR; addrBytesLeft = 3; dummyLeft = 1; dataWidth = 2; break;
+        case FLASH_CMD_QOR:
+            if (!quad) { phase = IGNORE; break; }
+            phase = ADDR; addrBytesLeft = 3; dummyLeft = 1; dataWidth = 4; break;
+        case FLASH_CMD_DIOR:                   // 12 addr clocks + 4 mode clocks
+            phase = ADDR; addrBytesLeft = 3; modePending = true;
+            ioWidth = dataWidth = 2; break;
+        case FLASH_CMD_QIOR:                   // 6 addr + 2 mode + 4 dummy clocks
+            if (!quad) { phase = IGNORE; break; }
+            phase = ADDR; addrBytesLeft = 3; modePending = true; dummyLeft = 2;
+            ioWidth = dataWidth = 4; break;
+        case FLASH_CMD_PP:
+            if (!wel) { phase = IGNORE; break; }
+            phase = ADDR; addrBytesLeft = 3;
+            memset(pageMask, 0, sizeof(pageMask));
+            break;
+        case FLASH_CMD_SE:
+        case FLASH_CMD_BE:
+            phase = wel ? ADDR : IGNORE; addrBytesLeft = 3; break;
+        case FLASH_CMD_CE:        phase = wel ? DATA : IGNORE; break;
+        default:                  phase = IGNORE; break;   // unsupported opcode
+        }
+        return 0xFF;
+    }
+
+    uint8_t dataPhase(uint8_t mosi) {
+        switch (opcode) {
+        case FLASH_CMD_RDID: {
+            uint8_t capacityLog2 = 0;
+            while ((1u << capacityLog2) < size) capacityLog2++;
+            const uint8_t id[3] = {0xEF, 0x40, capacityLog2};   // Winbond, SPI, 2^N
+            return dataCount < 3 ? id[dataCount++] : 0xFF;
+        }
+        case FLASH_CMD_RDSR:
+            return (busy() ? FLASH_SR_WIP : 0) | (wel ? FLASH_SR_WEL : 0);
+        case FLASH_CMD_RDSR2:
+            return sr2;
+        case FLASH_CMD_WRSR2:
+            if (dataCount++ == 0) sr2Latch = mosi;
+            return 0xFF;
+        case FLASH_CMD_READ:
+        case FLASH_CMD_FAST_READ:
+        case FLASH_CMD_DOR:
+        case FLASH_CMD_QOR:
+        case FLASH_CMD_DIOR:
+        case FLASH_CMD_QIOR: {
+            uint8_t v = cell(addr);
+            addr = (addr + 1) % size;                      // wraps at end of chip
+            return v;
+        }
+        case FLASH_CMD_PP: {
+            // Bytes past the end of the page wrap to its start
+            pageBase = addr & ~(FLASH_PAGE_SIZE - 1);
+            uint32_t offset = (addr + dataCount) % FLASH_PAGE_SIZE;
+            pageLatch[offset] = mosi;
+            pageMask[offset] = true;
+            dataCount++;
+            return 0xFF;
+        }
+        default:
+            return 0xFF;
+        }
+    }
+
+    void eraseRange(uint32_t start, uint32_t len, uint64_t timeNs) {
+        memset(mem + start, 0, len);                       // inverted 0xFF
+        startInternal(timeNs);
+        erases++;
+    }
+
+    void startInternal(uint64_t timeNs) {
+        busyUntilNs = SPI_NowNs + timeNs;
+        wel = false;                                       // WEL auto-clears
+    }
+
+    uint8_t *mem = nullptr;
+    uint32_t size = 0;
+    int fd = -1;
+
+    Phase phase = IGNORE;
+    uint8_t opcode = 0;
+    uint32_t addr = 0;
+    int addrBytesLeft = 0;
+    int dummyLeft = 0;
+    uint32_t dataCount = 0;
+    int ioWidth = 1;                // Lines for address/mode/dummy phases
+    int dataWidth = 1;              // Lines for the data phase
+    bool modePending = false;       // Mode byte (M7-0) follows the address
+    bool continuousRead = false;    // Next CS cycle skips the command byte
+    bool wel = false;
+    uint8_t sr2 = 0;                // Status register 2 (QE)
+    uint8_t sr2Latch = 0;
+    uint64_t busyUntilNs = 0;
+
+    uint32_t pageBase = 0;
+    uint8_t pageLatch[FLASH_PAGE_SIZE];
+    bool pageMask[FLASH_PAGE_SIZE];
+};
+
+// -----------------------------------------------------------------------------
+// SECTION 6: Flash Driver (what firmware would call)
+// -----------------------------------------------------------------------------
+void Flash_Command(SPIDevice &flash, uint8_t op) {
+    SPI_Select(flash);
+    SPI_TransferByte(flash, op);
+    SPI_Deselect(flash);
+}
+
+void Flash_SendAddress(SPIDevice &flash, uint8_t op, uint32_t addr) {
+    SPI_TransferByte(flash, op);
+    SPI_TransferByte(flash, (addr >> 16) & 0xFF);
+    SPI_TransferByte(flash, (addr >> 8) & 0xFF);
+    SPI_TransferByte(flash, addr & 0xFF);
+}
+
+uint32_t Flash_ReadJedecId(SPIDevice &flash) {
+    SPI_Select(flash);
+    SPI_TransferByte(flash, FLASH_CMD_RDID);
+    uint32_t id = 0;
+    for (int i = 0; i < 3; i++) id = (id << 8) | SPI_TransferByte(flash, 0xFF);
+    SPI_Deselect(flash);
+    return id;
+}
+
+// Poll RDSR until WIP clears; returns number of status reads
+unsigned long Flash_WaitReady(SPIDevice &flash, uint64_t pollIntervalNs = 10000) {
+    unsigned long polls = 0;
+    while (true) {
+        SPI_Select(flash);
+        SPI_TransferByte(flash, FLASH_CMD_RDSR);
+        uint8_t sr = SPI_TransferByte(flash, 0xFF);
+        SPI_Deselect(flash);
+        polls++;
+        if (!(sr & FLASH_SR_WIP)) return polls;
+        SPI_NowNs += pollIntervalNs;               // firmware waits between polls
+    }
+}
+
+void Flash_EraseSector(SPIDevice &flash, uint32_t addr) {
+    Flash_Command(flash, FLASH_CMD_WREN);
+    SPI_Select(flash);
+    Flash_SendAddress(flash, FLASH_CMD_SE, addr);
+    SPI_Deselect(flash);
+    Flash_WaitReady(flash);
+}
+
+// Program any length; split at page boundaries like every NOR driver must
+void Flash_Write(SPIDevice &flash, uint32_t addr, const uint8_t *data, uint32_t len) {
+    while (len > 0) {
+        uint32_t chunk = FLASH_PAGE_SIZE - (addr % FLASH_PAGE_SIZE);
+        if (chunk > len) chunk = len;
+        Flash_Command(flash, FLASH_CMD_WREN);
+        SPI_Select(flash);
+        Flash_SendAddress(flash, FLASH_CMD_PP, addr);
+        for (uint32_t i = 0; i < chunk; i++) SPI_TransferByte(flash, data[i]);
+        SPI_Deselect(flash);
+        Flash_WaitReady(flash);
+        addr += chunk; data += chunk; len -= chunk;
+    }
 }
 
 // -----------------------------------------------------------------------------
-// SECTION 3: SPI Master (send byte, read echo)
+// SECTION 7: Dual/Quad SPI Transfers and Execute-in-Place Window
 // -----------------------------------------------------------------------------
-void SPIMaster(uint8_t data_out) {
-    cout << "[MASTER] Sending byte: 0b" << bitset<8>(data_out) << endl;
+/*
+A QSPI controller describes every flash access as phases, each with its
+own number of data lines (written as cmd-addr-data, e.g. 1-4-4):
+  command → address (3 bytes) → mode byte → dummy clocks → data
+QSPI_Mode is that description (like the controller's CCR register).
+The controller drives each phase at its configured width; if the flash
+expects a different width the byte would be garbage on real hardware,
+so QSPI_LineMismatches counts it.
 
-    // Start transaction by pulling CS low
-    SPI.CS = false;
+In memory-mapped (XIP) mode the CPU reads flash like RAM through a
+window at XIP_BASE. A small read cache holds recent lines; every miss
+becomes a QSPI read of one cache line. With continuous read mode the
+flash skips the command byte, so a 1-4-4 line fill costs 8 fewer clocks.
+*/
+struct QSPI_Mode {
+    const char *name;
+    uint8_t opcode;
+    uint8_t addrLines;      // Lines for address, mode byte and dummy clocks
+    bool modeByte;          // Sends M7-0 after the address
+    uint8_t dummyClocks;    // SCLK cycles between address/mode and data
+    uint8_t dataLines;      // Lines for the data phase
+};
 
-    uint8_t received_byte = 0;
+const QSPI_Mode QSPI_MODES[] = {
+    {"1-1-1 READ",      FLASH_CMD_READ,      1, false, 0, 1},
+    {"1-1-1 FAST_READ", FLASH_CMD_FAST_READ, 1, false, 8, 1},
+    {"1-1-2 DOR",       FLASH_CMD_DOR,       1, false, 8, 2},
+    {"1-2-2 DIOR",      FLASH_CMD_DIOR,      2, true,  0, 2},
+    {"1-1-4 QOR",       FLASH_CMD_QOR,       1, false, 8, 4},
+    {"1-4-4 QIOR",      FLASH_CMD_QIOR,      4, true,  4, 4},
+};
 
-    // Send 8 bits, MSB first
-    for (int i = 7; i >= 0; i--) {
-        {
-            lock_guard<mutex> lock(SPI.spiLock);
+uint8_t QSPI_Phase(SPIDevice &dev, uint8_t out, int lines) {
+    if (dev.dataLines() != lines) QSPI_LineMismatches++;
+    SPI_NowNs += SPI_ByteTimeNs(lines);
+    return dev.transfer(out);
+}
 
-            // Set MOSI bit
-            SPI.MOSI = (data_out >> i) & 1;
+/*
+QSPI_Read(): one indirect-mode read. `continuous` asks the flash to stay
+in continuous read mode afterwards; `skipCommand` is used when it
+already is (the command phase is omitted entirely).
+*/
+void QSPI_Read(SPIDevice &dev, const QSPI_Mode &m, uint32_t addr, uint8_t *buf,
+               uint32_t len, bool continuous = false, bool skipCommand = false) {
+    SPI_Select(dev);
+    if (!skipCommand) QSPI_Phase(dev, m.opcode, 1);
+    QSPI_Phase(dev, (addr >> 16) & 0xFF, m.addrLines);
+    QSPI_Phase(dev, (addr >> 8) & 0xFF, m.addrLines);
+    QSPI_Phase(dev, addr & 0xFF, m.addrLines);
+    if (m.modeByte) QSPI_Phase(dev, continuous ? FLASH_MODE_CONTINUOUS : 0x00, m.addrLines);
+    for (int i = 0; i < m.dummyClocks * m.addrLines / 8; i++) QSPI_Phase(dev, 0xFF, m.addrLines);
+    for (uint32_t i = 0; i < len; i++) buf[i] = QSPI_Phase(dev, 0xFF, m.dataLines);
+    SPI_Deselect(dev);
+}
+
+#define XIP_BASE         0x90000000u
+#define XIP_LINE_SIZE    32
+#define XIP_CACHE_LINES  64          // 2 KB direct-mapped read cache
+#define XIP_HIT_NS       5           // One CPU cycle at 200 MHz
 
-            // Toggle clock high → slave reads bit
-            SPI.SCLK = true;
+struct QSPI_XipWindow {
+    SPIDevice *flash = nullptr;
+    const QSPI_Mode *mode = nullptr;
+    bool continuous = false;         // Use continuous read mode if supported
+    bool flashInContinuous = false;
+    bool valid[XIP_CACHE_LINES] = {};
+    uint32_t tag[XIP_CACHE_LINES] = {};
+    uint8_t line[XIP_CACHE_LINES][XIP_LINE_SIZE];
+    unsigned long hits = 0, misses = 0;
+};
+
+uint32_t XIP_Read32(QSPI_XipWindow &xip, uint32_t cpuAddr) {
+    uint32_t offset = cpuAddr - XIP_BASE;
+    uint32_t lineAddr = offset & ~(uint32_t)(XIP_LINE_SIZE - 1);
+    int idx = (lineAddr / XIP_LINE_SIZE) % XIP_CACHE_LINES;
+    SPI_NowNs += XIP_HIT_NS;
+    if (!xip.valid[idx] || xip.tag[idx] != lineAddr) {     // miss → line fill
+        bool keep = xip.continuous && xip.mode->modeByte;
+        QSPI_Read(*xip.flash, *xip.mode, lineAddr, xip.line[idx], XIP_LINE_SIZE,
+                  keep, xip.flashInContinuous);
+        xip.flashInContinuous = keep;
+        xip.valid[idx] = true;
+        xip.tag[idx] = lineAddr;
+        xip.misses++;
+    } else {
+        xip.hits++;
+    }
+    uint32_t v;
+    memcpy(&v, &xip.line[idx][offset % XIP_LINE_SIZE], sizeof(v));
+    return v;
+}
+
+void Flash_EnableQuad(SPIDevice &flash) {
+    Flash_Command(flash, FLASH_CMD_WREN);
+    SPI_Select(flash);
+    SPI_TransferByte(flash, FLASH_CMD_WRSR2);
+    SPI_TransferByte(flash, FLASH_SR2_QE);
+    SPI_Deselect(flash);
+    Flash_WaitReady(flash);
+}
+
+/*
+Flash_BootBenchmark(): the three ways a product touches external flash.
+  copy boot: bootloader copies a 512 KB application into RAM
+  XIP boot:  CPU executes 1M instruction fetches straight from flash
+             (mostly sequential, with short loops and far calls)
+  assets:    200 random 8 KB assets, one read command each
+*/
+void Flash_BootBenchmark(SPIFlash &flash, const vector<uint8_t> &image) {
+    const uint32_t appSize = 512 * 1024, codeSize = 256 * 1024;
+    vector<uint8_t> ram(appSize);
+
+    cout << "\n[QSPI] " << left << setw(26) << "Mode" << right << setw(12) << "Copy boot"
+         << setw(12) << "XIP boot" << setw(10) << "Miss %" << setw(12) << "Assets" << endl;
+
+    struct Row { const QSPI_Mode *mode; bool continuous; };
+    vector<Row> rows;
+    for (const QSPI_Mode &m : QSPI_MODES) rows.push_back(Row{&m, false});
+    rows.push_back(Row{&QSPI_MODES[5], true});                  // 1-4-4 + continuous
+
+    unsigned long mismatchesBefore = QSPI_LineMismatches;
+    for (const Row &row : rows) {
+        uint64_t start = SPI_NowNs;
+        QSPI_Read(flash, *row.mode, 0, ram.data(), appSize);
+        uint64_t copyNs = SPI_NowNs - start;
+
+        QSPI_XipWindow xip;
+        xip.flash = &flash;
+        xip.mode = row.mode;
+        xip.continuous = row.continuous;
+        uint32_t pc = 0, lcg = 12345;
+        start = SPI_NowNs;
+        for (int i = 0; i < 1000000; i++) {
+            XIP_Read32(xip, XIP_BASE + pc);              // instruction fetch
+            lcg = lcg * 1103515245u + 12345u;
+            uint32_t r = (lcg >> 16) % 100;
+            if (r < 85)      pc += 4;                                   // sequential
+            else if (r < 95) pc -= 4 * (1 + (lcg >> 8) % 64);           // loop back
+            else             pc = ((lcg >> 4) % (codeSize / 4)) * 4;     // far call
+            pc %= codeSize;
+        }
+        uint64_t xipNs = SPI_NowNs - start;
+        if (xip.flashInContinuous) {                 // leave continuous mode
+            uint8_t dummy;
+            QSPI_Read(flash, *row.mode, 0, &dummy, 1, false, true);
         }
 
-        // Small delay to simulate hardware clock
-        this_thread::sleep_for(chrono::milliseconds(50));
+        uint8_t asset[8192];
+        start = SPI_NowNs;
+        for (int i = 0; i < 200; i++) {
+            uint32_t addr = (uint32_t)((i * 2654435761u) % (image.size() - sizeof(asset)));
+            QSPI_Read(flash, *row.mode, addr, asset, sizeof(asset));
+        }
+        uint64_t assetNs = SPI_NowNs - start;
+
+        string name = string(row.mode->name) + (row.continuous ? " +continuous" : "");
+        cout << "[QSPI] " << left << setw(26) << name << right << fixed << setprecision(2)
+             << setw(9) << copyNs / 1e6 << " ms" << setw(9) << xipNs / 1e6 << " ms"
+             << setw(9) << 100.0 * xip.misses / (xip.hits + xip.misses) << "%"
+             << setw(9) << assetNs / 1e6 << " ms"
+             << (memcmp(ram.data(), image.data(), appSize) ? "  MISMATCH" : "") << endl;
+    }
+    if (QSPI_LineMismatches != mismatchesBefore)
+        cout << "[QSPI] Line-width mismatches: " << QSPI_LineMismatches - mismatchesBefore << endl;
+}
+
+/*
+Flash_Benchmark(): write a 1 MB "firmware image" into a 16 MB chip,
+then read it back in every 1/2/4-bit mode and report how long each
+takes in simulated time.
+*/
+void Flash_Benchmark() {
+    const char *path = "spi_flash.bin";
+    const uint32_t chipSize = 16 * 1024 * 1024;
+    const uint32_t imageSize = 1024 * 1024;
+
+    cout << "\n---- SPI NOR flash model (" << chipSize / (1024 * 1024)
+         << " MB, backed by " << path << ", SCLK "
+         << SPI_ClockHz / 1000000 << " MHz) ----" << endl;
+
+    SPIFlash flash;
+    if (!flash.open(path, chipSize)) return;
+
+    cout << "[FLASH] JEDEC ID: 0x" << hex << Flash_ReadJedecId(flash) << dec << endl;
+    Flash_EnableQuad(flash);
+
+    vector<uint8_t> image(imageSize), readBack(imageSize);
+    for (uint32_t i = 0; i < imageSize; i++) image[i] = (uint8_t)(i * 31 + (i >> 8));
+
+    uint64_t t0 = SPI_NowNs;
+    for (uint32_t a = 0; a < imageSize; a += FLASH_SECTOR_SIZE) Flash_EraseSector(flash, a);
+    uint64_t t1 = SPI_NowNs;
+    Flash_Write(flash, 0, image.data(), imageSize);
+    uint64_t t2 = SPI_NowNs;
+    cout << "[FLASH] Erase 1 MB:   " << (t1 - t0) / 1000000 << " ms ("
+         << flash.erases << " sectors)" << endl;
+    cout << "[FLASH] Program 1 MB: " << (t2 - t1) / 1000000 << " ms ("
+         << flash.programs << " pages)" << endl;
+
+    for (const QSPI_Mode &m : QSPI_MODES) {
+        uint64_t start = SPI_NowNs;
+        QSPI_Read(flash, m, 0, readBack.data(), imageSize);
+        double ms = (SPI_NowNs - start) / 1e6;
+        bool ok = readBack == image;
+        cout << "[FLASH] " << left << setw(18) << m.name << right << fixed
+             << setprecision(2) << setw(8) << ms << " ms  "
+             << setw(6) << imageSize / (ms * 1000.0) << " MB/s  "
+             << (ok ? "verified" : "MISMATCH") << endl;
+    }
+
+    Flash_BootBenchmark(flash, image);
+    flash.close();
+    remove(path);
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 8: Multi-Slave SPI Controller
+// -----------------------------------------------------------------------------
+/*
+Real boards hang several devices off one SPI controller. SCLK, MOSI and
+MISO are shared; each device gets its own chip-select line. The
+controller keeps a registry of which device sits on which CS line.
+
+Only one CS may be low at a time: if two devices are selected they both
+drive MISO and the master reads garbage (bus contention). The controller
+detects this and counts it instead of silently returning bad data.
+
+Daisy-chained shift registers (74HC595, LED drivers, some ADCs) share a
+single CS: MOSI enters the first device, each device's output feeds the
+next, and the last one drives MISO. SPIDaisyChain models that as one
+composite device on one CS line.
+*/
+#define SPI_MAX_CS 8
+
+struct SPIController {
+    SPIDevice *devices[SPI_MAX_CS] = {};    // Device registry, indexed by CS
+    const char *names[SPI_MAX_CS] = {};
+    bool csActive[SPI_MAX_CS] = {};         // true = CS line driven low
+    uint64_t csSetupNs = 100;               // CS-to-first-SCLK + hold time
+
+    // Statistics
+    unsigned long contentionErrors = 0;     // Transfers with >1 CS active
+    uint64_t busyNs = 0;                    // Time SCLK/CS were in use
+    uint64_t busyNsPerCs[SPI_MAX_CS] = {};
+    unsigned long transactionsPerCs[SPI_MAX_CS] = {};
+};
 
-        {
-            lock_guard<mutex> lock(SPI.spiLock);
+bool SPI_Attach(SPIController &ctrl, int cs, SPIDevice &dev, const char *name) {
+    if (cs < 0 || cs >= SPI_MAX_CS || ctrl.devices[cs]) {
+        cout << "[SPI] Cannot attach " << name << " to CS" << cs << endl;
+        return false;
+    }
+    ctrl.devices[cs] = &dev;
+    ctrl.names[cs] = name;
+    return true;
+}
 
-            // Read MISO bit from slave
-            received_byte |= ((SPI.MISO & 1) << i);
+// A CS line that exists and has a device on it
+bool SPI_ValidCS(const SPIController &ctrl, int cs) {
+    if (cs >= 0 && cs < SPI_MAX_CS && ctrl.devices[cs]) return true;
+    cout << "[SPI] No device on CS" << cs << endl;
+    return false;
+}
+
+void SPI_AssertCS(SPIController &ctrl, int cs) {
+    if (!SPI_ValidCS(ctrl, cs)) return;
+    if (FwTrace_On()) FwTrace_Begin(FwTrace_Track("SPI bus", ctrl.names[cs]), "CS cycle", "spi", SPI_NowNs);
+    ctrl.csActive[cs] = true;
+    ctrl.devices[cs]->select();
+    SPI_NowNs += ctrl.csSetupNs;
+    ctrl.busyNs += ctrl.csSetupNs;
+    ctrl.busyNsPerCs[cs] += ctrl.csSetupNs;
+    ctrl.transactionsPerCs[cs]++;
+}
 
-            // Toggle clock low → prepare next bit
-            SPI.SCLK = false;
+void SPI_ReleaseCS(SPIController &ctrl, int cs) {
+    if (!SPI_ValidCS(ctrl, cs)) return;
+    ctrl.devices[cs]->deselect();
+    ctrl.csActive[cs] = false;
+    if (FwTrace_On()) FwTrace_End(FwTrace_Track("SPI bus", ctrl.names[cs]), SPI_NowNs);
+}
+
+/*
+SPI_BusTransfer() clocks one byte out on the shared bus. Every selected
+device sees MOSI; if more than one is selected their MISO outputs fight
+and the master sees the wired-AND of them (a weak model of contention).
+*/
+uint8_t SPI_BusTransfer(SPIController &ctrl, uint8_t out) {
+    int selected = 0, lines = 1, owner = -1;
+    uint8_t miso = 0xFF;
+    for (int cs = 0; cs < SPI_MAX_CS; cs++) {
+        if (!ctrl.csActive[cs]) continue;
+        if (selected++ == 0) { lines = ctrl.devices[cs]->dataLines(); owner = cs; }
+        miso &= ctrl.devices[cs]->transfer(out);
+    }
+    if (selected > 1) {
+        ctrl.contentionErrors++;
+        if (FwTrace_On())
+            FwTrace_Instant(FwTrace_Track("SPI bus", "controller"), "contention", "spi", SPI_NowNs,
+                            "selected", nullptr, selected);
+        FW_LOG_WARN("[SPI] CONTENTION: %d chip selects active", selected);
+    }
+    uint64_t t = SPI_ByteTimeNs(lines);
+    SPI_NowNs += t;
+    ctrl.busyNs += t;
+    if (owner >= 0) ctrl.busyNsPerCs[owner] += t;
+    return miso;
+}
+
+// 74HC595-style 8-bit shift register with output latch
+class ShiftRegisterDevice : public SPIDevice {
+public:
+    uint8_t transfer(uint8_t mosi) override {
+        uint8_t shiftedOut = shiftReg;     // QH' pin: previous contents
+        shiftReg = mosi;
+        return shiftedOut;
+    }
+    void deselect() override { outputs = shiftReg; }   // RCLK rising edge
+    uint8_t outputs = 0;                    // Parallel output pins Q0..Q7
+private:
+    uint8_t shiftReg = 0;
+};
+
+class SPIDaisyChain : public SPIDevice {
+public:
+    void add(SPIDevice &dev) { chain.push_back(&dev); }
+    void select() override { for (SPIDevice *d : chain) d->select(); }
+    uint8_t transfer(uint8_t mosi) override {
+        uint8_t data = mosi;
+        for (SPIDevice *d : chain) data = d->transfer(data);   // DOUT → next DIN
+        return data;                                           // last DOUT = MISO
+    }
+    void deselect() override { for (SPIDevice *d : chain) d->deselect(); }
+private:
+    vector<SPIDevice *> chain;
+};
+
+// -----------------------------------------------------------------------------
+// SECTION 9: Shared-Bus Utilization Benchmark
+// -----------------------------------------------------------------------------
+/*
+A sensor hub, the NOR flash and a display share one 50 MHz controller:
+  - sensor hub: 12-byte IMU sample every 1 ms (deadline: next sample)
+  - flash:      4 KB asset chunk every 5 ms (FAST_READ)
+  - display:    240x240 RGB565 frame (115200 bytes) at 30 fps
+The report shows bus utilization per device and the worst-case latency
+each device saw. A full-frame display transfer holds the bus for ~18 ms
+and the sensor misses samples; 4 KB chunks fix that with the same
+display bandwidth.
+*/
+class SensorHubDevice : public SPIDevice {
+public:
+    void select() override { first = true; }
+    uint8_t transfer(uint8_t mosi) override {
+        if (first) { reg = mosi & 0x7F; first = false; return 0xFF; }
+        return (uint8_t)(reg++ + sample);   // burst read of sample registers
+    }
+    void deselect() override { sample++; }
+private:
+    bool first = true;
+    uint8_t reg = 0, sample = 0;
+};
+
+class DisplayDevice : public SPIDevice {
+public:
+    uint8_t transfer(uint8_t) override { pixelsBytes++; return 0xFF; }
+    unsigned long pixelsBytes = 0;
+};
+
+struct SPI_BusJob {
+    int cs;                  // Which device
+    uint8_t command;         // First byte of every CS cycle
+    int headerBytes;         // Address/dummy bytes after the command
+    uint64_t periodNs;       // Release period
+    uint32_t bytes;          // Payload bytes per release
+    uint32_t chunk;          // Max payload bytes per CS cycle (0 = all at once)
+    uint64_t nextRelease;
+    uint64_t releasedAt;     // Release time of the pending instance
+    uint32_t pending;        // Payload bytes still to move
+    uint64_t worstLatencyNs; // Release → completion
+    unsigned long missed;    // Still pending when the next release came
+};
+
+// One CS cycle: command + header + up to `chunk` payload bytes
+void SPI_RunChunk(SPIController &ctrl, SPI_BusJob &job) {
+    uint32_t n = job.chunk && job.chunk < job.pending ? job.chunk : job.pending;
+    if (FwTrace_On() && job.pending == job.bytes && SPI_NowNs > job.releasedAt)
+        FwTrace_Complete(FwTrace_Track("SPI bus", ctrl.names[job.cs]), "wait for bus", "spi",
+                         job.releasedAt, SPI_NowNs - job.releasedAt);
+    SPI_AssertCS(ctrl, job.cs);
+    SPI_BusTransfer(ctrl, job.command);
+    for (int i = 0; i < job.headerBytes; i++) SPI_BusTransfer(ctrl, 0);
+    for (uint32_t i = 0; i < n; i++) SPI_BusTransfer(ctrl, 0xFF);
+    SPI_ReleaseCS(ctrl, job.cs);
+    job.pending -= n;
+}
+
+/*
+Scheduling is rate-monotonic at CS-cycle granularity: after every CS
+cycle the controller picks the pending job with the shortest period.
+A transfer can only be interrupted between CS cycles, so chunk size
+bounds how long a high-rate device can be blocked.
+*/
+void SPI_SharedBusBenchmark(uint32_t displayChunk) {
+    SPIController ctrl;
+    SensorHubDevice hub;
+    SPIFlash flash;
+    DisplayDevice display;
+    if (!flash.open("spi_bus_flash.bin", 1024 * 1024)) return;
+    SPI_Attach(ctrl, 0, hub, "sensor hub");
+    SPI_Attach(ctrl, 1, flash, "flash");
+    SPI_Attach(ctrl, 2, display, "display");
+
+    SPI_BusJob jobs[] = {
+        {0, 0x80,                0, 1000000,  12,     0,            0, 0, 0, 0, 0},
+        {1, FLASH_CMD_FAST_READ, 4, 5000000,  4096,   0,            0, 0, 0, 0, 0},
+        {2, 0x2C,                0, 33333333, 115200, displayChunk, 0, 0, 0, 0, 0},
+    };
+    const uint64_t start = SPI_NowNs, duration = 1000000000ULL;   // 1 s
+    for (SPI_BusJob &j : jobs) j.nextRelease = start;
+
+    while (true) {
+        // Release every job whose period has come round
+        uint64_t nextEvent = UINT64_MAX;
+        for (SPI_BusJob &j : jobs) {
+            while (j.nextRelease <= SPI_NowNs && j.nextRelease < start + duration) {
+                if (j.pending) j.missed++;         // previous instance overran
+                j.pending = j.bytes;
+                j.releasedAt = j.nextRelease;
+                j.nextRelease += j.periodNs;
+            }
+            if (j.nextRelease < start + duration) nextEvent = min(nextEvent, j.nextRelease);
         }
 
-        this_thread::sleep_for(chrono::milliseconds(50));
+        SPI_BusJob *run = nullptr;                 // highest-rate pending job
+        for (SPI_BusJob &j : jobs)
+            if (j.pending && (!run || j.periodNs < run->periodNs)) run = &j;
+
+        if (!run) {
+            if (nextEvent == UINT64_MAX) break;
+            SPI_NowNs = nextEvent;                 // bus idle until next release
+            continue;
+        }
+        SPI_RunChunk(ctrl, *run);
+        if (!run->pending) {
+            uint64_t latency = SPI_NowNs - run->releasedAt;
+            if (latency > run->worstLatencyNs) run->worstLatencyNs = latency;
+        }
     }
+    uint64_t elapsed = SPI_NowNs - start;
+
+    cout << "Display transfer: "
+         << (displayChunk ? to_string(displayChunk) + "-byte chunks" : string("whole frame"))
+         << ", bus utilization " << fixed << setprecision(1)
+         << 100.0 * ctrl.busyNs / elapsed << "%" << endl;
+    for (SPI_BusJob &j : jobs) {
+        cout << "  CS" << j.cs << " " << left << setw(11) << ctrl.names[j.cs] << right
+             << setw(6) << 100.0 * ctrl.busyNsPerCs[j.cs] / elapsed << "%  "
+             << setw(7) << ctrl.transactionsPerCs[j.cs] << " CS cycles  worst latency "
+             << setw(8) << setprecision(3) << j.worstLatencyNs / 1e6 << " ms  missed "
+             << j.missed << setprecision(1) << endl;
+    }
+    flash.close();
+    remove("spi_bus_flash.bin");
+}
+
+void SPI_MultiSlaveDemo() {
+    cout << "\n---- Multi-slave SPI controller ----" << endl;
 
-    // End transaction
-    SPI.CS = true;
+    // Daisy chain: three 74HC595s on CS3, 24 output pins from one CS
+    SPIController ctrl;
+    ShiftRegisterDevice sr[3];
+    SPIDaisyChain chain;
+    for (ShiftRegisterDevice &d : sr) chain.add(d);
+    DisplayDevice display;
+    SPI_Attach(ctrl, 3, chain, "595 chain");
+    SPI_Attach(ctrl, 2, display, "display");
 
-    cout << "[MASTER] Byte received from slave: 0b"
-         << bitset<8>(received_byte) << endl;
+    SPI_AssertCS(ctrl, 3);
+    const uint8_t pattern[3] = {0xC3, 0x5A, 0x0F};   // last byte → first chip
+    for (uint8_t b : pattern) SPI_BusTransfer(ctrl, b);
+    SPI_ReleaseCS(ctrl, 3);
+    cout << "[CHAIN] Outputs: " << bitset<8>(sr[0].outputs) << " "
+         << bitset<8>(sr[1].outputs) << " " << bitset<8>(sr[2].outputs) << endl;
+
+    // Contention: a driver forgets to release CS2 before selecting CS3
+    SPI_AssertCS(ctrl, 2);
+    SPI_AssertCS(ctrl, 3);
+    SPI_BusTransfer(ctrl, 0x55);
+    SPI_ReleaseCS(ctrl, 3);
+    SPI_ReleaseCS(ctrl, 2);
+    SPI_HostDecode();
+    cout << "[SPI] Contention errors detected: " << ctrl.contentionErrors << endl;
+
+    // Traced: the first second shows the display frame hogging the bus,
+    // the second the same load in 4 KB chunks
+    cout << "\n---- Shared bus: sensor hub + flash + display (1 s simulated) ----" << endl;
+    FwTrace_Start();
+    SPI_SharedBusBenchmark(0);
+    SPI_SharedBusBenchmark(4096);
+    FwTrace_Stop();
+    ofstream trace("trace_11.json");
+    FwTrace_WriteJson(trace);
+    cout << "Timeline of both runs written to trace_11.json (open in ui.perfetto.dev)" << endl;
 }
 
 // -----------------------------------------------------------------------------
-// SECTION 4: MAIN
+// SECTION 10: MAIN
 // -----------------------------------------------------------------------------
 int main() {
     cout << "==== SPI Realistic Simulation ====" << endl;
+    FwLog_Start(SPI_DebugUart, FWLOG_BINARY, true);   // sized as text too
 
-    // Byte to send
-    uint8_t data_to_send = 0b10101100;
-    uint8_t received_by_slave = 0;
-
-    // Start slave thread
-    thread slave_thread(SPISlave, ref(received_by_slave));
+    // Bit-accurate master/slave exchange in all four SPI modes
+    SPI_BitAccurateDemo();
 
-    // Give slave a moment to start
-    this_thread::sleep_for(chrono::milliseconds(10));
+    // Byte-level flash model: erase/program/read timing in simulated time
+    Flash_Benchmark();
 
-    // Master sends byte
-    SPIMaster(data_to_send);
-
-    // Wait for slave to finish
-    slave_thread.join();
+    // Several devices sharing one controller
+    SPI_MultiSlaveDemo();
+    FwLog_Stop();
+    SPI_HostDecode();
+    FwLog_SizeReport(cout, 115200);       // Same log as text vs binary
 
     cout << "==== SPI Simulation Complete ====" << endl;
     return 0;
@@ -143,8 +1220,9 @@ int main() {
 
 1. Bit-by-bit transfer:
    - MSB-first
-   - Rising edge reads
-   - Falling edge prepares next bit
+   - CPOL sets the idle clock level
+   - CPHA = 0: sample on leading edge, shift on trailing edge
+   - CPHA = 1: shift on leading edge, sample on trailing edge
 
 2. Master / Slave relationship:
    - CS low = transaction active
@@ -152,13 +1230,28 @@ int main() {
 
 3. Shift register simulation:
    - Slave reconstructs byte from individual bits
+   - Slave is clocked by edge callbacks, not by polling in a thread
 
 4. Echo back:
-   - MISO returns same bit sent by master
-   - Can be replaced by computed response
+   - MISO returns the previous byte sent by master
+   - Override respond() for a computed response
+
+5. No shared state between threads:
+   - Synchronous edge callbacks need no mutex and cannot race
+
+6. SPI NOR flash:
+   - Command byte, 24-bit address, optional dummy clocks, then data
+   - Program can only clear bits; erase sets a whole sector back to 0xFF
+   - WIP busy bit must be polled after every program/erase
+   - Dual/quad output reads move 2/4 bits per clock → 2x/4x throughput
+   - I/O modes (1-2-2, 1-4-4) also shorten the address phase, which
+     matters for many small reads (XIP cache fills, small assets)
+   - Continuous read mode drops the command byte from every XIP fill
 
-5. Mutex usage:
-   - Simulates exclusive bus access (like disabling IRQs in hardware)
+7. Shared bus:
+   - One CS line per device; exactly one may be active at a time
+   - Daisy-chained shift registers share one CS and pass data along
+   - Long transfers block other devices: chunk them to bound latency
 
 Real-world relevance:
 - SPI flash, ADCs, sensors use similar bit-level transfer.
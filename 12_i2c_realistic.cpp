@@ -1,7 +1,12 @@
 /******************************************************
  * Purpose: Realistic I2C master-slave simulation in C++.
- *          Demonstrates start/stop, 7-bit address, ACK/NACK,
- *          and bit-by-bit data transfer using threads.
+ *          Demonstrates start/stop, repeated start, 7-bit
+ *          address with R/W bit, ACK/NACK, bit-by-bit data
+ *          transfer, multi-byte bursts, register-pointer
+ *          addressing, clock stretching and multi-master
+ *          arbitration on an open-drain bus. One load run is
+ *          exported as a timeline (trace_12.json) of transactions,
+ *          bus waits, clock stretching and lost arbitration.
  *
  * Compile:
  *   g++ 12_i2c_realistic.cpp -o i2c_demo -std=c++11 -pthread
@@ -9,155 +14,1071 @@
  ******************************************************/
 
 #include <iostream>
-#include <thread>
-#include <mutex>
-#include <chrono>
+#include <iomanip>
 #include <bitset>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <random>
+#include <fstream>
+#include "fw_trace.h"   // Timeline export
 using namespace std;
 
 // -----------------------------------------------------------------------------
 // SECTION 1: I2C Bus Simulation
 // -----------------------------------------------------------------------------
+/*
+SDA and SCL are both open-drain: any device can pull a line low, nobody
+drives it high (a pull-up resistor does). Each line level is therefore
+the AND of what every device "drives". That is how a slave ACKs by
+pulling SDA low while the master has released it, how a slave stretches
+the clock by holding SCL low, and how two masters detect that they are
+talking over each other.
+
+Every time a line changes, each slave's state machine and each master
+is notified synchronously (no threads, no polling). Time advances on a
+simulated clock by the I2C timing parameters of the selected bus speed.
+*/
+class I2CSlaveDevice;
+class I2CMaster;
+
+struct I2CTiming {
+    const char *name;
+    uint32_t hz;            // Nominal SCL frequency
+    uint32_t tLOW;          // SCL low time (ns)
+    uint32_t tHIGH;         // SCL high time (ns)
+    uint32_t tHD_STA;       // Hold time after (repeated) START
+    uint32_t tSU_STA;       // Setup time before repeated START
+    uint32_t tSU_STO;       // Setup time before STOP
+    uint32_t tBUF;          // Bus free time between STOP and START
+};
+
+// Spec minimums (UM10204), SCL low/high stretched to the nominal period
+const I2CTiming I2C_STANDARD  = {"100 kHz",  100000, 5000, 5000, 4000, 4700, 4000, 4700};
+const I2CTiming I2C_FAST      = {"400 kHz",  400000, 1300, 1200,  600,  600,  600, 1300};
+const I2CTiming I2C_FAST_PLUS = {"1 MHz",   1000000,  500,  500,  260,  260,  260,  500};
+
 struct I2CBus {
     bool SDA = true;       // Data line (1 = idle)
     bool SCL = true;       // Clock line (1 = idle)
-    mutex busLock;         // Protects SDA/SCL access
-} I2C;
+    bool busy = false;     // Between a START and the next STOP
+    uint64_t busySinceNs = 0;          // When the last START was seen
+    vector<I2CSlaveDevice *> slaves;   // Devices attached to the bus
+    vector<I2CMaster *> masters;       // Masters attach themselves
+    const I2CTiming *timing = &I2C_STANDARD;
+    uint64_t nowNs = 0;    // Simulated time
+};
+
+/*
+The driver names the selected bus I2C (and its controller I2C_Master0,
+its queue I2C_Async), as a CMSIS device header makes I2C1 mean
+((I2C_TypeDef *)I2C1_BASE). Every thread starts on the default
+instances, so a process is one device; I2C_Use() (section 4) points the
+calling thread at an I2CPeripheral of its own, which is how the device
+farm (18_device_farm.cpp) runs thousands of buses on a pool of threads.
+*/
+I2CBus I2C_DefaultBus;
+thread_local I2CBus *I2C_ActiveBus = &I2C_DefaultBus;
+#define I2C (*I2C_ActiveBus)
+
+void I2C_Resolve();
 
 // -----------------------------------------------------------------------------
-// SECTION 2: I2C Slave
+// SECTION 2: I2C Slave (bus-event driven state machine)
 // -----------------------------------------------------------------------------
-void I2CSlave(uint8_t address, uint8_t &received_data) {
-    /*
-      Simulates a slave waiting for its address,
-      ACK/NACK, and receiving 8-bit data from master
-    */
-    received_data = 0;
-
-    // Wait for Start condition (SDA goes low while SCL is high)
-    while (I2C.SDA || !I2C.SCL) this_thread::sleep_for(chrono::milliseconds(1));
-    cout << "[SLAVE] Detected START condition" << endl;
-
-    // Receive 7-bit address + R/W bit
-    uint8_t received_address = 0;
-    for (int i = 7; i >= 1; i--) {  // 7-bit address
-        while (!I2C.SCL) this_thread::sleep_for(chrono::milliseconds(1)); // wait SCL high
-        {
-            lock_guard<mutex> lock(I2C.busLock);
-            received_address |= ((I2C.SDA & 1) << i);
+/*
+I2CSlaveDevice follows the bus exactly like the I2C block in a sensor:
+  - START / repeated START (SDA falls while SCL high) → expect address
+  - 8 address bits, then ACK if the address matches
+  - write direction: receive bytes, ACK each one
+  - read direction: shift out bytes, master ACKs all but the last
+  - STOP (SDA rises while SCL high) → back to idle
+Data bits are sampled on SCL rising and changed on SCL falling.
+Subclasses supply onWrite()/onRead() for the device behaviour.
+*/
+class I2CSlaveDevice {
+public:
+    explicit I2CSlaveDevice(uint8_t addr) : address(addr) {}
+    virtual ~I2CSlaveDevice() {}
+
+    bool sdaOut = true;     // What this slave drives onto SDA
+    bool sclOut = true;     // Low while stretching the clock
+    bool verbose = false;   // Print protocol events
+
+    // Clock stretching: hold SCL low this long after every ACK bit while
+    // the "firmware" behind the I2C block handles the byte
+    uint32_t stretchNs = 0;
+    uint64_t sclReleaseNs = UINT64_MAX;   // When the stretch ends
+    unsigned long stretches = 0;
+
+    void reset() {
+        state = IDLE;
+        sdaOut = true;
+        shift = 0;
+        bits = 0;
+        releaseClock();
+    }
+
+    void releaseClock() {
+        sclOut = true;
+        sclReleaseNs = UINT64_MAX;
+    }
+
+    // Called after every line change with the previous line levels
+    void onBusChange(bool oldSDA, bool oldSCL) {
+        bool sda = I2C.SDA, scl = I2C.SCL;
+        if (scl && oldSCL && sda != oldSDA) {            // SDA moved while SCL high
+            if (!sda) {                                  // START / repeated START
+                if (verbose) cout << "[SLAVE] Detected " << (state == IDLE ? "" : "repeated ")
+                                  << "START condition" << endl;
+                state = ADDRESS; shift = 0; bits = 0; sdaOut = true;
+                onStart();
+            } else {                                     // STOP
+                if (verbose) cout << "[SLAVE] Detected STOP condition" << endl;
+                state = IDLE; sdaOut = true;
+                onStop();
+            }
+            return;
         }
-        while (I2C.SCL) this_thread::sleep_for(chrono::milliseconds(1)); // wait SCL low
+        if (scl && !oldSCL) clockRising(sda);
+        else if (!scl && oldSCL) clockFalling();
     }
 
-    cout << "[SLAVE] Address received: 0b" << bitset<7>(received_address) << endl;
+protected:
+    virtual void onStart() {}
+    virtual void onStop() {}
+    virtual bool onWrite(uint8_t) { return true; }       // true = ACK
+    virtual uint8_t onRead() { return 0xFF; }
+
+    uint8_t address;
 
-    // ACK if address matches
-    if (received_address == address) {
-        lock_guard<mutex> lock(I2C.busLock);
-        I2C.SDA = false; // ACK
-        cout << "[SLAVE] Sending ACK" << endl;
-    } else {
-        lock_guard<mutex> lock(I2C.busLock);
-        I2C.SDA = true;  // NACK
-        cout << "[SLAVE] Sending NACK" << endl;
-        return;          // ignore transaction
+private:
+    enum State { IDLE, ADDRESS, ADDR_ACK, WRITE, WRITE_ACK, READ, READ_ACK };
+
+    // Called on the falling edge that ends an ACK bit: SCL is already low
+    void stretch() {
+        if (!stretchNs) return;
+        sclOut = false;
+        sclReleaseNs = I2C.nowNs + stretchNs;
+        stretches++;
+    }
+
+    void clockRising(bool sda) {
+        switch (state) {
+        case ADDRESS:
+        case WRITE:
+            shift = (uint8_t)((shift << 1) | sda);       // MSB first
+            bits++;
+            break;
+        case READ:
+            bits++;                                      // master sampled a bit
+            break;
+        case READ_ACK:
+            masterAck = !sda;                            // low = ACK = "more"
+            break;
+        default:
+            break;
+        }
     }
 
-    // Receive 8-bit data
-    for (int i = 7; i >= 0; i--) {
-        while (!I2C.SCL) this_thread::sleep_for(chrono::milliseconds(1));
-        {
-            lock_guard<mutex> lock(I2C.busLock);
-            received_data |= ((I2C.SDA & 1) << i);
+    void clockFalling() {
+        switch (state) {
+        case ADDRESS:
+            if (bits < 8) break;
+            if ((shift >> 1) == address) {
+                reading = shift & 1;
+                if (verbose) cout << "[SLAVE] Address 0x" << hex << (int)address << dec
+                                  << (reading ? " R" : " W") << " matched, sending ACK" << endl;
+                sdaOut = false;                          // ACK
+                state = ADDR_ACK;
+            } else {
+                state = IDLE;                            // not for us
+            }
+            break;
+        case ADDR_ACK:
+        case READ_ACK:
+            sdaOut = true;
+            if (state == READ_ACK && !masterAck) { state = IDLE; break; }  // NACK: done
+            stretch();
+            if (reading) {
+                state = READ; bits = 0;
+                txByte = onRead();
+                sdaOut = (txByte >> 7) & 1;              // bit 7 while SCL low
+            } else {
+                state = WRITE; bits = 0; shift = 0;
+            }
+            break;
+        case WRITE:
+            if (bits < 8) break;
+            if (onWrite(shift)) { sdaOut = false; state = WRITE_ACK; }
+            else                { state = IDLE; }        // NACK
+            break;
+        case WRITE_ACK:
+            sdaOut = true;
+            stretch();
+            state = WRITE; bits = 0; shift = 0;
+            break;
+        case READ:
+            if (bits < 8) sdaOut = (txByte >> (7 - bits)) & 1;
+            else        { sdaOut = true; state = READ_ACK; }   // master ACKs
+            break;
+        default:
+            break;
         }
-        while (I2C.SCL) this_thread::sleep_for(chrono::milliseconds(1));
     }
 
-    // Send ACK after data
-    lock_guard<mutex> lock(I2C.busLock);
-    I2C.SDA = false; // ACK
-    cout << "[SLAVE] Data received: 0b" << bitset<8>(received_data)
-         << " | ACK sent" << endl;
+    State state = IDLE;
+    uint8_t shift = 0;
+    int bits = 0;
+    bool reading = false;
+    bool masterAck = false;
+    uint8_t txByte = 0xFF;
+};
 
-    // Wait for Stop condition (SDA goes high while SCL is high)
-    while (!I2C.SDA || !I2C.SCL) this_thread::sleep_for(chrono::milliseconds(1));
-    cout << "[SLAVE] Detected STOP condition" << endl;
-}
+/*
+I2CRegisterDevice: the register-pointer interface of nearly all sensors,
+EEPROMs and PMICs. The first byte written after the address sets the
+register pointer; further written bytes go to reg[ptr++]; reads return
+reg[ptr++]. A repeated START keeps the pointer, so "write pointer, read
+N bytes" is one transaction.
+*/
+class I2CRegisterDevice : public I2CSlaveDevice {
+public:
+    explicit I2CRegisterDevice(uint8_t addr) : I2CSlaveDevice(addr) {
+        for (int i = 0; i < 256; i++) regs[i] = 0;
+    }
+    uint8_t regs[256];
+    uint8_t pointer = 0;
+
+protected:
+    void onStart() override { firstWrite = true; }
+    bool onWrite(uint8_t b) override {
+        if (firstWrite) { pointer = b; firstWrite = false; }
+        else            { regs[pointer++] = b; }
+        return true;
+    }
+    uint8_t onRead() override { return regs[pointer++]; }
+
+private:
+    bool firstWrite = true;
+};
+
+// IMU-style sensor: 14 data bytes at 0x3B..0x48 that change every read
+class I2CSensorDevice : public I2CRegisterDevice {
+public:
+    explicit I2CSensorDevice(uint8_t addr) : I2CRegisterDevice(addr) {
+        regs[0x75] = 0x68;                                // WHO_AM_I
+    }
+    unsigned long samples = 0;
+protected:
+    void onStop() override {                              // new sample latched
+        samples++;
+        for (int i = 0; i < 14; i++) regs[0x3B + i] = (uint8_t)(samples + i);
+    }
+};
 
 // -----------------------------------------------------------------------------
-// SECTION 3: I2C Master
+// SECTION 3: I2C Master (event-driven, multi-master capable)
 // -----------------------------------------------------------------------------
-void I2CMaster_Write(uint8_t address, uint8_t data) {
+/*
+I2CMaster runs a transaction as a small program of bus operations
+(START, bit, repeated START, STOP), each split into the phases of one
+SCL period. step() is called by the scheduler when the next phase is
+due, exactly like the event interrupt of an MCU's I2C block.
+
+Open-drain rules the master has to respect:
+  - Clock synchronisation: after releasing SCL it waits until the line
+    really is high. A slave stretching the clock, or another master
+    still in its low period, delays the rising edge. The high period is
+    cut short if another master pulls SCL low first.
+  - Arbitration: whenever it releases SDA to send a 1 but sees 0 while
+    SCL is high, another master is sending a 0 at the same time. The
+    loser lets go of both lines immediately, waits for the winner's
+    STOP and retries the whole transaction. The winner never notices,
+    its bits were on the wire unharmed.
+Masters register themselves on a bus (by default the selected one) when
+constructed.
+*/
+class I2CMaster {
+public:
+    explicit I2CMaster(const char *n, I2CBus &b = I2C) : name(n), home(&b) {
+        home->masters.push_back(this);
+    }
+    ~I2CMaster() {
+        for (size_t i = 0; i < home->masters.size(); i++)
+            if (home->masters[i] == this) home->masters.erase(home->masters.begin() + i);
+    }
+    I2CMaster(const I2CMaster &) = delete;
+    I2CMaster &operator=(const I2CMaster &) = delete;
+
+    const char *name;
+    bool sdaOut = true;                 // What this master drives onto SDA
+    bool sclOut = true;                 // What this master drives onto SCL
+    uint64_t nextEventNs = UINT64_MAX;  // When step() is due
+    bool lastOk = false;                // Result of the last transaction
+    void (*completeISR)(I2CMaster &) = nullptr;   // "Transfer complete" IRQ
+
+    // Statistics
+    unsigned long completed = 0;        // Transactions finished (incl. NACKed)
+    unsigned long nacked = 0;
+    unsigned long arbitrationLost = 0;
+    uint64_t clockWaitNs = 0;           // SCL held low by someone else
+    uint64_t latencyNs = 0;             // Sum of request → STOP times
+    uint64_t maxLatencyNs = 0;
+
+    bool idle() const { return !active; }
+
+    void resetStats() {
+        completed = nacked = arbitrationLost = 0;
+        clockWaitNs = latencyNs = maxLatencyNs = 0;
+    }
+
+    // Abandon any transaction and release both lines, as after a
+    // controller reset (the bus itself is reset by I2C_Reset)
+    void reset() {
+        ops.clear();
+        pc = 0; phase = 0;
+        active = nack = waitClock = waitBusFree = false;
+        sdaOut = sclOut = true;
+        nextEventNs = UINT64_MAX;
+        lastOk = false;
+        resetStats();
+    }
+
     /*
-      Simulates master sending start, address, data,
-      and stop conditions over I2C bus
+    Start a transaction delayNs from now:
+      START, addr+W, wlen bytes, [repeated START, addr+R, rlen bytes], STOP
+    Either part may be empty. rbuf must stay valid until idle().
     */
+    void begin(uint8_t address, const uint8_t *wbuf, int wlen,
+               uint8_t *rbuf, int rlen, uint32_t delayNs = 0) {
+        ops.clear();
+        ops.push_back(Op{OP_START, false, false, false, nullptr, 0});
+        if (wlen > 0 || rlen == 0) {
+            pushByte((uint8_t)(address << 1));                  // R/W = 0
+            for (int i = 0; i < wlen; i++) pushByte(wbuf[i]);
+            if (rlen > 0) ops.push_back(Op{OP_RESTART, false, false, false, nullptr, 0});
+        }
+        if (rlen > 0) {
+            pushByte((uint8_t)((address << 1) | 1));            // R/W = 1
+            for (int i = 0; i < rlen; i++) {
+                for (int b = 7; b >= 0; b--)
+                    ops.push_back(Op{OP_BIT, true, false, false, &rbuf[i], b});
+                // ACK all but the last byte; NACK (released SDA) ends the read
+                ops.push_back(Op{OP_BIT, i == rlen - 1, false, false, nullptr, 0});
+            }
+        }
+        ops.push_back(Op{OP_STOP, false, false, false, nullptr, 0});
+        pc = 0; phase = 0; nack = false;
+        waitClock = waitBusFree = false;
+        active = true;
+        requestNs = I2C.nowNs + delayNs;
+        waitSinceNs = requestNs;
+        this->address = address;
+        nextEventNs = requestNs;
+    }
+
+    void step() {
+        const I2CTiming &t = *I2C.timing;
+        const Op &op = ops[pc];
+        switch (op.type) {
+        case OP_START:
+            if (phase == 0) {
+                // Bus owned by someone else: wait for their STOP. A START
+                // seen in this very instant is a simultaneous start, and
+                // arbitration will sort it out.
+                if (I2C.busy && I2C.busySinceNs != I2C.nowNs) { waitBusFree = true; break; }
+                if (pc == 0) traceStart();
+                drive(false, true);                      // SDA falls while SCL high
+                after(t.tHD_STA); phase = 1;
+            } else {
+                drive(false, false);                     // SCL low, ready for bit 7
+                after(t.tLOW / 2); next();
+            }
+            break;
+
+        case OP_BIT:
+            if (phase == 0) {
+                drive(op.value, false);                  // change SDA in SCL low
+                after(t.tLOW / 2); phase = 1;
+            } else if (phase == 1) {
+                phase = 2; releaseClock();               // rising edge
+            } else if (phase == 2) {
+                bool sample = I2C.SDA;
+                if (op.arbitrate && op.value && !sample) { loseArbitration(); break; }
+                if (op.ackCheck && sample) nack = true;
+                if (op.capture) {
+                    if (sample) *op.capture |= (uint8_t)(1 << op.bit);
+                    else        *op.capture &= (uint8_t)~(1 << op.bit);
+                }
+                after(t.tHIGH); phase = 3;
+            } else {
+                drive(op.value, false);                  // falling edge
+                after(t.tLOW / 2); next();
+            }
+            break;
+
+        case OP_RESTART:
+            if (phase == 0) {
+                drive(true, false);                      // release SDA while SCL low
+                after(t.tLOW / 2); phase = 1;
+            } else if (phase == 1) {
+                phase = 2; releaseClock();
+            } else if (phase == 2) {
+                after(t.tSU_STA); phase = 3;
+            } else if (phase == 3) {
+                drive(false, true);                      // SDA falls while SCL high
+                after(t.tHD_STA); phase = 4;
+            } else {
+                drive(false, false);
+                after(t.tLOW / 2); next();
+            }
+            break;
+
+        case OP_STOP:
+            if (phase == 0) {
+                drive(false, false);                     // SDA low while SCL low
+                after(t.tLOW / 2); phase = 1;
+            } else if (phase == 1) {
+                phase = 2; releaseClock();
+            } else if (phase == 2) {
+                after(t.tSU_STO); phase = 3;
+            } else if (phase == 3) {
+                drive(true, true);                       // SDA rises → STOP
+                after(t.tBUF); phase = 4;
+            } else {
+                finish();
+            }
+            break;
+        }
+    }
+
+    // Called after every line change with the previous line levels
+    void onBusChange(bool oldSDA, bool oldSCL) {
+        (void)oldSDA;
+        if (!active) return;
+        if (waitClock && I2C.SCL && !oldSCL) {           // stretch / sync over
+            waitClock = false;
+            clockWaitNs += I2C.nowNs - clockWaitStartNs;
+            if (FwTrace_On() && I2C.nowNs > clockWaitStartNs)
+                FwTrace_Complete(FwTrace_Track("I2C bus", name), "SCL held low", "i2c",
+                                 clockWaitStartNs, I2C.nowNs - clockWaitStartNs);
+            nextEventNs = I2C.nowNs;
+        }
+        if (waitBusFree && !I2C.busy) {                  // STOP seen
+            waitBusFree = false;
+            nextEventNs = I2C.nowNs + I2C.timing->tBUF;
+        }
+        // Clock synchronisation: another master ended the high period early
+        if (ops[pc].type == OP_BIT && phase == 3 && sclOut && oldSCL && !I2C.SCL)
+            nextEventNs = I2C.nowNs;
+    }
+
+private:
+    I2CBus *home;                       // Bus this master is attached to
+
+    enum OpType { OP_START, OP_RESTART, OP_BIT, OP_STOP };
+    struct Op {
+        OpType type;
+        bool value;         // Level driven onto SDA for OP_BIT
+        bool arbitrate;     // Master-transmitted bit: check for lost arbitration
+        bool ackCheck;      // ACK slot after a transmitted byte
+        uint8_t *capture;   // Read bit destination
+        int bit;
+    };
+
+    void pushByte(uint8_t b) {
+        for (int i = 7; i >= 0; i--)
+            ops.push_back(Op{OP_BIT, (bool)((b >> i) & 1), true, false, nullptr, 0});
+        ops.push_back(Op{OP_BIT, true, false, true, nullptr, 0});   // release, read ACK
+    }
+
+    void drive(bool sda, bool scl) {
+        sdaOut = sda;
+        sclOut = scl;
+        I2C_Resolve();
+    }
+
+    void after(uint32_t ns) { nextEventNs = I2C.nowNs + ns; }
+
+    // Release SCL; continue now if it went high, else when it does
+    void releaseClock() {
+        drive(sdaOut, true);
+        if (I2C.SCL) { after(0); return; }
+        waitClock = true;
+        clockWaitStartNs = I2C.nowNs;
+    }
+
+    void next() {
+        pc = nack ? ops.size() - 1 : pc + 1;             // NACK: straight to STOP
+        phase = 0;
+    }
+
+    // Timeline: the wait since the request (or the lost attempt), then
+    // one slice per attempt on the bus
+    void traceStart() {
+        if (!FwTrace_On()) return;
+        int track = FwTrace_Track("I2C bus", name);
+        if (I2C.nowNs > waitSinceNs)
+            FwTrace_Complete(track, "wait for bus", "i2c", waitSinceNs, I2C.nowNs - waitSinceNs);
+        FwTrace_Begin(track, "transaction", "i2c", I2C.nowNs, "addr", nullptr, address);
+    }
+
+    void loseArbitration() {
+        arbitrationLost++;
+        waitSinceNs = I2C.nowNs;
+        if (FwTrace_On()) {
+            int track = FwTrace_Track("I2C bus", name);
+            FwTrace_End(track, I2C.nowNs);
+            FwTrace_Instant(track, "arbitration lost", "i2c", I2C.nowNs);
+        }
+        drive(true, true);                               // get off the bus
+        pc = 0; phase = 0; nack = false;
+        waitBusFree = true;                              // retry after STOP
+    }
+
+    void finish() {
+        active = false;
+        if (FwTrace_On()) FwTrace_End(FwTrace_Track("I2C bus", name), I2C.nowNs);
+        lastOk = !nack;
+        completed++;
+        if (nack) nacked++;
+        uint64_t latency = I2C.nowNs - requestNs;
+        latencyNs += latency;
+        if (latency > maxLatencyNs) maxLatencyNs = latency;
+        if (completeISR) completeISR(*this);             // may begin() the next one
+    }
+
+    vector<Op> ops;
+    size_t pc = 0;
+    int phase = 0;
+    bool active = false;
+    bool nack = false;
+    bool waitClock = false;
+    bool waitBusFree = false;
+    uint64_t clockWaitStartNs = 0;
+    uint64_t requestNs = 0;
+    uint64_t waitSinceNs = 0;          // Request, or the last lost attempt
+    uint8_t address = 0;               // Slave of the current transaction
+};
+
+/*
+I2C_Resolve(): recompute both wired-AND lines from every device's
+outputs and notify everybody of the change. Slaves may change their own
+outputs while being notified (ACK, read data, stretching), so repeat
+until the lines settle.
+*/
+void I2C_Resolve() {
+    for (int pass = 0; pass < 4; pass++) {
+        bool sda = true, scl = true;
+        for (I2CMaster *m : I2C.masters)     { sda = sda && m->sdaOut; scl = scl && m->sclOut; }
+        for (I2CSlaveDevice *s : I2C.slaves) { sda = sda && s->sdaOut; scl = scl && s->sclOut; }
+        if (sda == I2C.SDA && scl == I2C.SCL) return;
+
+        bool oldSDA = I2C.SDA, oldSCL = I2C.SCL;
+        I2C.SDA = sda;
+        I2C.SCL = scl;
+        if (scl && oldSCL && sda != oldSDA) {            // START or STOP
+            I2C.busy = !sda;
+            if (!sda) I2C.busySinceNs = I2C.nowNs;
+        }
+        for (I2CSlaveDevice *s : I2C.slaves) s->onBusChange(oldSDA, oldSCL);
+        for (I2CMaster *m : I2C.masters)     m->onBusChange(oldSDA, oldSCL);
+    }
+}
 
-    // START condition: SDA goes low while SCL is high
-    {
-        lock_guard<mutex> lock(I2C.busLock);
-        I2C.SDA = false;
-        I2C.SCL = true;
+/*
+I2C_Step(): advance simulated time to the earliest pending event (a
+master phase or the end of a slave's clock stretch) and run it.
+Returns false when nothing is pending.
+*/
+uint64_t I2C_NextEventNs() {
+    uint64_t t = UINT64_MAX;
+    for (I2CMaster *m : I2C.masters)     if (m->nextEventNs < t) t = m->nextEventNs;
+    for (I2CSlaveDevice *s : I2C.slaves) if (s->sclReleaseNs < t) t = s->sclReleaseNs;
+    return t;
+}
+
+bool I2C_Step() {
+    uint64_t t = I2C_NextEventNs();
+    if (t == UINT64_MAX) return false;
+    if (t > I2C.nowNs) I2C.nowNs = t;
+    for (I2CSlaveDevice *s : I2C.slaves) {
+        if (s->sclReleaseNs != t) continue;
+        s->releaseClock();
+        I2C_Resolve();
+        return true;
+    }
+    for (I2CMaster *m : I2C.masters) {
+        if (m->nextEventNs != t) continue;
+        m->nextEventNs = UINT64_MAX;
+        m->step();
+        return true;
     }
-    cout << "[MASTER] START condition" << endl;
-    this_thread::sleep_for(chrono::milliseconds(50));
+    return true;
+}
+
+// The MCU's own I2C controller
+I2CMaster I2C_DefaultMaster("MCU", I2C_DefaultBus);
+thread_local I2CMaster *I2C_ActiveMaster = &I2C_DefaultMaster;
+#define I2C_Master0 (*I2C_ActiveMaster)
+
+// -----------------------------------------------------------------------------
+// SECTION 4: Asynchronous Transaction Queue
+// -----------------------------------------------------------------------------
+/*
+The driver API every task uses. I2C_Submit() only puts the transaction
+into a fixed-size ring and returns; the caller keeps running. The
+master's "transfer complete" interrupt (I2C_AsyncCompleteISR) starts the
+next queued transaction first, so the bus goes straight from one STOP
+to the next START, and then runs the finished transaction's callback.
+
+Callbacks run in interrupt context: keep them short. They may submit
+new transactions (e.g. "read the data now that the status says ready").
+The transaction and its buffers belong to the driver until the callback
+has run.
+*/
+#define I2C_QUEUE_DEPTH 16
+
+struct I2CTransaction {
+    uint8_t address;
+    const uint8_t *wbuf;        // Written first (may be null if wlen == 0)
+    int wlen;
+    uint8_t *rbuf;              // Read after a repeated START
+    int rlen;
+    void (*callback)(I2CTransaction &);   // Completion, in ISR context
+    void *context;              // For the callback
+    bool ok;                    // Result, valid in the callback
+};
+
+struct I2CAsyncQueue {
+    I2CMaster *master = &I2C_Master0;
+    I2CTransaction *ring[I2C_QUEUE_DEPTH];
+    int head = 0, tail = 0, count = 0;
+    I2CTransaction *current = nullptr;    // On the bus right now
+
+    // Statistics
+    unsigned long submitted = 0;
+    unsigned long completed = 0;
+    unsigned long rejected = 0;           // Queue full
+    int maxDepth = 0;
+};
+
+I2CAsyncQueue I2C_DefaultAsync;
+thread_local I2CAsyncQueue *I2C_ActiveAsync = &I2C_DefaultAsync;
+#define I2C_Async (*I2C_ActiveAsync)
+
+// One device's I2C block: bus, controller and driver queue
+struct I2CPeripheral {
+    I2CBus bus;
+    I2CMaster master0;
+    I2CAsyncQueue async;
+
+    I2CPeripheral() : master0("MCU", bus) { async.master = &master0; }
+    I2CPeripheral(const I2CPeripheral &) = delete;
+    I2CPeripheral &operator=(const I2CPeripheral &) = delete;
+};
 
-    // Send 7-bit address (MSB first)
-    for (int i = 7; i >= 1; i--) {
-        lock_guard<mutex> lock(I2C.busLock);
-        I2C.SDA = (address >> i) & 1;
-        // Toggle clock high
-        I2C.SCL = true;
-        this_thread::sleep_for(chrono::milliseconds(50));
-        I2C.SCL = false;
+// Select the instance this thread's I2C calls act on (null: the defaults)
+void I2C_Use(I2CPeripheral *p) {
+    I2C_ActiveBus = p ? &p->bus : &I2C_DefaultBus;
+    I2C_ActiveMaster = p ? &p->master0 : &I2C_DefaultMaster;
+    I2C_ActiveAsync = p ? &p->async : &I2C_DefaultAsync;
+}
+
+void I2C_AsyncCompleteISR(I2CMaster &m);
+
+void I2C_AsyncStartNext() {
+    I2CAsyncQueue &q = I2C_Async;
+    if (q.count == 0) { q.current = nullptr; return; }
+    I2CTransaction *t = q.ring[q.head];
+    q.head = (q.head + 1) % I2C_QUEUE_DEPTH;
+    q.count--;
+    q.current = t;
+    q.master->begin(t->address, t->wbuf, t->wlen, t->rbuf, t->rlen);
+}
+
+// Returns false (and drops nothing) if the queue is full
+bool I2C_Submit(I2CTransaction *t) {
+    I2CAsyncQueue &q = I2C_Async;
+    if (q.count == I2C_QUEUE_DEPTH) { q.rejected++; return false; }
+    q.master->completeISR = I2C_AsyncCompleteISR;
+    q.ring[q.tail] = t;
+    q.tail = (q.tail + 1) % I2C_QUEUE_DEPTH;
+    q.count++;
+    q.submitted++;
+    if (q.count > q.maxDepth) q.maxDepth = q.count;
+    if (!q.current && q.master->idle()) I2C_AsyncStartNext();
+    return true;
+}
+
+void I2C_AsyncCompleteISR(I2CMaster &m) {
+    I2CTransaction *done = I2C_Async.current;
+    I2C_AsyncStartNext();               // bus first, bookkeeping after
+    if (!done) return;                  // master was used directly
+    done->ok = m.lastOk;
+    I2C_Async.completed++;
+    if (done->callback) done->callback(*done);
+}
+
+/*
+I2CMaster_Transfer(): the blocking call, built on the queue. Submits
+and then runs the bus until this transaction's callback has fired;
+anything queued before it goes first.
+  START, addr+W, wlen bytes, [repeated START, addr+R, rlen bytes], STOP
+Either part may be empty. Returns false if any byte was NACKed.
+*/
+static void I2C_BlockingDone(I2CTransaction &t) { *(bool *)t.context = true; }
+
+bool I2CMaster_Transfer(uint8_t address, const uint8_t *wbuf, int wlen,
+                        uint8_t *rbuf, int rlen) {
+    bool done = false;
+    I2CTransaction t = {address, wbuf, wlen, rbuf, rlen, I2C_BlockingDone, &done, false};
+    while (!I2C_Submit(&t))
+        if (!I2C_Step()) return false;
+    while (!done && I2C_Step()) {}
+    return done && t.ok;
+}
+
+bool I2CMaster_Write(uint8_t address, const uint8_t *data, int len) {
+    return I2CMaster_Transfer(address, data, len, nullptr, 0);
+}
+
+bool I2CMaster_Read(uint8_t address, uint8_t *data, int len) {
+    return I2CMaster_Transfer(address, nullptr, 0, data, len);
+}
+
+// Register-addressed helpers: pointer write, then burst data
+bool I2C_WriteRegisters(uint8_t address, uint8_t reg, const uint8_t *data, int len) {
+    if (len < 0 || len > 256) return false;    // one pointer byte + up to 256 data
+    uint8_t buf[257];
+    buf[0] = reg;
+    for (int i = 0; i < len; i++) buf[1 + i] = data[i];
+    return I2CMaster_Write(address, buf, len + 1);
+}
+
+bool I2C_ReadRegisters(uint8_t address, uint8_t reg, uint8_t *data, int len) {
+    return I2CMaster_Transfer(address, &reg, 1, data, len);
+}
+
+/*
+I2C_Reset(): power-on state for the whole simulation: lines idle,
+time 0, no slaves, every master and the queue empty. No threads and no
+sleeps anywhere, so tests and fuzzers can reset thousands of times a
+second. Slaves are owned by the caller; attach fresh ones afterwards.
+*/
+void I2C_Reset(const I2CTiming &timing = I2C_STANDARD) {
+    I2C.SDA = I2C.SCL = true;
+    I2C.busy = false;
+    I2C.busySinceNs = 0;
+    I2C.slaves.clear();
+    I2C.timing = &timing;
+    I2C.nowNs = 0;
+    for (I2CMaster *m : I2C.masters) m->reset();
+    I2C_Async = I2CAsyncQueue();
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 5: Sensor Readout Benchmark
+// -----------------------------------------------------------------------------
+/*
+Read the 14-byte IMU sample 1000 times at each bus speed, either as one
+burst (pointer write + repeated START + 14 reads) or as 14 separate
+single-register transactions, and report samples/s in simulated time.
+*/
+void I2C_SensorBenchmark() {
+    const I2CTiming *speeds[] = {&I2C_STANDARD, &I2C_FAST, &I2C_FAST_PLUS};
+    const int samples = 1000;
+
+    I2CSensorDevice imu(0x68);
+    I2C.slaves = {&imu};
+
+    cout << "\n---- Sensor readout: 14-byte IMU sample, " << samples << " samples ----" << endl;
+    cout << left << setw(10) << "Bus" << setw(12) << "Mode" << right << setw(12) << "us/sample"
+         << setw(14) << "samples/s" << setw(14) << "payload B/s" << endl;
+    for (const I2CTiming *t : speeds) {
+        I2C.timing = t;
+        for (int burst = 1; burst >= 0; burst--) {
+            uint8_t data[14];
+            uint64_t start = I2C.nowNs;
+            bool ok = true;
+            for (int n = 0; n < samples; n++) {
+                if (burst) {
+                    ok = I2C_ReadRegisters(0x68, 0x3B, data, 14) && ok;
+                } else {
+                    for (int r = 0; r < 14; r++)
+                        ok = I2C_ReadRegisters(0x68, (uint8_t)(0x3B + r), &data[r], 1) && ok;
+                }
+            }
+            double us = (I2C.nowNs - start) / 1e3 / samples;
+            cout << left << setw(10) << t->name << setw(12) << (burst ? "burst" : "per-reg")
+                 << right << fixed << setprecision(1) << setw(12) << us
+                 << setw(14) << setprecision(0) << 1e6 / us
+                 << setw(14) << 14e6 / us << (ok ? "" : "  NACK!") << endl;
+        }
     }
+    I2C.slaves.clear();
+    I2C.timing = &I2C_STANDARD;
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 6: Clock Stretching and Arbitration Under Load
+// -----------------------------------------------------------------------------
+/*
+Two masters (the MCU and a BMC) each poll their own IMU: every poll
+drains 4 FIFO samples with back-to-back 14-byte burst reads, then the
+master "thinks" for a random time of up to 8 transactions, so each
+offers roughly 50% bus load and the pair contend for the bus. A master
+that found the bus busy restarts at STOP + tBUF, the same instant the
+owner starts its next back-to-back read: that is where arbitration
+happens. Optionally both sensors stretch SCL after every ACK; a stretch
+shorter than the master's own SCL low time is invisible. Reported per
+configuration, over 200 ms of simulated time:
+  tx/s       completed reads per second (total and per master)
+  arb lost   transactions that lost arbitration and were retried
+  latency    request → STOP, including waiting for the bus
+  SCL held   share of time masters waited for SCL to rise
+Arbitration itself costs no bus time (the winner's bits are never
+corrupted); the cost shows up as latency for the loser.
+*/
+void I2C_LoadBenchmark() {
+    const I2CTiming *speeds[] = {&I2C_STANDARD, &I2C_FAST, &I2C_FAST_PLUS};
+    const uint32_t stretchNs = 4000;                  // 4 us per ACKed byte
+    const uint64_t runNs = 200000000ULL;
+
+    I2CSensorDevice imuA(0x68), imuB(0x69);
+    I2CMaster bmc("BMC");
+    I2CMaster *masters[2] = {&I2C_Master0, &bmc};
+    const uint8_t addrs[2] = {0x68, 0x69};
+    I2C.slaves = {&imuA, &imuB};
+
+    cout << "\n---- Load: 14-byte burst polling, stretch " << stretchNs / 1000
+         << " us/byte, 200 ms simulated ----" << endl;
+    cout << left << setw(10) << "Bus" << setw(20) << "Config" << right << setw(9) << "tx/s"
+         << setw(9) << "MCU" << setw(9) << "BMC" << setw(10) << "arb lost"
+         << setw(12) << "avg lat us" << setw(12) << "max lat us" << setw(10) << "SCL held" << endl;
+
+    for (const I2CTiming *t : speeds) {
+        I2C.timing = t;
+        // ~17 bytes of 9 clocks each per read
+        uint32_t txNs = 17 * 9 * (t->tLOW + t->tHIGH);
+        for (int config = 0; config < 4; config++) {
+            int nMasters = (config & 2) ? 2 : 1;
+            bool stretching = config & 1;
+            bool traced = t == &I2C_FAST && nMasters == 2 && stretching;
+            if (traced) FwTrace_Start();
+            imuA.reset(); imuB.reset();
+            imuA.stretchNs = imuB.stretchNs = stretching ? stretchNs : 0;
+            mt19937 rng(1234);
+            uniform_int_distribution<uint32_t> think(0, 8 * txNs);
+            uint8_t reg = 0x3B, data[2][14];
+            int batch[2] = {0, 0};
+            for (I2CMaster *m : masters) m->resetStats();
 
-    // Simulate wait for ACK/NACK
-    this_thread::sleep_for(chrono::milliseconds(50));
+            uint64_t start = I2C.nowNs, end = start + runNs;
+            while (true) {
+                for (int i = 0; i < nMasters; i++)
+                    if (masters[i]->idle() && I2C.nowNs < end) {
+                        uint32_t delay = (batch[i]++ % 4 == 0) ? think(rng) : 0;
+                        masters[i]->begin(addrs[i], &reg, 1, data[i], 14, delay);
+                    }
+                if (!I2C_Step()) break;
+            }
+            double sec = (I2C.nowNs - start) / 1e9;
+            if (traced) FwTrace_Stop();
 
-    // Send 8-bit data (MSB first)
-    for (int i = 7; i >= 0; i--) {
-        lock_guard<mutex> lock(I2C.busLock);
-        I2C.SDA = (data >> i) & 1;
-        // Clock high → slave reads
-        I2C.SCL = true;
-        this_thread::sleep_for(chrono::milliseconds(50));
-        I2C.SCL = false;
+            unsigned long done = 0, lost = 0;
+            uint64_t latency = 0, maxLatency = 0, held = 0;
+            for (int i = 0; i < nMasters; i++) {
+                done += masters[i]->completed;
+                lost += masters[i]->arbitrationLost;
+                latency += masters[i]->latencyNs;
+                held += masters[i]->clockWaitNs;
+                if (masters[i]->maxLatencyNs > maxLatency) maxLatency = masters[i]->maxLatencyNs;
+            }
+            string name = string(nMasters == 2 ? "2 masters" : "1 master") +
+                          (stretching ? " + stretch" : "");
+            cout << left << setw(10) << t->name << setw(20) << name << right << fixed
+                 << setprecision(0) << setw(9) << done / sec
+                 << setw(9) << masters[0]->completed / sec
+                 << setw(9) << (nMasters == 2 ? masters[1]->completed / sec : 0.0)
+                 << setw(10) << lost
+                 << setprecision(1) << setw(12) << latency / 1e3 / done
+                 << setw(12) << maxLatency / 1e3
+                 << setw(9) << 100.0 * held / (I2C.nowNs - start) << "%" << endl;
+        }
     }
+    imuA.stretchNs = imuB.stretchNs = 0;
+    I2C.slaves.clear();
+    I2C.timing = &I2C_STANDARD;
+
+    ofstream trace("trace_12.json");
+    FwTrace_WriteJson(trace);
+    cout << "Timeline of 400 kHz, 2 masters + stretch written to trace_12.json"
+         << " (open in ui.perfetto.dev)" << endl;
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 7: Blocking vs Asynchronous Polling
+// -----------------------------------------------------------------------------
+/*
+One task polls 8 IMUs and spends 100 us of CPU per 14-byte sample (filter,
+fusion). With the blocking driver the task alternates bus time and CPU
+time, and the bus sits idle while it computes. With the queue, each
+completion callback hands the sample to the task and immediately
+re-queues that sensor, so the bus stays saturated while the task works.
+  bus busy   share of time a transaction was on the bus
+  CPU free   share of time the task had nothing to do (could sleep)
+*/
+static unsigned long I2C_PendingSamples = 0;
+static bool I2C_Polling = false;
+
+static void I2C_PollDone(I2CTransaction &t) {
+    I2C_PendingSamples++;                 // hand the sample to the task
+    if (I2C_Polling) I2C_Submit(&t);      // and poll this sensor again
+}
+
+void I2C_AsyncBenchmark() {
+    const I2CTiming *speeds[] = {&I2C_STANDARD, &I2C_FAST, &I2C_FAST_PLUS};
+    const int nSensors = 8;
+    const uint32_t processNs = 100000;
+    const uint64_t runNs = 200000000ULL;
 
-    // STOP condition: SDA goes high while SCL is high
-    {
-        lock_guard<mutex> lock(I2C.busLock);
-        I2C.SDA = true;
-        I2C.SCL = true;
+    vector<I2CSensorDevice> imus;
+    imus.reserve(nSensors);
+    I2C.slaves.clear();
+    for (int i = 0; i < nSensors; i++) imus.emplace_back((uint8_t)(0x68 + i));
+    for (I2CSensorDevice &imu : imus) I2C.slaves.push_back(&imu);
+
+    uint8_t reg = 0x3B, data[nSensors][14];
+    I2CTransaction polls[nSensors];
+    for (int i = 0; i < nSensors; i++)
+        polls[i] = I2CTransaction{(uint8_t)(0x68 + i), &reg, 1, data[i], 14, I2C_PollDone, nullptr, false};
+
+    cout << "\n---- Polling " << nSensors << " IMUs, " << processNs / 1000
+         << " us CPU per sample, 200 ms simulated ----" << endl;
+    cout << left << setw(10) << "Bus" << setw(10) << "Driver" << right << setw(12) << "samples/s"
+         << setw(11) << "bus busy" << setw(11) << "CPU free" << setw(11) << "max queue" << endl;
+
+    for (const I2CTiming *t : speeds) {
+        I2C.timing = t;
+        for (int async = 0; async <= 1; async++) {
+            I2C_Master0.resetStats();
+            I2C_Async.maxDepth = 0;
+            uint64_t start = I2C.nowNs, end = start + runNs;
+            unsigned long samples = 0;
+            uint64_t cpuBusyNs = 0;
+
+            if (!async) {
+                // Read, process, next sensor: the task owns the CPU throughout
+                for (int n = 0; I2C.nowNs < end; n++) {
+                    I2C_ReadRegisters((uint8_t)(0x68 + n % nSensors), 0x3B, data[0], 14);
+                    I2C.nowNs += processNs;
+                    cpuBusyNs = I2C.nowNs - start;
+                    samples++;
+                }
+            } else {
+                I2C_PendingSamples = 0;
+                I2C_Polling = true;
+                for (I2CTransaction &p : polls) I2C_Submit(&p);
+                uint64_t cpuFreeNs = start;
+                while (true) {
+                    if (I2C.nowNs >= end) I2C_Polling = false;
+                    if (I2C_PendingSamples && cpuFreeNs <= I2C.nowNs) {   // task runs
+                        I2C_PendingSamples--;
+                        samples++;
+                        cpuFreeNs = I2C.nowNs + processNs;
+                        cpuBusyNs += processNs;
+                    }
+                    uint64_t bus = I2C_NextEventNs();
+                    uint64_t cpu = I2C_PendingSamples ? cpuFreeNs : UINT64_MAX;
+                    if (bus == UINT64_MAX && cpu == UINT64_MAX) break;
+                    if (bus <= cpu) I2C_Step();
+                    else            I2C.nowNs = cpu;
+                }
+                if (cpuFreeNs > I2C.nowNs) I2C.nowNs = cpuFreeNs;
+            }
+
+            double elapsed = (double)(I2C.nowNs - start);
+            cout << left << setw(10) << t->name << setw(10) << (async ? "async" : "blocking")
+                 << right << fixed << setprecision(0) << setw(12) << samples / (elapsed / 1e9)
+                 << setprecision(1) << setw(10) << 100.0 * I2C_Master0.latencyNs / elapsed << "%"
+                 << setw(10) << 100.0 * (1.0 - cpuBusyNs / elapsed) << "%"
+                 << setw(11) << (async ? I2C_Async.maxDepth : 1) << endl;
+        }
     }
-    cout << "[MASTER] STOP condition" << endl;
+    I2C.slaves.clear();
+    I2C.timing = &I2C_STANDARD;
 }
 
 // -----------------------------------------------------------------------------
-// SECTION 4: MAIN
+// SECTION 8: MAIN
 // -----------------------------------------------------------------------------
+static void I2C_DemoDone(I2CTransaction &t) {
+    cout << "[I2C-ISR] " << (const char *)t.context << ": " << (t.ok ? "ACK" : "NACK")
+         << " at t=" << I2C.nowNs / 1000 << " us" << endl;
+}
+
 int main() {
     cout << "==== I2C Realistic Simulation ====" << endl;
 
     uint8_t slave_address = 0x50;
-    uint8_t data_to_send = 0xA5;
-    uint8_t slave_received = 0;
+    I2CRegisterDevice slave(slave_address);
+    slave.verbose = true;
+    I2C.slaves.push_back(&slave);
+
+    // Burst write: register pointer 0x10, then three data bytes
+    const uint8_t data_to_send[3] = {0xA5, 0x5A, 0x3C};
+    cout << "[MASTER] Writing 3 bytes to register 0x10" << endl;
+    bool ok = I2C_WriteRegisters(slave_address, 0x10, data_to_send, 3);
+
+    // Write-then-read with repeated START: read them back
+    uint8_t readBack[3] = {0, 0, 0};
+    cout << "[MASTER] Reading 3 bytes from register 0x10 (repeated START)" << endl;
+    ok = I2C_ReadRegisters(slave_address, 0x10, readBack, 3) && ok;
 
-    // Start slave thread
-    thread slave_thread(I2CSlave, slave_address, ref(slave_received));
+    cout << "[MAIN] Read back:";
+    for (uint8_t b : readBack) cout << " 0b" << bitset<8>(b);
+    cout << (ok ? "" : "  (NACK)") << endl;
 
-    // Give slave time to be ready
-    this_thread::sleep_for(chrono::milliseconds(10));
+    // Nobody answers at 0x51 → NACK
+    uint8_t dummy = 0;
+    slave.verbose = false;
+    cout << "[MASTER] Probe 0x51: "
+         << (I2CMaster_Read(0x51, &dummy, 1) ? "ACK" : "NACK") << endl;
 
-    // Master sends byte
-    I2CMaster_Write(slave_address, data_to_send);
+    // Two masters write different values to register 0x20 at the same
+    // instant. Address and pointer bytes match; the data byte differs at
+    // bit 4 (0x11 vs 0x0F), where the MCU sends 1, sees 0 and backs off.
+    I2CMaster bmc("BMC");
+    const uint8_t mcuData[2] = {0x20, 0x11}, bmcData[2] = {0x20, 0x0F};
+    I2C_Master0.begin(slave_address, mcuData, 2, nullptr, 0);
+    bmc.begin(slave_address, bmcData, 2, nullptr, 0);
+    while (I2C_Step()) {}
+    cout << "[MULTI] MCU lost arbitration " << I2C_Master0.arbitrationLost
+         << "x, BMC " << bmc.arbitrationLost << "x; register 0x20 = 0x"
+         << hex << (int)slave.regs[0x20] << dec << " (MCU retried after the BMC's STOP)" << endl;
+    I2C_Master0.resetStats();
 
-    // Wait for slave to finish
-    slave_thread.join();
+    // Non-blocking: queue a write and two reads, then let the bus run.
+    // The callbacks fire from the transfer-complete interrupt.
+    const uint8_t cfg[2] = {0x30, 0x07};
+    uint8_t ptr = 0x30, cfgBack = 0, probe = 0;
+    I2CTransaction queued[3] = {
+        {slave_address, cfg, 2, nullptr, 0, I2C_DemoDone, (void *)"write 0x30", false},
+        {slave_address, &ptr, 1, &cfgBack, 1, I2C_DemoDone, (void *)"read 0x30", false},
+        {0x51, nullptr, 0, &probe, 1, I2C_DemoDone, (void *)"probe 0x51", false},
+    };
+    for (I2CTransaction &t : queued) I2C_Submit(&t);
+    cout << "[MAIN] 3 transactions queued at t=" << I2C.nowNs / 1000
+         << " us, task continues" << endl;
+    while (I2C_Step()) {}
+    cout << "[MAIN] Register 0x30 read back 0x" << hex << (int)cfgBack << dec << endl;
+    I2C.slaves.clear();
 
-    cout << "[MAIN] Slave received final data: 0x" 
-         << hex << (int)slave_received << endl;
+    I2C_SensorBenchmark();
+    I2C_LoadBenchmark();
+    I2C_AsyncBenchmark();
 
     cout << "==== I2C Simulation Complete ====" << endl;
     return 0;
@@ -168,15 +1089,29 @@ int main() {
 Concepts Demonstrated:
 
 1. Start/Stop conditions (SDA changes while SCL high)
-2. 7-bit address recognition and ACK/NACK
+2. 7-bit address + R/W bit, recognition and ACK/NACK
 3. Bit-by-bit data transfer (MSB-first)
 4. Master-Slave synchronization using clock (SCL)
-5. Mutex simulates exclusive access to shared bus
-6. Delay simulates real-world timing
+5. Open-drain SDA: the line is the AND of every device's output
+6. Repeated START: switch from write to read without releasing the bus
+7. Register-pointer addressing and multi-byte bursts
+8. Bus timing (tLOW, tHIGH, tHD;STA...) at 100 kHz, 400 kHz and 1 MHz
+9. Open-drain SCL: slave clock stretching and clock synchronisation
+10. Multi-master arbitration: a master sending 1 that reads 0 backs off
+11. Non-blocking driver: transaction queue, completion callbacks from the
+    transfer-complete interrupt, back-to-back transfers
 
 Real-world relevance:
 - Sensors, EEPROMs, RTCs use I2C.
-- Master drives clock; slave must respond in sync.
+- Master drives clock; slave must respond in sync or stretch it.
 - Proper ACK/NACK ensures reliable communication.
+- One burst read costs a fraction of per-register reads: the address
+  and pointer overhead is paid once per sample, not once per byte.
+- Arbitration is lossless for the winner, but a loser may wait a whole
+  transaction (or several) — fixed address priority can starve it.
+- A blocking driver leaves the bus idle while the task computes; a queue
+  keeps it saturated and gives the CPU time back.
+- A timeline of both masters shows where latency goes: waiting for the
+  bus, retries after lost arbitration, SCL held low by a stretching slave.
 ===============================================================================
 */
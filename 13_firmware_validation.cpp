@@ -1,47 +1,98 @@
 /******************************************************
  * Filename: 13_firmware_validation.cpp
  * Purpose: Demonstrates firmware debugging & validation
- *          using a simulated UART peripheral.
- *          Shows unit testing, flag checks, and logging.
+ *          of the simulated UART peripheral from lesson 10.
+ *          Shows unit testing with fixtures, parameterized
+ *          tests, flag checks, and logging.
+ *
+ * How to compile & run:
+ *   g++ 13_firmware_validation.cpp -o validation_demo -std=c++11 -pthread
+ *   ./validation_demo [--verbose] [--filter=Fifo]
  ******************************************************/
 
-#include <iostream>
-#include <queue>
-#include <cassert>
-using namespace std;
-
-// Simulated UART registers
-struct UART {
-    queue<char> txBuffer;
-    bool txReady = true;
-} UART1;
-
-// Function to send a character
-void UART_SendChar(char data) {
-    if (UART1.txReady) {
-        UART1.txBuffer.push(data);
-        UART1.txReady = false; // busy
-        cout << "[DEBUG] UART queued char: " << data << endl;
-        UART1.txReady = true;  // mark ready again
+// The driver under test is lesson 10 itself, not a copy of it
+#define main UART_LessonMain
+#include "10_uart_simulation.cpp"
+#undef main
+#include "fw_test.h"    // Test runner: fixtures, parameters, sharding
+
+// --------------------------- Fixture -----------------------------
+// Every test gets a fresh UART, as after a reset, so no test depends
+// on what an earlier one left in the FIFOs or flags
+struct UARTTest : FwTestFixture {
+    UART_Registers uart;
+    UART_Registers peer;        // Far end of the wire
+    void setUp() override {
+        UART_TxTimeMs = 0;      // no simulated TX delay in tests
+        uart.rxBuffer.reset(16);
+        peer.rxBuffer.reset(16);
     }
-}
+};
 
+// --------------------------- Unit Tests -----------------------------
 // Unit test for UART_SendChar
-void test_UART_SendChar() {
-    UART1.txBuffer = queue<char>();  // clear buffer
-    UART1.txReady = true;
-    
-    UART_SendChar('A');
-    assert(!UART1.txBuffer.empty());            // buffer should have data
-    assert(UART1.txBuffer.front() == 'A');     // data should match
-    cout << "[TEST PASSED] UART_SendChar works correctly\n";
+FW_TEST_F(UARTTest, SendCharQueuesByte) {
+    UART_SendChar(uart, 'A');
+    FW_ASSERT_FALSE(uart.txBuffer.empty());     // buffer should have data
+    FW_EXPECT_EQ(uart.txBuffer.front(), 'A');   // data should match
+    FW_EXPECT_TRUE(uart.txReady);               // transmitter ready again
+}
+
+FW_TEST_F(UARTTest, ReadCharWithoutDataReturnsZero) {
+    FW_EXPECT_EQ(UART_ReadChar(uart), 0);
+    FW_EXPECT_FALSE(uart.rxReady);
+}
+
+FW_TEST_F(UARTTest, WireDeliversByteAndSetsRxReady) {
+    uart.txBuffer.push('Z');
+    UART_TransferWireOneWay(uart, peer);
+    FW_EXPECT_TRUE(peer.rxReady);               // flag check
+    FW_EXPECT_EQ(UART_ReadChar(peer), 'Z');
+    FW_EXPECT_FALSE(peer.rxReady);              // FIFO empty again
+    FW_EXPECT_EQ(uart.txBytes, 1ul);
+}
+
+// --------------------------- Parameterized Test -----------------------------
+// Same test for every FIFO depth: the byte after a full FIFO is lost
+// and counted as an overrun, never silently stored
+struct UARTFifoDepth : FwTestWithParam<int> {
+    UART_Registers tx, rx;
+    void setUp() override { rx.rxBuffer.reset(param()); }
+};
+
+FW_TEST_P(UARTFifoDepth, OverrunAfterDepthBytes) {
+    for (int i = 0; i < param() + 3; i++) {
+        tx.txBuffer.push((char)('a' + i % 26));
+        UART_WireShiftByte(tx, rx);
+    }
+    FW_EXPECT_EQ(rx.rxBytes, (unsigned long)param());
+    FW_EXPECT_EQ(rx.rxOverruns, 3ul);
+    FW_EXPECT_EQ(UART_ReadChar(rx), 'a');       // oldest byte kept
 }
 
-int main() {
+FW_INSTANTIATE(Fifo, UARTFifoDepth, std::vector<int>({1, 16, 64}));
+
+// --------------------------- Main -----------------------------
+int main(int argc, char **argv) {
     cout << "=== Firmware Validation Demo ===\n";
-    
-    test_UART_SendChar();   // run unit test
-    
+
+    int failed = FwTest_Main(argc, argv);   // run all tests, report failures
+
     cout << "=== Demo Complete ===\n";
-    return 0;
+    return failed;
 }
+
+/*
+SUMMARY / LEARNING POINTS
+1. Test the driver the firmware ships, not a copy of it in the test.
+2. A fixture resets the peripheral before every test: tests stay
+   independent and can run in any order, or in parallel.
+3. EXPECT checks report and continue; ASSERT stops the test when
+   the rest would only crash or mislead. Neither aborts the program.
+4. Parameterized tests run one check over every configuration
+   (FIFO depth, baud rate, SPI mode) without copy-paste.
+5. Examples only test the cases someone thought of. The properties in
+   fuzz/ (fw_fuzz.h) check invariants on thousands of generated inputs
+   and shrink any failure to a minimal one: that is where parser
+   crashes are found before they reach the field.
+*/
@@ -5,6 +5,8 @@
  * - Mutex and semaphore usage
  * - Pipelining tasks
  * - Deadlock avoidance
+ * - Reproducible interleavings: FW_SCHED_SEED=n runs the
+ *   tasks on the deterministic scheduler (fw_sched.h)
  ******************************************************/
 
 #include <iostream>
@@ -13,26 +15,28 @@
 #include <chrono>
 #include <queue>
 #include <condition_variable>
+#include "fw_sched.h"
 using namespace std;
 
 // --------------------------- Global Resources -----------------------------
-mutex uart_mutex;          // Protect UART
-mutex sensor_mutex;        // Protect sensor access
+FwMutex uart_mutex;        // Protect UART
+FwMutex sensor_mutex;      // Protect sensor access
+FwMutex queue_mutex;       // Protect the pipeline queue
 
 // Semaphore simulation (counting)
 class Semaphore {
     int count;
-    mutex mtx;
-    condition_variable cv;
+    FwMutex mtx;
+    FwCondVar cv;
 public:
     Semaphore(int init = 1) : count(init) {}
     void wait() {
-        unique_lock<mutex> lock(mtx);
+        unique_lock<FwMutex> lock(mtx);
         cv.wait(lock, [&]() { return count > 0; });
         count--;
     }
     void signal() {
-        unique_lock<mutex> lock(mtx);
+        unique_lock<FwMutex> lock(mtx);
         count++;
         cv.notify_one();
     }
@@ -40,44 +44,56 @@ public:
 Semaphore pipeline_slots(2); // only 2 slots can process at a time
 
 // --------------------------- Tasks -----------------------------
+// Both consumers take from the same queue: the check and the pop have
+// to happen under one lock, or two tasks can pop the same slot
+bool pop_item(queue<int> &dataQueue, int &val) {
+    lock_guard<FwMutex> lock(queue_mutex);
+    if(dataQueue.empty()) return false;
+    val = dataQueue.front();
+    dataQueue.pop();
+    return true;
+}
+
 void task_sensor_read(queue<int> &dataQueue) {
     int sensor_value = 0;
     while(sensor_value < 5) { // simulate 5 readings
         {
-            lock_guard<mutex> lock(sensor_mutex); // protect sensor
+            lock_guard<FwMutex> lock(sensor_mutex); // protect sensor
             sensor_value++;
             cout << "[SENSOR] Read value: " << sensor_value << endl;
         }
         pipeline_slots.wait(); // wait for pipeline slot
-        dataQueue.push(sensor_value);
-        this_thread::sleep_for(chrono::milliseconds(100));
+        {
+            lock_guard<FwMutex> lock(queue_mutex);
+            dataQueue.push(sensor_value);
+        }
+        FwSleepFor(chrono::milliseconds(100));
     }
 }
 
 void task_data_process(queue<int> &dataQueue) {
     while(true) {
-        if(!dataQueue.empty()) {
-            int val = dataQueue.front();
-            dataQueue.pop();
+        int val;
+        if(pop_item(dataQueue, val)) {
             int processed = val * 2; // dummy processing
             cout << "[PROCESS] Processed data: " << processed << endl;
             pipeline_slots.signal(); // free slot
         } else {
-            this_thread::sleep_for(chrono::milliseconds(50));
+            FwSleepFor(chrono::milliseconds(50));
         }
     }
 }
 
 void task_uart_send(queue<int> &dataQueue) {
     while(true) {
-        if(!dataQueue.empty()) {
-            int val = dataQueue.front();
-            dataQueue.pop();
-            lock_guard<mutex> lock(uart_mutex); // protect UART
+        int val;
+        if(pop_item(dataQueue, val)) {
+            pipeline_slots.signal(); // free slot (a lost slot stalls the sensor)
+            lock_guard<FwMutex> lock(uart_mutex); // protect UART
             cout << "[UART] Sending data: " << val << endl;
-            this_thread::sleep_for(chrono::milliseconds(50));
+            FwSleepFor(chrono::milliseconds(50));
         } else {
-            this_thread::sleep_for(chrono::milliseconds(50));
+            FwSleepFor(chrono::milliseconds(50));
         }
     }
 }
@@ -89,15 +105,15 @@ int main() {
     queue<int> pipelineQueue;
 
     // Multi-threaded pipeline
-    thread sensor(task_sensor_read, ref(pipelineQueue));
-    thread process(task_data_process, ref(pipelineQueue));
-    thread uart(task_uart_send, ref(pipelineQueue));
+    FwThread sensor(task_sensor_read, ref(pipelineQueue));
+    FwThread process(task_data_process, ref(pipelineQueue));
+    FwThread uart(task_uart_send, ref(pipelineQueue));
 
     // Wait for sensor to finish
     sensor.join();
 
     // Wait some time for remaining data to be processed and sent
-    this_thread::sleep_for(chrono::seconds(2));
+    FwSleepFor(chrono::seconds(2));
 
     // Detach other threads for demo
     process.detach();
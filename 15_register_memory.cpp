@@ -6,6 +6,7 @@
  ******************************************************/
 
 #include <iostream>
+#include <bitset>
 using namespace std;
 
 // --------------------------- Register Map -----------------------------
@@ -3,11 +3,22 @@
  * Purpose: Demonstrates firmware optimization and
  *          low-power simulation using sleep modes,
  *          peripheral enable/disable, and efficient loops.
+ *          Idle time uses tickless idle on the simulated
+ *          CPU of fw_irq.h / fw_power.h, which also
+ *          integrates energy per peripheral and per task,
+ *          DVFS governors trade clock speed for energy, and
+ *          drivers request reference-counted, auto-gated clocks.
+ * How to compile:
+ *   g++ 16_firmware_power.cpp -o power_demo -std=c++11 -pthread
  ******************************************************/
 
 #include <iostream>
 #include <thread>
-#include <bitset>
+#include <iomanip>
+#include <fstream>
+#include "fw_irq.h"     // Simulated CPU, NVIC and time
+#include "fw_power.h"   // Sleep states, tickless idle, energy
+#include "fw_log.h"     // Buffered logging for driver debug output
 using namespace std;
 
 // Simulated registers
@@ -15,42 +26,439 @@ struct LED_REGS {
     volatile uint8_t DATA;
     volatile uint8_t CTRL;
 };
-LED_REGS LED = {0,0};
+
+// LED is the selected instance, as in a CMSIS header (compare the fixed
+// pointer in 15_register_memory.cpp). A process is one device on
+// LED_Default; LED_Use() gives the calling thread another register
+// block (18_device_farm.cpp). The power model below stays one per process.
+LED_REGS LED_Default = {0,0};
+thread_local LED_REGS *LED_Active = &LED_Default;
+#define LED (*LED_Active)
+
+void LED_Use(LED_REGS *regs) { LED_Active = regs ? regs : &LED_Default; }
 
 // Bit positions
 #define LED_ENABLE 0
 
+// -----------------------------------------------------------------------------
+// Power model: current draw of each peripheral state (mA at 3.3 V)
+// -----------------------------------------------------------------------------
+enum { PERIPH_OFF = 0, PERIPH_ACTIVE = 1 };
+enum { UART_OFF, UART_RX_IDLE, UART_TX };
+
+int pwrLed, pwrUart, pwrSpi, pwrI2c;
+int clkDomain, clkApb1, clkApb2, clkGpio, clkUart, clkSpi, clkI2c;
+
+/*
+  Clock tree (mA while ungated):
+    PD_PERIPH 0.02, 20 us power-up ── APB1 0.03 ── I2C_CLK 0.03
+                                    └─ APB2 0.03 ── SPI_CLK 0.05
+    GPIO_CLK 0.005          always-on domain
+    LPUART_CLK 0.02         LSE-clocked, keeps running in STOP2
+  I2C and SPI kernel clocks stop in STOP modes: while a transfer holds
+  them the core may only enter SLEEP.
+*/
+// Call after every PWR_Reset()
+void registerPowerModel(uint64_t autoGateNs = 2000000) {
+    clkDomain = PWR_AddClock("PD_PERIPH", -1, 0.02, 20000);
+    clkApb1 = PWR_AddClock("APB1", clkDomain, 0.03);
+    clkApb2 = PWR_AddClock("APB2", clkDomain, 0.03);
+    clkGpio = PWR_AddClock("GPIO_CLK", -1, 0.005);
+    clkUart = PWR_AddClock("LPUART_CLK", -1, 0.02);
+    clkI2c = PWR_AddClock("I2C_CLK", clkApb1, 0.03, 0, PWR_SLEEP);
+    clkSpi = PWR_AddClock("SPI_CLK", clkApb2, 0.05, 0, PWR_SLEEP);
+    for (int k = 0; k < PWR.clockCount; k++) PWR_SetAutoGate(k, autoGateNs);
+
+    pwrLed = PWR_AddPeripheral("LED", clkGpio);
+    PWR_AddState(pwrLed, "off", 0);
+    PWR_AddState(pwrLed, "on", 5.0);
+    pwrUart = PWR_AddPeripheral("UART", clkUart);
+    PWR_AddState(pwrUart, "off", 0);
+    PWR_AddState(pwrUart, "rx_idle", 0.01);          // LPUART listening in STOP
+    PWR_AddState(pwrUart, "tx", 0.5);
+    pwrSpi = PWR_AddPeripheral("SPI", clkSpi);
+    PWR_AddState(pwrSpi, "off", 0);
+    PWR_AddState(pwrSpi, "active", 0.4);
+    pwrI2c = PWR_AddPeripheral("I2C", clkI2c);
+    PWR_AddState(pwrI2c, "off", 0);
+    PWR_AddState(pwrI2c, "active", 0.25);
+}
+
+// The LED draws current only while enabled and at least one pin is lit
+void updateLedPower() {
+    PWR_SetState(pwrLed, (LED.CTRL & (1 << LED_ENABLE)) && LED.DATA ? PERIPH_ACTIVE : PERIPH_OFF);
+}
+
 // Efficient function to toggle LED
 inline void toggleLED(uint8_t pin) {
     LED.DATA ^= (1 << pin); // XOR toggles
-    cout << "[DEBUG] LED pin " << (int)pin 
-         << " toggled: " << bitset<8>(LED.DATA) << endl;
+    updateLedPower();
+    FW_LOG_DEBUG("[DEBUG] LED pin %u toggled: 0x%02x", pin, LED.DATA);
 }
 
-// Simulate low-power sleep
+// Low-power sleep until a deadline `ms` from now (simulated time).
+// The deepest state that pays off is chosen; an interrupt ends it early.
 void lowPowerSleep(int ms) {
+    uint64_t deadline = NVIC.nowNs + (uint64_t)ms * 1000000;
     cout << "[DEBUG] Entering low-power sleep for " << ms << " ms" << endl;
-    this_thread::sleep_for(chrono::milliseconds(ms));
-    cout << "[DEBUG] Woke up from sleep" << endl;
+    while (NVIC.nowNs < deadline) {
+        int mode = PWR_Idle(deadline);
+        cout << "[DEBUG] Woke up from " << PWR_STATES[mode].name << " at "
+             << NVIC.nowNs / 1000000.0 << " ms" << endl;
+    }
+}
+
+// Shared LED: every user takes a reference on its clock, and LED.CTRL
+// only clears when the last user lets go
+void ledEnable(bool enable) {
+    if (enable) PWR_ClockGet(clkGpio);
+    else PWR_ClockPut(clkGpio);
+    LED.CTRL = PWR.clocks[clkGpio].refs ? (1 << LED_ENABLE) : 0;
+    updateLedPower();
 }
 
 // Simulate peripheral control
 void controlPeripheral(bool enable) {
-    LED.CTRL = enable ? (1 << LED_ENABLE) : 0;
+    ledEnable(enable);
     cout << "[DEBUG] LED peripheral " 
-         << (enable ? "enabled" : "disabled") << endl;
+         << (enable ? "requested" : "released") << ", " << PWR.clocks[clkGpio].refs
+         << " user(s): " << (LED.CTRL ? "enabled" : "disabled") << endl;
+}
+
+// Driver hooks: each transaction holds its peripheral clock
+void I2C_Transaction(uint64_t ns) {
+    PWR_ClockRequest clk(clkI2c);
+    PWR_SetState(pwrI2c, PERIPH_ACTIVE);
+    CPU_Run(ns);
+    PWR_SetState(pwrI2c, PERIPH_OFF);
+}
+
+void SPI_Transaction(uint64_t ns) {
+    PWR_ClockRequest clk(clkSpi);
+    PWR_SetState(pwrSpi, PERIPH_ACTIVE);
+    CPU_Run(ns);
+    PWR_SetState(pwrSpi, PERIPH_OFF);
+}
+
+void UART_Transmit(uint64_t ns) {
+    PWR_ClockRequest clk(clkUart);
+    PWR_SetState(pwrUart, UART_TX);
+    CPU_Run(ns);
+    PWR_SetState(pwrUart, UART_RX_IDLE, "main");     // listening is the console's cost
+}
+
+// -----------------------------------------------------------------------------
+// Tickless idle vs. a periodic tick
+// -----------------------------------------------------------------------------
+/*
+  Four periodic tasks and a button, 10 s of simulated time:
+    sensor_sample  every 100 ms, 4 I2C register reads of 50 us
+    led_on/led_off every 500 ms, 5 ms flash
+    radio_beacon   every 1 s,    8 SPI writes of 250 us to the radio,
+                                 300 us UART log
+    EXTI13 button  every 730 ms, 5 us handler (wakes the core early)
+
+  tick      1 kHz SysTick wakes the scheduler every millisecond to check
+            for due tasks; WFI only (SysTick stops in STOP modes)
+  tickless  no SysTick: the scheduler sleeps until the earliest task
+            deadline, in the deepest state allowed
+*/
+struct PowerTask {
+    const char *name;
+    uint64_t periodNs;
+    uint64_t phaseNs;
+    void (*run)();
+    uint64_t nextNs;
+};
+
+void sensorSample() {
+    for (int reg = 0; reg < 4; reg++) I2C_Transaction(50000);
+}
+
+void ledOn()  { ledEnable(true);  LED.DATA |= 1;  updateLedPower(); CPU_Run(10000); }
+void ledOff() { LED.DATA &= ~1; ledEnable(false); CPU_Run(10000); }
+
+void radioBeacon() {
+    for (int chunk = 0; chunk < 8; chunk++) SPI_Transaction(250000);
+    UART_Transmit(300000);
+}
+
+PowerTask powerTasks[] = {
+    {"sensor_sample", 100000000, 0,       sensorSample, 0},
+    {"led_on",        500000000, 0,       ledOn,        0},
+    {"led_off",       500000000, 5000000, ledOff,       0},
+    {"radio_beacon", 1000000000, 0,       radioBeacon,  0},
+};
+const int POWER_TASKS = sizeof(powerTasks) / sizeof(powerTasks[0]);
+
+void sysTickHandler() { CPU_Run(1500); }    // tick count, time slice check
+void buttonHandler()  { CPU_Run(5000); }
+int buttonIrq;                                       // Its NVIC index this run
+
+uint64_t nextTaskDeadline() {
+    uint64_t next = PWR_NO_DEADLINE;
+    for (int i = 0; i < POWER_TASKS; i++)
+        if (powerTasks[i].nextNs < next) next = powerTasks[i].nextNs;
+    return next;
+}
+
+enum GatePolicy { GATE_NEVER, GATE_AT_ONCE, GATE_AUTO };
+
+// Returns how late the scheduler woke up for a due task, at worst (ns)
+uint64_t runPowerScenario(bool tickless, int deepest, GatePolicy gating, uint64_t runNs) {
+    NVIC_Reset();
+    PWR_Reset();
+    registerPowerModel(gating == GATE_AUTO ? 2000000 : 0);
+    PWR_AllowDeepest(deepest);
+    if (gating == GATE_NEVER)                        // boot code enables everything
+        for (int k = 0; k < PWR.clockCount; k++) PWR_ClockGet(k);
+    LED.CTRL = 0;
+    LED.DATA = 0;
+    PWR_ClockGet(clkUart);                           // console keeps listening
+    PWR_SetState(pwrUart, UART_RX_IDLE);
+    if (!tickless) NVIC_Register("SysTick", 3, sysTickHandler, 1000000, 1000000);
+    buttonIrq = NVIC_Register("EXTI13", 2, buttonHandler, 730000000, 123000000);
+    for (int i = 0; i < POWER_TASKS; i++)
+        powerTasks[i].nextNs = powerTasks[i].periodNs + powerTasks[i].phaseNs;
+
+    uint64_t maxLateNs = 0;
+    while (NVIC.nowNs < runNs) {
+        uint64_t due = nextTaskDeadline();
+        if (NVIC.nowNs >= due && NVIC.nowNs - due > maxLateNs) maxLateNs = NVIC.nowNs - due;
+        for (int i = 0; i < POWER_TASKS; i++) {
+            PowerTask &t = powerTasks[i];
+            if (NVIC.nowNs < t.nextNs) continue;
+            const char *prev = PWR_SetTask(t.name);
+            t.run();
+            PWR_SetTask(prev);
+            t.nextNs += t.periodNs;
+        }
+        uint64_t deadline = tickless ? nextTaskDeadline() : PWR_NO_DEADLINE;
+        PWR_Idle(deadline < runNs ? deadline : runNs);
+    }
+    return maxLateNs;
+}
+
+void ticklessIdleDemo() {
+    struct Config { const char *name; bool tickless; int deepest; };
+    const Config configs[] = {
+        {"1 kHz tick, WFI", false, PWR_SLEEP},
+        {"tickless, WFI",   true,  PWR_SLEEP},
+        {"tickless, STOP2", true,  PWR_STOP2},
+    };
+    const uint64_t runNs = 10000000000ULL;
+    double baselineUj = 0;
+
+    cout << "\n---- Idle strategy, 10 s simulated ----" << endl;
+    cout << left << setw(18) << "Idle" << right << setw(12) << "wakeups/s" << setw(10) << "by IRQ"
+         << setw(11) << "avg mW" << setw(12) << "energy mJ" << setw(9) << "saved"
+         << setw(11) << "late us" << setw(13) << "btn lat us" << endl;
+    for (const Config &cfg : configs) {
+        uint64_t lateNs = runPowerScenario(cfg.tickless, cfg.deepest, GATE_AUTO, runNs);
+        double uj = PWR_EnergyUj();
+        if (!baselineUj) baselineUj = uj;
+        const NVIC_Irq &button = NVIC.irqs[buttonIrq];
+        cout << left << setw(18) << cfg.name << right << fixed << setprecision(1)
+             << setw(12) << PWR_WakeupsPerSec() << setw(10) << PWR.irqWakeups
+             << setprecision(3) << setw(11) << PWR_AveragePowerMw()
+             << setw(12) << uj / 1000 << setprecision(1) << setw(8) << 100 * (1 - uj / baselineUj) << "%"
+             << setprecision(2) << setw(11) << lateNs / 1000.0 << setw(13) << button.maxLatencyNs / 1000.0 << endl;
+    }
+    cout << "CPU residency of the last run:" << endl;
+    PWR_Report(cout);
+    cout << "Energy by peripheral and task:" << endl;
+    PWR_EnergyReport(cout);
+    ofstream json("power_16.json");
+    PWR_DumpJson(json);
+    cout << "Energy breakdown written to power_16.json" << endl;
+}
+
+// -----------------------------------------------------------------------------
+// Clock gating policies
+// -----------------------------------------------------------------------------
+/*
+  The same 10 s workload, tickless STOP2, three clock policies:
+    always on      boot code enables every clock and never gates one
+                   (SPI/I2C held: the core can only enter SLEEP)
+    gate at once   the last put gates the clock and, up the tree, the
+                   power domain: every transfer pays the 20 us power-up
+    auto-gate 2 ms clocks stay on 2 ms after the last put, so a burst
+                   of transfers powers the domain up once
+*/
+void clockGatingDemo() {
+    struct Config { const char *name; GatePolicy gating; };
+    const Config configs[] = {
+        {"always on",      GATE_NEVER},
+        {"gate at once",   GATE_AT_ONCE},
+        {"auto-gate 2 ms", GATE_AUTO},
+    };
+    const uint64_t runNs = 10000000000ULL;
+    double baselineUj = 0;
+
+    cout << "\n---- Clock gating, 10 s simulated, tickless STOP2 ----" << endl;
+    cout << left << setw(16) << "Policy" << right << setw(12) << "energy mJ" << setw(9) << "saved"
+         << setw(11) << "clocks mJ" << setw(10) << "ungates" << setw(11) << "stall us"
+         << setw(10) << "STOP2" << setw(8) << "faults" << endl;
+    for (const Config &cfg : configs) {
+        runPowerScenario(true, PWR_STOP2, cfg.gating, runNs);
+        double uj = PWR_EnergyUj(), clockUj = 0;
+        unsigned long ungates = 0;
+        for (int k = 0; k < PWR.clockCount; k++) {
+            clockUj += PWR_PeripheralUj(PWR.clocks[k].periph);
+            ungates += PWR.clocks[k].enables;
+        }
+        if (!baselineUj) baselineUj = uj;
+        cout << left << setw(16) << cfg.name << right << fixed << setprecision(3)
+             << setw(12) << uj / 1000 << setprecision(1) << setw(8) << 100 * (1 - uj / baselineUj) << "%"
+             << setprecision(3) << setw(11) << clockUj / 1000 << setw(10) << ungates
+             << setprecision(1) << setw(11) << PWR.clockStallNs / 1000.0
+             << setw(9) << 100.0 * PWR.residencyNs[PWR_STOP2] / runNs << "%"
+             << setw(8) << PWR.gatedAccesses + PWR.clockErrors << endl;
+    }
+    cout << "Clock tree of the last run:" << endl;
+    PWR_ClockReport(cout);
+}
+
+// -----------------------------------------------------------------------------
+// DVFS: which governor meets the deadlines at the lowest energy?
+// -----------------------------------------------------------------------------
+/*
+  20 s of simulated time, tickless STOP2 idle:
+    TIM2 control loop  IRQ every 10 ms, 1.5 ms of work, done within 10 ms
+    telemetry          task every 100 ms, 5 ms, deadline 100 ms
+    compress_log       task every 2 s, 300 ms, deadline 1 s
+  Work is given at 80 MHz: 35% load there, 117% at 24 MHz. Tasks run
+  earliest-deadline-first in 2 ms slices, so compress_log cannot hold
+  up telemetry. 24 MHz is the cheapest clock per cycle (low-voltage
+  range) but can only carry the load between compress_log bursts.
+*/
+struct DvfsJob {
+    const char *name;
+    uint64_t periodNs;
+    uint64_t workNs;             // At 80 MHz
+    uint64_t deadlineNs;         // Relative to release
+    uint64_t releaseNs;
+    uint64_t remainingNs;
+};
+
+DvfsJob dvfsJobs[] = {
+    {"telemetry",     100000000,  5000000,   100000000, 0, 0},
+    {"compress_log", 2000000000, 300000000, 1000000000, 0, 0},
+};
+const int DVFS_JOBS = sizeof(dvfsJobs) / sizeof(dvfsJobs[0]);
+const uint64_t DVFS_SLICE_NS = 2000000;
+
+int dvfsCtrlIrq;
+unsigned long dvfsMisses;
+double dvfsWorstResponse;        // Share of the deadline, worst case
+
+void dvfsResponse(uint64_t releaseNs, uint64_t deadlineNs) {
+    double r = (double)(NVIC.nowNs - releaseNs) / deadlineNs;
+    if (r > 1) dvfsMisses++;
+    if (r > dvfsWorstResponse) dvfsWorstResponse = r;
+}
+
+void dvfsControlHandler() {
+    uint64_t release = NVIC.irqs[dvfsCtrlIrq].pendingSinceNs;
+    CPU_Run(1500000);
+    dvfsResponse(release, 10000000);
+}
+
+void runDvfsScenario(PWR_Governor gov, int userOpp, unsigned upThreshold, uint64_t sampleNs,
+                     uint64_t runNs) {
+    NVIC_Reset();
+    PWR_Reset();
+    PWR.userOpp = userOpp;
+    dvfsCtrlIrq = NVIC_Register("TIM2_CTRL", 2, dvfsControlHandler, 10000000, 3000000);
+    PWR_SetGovernor(gov, sampleNs, upThreshold);
+    dvfsMisses = 0;
+    dvfsWorstResponse = 0;
+    for (int i = 0; i < DVFS_JOBS; i++) {
+        dvfsJobs[i].releaseNs = 0;
+        dvfsJobs[i].remainingNs = dvfsJobs[i].workNs;
+    }
+
+    while (NVIC.nowNs < runNs) {
+        DvfsJob *next = nullptr;
+        uint64_t nextRelease = runNs;
+        for (int i = 0; i < DVFS_JOBS; i++) {
+            DvfsJob &j = dvfsJobs[i];
+            if (!j.remainingNs && NVIC.nowNs >= j.releaseNs + j.periodNs) {
+                j.releaseNs += j.periodNs;
+                j.remainingNs = j.workNs;
+            }
+            if (!j.remainingNs) {
+                if (j.releaseNs + j.periodNs < nextRelease) nextRelease = j.releaseNs + j.periodNs;
+            } else if (!next || j.releaseNs + j.deadlineNs < next->releaseNs + next->deadlineNs) {
+                next = &j;
+            }
+        }
+        if (!next) {
+            PWR_Idle(nextRelease);
+            continue;
+        }
+        uint64_t slice = next->remainingNs < DVFS_SLICE_NS ? next->remainingNs : DVFS_SLICE_NS;
+        const char *prev = PWR_SetTask(next->name);
+        CPU_Run(slice);
+        PWR_SetTask(prev);
+        next->remainingNs -= slice;
+        if (!next->remainingNs) dvfsResponse(next->releaseNs, next->deadlineNs);
+    }
+}
+
+void dvfsGovernorDemo() {
+    struct Config { const char *name; PWR_Governor gov; int userOpp; unsigned up; uint64_t sampleNs; };
+    const Config configs[] = {
+        {"performance",         PWR_GovPerformance, 0, 80, 10000000},
+        {"powersave",           PWR_GovPowersave,   0, 80, 10000000},
+        {"userspace 48 MHz",    PWR_GovUserspace,   1, 80, 10000000},
+        {"userspace 24 MHz",    PWR_GovUserspace,   2, 80, 10000000},
+        {"ondemand 60%, 10ms",  PWR_GovOndemand,    0, 60, 10000000},
+        {"ondemand 80%, 10ms",  PWR_GovOndemand,    0, 80, 10000000},
+        {"ondemand 95%, 10ms",  PWR_GovOndemand,    0, 95, 10000000},
+        {"ondemand 80%, 50ms",  PWR_GovOndemand,    0, 80, 50000000},
+    };
+    const uint64_t runNs = 20000000000ULL;
+    const Config *best = nullptr;
+    double bestUj = 0;
+
+    cout << "\n---- DVFS governors, 20 s simulated ----" << endl;
+    cout << left << setw(20) << "Governor" << right << setw(9) << "avg MHz" << setw(10) << "switches"
+         << setw(8) << "misses" << setw(11) << "worst resp" << setw(12) << "energy mJ"
+         << setw(10) << "avg mW" << endl;
+    for (const Config &cfg : configs) {
+        runDvfsScenario(cfg.gov, cfg.userOpp, cfg.up, cfg.sampleNs, runNs);
+        double uj = PWR_EnergyUj();
+        if (!dvfsMisses && (!best || uj < bestUj)) { best = &cfg; bestUj = uj; }
+        cout << left << setw(20) << cfg.name << right << fixed << setprecision(1)
+             << setw(9) << PWR_AverageMhz() << setw(10) << PWR.oppSwitches << setw(8) << dvfsMisses
+             << setw(10) << 100 * dvfsWorstResponse << "%" << setprecision(3)
+             << setw(12) << uj / 1000 << setw(10) << PWR_AveragePowerMw() << endl;
+    }
+    cout << "CPU residency of the last run:" << endl;
+    PWR_Report(cout);
+    if (best) cout << "Lowest energy without a missed deadline: " << best->name << endl;
 }
 
 int main() {
     cout << "=== Firmware Optimization & Power Management ===" << endl;
+    NVIC_Reset();
+    PWR_Reset();
+    registerPowerModel();
+    FwLog_Start(cout);
 
-    // Enable peripheral
+    // Enable peripheral: a status driver and a blink driver share the LED
+    controlPeripheral(true);
     controlPeripheral(true);
 
     // Optimized loop: unrolled
     for(int i=0;i<2;i++) toggleLED(i);
     toggleLED(0);
     toggleLED(1);
+    FwLog_Flush();
+
+    // The status driver is done; the blink driver still owns the LED
+    controlPeripheral(false);
 
     // Enter low-power sleep for 500 ms
     lowPowerSleep(500);
@@ -58,6 +466,11 @@ int main() {
     // Disable peripheral
     controlPeripheral(false);
 
+    ticklessIdleDemo();
+    clockGatingDemo();
+    dvfsGovernorDemo();
+    FwLog_Stop();
+
     cout << "=== Demo Complete ===" << endl;
     return 0;
 }
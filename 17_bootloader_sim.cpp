@@ -7,22 +7,144 @@
 
 #include <iostream>
 #include <string>
+#include <cstdint>
 using namespace std;
 
+// --------------------------- Image Format -----------------------------
+/*
+Image = header, application bytes, then a 4-byte CRC-32 trailer over
+header + application, the same check most MCU bootloaders run before
+jumping. All fields are little-endian:
+  0  magic        "FWIM"
+  4  headerSize   u16, >= BOOT_HEADER_SIZE (newer tools may add fields)
+  6  version      u16, application version
+  8  appSize      u32, bytes after the header, before the trailer
+  12 loadAddr     u32, where the application runs (inside the app region)
+  16 entryOffset  u32, entry point relative to loadAddr, < appSize
+  20 reserved     u32, 0
+The image arrives over a wire from outside: every field is checked
+against the received length before it is used, and the sizes are
+compared by subtraction so a huge appSize cannot wrap around.
+*/
+#define BOOT_MAGIC        0x4D495746u   // "FWIM" read as little-endian u32
+#define BOOT_HEADER_SIZE  24
+#define BOOT_APP_BASE     0x08004000u   // Flash after the 16 KB bootloader
+#define BOOT_APP_LIMIT    0x08200000u   // End of the 2 MB flash
+
+enum Boot_Status {
+    BOOT_OK, BOOT_TOO_SHORT, BOOT_BAD_MAGIC, BOOT_BAD_HEADER, BOOT_BAD_SIZE,
+    BOOT_BAD_ADDRESS, BOOT_BAD_ENTRY, BOOT_BAD_CRC
+};
+
+const char *Boot_StatusName(Boot_Status s) {
+    static const char *names[] = {"ok", "too short", "bad magic", "bad header size",
+                                  "bad size", "bad load address", "bad entry point", "bad CRC"};
+    return names[s];
+}
+
+struct Boot_ImageHeader {
+    uint16_t headerSize;
+    uint16_t version;
+    uint32_t appSize;
+    uint32_t loadAddr;
+    uint32_t entryOffset;
+};
+
+struct Boot_Crc32Table {                    // reflected 0x04C11DB7
+    uint32_t t[256];
+    Boot_Crc32Table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int b = 0; b < 8; b++) c = (c & 1) ? (c >> 1) ^ 0xEDB88320u : c >> 1;
+            t[i] = c;
+        }
+    }
+};
+
+uint32_t Boot_Crc32(const uint8_t *data, size_t len) {
+    static const Boot_Crc32Table tab;          // built once, thread-safe
+    const uint32_t *table = tab.t;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint32_t Boot_Get(const uint8_t *p, int bytes) {
+    uint32_t v = 0;
+    for (int i = 0; i < bytes; i++) v |= (uint32_t)p[i] << (8 * i);
+    return v;
+}
+
+static void Boot_Put(string &out, uint32_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) out += (char)((v >> (8 * i)) & 0xFF);
+}
+
+string Boot_BuildImage(const string &app, uint16_t version = 1,
+                       uint32_t loadAddr = BOOT_APP_BASE, uint32_t entryOffset = 0) {
+    string image;
+    image.reserve(BOOT_HEADER_SIZE + app.size() + 4);
+    Boot_Put(image, BOOT_MAGIC, 4);
+    Boot_Put(image, BOOT_HEADER_SIZE, 2);
+    Boot_Put(image, version, 2);
+    Boot_Put(image, (uint32_t)app.size(), 4);
+    Boot_Put(image, loadAddr, 4);
+    Boot_Put(image, entryOffset, 4);
+    Boot_Put(image, 0, 4);
+    image += app;
+    Boot_Put(image, Boot_Crc32((const uint8_t *)image.data(), image.size()), 4);
+    return image;
+}
+
+/*
+Boot_ParseImage(): check an image of len bytes and fill in its header.
+Reads nothing outside data[0..len), whatever the bytes are.
+*/
+Boot_Status Boot_ParseImage(const uint8_t *data, size_t len, Boot_ImageHeader &hdr) {
+    if (len < BOOT_HEADER_SIZE + 4) return BOOT_TOO_SHORT;
+    if (Boot_Get(data, 4) != BOOT_MAGIC) return BOOT_BAD_MAGIC;
+    hdr.headerSize  = (uint16_t)Boot_Get(data + 4, 2);
+    hdr.version     = (uint16_t)Boot_Get(data + 6, 2);
+    hdr.appSize     = Boot_Get(data + 8, 4);
+    hdr.loadAddr    = Boot_Get(data + 12, 4);
+    hdr.entryOffset = Boot_Get(data + 16, 4);
+
+    size_t body = len - 4;                         // Header + application
+    if (hdr.headerSize < BOOT_HEADER_SIZE || hdr.headerSize > body) return BOOT_BAD_HEADER;
+    if (hdr.appSize != body - hdr.headerSize) return BOOT_BAD_SIZE;
+    if (hdr.loadAddr < BOOT_APP_BASE || hdr.loadAddr >= BOOT_APP_LIMIT ||
+        hdr.appSize > BOOT_APP_LIMIT - hdr.loadAddr) return BOOT_BAD_ADDRESS;
+    if (hdr.entryOffset >= hdr.appSize) return BOOT_BAD_ENTRY;
+    if (Boot_Crc32(data, body) != Boot_Get(data + body, 4)) return BOOT_BAD_CRC;
+    return BOOT_OK;
+}
+
+Boot_Status Boot_ParseImage(const string &fw, Boot_ImageHeader &hdr) {
+    return Boot_ParseImage((const uint8_t *)fw.data(), fw.size(), hdr);
+}
+
+bool Boot_ImageValid(const string &fw) {
+    Boot_ImageHeader hdr;
+    return Boot_ParseImage(fw, hdr) == BOOT_OK;
+}
+
 // --------------------------- Bootloader -----------------------------
 bool validateFirmware(const string &fw) {
-    // Simulate checksum/signature validation
-    if(fw == "VALID_FW") {
+    // Header checks, then the checksum over the whole image
+    Boot_ImageHeader hdr;
+    Boot_Status status = Boot_ParseImage(fw, hdr);
+    if(status == BOOT_OK) {
         cout << "[BOOTLOADER] Firmware validation SUCCESS\n";
         return true;
     } else {
-        cout << "[BOOTLOADER] Firmware validation FAILED\n";
+        cout << "[BOOTLOADER] Firmware validation FAILED (" << Boot_StatusName(status) << ")\n";
         return false;
     }
 }
 
 void loadFirmware(const string &fw) {
-    cout << "[BOOTLOADER] Loading firmware: " << fw << endl;
+    Boot_ImageHeader hdr;
+    Boot_ParseImage(fw, hdr);
+    cout << "[BOOTLOADER] Loading firmware: " << fw.substr(hdr.headerSize, hdr.appSize) << endl;
     // Simulate delay
     for(int i=0;i<3;i++) {
         cout << "[BOOTLOADER] Initializing memory/peripherals...\n";
@@ -39,7 +161,8 @@ void mainFirmware() {
 int main() {
     cout << "=== Bootloader Simulation ===\n";
 
-    string firmware = "VALID_FW"; // try "CORRUPT_FW" to test failure
+    string firmware = Boot_BuildImage("VALID_FW");
+    // firmware[0] ^= 1;   // flip one bit to test failure
 
     cout << "[BOOTLOADER] Starting boot sequence...\n";
 
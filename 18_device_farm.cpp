@@ -0,0 +1,455 @@
+/*
+===============================================================================
+Purpose: Simulate a whole fleet in one process: thousands of sensor nodes,
+         each running its own firmware on its own simulated UART, I2C,
+         SPI flash and LED, against a fleet server that rolls out a
+         firmware update in waves. Load-tests the server's update logic
+         with realistic device behaviour on one Linux box.
+         - Per-device peripheral instances (SPI_Use, I2C_Use, LED_Use)
+         - A work-stealing thread pool running the devices (fw_farm.h)
+         - Lock-step epochs of simulated time: results do not depend on
+           the number of threads
+         - Canary wave, bounded parallel rollout, retries on bad links
+Author: Sankalpa Hota
+How to compile & run:
+  g++ -O2 18_device_farm.cpp -o device_farm -std=c++11 -pthread
+  ./device_farm [devices=2000] [seconds=30] [workers=all cores]
+  (the run ends early once the whole fleet reports the new version)
+===============================================================================
+*/
+
+// The peripherals come from the earlier lessons, main() renamed. The
+// push/pop keeps a caller's own "#define main" (tests/test_farm.cpp).
+#pragma push_macro("main")
+#undef main
+#define main UART_LessonMain
+#include "10_uart_simulation.cpp"
+#undef main
+#define main SPI_LessonMain
+#include "11_spi_realistic.cpp"
+#undef main
+#define main I2C_LessonMain
+#include "12_i2c_realistic.cpp"
+#undef main
+#define main Power_LessonMain
+#include "16_firmware_power.cpp"
+#undef main
+#define main Boot_LessonMain
+#include "17_bootloader_sim.cpp"
+#undef main
+#pragma pop_macro("main")
+#include <memory>
+#include "fw_farm.h"
+
+// -----------------------------------------------------------------------------
+// SECTION 1: Protocol and fleet parameters
+// -----------------------------------------------------------------------------
+/*
+Devices and server talk in UART frames (10_uart_simulation.cpp: SOF,
+LEN, SEQ, payload, CRC-8); the first payload byte is the message type.
+  TELEMETRY  device → server   version, sensor reading, boot count
+  CHUNK      server → device   chunk index + 64 image bytes
+  END        server → device   image length and chunk count
+  NACK       device → server   image incomplete or failed its CRC-32
+A device writes chunks into the update slot of its SPI flash, reads the
+image back at END, checks it like a bootloader (17_bootloader_sim.cpp)
+and "reboots" into the new version. Telemetry after the reboot is the
+server's only proof that the update worked.
+*/
+#define FARM_MSG_TELEMETRY  0x01
+#define FARM_MSG_CHUNK      0x02
+#define FARM_MSG_END        0x03
+#define FARM_MSG_NACK       0x04
+
+#define FARM_SLICE_MS       100          // Simulated time per epoch
+#define FARM_TELEMETRY_MS   1000         // Report period
+#define FARM_BAUD           115200       // 8N1: 10 bits per byte on the cable
+#define FARM_LINE_BYTES     (FARM_BAUD / 10 * FARM_SLICE_MS / 1000)   // per slice
+#define FARM_CHUNK          64           // Image bytes per CHUNK frame
+#define FARM_APP_SIZE       4096         // Application part of the update
+#define FARM_FLASH_SIZE     (128 * 1024) // Per device, anonymous memory
+#define FARM_SLOT_ADDR      0x10000      // Update slot in SPI flash
+#define FARM_SENSOR_ADDR    0x68         // IMU on the I2C bus
+
+#define FARM_ROLLOUT_MS     2000         // Server starts the update here
+#define FARM_CANARY_EVERY   50           // 1 device in 50 is a canary
+#define FARM_IN_FLIGHT_PCT  10           // At most 10% of the fleet streaming
+#define FARM_STREAM_TIMEOUT_MS 3000      // No NACK or new version by then: resend
+#define FARM_NOISY_EVERY    20           // 1 cable in 20 is noisy...
+#define FARM_NOISY_PPM      100          // ...bad bytes per million
+
+// -----------------------------------------------------------------------------
+// SECTION 2: One device
+// -----------------------------------------------------------------------------
+/*
+Everything one sensor node owns. The peripheral instances replace the
+lessons' single global ones while the device runs (Farm_Slice selects
+them), so any number of devices can run at once on different threads.
+The server's end of this device's connection lives here as well: it is
+only touched from the device's own slice, and what the fleet server
+needs from it is collected between epochs.
+*/
+struct FarmDevice {
+    explicit FarmDevice(int n) : id(n), imu(FARM_SENSOR_ADDR) {
+        canary = id % FARM_CANARY_EVERY == 0;
+        noisy = id % FARM_NOISY_EVERY == FARM_NOISY_EVERY / 2;
+        rng = 0x9E3779B97F4A7C15ULL * (id + 1);
+        i2c.bus.timing = &I2C_FAST;
+        i2c.bus.slaves.push_back(&imu);
+        flash.open(nullptr, FARM_FLASH_SIZE);
+        uart.rxBuffer.reset(UART_RX_FIFO_MAX);
+        gateway.rxBuffer.reset(UART_RX_FIFO_MAX);
+    }
+
+    int id;
+    bool canary, noisy;
+    uint64_t rng;                   // Bit errors on this device's cable
+    uint64_t nowMs = 0;             // Device time
+
+    // Peripherals
+    I2CPeripheral i2c;
+    SPIPeripheral spi;
+    LED_REGS led = {0, 0};
+    I2CSensorDevice imu;
+    SPIFlash flash;
+    UART_Registers uart;            // The device's UART...
+    UART_Registers gateway;         // ...cabled to a port of the fleet gateway
+
+    // Firmware
+    uint16_t version = 1;
+    unsigned boots = 1;
+    uint8_t txSeq = 0;
+    UART_FrameParser rx;
+    vector<bool> chunkOk;           // Chunks of the transfer in progress
+    unsigned long sensorReads = 0, sensorErrors = 0;
+    unsigned long flashPages = 0;
+
+    // Server side of the connection
+    UART_FrameParser gwRx;
+    uint8_t gwSeq = 0;
+    uint16_t reportedVersion = 0;   // From the last telemetry
+    bool granted = false;           // Server allows streaming the update
+    bool streaming = false;         // Image frames queued or on the wire
+    uint64_t streamStartMs = 0;     // When the current transfer was queued
+    unsigned long telemetry = 0, transfers = 0, nacks = 0, timeouts = 0;
+    uint64_t updatedAtMs = 0;       // First telemetry on the new version
+};
+
+// The update every device should end up running
+struct FarmFleet {
+    uint16_t targetVersion = 2;
+    string image;                   // Header + app + CRC-32 (17_bootloader_sim)
+    vector<vector<uint8_t> > frames;   // The image as CHUNK... END frame payloads
+    bool fullRollout = false;       // Canary wave passed
+    uint64_t canaryDoneMs = 0, rolloutDoneMs = 0;
+    unsigned long maxInFlight = 1;
+};
+
+// -----------------------------------------------------------------------------
+// SECTION 3: Device firmware
+// -----------------------------------------------------------------------------
+void Farm_SendFrame(UART_Registers &port, uint8_t &seq, const uint8_t *payload, uint8_t len) {
+    vector<uint8_t> frame;
+    UART_BuildFrame(frame, seq++, payload, len);
+    for (uint8_t b : frame) UART_SendChar(port, (char)b);
+}
+
+// Read the IMU, blink, report. Runs every FARM_TELEMETRY_MS and after a reboot.
+void Farm_Telemetry(FarmDevice &d) {
+    uint8_t sample[6] = {};
+    if (I2C_ReadRegisters(FARM_SENSOR_ADDR, 0x3B, sample, 6)) d.sensorReads++;
+    else d.sensorErrors++;
+    LED.DATA ^= 1;                                   // heartbeat
+    uint8_t msg[6] = {FARM_MSG_TELEMETRY, (uint8_t)d.version, (uint8_t)(d.version >> 8),
+                      sample[0], sample[1], (uint8_t)d.boots};
+    Farm_SendFrame(d.uart, d.txSeq, msg, sizeof(msg));
+}
+
+// Image chunk: erase each sector when its first chunk arrives, program
+void Farm_OnChunk(FarmDevice &d, const uint8_t *p, uint8_t len) {
+    if (len < 3) return;
+    uint32_t idx = p[1] | (p[2] << 8);
+    uint32_t addr = FARM_SLOT_ADDR + idx * FARM_CHUNK;
+    if (idx == 0) d.chunkOk.assign(d.chunkOk.size(), false);   // new attempt
+    if (idx * FARM_CHUNK + FARM_CHUNK > FARM_FLASH_SIZE - FARM_SLOT_ADDR) return;
+    if (d.chunkOk.size() <= idx) d.chunkOk.resize(idx + 1, false);
+    if (addr % FLASH_SECTOR_SIZE == 0) Flash_EraseSector(d.flash, addr);
+    Flash_Write(d.flash, addr, p + 3, len - 3);
+    d.flashPages++;
+    d.chunkOk[idx] = true;
+}
+
+// Transfer complete: every chunk there, image valid → reboot into it
+void Farm_OnEnd(FarmDevice &d, const uint8_t *p, uint8_t len) {
+    if (len < 7) return;
+    uint32_t size = p[1] | (p[2] << 8) | (p[3] << 16) | ((uint32_t)p[4] << 24);
+    uint32_t chunks = p[5] | (p[6] << 8);
+    bool complete = chunks <= d.chunkOk.size() && size <= chunks * FARM_CHUNK;
+    for (uint32_t i = 0; complete && i < chunks; i++) complete = d.chunkOk[i];
+    d.chunkOk.clear();
+
+    Boot_ImageHeader hdr;
+    if (complete) {
+        vector<uint8_t> image(size);
+        QSPI_Read(d.flash, QSPI_MODES[0], FARM_SLOT_ADDR, image.data(), size);
+        complete = Boot_ParseImage(image.data(), size, hdr) == BOOT_OK;
+    }
+    if (!complete) {
+        uint8_t nack = FARM_MSG_NACK;
+        Farm_SendFrame(d.uart, d.txSeq, &nack, 1);
+        return;
+    }
+    d.version = hdr.version;                          // jump to the new app
+    d.boots++;
+    Farm_Telemetry(d);
+}
+
+void Farm_DeviceRx(FarmDevice &d, uint8_t byte) {
+    if (!d.rx.feed(byte) || d.rx.len == 0) return;
+    const uint8_t *p = d.rx.payload();
+    if (p[0] == FARM_MSG_CHUNK) Farm_OnChunk(d, p, d.rx.len);
+    else if (p[0] == FARM_MSG_END) Farm_OnEnd(d, p, d.rx.len);
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 4: Fleet server, per connection
+// -----------------------------------------------------------------------------
+void Farm_StreamImage(FarmDevice &d, const FarmFleet &fleet) {
+    for (const vector<uint8_t> &f : fleet.frames)
+        Farm_SendFrame(d.gateway, d.gwSeq, f.data(), (uint8_t)f.size());
+    d.streaming = true;
+    d.streamStartMs = d.nowMs;
+    d.transfers++;
+}
+
+void Farm_ServerRx(FarmDevice &d, const FarmFleet &fleet, uint8_t byte) {
+    if (!d.gwRx.feed(byte) || d.gwRx.len == 0) return;
+    const uint8_t *p = d.gwRx.payload();
+    if (p[0] == FARM_MSG_TELEMETRY && d.gwRx.len >= 3) {
+        d.telemetry++;
+        d.reportedVersion = p[1] | (p[2] << 8);
+        if (d.reportedVersion == fleet.targetVersion && d.streaming) {
+            d.streaming = false;
+            d.updatedAtMs = d.nowMs;
+        }
+    } else if (p[0] == FARM_MSG_NACK && d.streaming) {
+        d.nacks++;
+        Farm_StreamImage(d, fleet);                  // retry from the start
+    }
+}
+
+/*
+One character time on the cable, in each direction, for a slice's worth
+of bytes. A noisy cable flips a random bit in FARM_NOISY_PPM bytes per
+million: roughly one image transfer in three fails its CRC. Both
+receivers read each byte straight away, as an RX interrupt would, so
+the FIFOs never overrun.
+*/
+void Farm_Cable(FarmDevice &d, const FarmFleet &fleet) {
+    for (int dir = 0; dir < 2; dir++) {
+        UART_Registers &from = dir ? d.gateway : d.uart;
+        UART_Registers &to = dir ? d.uart : d.gateway;
+        for (int n = 0; n < FARM_LINE_BYTES && !from.txBuffer.empty(); n++) {
+            if (d.noisy) {
+                d.rng = d.rng * 6364136223846793005ULL + 1442695040888963407ULL;
+                if ((d.rng >> 33) % 1000000 < FARM_NOISY_PPM)
+                    from.txBuffer.front() ^= (char)(1 << ((d.rng >> 20) & 7));
+            }
+            UART_WireShiftByte(from, to);
+            if (!to.rxReady) continue;
+            uint8_t b = (uint8_t)UART_ReadChar(to);
+            if (dir) Farm_DeviceRx(d, b);
+            else Farm_ServerRx(d, fleet, b);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 5: One epoch of one device
+// -----------------------------------------------------------------------------
+/*
+A worker thread picks the device up, selects its peripherals (like an
+RTOS restoring a task's context), runs FARM_SLICE_MS of its firmware and
+cable, and puts the defaults back. Which worker runs which device, and
+in what order, does not matter: nothing here touches another device.
+*/
+void Farm_Slice(FarmDevice &d, const FarmFleet &fleet) {
+    SPI_Use(&d.spi);
+    I2C_Use(&d.i2c);
+    LED_Use(&d.led);
+
+    d.nowMs += FARM_SLICE_MS;
+    if (d.granted && !d.streaming && d.reportedVersion != fleet.targetVersion && !d.updatedAtMs)
+        Farm_StreamImage(d, fleet);
+    // A corrupted END or a lost NACK leaves the device silent: resend
+    // rather than hold the in-flight slot for good
+    if (d.streaming && d.nowMs - d.streamStartMs >= FARM_STREAM_TIMEOUT_MS) {
+        d.timeouts++;
+        Farm_StreamImage(d, fleet);
+    }
+    if (d.nowMs % FARM_TELEMETRY_MS == 0) Farm_Telemetry(d);
+    Farm_Cable(d, fleet);
+
+    SPI_Use(nullptr);
+    I2C_Use(nullptr);
+    LED_Use(nullptr);
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 6: Fleet server, rollout policy (between epochs)
+// -----------------------------------------------------------------------------
+/*
+Runs on one thread while no device does, so it may read every device.
+  - Nothing before FARM_ROLLOUT_MS: every device reports in first
+  - Canary wave: only canaries get the update; once all of them report
+    the new version the rollout opens to the whole fleet
+  - Never more than FARM_IN_FLIGHT_PCT of the fleet streaming at once
+    (the server's uplink); grants go out in device order
+Returns false when every device runs the target version.
+*/
+bool Farm_Plan(vector<unique_ptr<FarmDevice> > &fleetDevices, FarmFleet &fleet, uint64_t nowMs) {
+    if (nowMs < FARM_ROLLOUT_MS) return true;
+    size_t canaries = 0, canariesDone = 0, done = 0;
+    unsigned long inFlight = 0;
+    for (auto &d : fleetDevices) {
+        bool upToDate = d->reportedVersion == fleet.targetVersion;
+        done += upToDate;
+        if (d->canary) { canaries++; canariesDone += upToDate; }
+        if (d->granted && !upToDate) inFlight++;
+    }
+    if (!fleet.fullRollout && canariesDone == canaries) {
+        fleet.fullRollout = true;
+        fleet.canaryDoneMs = nowMs;
+    }
+    if (done == fleetDevices.size()) {
+        fleet.rolloutDoneMs = nowMs;
+        return false;
+    }
+    for (auto &d : fleetDevices) {
+        if (inFlight >= fleet.maxInFlight) break;
+        if (d->granted || !d->reportedVersion || d->reportedVersion == fleet.targetVersion) continue;
+        if (!fleet.fullRollout && !d->canary) continue;
+        d->granted = true;
+        inFlight++;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 7: Building the update and running the farm
+// -----------------------------------------------------------------------------
+void Farm_BuildUpdate(FarmFleet &fleet) {
+    string app(FARM_APP_SIZE, '\0');
+    for (size_t i = 0; i < app.size(); i++) app[i] = (char)(i * 31 + 7);
+    fleet.image = Boot_BuildImage(app, fleet.targetVersion);
+    uint32_t chunks = (uint32_t)((fleet.image.size() + FARM_CHUNK - 1) / FARM_CHUNK);
+    for (uint32_t i = 0; i < chunks; i++) {
+        vector<uint8_t> f = {FARM_MSG_CHUNK, (uint8_t)i, (uint8_t)(i >> 8)};
+        size_t off = (size_t)i * FARM_CHUNK, n = min((size_t)FARM_CHUNK, fleet.image.size() - off);
+        f.insert(f.end(), fleet.image.begin() + off, fleet.image.begin() + off + n);
+        fleet.frames.push_back(f);
+    }
+    uint32_t size = (uint32_t)fleet.image.size();
+    fleet.frames.push_back({FARM_MSG_END, (uint8_t)size, (uint8_t)(size >> 8), (uint8_t)(size >> 16),
+                            (uint8_t)(size >> 24), (uint8_t)chunks, (uint8_t)(chunks >> 8)});
+}
+
+struct FarmResult {
+    FwFarmStats farm;
+    size_t devices = 0, updated = 0;
+    uint64_t canaryDoneMs = 0, rolloutDoneMs = 0, simMs = 0;
+    unsigned long telemetry = 0, transfers = 0, nacks = 0, noisyNacks = 0, timeouts = 0;
+    unsigned long crcErrors = 0, sensorReads = 0, sensorErrors = 0, flashPages = 0;
+};
+
+FarmResult Farm_Run(size_t devices, int seconds, int workers) {
+    UART_TxTimeMs = 0;                               // the cable model paces bytes
+    FarmFleet fleet;
+    Farm_BuildUpdate(fleet);
+    fleet.maxInFlight = max<unsigned long>(1, devices * FARM_IN_FLIGHT_PCT / 100);
+
+    vector<unique_ptr<FarmDevice> > fleetDevices;
+    for (size_t i = 0; i < devices; i++) fleetDevices.emplace_back(new FarmDevice((int)i));
+
+    FwPool pool(workers);
+    FarmResult r;
+    r.farm = FwFarm_Run(pool, devices, (size_t)seconds * 1000 / FARM_SLICE_MS,
+        [&](size_t i, size_t) { Farm_Slice(*fleetDevices[i], fleet); },
+        [&](size_t epoch) { return Farm_Plan(fleetDevices, fleet, (epoch + 1) * FARM_SLICE_MS); });
+
+    r.devices = devices;
+    r.simMs = r.farm.epochs * FARM_SLICE_MS;
+    r.canaryDoneMs = fleet.canaryDoneMs;
+    r.rolloutDoneMs = fleet.rolloutDoneMs;
+    for (auto &d : fleetDevices) {
+        r.updated += d->version == fleet.targetVersion;
+        r.telemetry += d->telemetry;
+        r.transfers += d->transfers;
+        r.nacks += d->nacks;
+        if (d->noisy) r.noisyNacks += d->nacks;
+        r.timeouts += d->timeouts;
+        r.crcErrors += d->rx.crcErrors + d->gwRx.crcErrors;
+        r.sensorReads += d->sensorReads;
+        r.sensorErrors += d->sensorErrors;
+        r.flashPages += d->flashPages;
+    }
+    return r;
+}
+
+void Farm_Report(const FarmResult &r) {
+    cout << "\n---- Device farm: " << r.devices << " devices, " << r.simMs / 1000.0
+         << " s simulated ----" << endl;
+    FwFarm_Report(cout, r.farm);
+    cout << fixed << setprecision(1)
+         << "Fleet time / wall time: " << r.devices * r.simMs / 1000.0 / r.farm.wallSec
+         << " device-seconds per second" << endl;
+
+    cout << "\n---- Fleet update v1 -> v2 (" << FARM_APP_SIZE << " B app, "
+         << FARM_IN_FLIGHT_PCT << "% in flight) ----" << endl;
+    if (r.canaryDoneMs) cout << "Canary wave done at     " << r.canaryDoneMs / 1000.0 << " s" << endl;
+    else cout << "Canary wave done at     -" << endl;
+    if (r.rolloutDoneMs) cout << "Whole fleet updated at  " << r.rolloutDoneMs / 1000.0 << " s" << endl;
+    else cout << "Whole fleet updated at  - (" << r.updated << " of " << r.devices << " so far)" << endl;
+    cout << "Devices on v2           " << r.updated << " / " << r.devices << endl;
+    cout << "Image transfers         " << r.transfers << " (" << r.nacks << " retried after a NACK, "
+         << r.noisyNacks << " of them on noisy cables; " << r.timeouts << " after a timeout)" << endl;
+    cout << "Frames with CRC errors  " << r.crcErrors << endl;
+    cout << "Telemetry frames        " << r.telemetry << endl;
+    cout << "Sensor reads (I2C)      " << r.sensorReads << " ok, " << r.sensorErrors << " failed" << endl;
+    cout << "Flash chunks written    " << r.flashPages << endl;
+    cout.unsetf(ios::floatfield);
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 8: MAIN
+// -----------------------------------------------------------------------------
+int main(int argc, char **argv) {
+    size_t devices = argc > 1 ? (size_t)atol(argv[1]) : 2000;
+    int seconds = argc > 2 ? atoi(argv[2]) : 30;
+    int workers = argc > 3 ? atoi(argv[3]) : 0;
+    cout << "==== Device Farm Simulation ====" << endl;
+    Farm_Report(Farm_Run(devices, seconds, workers));
+    cout << "==== Device Farm Complete ====" << endl;
+    return 0;
+}
+
+/*
+===============================================================================
+Key learnings:
+1. A global peripheral object limits a process to one device. Giving
+   every device its own instances, and selecting them per thread the
+   way CMSIS maps a name to a base address, keeps the driver code
+   unchanged and lets thousands run side by side.
+2. Devices are independent between epochs, so the pool can run them in
+   any order on any core. Cross-device logic (the rollout policy) runs
+   in between, on one thread, and sees a consistent fleet: the same
+   inputs give the same rollout with 1 thread or 64.
+3. Work stealing: each worker keeps its own devices (warm caches) and
+   only takes others' when it runs dry. Devices in the middle of an
+   update cost far more per epoch than idle ones; stealing evens that
+   out without a central queue every task has to pass through.
+4. Realistic devices find realistic server bugs: noisy links retry,
+   canaries gate the rollout, and the in-flight limit decides how long
+   a fleet takes to update.
+===============================================================================
+*/
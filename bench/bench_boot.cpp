@@ -0,0 +1,43 @@
+/*
+===============================================================================
+Purpose: Microbenchmarks for the bootloader (17_bootloader_sim.cpp): time
+         to validate an image, reported per MB, for a good image and for
+         one corrupted in its last byte (the whole image is still read).
+Author: Sankalpa Hota
+How to compile & run (or `cmake --build build/release --target bench`):
+  g++ -O2 -I. bench/bench_boot.cpp -o bench_boot -std=c++11
+  ./bench_boot --json=bench_boot.json [--baseline=old.json]
+===============================================================================
+*/
+
+#define main Boot_LessonMain
+#include "17_bootloader_sim.cpp"
+#undef main
+#include "fw_bench.h"
+
+int main(int argc, char **argv) {
+    FwBench_Init(argc, argv);
+
+    const size_t MB = 1024 * 1024;
+    string app(MB, '\0');
+    for (size_t i = 0; i < MB; i++) app[i] = (char)(i * 31 + (i >> 8));
+    string image = Boot_BuildImage(app);
+    string corrupt = image;
+    corrupt[MB - 1] ^= 0x01;
+
+    FwBench_Run("Boot/validate_1MB", [&] {
+        FwBench_Keep(Boot_ImageValid(image));
+    }, MB);
+    FwBench_Run("Boot/validate_1MB_corrupt", [&] {
+        FwBench_Keep(Boot_ImageValid(corrupt));
+    }, MB);
+    FwBench_Run("Boot/build_image_1MB", [&] {
+        FwBench_Keep(Boot_BuildImage(app).size());
+    }, MB);
+
+    if (!Boot_ImageValid(image) || Boot_ImageValid(corrupt)) {
+        cout << "[BENCH] CRC check gave the wrong answer" << endl;
+        return 1;
+    }
+    return FwBench_Finish();
+}
@@ -0,0 +1,65 @@
+/*
+===============================================================================
+Purpose: Microbenchmarks for the I2C simulation (12_i2c_realistic.cpp):
+         host time per transaction for the event-driven master, the
+         slave state machines and the asynchronous transaction queue.
+Author: Sankalpa Hota
+How to compile & run (or `cmake --build build/release --target bench`):
+  g++ -O2 -I. bench/bench_i2c.cpp -o bench_i2c -std=c++11 -pthread
+  ./bench_i2c --json=bench_i2c.json [--baseline=old.json] [--filter=I2C/]
+===============================================================================
+*/
+
+#define main I2C_LessonMain
+#include "12_i2c_realistic.cpp"
+#undef main
+#include "fw_bench.h"
+
+static void I2C_BenchDone(I2CTransaction &t) { (*(int *)t.context)++; }
+
+int main(int argc, char **argv) {
+    FwBench_Init(argc, argv);
+
+    I2CSensorDevice imu(0x68);
+    I2C.slaves = {&imu};
+    I2C.timing = &I2C_FAST;
+    uint8_t data[14] = {};
+    uint64_t simStart = 0, simNs = 0;
+
+    FwBench_Run("I2C/read_14B_burst_400k", [&] {
+        simStart = I2C.nowNs;
+        FwBench_Keep(I2C_ReadRegisters(0x68, 0x3B, data, 14));
+        simNs = I2C.nowNs - simStart;
+    }, 14, 1);
+    FwBench_Counter("sim_us", simNs / 1e3);
+
+    FwBench_Run("I2C/read_1B_400k", [&] {
+        simStart = I2C.nowNs;
+        FwBench_Keep(I2C_ReadRegisters(0x68, 0x75, data, 1));
+        simNs = I2C.nowNs - simStart;
+    }, 1, 1);
+    FwBench_Counter("sim_us", simNs / 1e3);
+
+    FwBench_Run("I2C/write_4B_400k", [&] {
+        simStart = I2C.nowNs;
+        FwBench_Keep(I2C_WriteRegisters(0x68, 0x10, data, 4));
+        simNs = I2C.nowNs - simStart;
+    }, 4, 1);
+    FwBench_Counter("sim_us", simNs / 1e3);
+
+    // A full queue of burst reads, completed from the "ISR"
+    I2CTransaction txns[I2C_QUEUE_DEPTH];
+    uint8_t reg = 0x3B, bufs[I2C_QUEUE_DEPTH][14];
+    int completed = 0;
+    FwBench_Run("I2C/async_queue_16_reads", [&] {
+        for (int i = 0; i < I2C_QUEUE_DEPTH; i++) {
+            txns[i] = I2CTransaction{0x68, &reg, 1, bufs[i], 14, I2C_BenchDone, &completed, false};
+            I2C_Submit(&txns[i]);
+        }
+        while (I2C_Step()) {}
+    }, 14 * I2C_QUEUE_DEPTH, I2C_QUEUE_DEPTH);
+    FwBench_Keep(completed);
+
+    I2C.slaves.clear();
+    return FwBench_Finish();
+}
@@ -0,0 +1,91 @@
+/*
+===============================================================================
+Purpose: Microbenchmarks for the simulated interrupt controller (fw_irq.h):
+         host time to dispatch an ISR, to nest one, and to arm a timer
+         and take its expiry interrupt.
+Author: Sankalpa Hota
+How to compile & run (or `cmake --build build/release --target bench`):
+  g++ -O2 -I. bench/bench_nvic.cpp -o bench_nvic -std=c++11 -pthread
+  ./bench_nvic --json=bench_nvic.json [--baseline=old.json] [--filter=Timer/]
+===============================================================================
+*/
+
+#include "fw_irq.h"
+#include "fw_bench.h"
+
+static unsigned long BenchIsrCount = 0;
+static int BenchHighIrq = -1;
+
+static void Bench_EmptyIsr() { BenchIsrCount++; }
+
+static void Bench_LowIsr() {             // preempted by the high-priority IRQ
+    NVIC_SetPending(BenchHighIrq);
+    CPU_Run(100);
+}
+
+int main(int argc, char **argv) {
+    FwBench_Init(argc, argv);
+
+    // -------------------------------------------------------------------------
+    // ISR dispatch
+    // -------------------------------------------------------------------------
+    NVIC_Reset();
+    int irq = NVIC_Register("EXTI0", 2, Bench_EmptyIsr);
+    FwBench_Run("NVIC/dispatch_1_irq", [&] {
+        NVIC_SetPending(irq);
+        NVIC_Dispatch();
+    }, 0, 1);
+    FwBench_Counter("sim_latency_ns", (double)NVIC.irqs[irq].maxLatencyNs);
+
+    // The dispatcher scans every registered IRQ for the most urgent one
+    NVIC_Reset();
+    for (int i = 0; i < NVIC_MAX_IRQS; i++) NVIC_Register("EXTIx", (uint8_t)(i + 1), Bench_EmptyIsr);
+    FwBench_Run("NVIC/dispatch_16_irqs", [&] {
+        NVIC_SetPending(NVIC_MAX_IRQS - 1);
+        NVIC_Dispatch();
+    }, 0, 1);
+
+    NVIC_Reset();
+    BenchHighIrq = NVIC_Register("TIM1", 1, Bench_EmptyIsr);
+    int low = NVIC_Register("UART1_RX", 3, Bench_LowIsr);
+    FwBench_Run("NVIC/nested_2_levels", [&] {
+        NVIC_SetPending(low);
+        NVIC_Dispatch();
+    }, 0, 2);
+
+    // Critical section: mask, a pending IRQ waits, unmask takes it
+    NVIC_Reset();
+    irq = NVIC_Register("EXTI0", 2, Bench_EmptyIsr);
+    FwBench_Run("NVIC/critical_section_pend", [&] {
+        IRQ_CriticalSection cs("bench");
+        NVIC_SetPending(irq);
+    }, 0, 1);
+
+    // -------------------------------------------------------------------------
+    // Timers
+    // -------------------------------------------------------------------------
+    // One-shot: arm 1 us ahead, run until it has expired and its ISR ran
+    NVIC_Reset();
+    int tim = NVIC_Register("TIM2", 1, Bench_EmptyIsr);
+    FwBench_Run("Timer/start_expire", [&] {
+        NVIC_ScheduleAt(tim, NVIC.nowNs + 1000);
+        CPU_Run(1000);
+    }, 0, 1);
+
+    // Same, but the core sleeps (WFI) until the expiry wakes it
+    FwBench_Run("Timer/start_sleep_expire", [&] {
+        NVIC_ScheduleAt(tim, NVIC.nowNs + 1000000);
+        CPU_SleepUntil(UINT64_MAX);
+        NVIC_Dispatch();
+    }, 0, 1);
+
+    // Periodic 1 kHz tick: cost of one tick inside 1 ms of running code
+    NVIC_Reset();
+    NVIC_Register("SysTick", 0, Bench_EmptyIsr, 1000000);
+    FwBench_Run("Timer/periodic_tick", [&] {
+        CPU_Run(1000000);
+    }, 0, 1);
+    FwBench_Keep(BenchIsrCount);
+
+    return FwBench_Finish();
+}
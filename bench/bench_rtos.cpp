@@ -0,0 +1,53 @@
+/*
+===============================================================================
+Purpose: Microbenchmarks for the RTOS primitives (14_rtos_advanced.cpp):
+         Semaphore wait/signal without contention and as a two-task
+         hand-off, next to a plain mutex for scale.
+Author: Sankalpa Hota
+How to compile & run (or `cmake --build build/release --target bench`):
+  g++ -O2 -I. bench/bench_rtos.cpp -o bench_rtos -std=c++11 -pthread
+  ./bench_rtos --json=bench_rtos.json [--baseline=old.json] [--filter=RTOS/]
+===============================================================================
+*/
+
+#define main RTOS_LessonMain
+#include "14_rtos_advanced.cpp"
+#undef main
+#include <atomic>
+#include "fw_bench.h"
+
+int main(int argc, char **argv) {
+    FwBench_Init(argc, argv);
+
+    FwBench_Run("RTOS/mutex_lock_unlock", [&] {
+        lock_guard<FwMutex> lock(uart_mutex);
+    }, 0, 1);
+
+    // Count never reaches 0: wait() never blocks
+    Semaphore sem(1);
+    FwBench_Run("RTOS/semaphore_wait_signal", [&] {
+        sem.wait();
+        sem.signal();
+    }, 0, 1);
+
+    // Producer/consumer hand-off: each iteration wakes the other task
+    // and waits to be woken back (two context switches)
+    Semaphore ping(0), pong(0);
+    atomic<bool> stop(false);
+    thread peer([&] {
+        while (true) {
+            ping.wait();
+            if (stop) break;
+            pong.signal();
+        }
+    });
+    FwBench_Run("RTOS/semaphore_ping_pong", [&] {
+        ping.signal();
+        pong.wait();
+    }, 0, 1);
+    stop = true;
+    ping.signal();
+    peer.join();
+
+    return FwBench_Finish();
+}
@@ -0,0 +1,79 @@
+/*
+===============================================================================
+Purpose: Microbenchmarks for the SPI simulation (11_spi_realistic.cpp):
+         host time per byte for the bit-accurate master, the byte-level
+         device model, the shared-bus controller and QSPI flash reads.
+Author: Sankalpa Hota
+How to compile & run (or `cmake --build build/release --target bench`):
+  g++ -O2 -I. bench/bench_spi.cpp -o bench_spi -std=c++11 -pthread
+  ./bench_spi --json=bench_spi.json [--baseline=old.json] [--filter=SPI/]
+===============================================================================
+*/
+
+#define main SPI_LessonMain
+#include "11_spi_realistic.cpp"
+#undef main
+#include "fw_bench.h"
+
+int main(int argc, char **argv) {
+    FwBench_Init(argc, argv);
+    ostream nullSink(nullptr);             // Logging on, as in the demo
+    FwLog_Start(nullSink, FWLOG_BINARY);
+
+    uint8_t out[4096], in[4096];
+    for (int i = 0; i < 4096; i++) out[i] = (uint8_t)(i * 13);
+
+    // Bit-accurate: 16 SCLK edges and 16 slave callbacks per byte
+    SPIShiftSlave echo;
+    SPI.slave = &echo;
+    SPI.mode = 0;
+    FwBench_Run("SPI/bit_accurate_256B", [&] {
+        SPIMaster(out, in, 256);
+        FwBench_Keep(in[255]);
+    }, 256);
+    SPI.slave = nullptr;
+
+    // Byte-level device model, one CS cycle per 256 bytes
+    ShiftRegisterDevice reg;
+    FwBench_Run("SPI/byte_model_256B", [&] {
+        SPI_Select(reg);
+        for (int i = 0; i < 256; i++) in[i] = SPI_TransferByte(reg, out[i]);
+        SPI_Deselect(reg);
+        FwBench_Keep(in[255]);
+    }, 256);
+
+    // Through the multi-slave controller (CS registry, contention check)
+    SPIController ctrl;
+    DisplayDevice display;
+    SPI_Attach(ctrl, 0, display, "display");
+    FwBench_Run("SPI/controller_256B", [&] {
+        SPI_AssertCS(ctrl, 0);
+        for (int i = 0; i < 256; i++) in[i] = SPI_BusTransfer(ctrl, out[i]);
+        SPI_ReleaseCS(ctrl, 0);
+        FwBench_Keep(in[255]);
+    }, 256);
+
+    // 4 KB reads from the NOR flash model, single and quad I/O
+    const char *path = "bench_spi_flash.bin";
+    SPIFlash flash;
+    if (flash.open(path, 1024 * 1024)) {
+        Flash_EnableQuad(flash);
+        const QSPI_Mode *modes[] = {&QSPI_MODES[0], &QSPI_MODES[5]};
+        const char *names[] = {"SPI/flash_read_4KB_1-1-1", "SPI/flash_read_4KB_1-4-4"};
+        for (int m = 0; m < 2; m++) {
+            uint64_t simNs = 0;
+            FwBench_Run(names[m], [&] {
+                uint64_t simStart = SPI_NowNs;
+                QSPI_Read(flash, *modes[m], 0, in, sizeof(in));
+                simNs = SPI_NowNs - simStart;
+                FwBench_Keep(in[4095]);
+            }, sizeof(in));
+            FwBench_Counter("sim_MBps", sizeof(in) * 1e3 / simNs);
+        }
+        flash.close();
+        remove(path);
+    }
+
+    FwLog_Stop();
+    return FwBench_Finish();
+}
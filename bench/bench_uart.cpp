@@ -0,0 +1,86 @@
+/*
+===============================================================================
+Purpose: Microbenchmarks for the UART simulation (10_uart_simulation.cpp):
+         host time per byte through the registers, per frame over the
+         simulated cable, per request/response transaction.
+Author: Sankalpa Hota
+How to compile & run (or `cmake --build build/release --target bench`):
+  g++ -O2 -I. bench/bench_uart.cpp -o bench_uart -std=c++11 -pthread
+  ./bench_uart --json=bench_uart.json [--baseline=old.json] [--filter=UART/]
+===============================================================================
+*/
+
+#define main UART_LessonMain
+#include "10_uart_simulation.cpp"
+#undef main
+#include "fw_bench.h"
+
+int main(int argc, char **argv) {
+    FwBench_Init(argc, argv);
+    ostream nullSink(nullptr);             // Logging on, as in the demo
+
+    // One byte: TX register → wire → RX FIFO → firmware read, with locks.
+    // Two log records per byte would fill the ring in well under the
+    // writer's FW_LOG_DRAIN_MS and leave only the drop path to time, so
+    // this thread drains it itself every 1024 bytes (FwLog_Flush with
+    // no writer running); the drain is part of the figure.
+    FwLog_Redirect(nullSink);
+    FwLog_Flush();
+    uint64_t droppedBefore = FwLog_Dropped();
+    UART_Registers a, b;
+    char c = 'A';
+    unsigned bytes = 0;
+    FwBench_Run("UART/byte_register_path", [&] {
+        a.txBuffer.push(c);
+        UART_TransferWireOneWay(a, b);
+        FwBench_Keep(UART_ReadChar(b));
+        if (++bytes % 1024 == 0) FwLog_Flush();
+    }, 1);
+    FwBench_Counter("log_dropped", (double)(FwLog_Dropped() - droppedBefore));
+    FwLog_Start(nullSink, FWLOG_BINARY);
+
+    // A 64-byte burst: build frame, shift it over the cable at 115200
+    // baud, parse it on the other side (one byte per RX interrupt)
+    UART_Registers tx, rx;
+    tx.rxBuffer.reset(UART_RX_FIFO_MAX);
+    rx.rxBuffer.reset(UART_RX_FIFO_MAX);
+    UART_Cable cable;
+    UART_CableConnect(cable, tx, rx);
+    UART_FrameParser parser;
+    vector<uint8_t> frame;
+    uint8_t payload[64];
+    for (int i = 0; i < 64; i++) payload[i] = (uint8_t)i;
+    uint64_t now = 0, simNs = 0;
+    uint8_t seq = 0;
+    FwBench_Run("UART/burst_64B_frame", [&] {
+        UART_BuildFrame(frame, seq++, payload, 64);
+        for (uint8_t byte : frame) tx.txBuffer.push((char)byte);
+        uint64_t start = now;
+        bool done = false;
+        while (!done && now - start < 1000000000ULL) {   // 1 s simulated: lost frame
+            uint64_t next = UART_CableStep(cable, cable.aToB, now);
+            char ch;
+            while (rx.rxBuffer.pop(ch)) done = parser.feed((uint8_t)ch) || done;
+            if (!done) now = next;
+        }
+        simNs = now - start;
+    }, 64 + 4);
+    FwBench_Counter("sim_us", simNs / 1e3);
+
+    // Request/response protocol, 16 B out / 64 B back, ideal cable
+    const UART_LinkConfig ideal = {"ideal", 115200, 115200, 0, 0.0};
+    UART_LinkResult link;
+    FwBench_Run("UART/link_100_transactions", [&] {
+        link = UART_RunLinkBenchmark(ideal, 100, 16, 64, 50000);
+    }, 0, 100);
+    FwBench_Counter("sim_rtt_us", link.rttMeanUs);
+
+    uint8_t block[256];
+    for (int i = 0; i < 256; i++) block[i] = (uint8_t)(i * 7);
+    FwBench_Run("UART/crc8_256B", [&] {
+        FwBench_Keep(UART_Crc8(block, sizeof(block)));
+    }, sizeof(block));
+
+    FwLog_Stop();
+    return FwBench_Finish();
+}
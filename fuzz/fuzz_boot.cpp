@@ -0,0 +1,99 @@
+/*
+===============================================================================
+Purpose: Properties and fuzz target for the bootloader image parser
+         (17_bootloader_sim.cpp): no input may crash it, valid images
+         parse back, damaged images never pass.
+Author: Sankalpa Hota
+How to compile & run (or `cmake --build build/release --target fuzz_boot`):
+  g++ -O2 -I. -fsanitize-coverage=trace-pc fuzz/fuzz_boot.cpp -o fuzz_boot -std=c++11 -pthread
+  ./fuzz_boot --props                       // property tests
+  ./fuzz_boot corpus_boot -max_total_time=60
+===============================================================================
+*/
+
+#define main Boot_LessonMain
+#include "17_bootloader_sim.cpp"
+#undef main
+#include "fw_fuzz.h"
+
+static bool Boot_HeaderSane(const Boot_ImageHeader &hdr, size_t len) {
+    return hdr.headerSize >= BOOT_HEADER_SIZE && (size_t)hdr.headerSize + hdr.appSize + 4 == len &&
+           hdr.loadAddr >= BOOT_APP_BASE && hdr.appSize <= BOOT_APP_LIMIT - hdr.loadAddr &&
+           hdr.entryOffset < hdr.appSize;
+}
+
+// Any bytes, half of the time behind a correct magic and a header of
+// fuzzed fields (random bytes alone rarely get past the magic). The
+// image is copied to a buffer of exactly its size so an ASan build
+// catches any read past the end.
+FW_PROPERTY(ParseAnyImage) {
+    std::vector<uint8_t> image;
+    if (in.flag()) {
+        string hdr;
+        uint32_t magic = BOOT_MAGIC;
+        for (int i = 0; i < 4; i++) hdr += (char)(magic >> (8 * i));
+        for (int i = 0; i < BOOT_HEADER_SIZE - 4; i++) hdr += (char)in.u8();
+        image.assign(hdr.begin(), hdr.end());
+    }
+    std::vector<uint8_t> tail = in.rest();
+    image.insert(image.end(), tail.begin(), tail.end());
+    std::unique_ptr<uint8_t[]> exact(new uint8_t[image.size() ? image.size() : 1]);
+    std::copy(image.begin(), image.end(), exact.get());
+
+    Boot_ImageHeader hdr;
+    Boot_Status status = Boot_ParseImage(exact.get(), image.size(), hdr);
+    FW_FUZZ_CHECK(status <= BOOT_BAD_CRC);
+    if (status == BOOT_OK) FW_FUZZ_CHECK(Boot_HeaderSane(hdr, image.size()));
+    return true;
+}
+
+static string Boot_RandomImage(FwFuzzInput &in, Boot_ImageHeader &want) {
+    std::vector<uint8_t> app = in.bytes(512);
+    if (app.empty()) app.push_back(0);
+    want.headerSize = BOOT_HEADER_SIZE;
+    want.version = in.u16();
+    want.appSize = (uint32_t)app.size();
+    want.loadAddr = BOOT_APP_BASE + in.below(BOOT_APP_LIMIT - BOOT_APP_BASE - want.appSize + 1);
+    want.entryOffset = in.below(want.appSize);
+    return Boot_BuildImage(string(app.begin(), app.end()), want.version, want.loadAddr,
+                           want.entryOffset);
+}
+
+FW_PROPERTY(BuiltImageParses) {
+    Boot_ImageHeader want, got;
+    string image = Boot_RandomImage(in, want);
+    FW_FUZZ_CHECK_EQ(Boot_StatusName(Boot_ParseImage(image, got)), Boot_StatusName(BOOT_OK));
+    FW_FUZZ_CHECK_EQ(got.version, want.version);
+    FW_FUZZ_CHECK_EQ(got.appSize, want.appSize);
+    FW_FUZZ_CHECK_EQ(got.loadAddr, want.loadAddr);
+    FW_FUZZ_CHECK_EQ(got.entryOffset, want.entryOffset);
+    return true;
+}
+
+// CRC-32 detects every single-bit error; a flipped header field is
+// caught by its own check even earlier
+FW_PROPERTY(BitFlipRejected) {
+    Boot_ImageHeader want, got;
+    string image = Boot_RandomImage(in, want);
+    size_t bit = in.below((uint32_t)image.size() * 8);
+    image[bit / 8] ^= (char)(1 << (bit % 8));
+    FW_FUZZ_CHECK(Boot_ParseImage(image, got) != BOOT_OK);
+    return true;
+}
+
+// A transfer cut short or with trailing bytes never boots
+FW_PROPERTY(WrongLengthRejected) {
+    Boot_ImageHeader want, got;
+    string image = Boot_RandomImage(in, want);
+    if (in.flag()) {
+        image.resize(in.below((uint32_t)image.size()));
+    } else {
+        std::vector<uint8_t> extra = in.bytes(64);
+        image.append(extra.begin(), extra.end());
+        if (extra.empty()) image += '\0';
+    }
+    FW_FUZZ_CHECK(Boot_ParseImage(image, got) != BOOT_OK);
+    return true;
+}
+
+FW_FUZZ_MAIN()
@@ -0,0 +1,115 @@
+/*
+===============================================================================
+Purpose: Properties and fuzz target for the I2C simulation
+         (12_i2c_realistic.cpp): the slave state machine under arbitrary
+         SDA/SCL sequences, and register transactions through the master
+         and the asynchronous queue.
+Author: Sankalpa Hota
+How to compile & run (or `cmake --build build/release --target fuzz_i2c`):
+  g++ -O2 -I. -fsanitize-coverage=trace-pc fuzz/fuzz_i2c.cpp -o fuzz_i2c -std=c++11 -pthread
+  ./fuzz_i2c --props                        // property tests
+  ./fuzz_i2c corpus_i2c -max_total_time=60
+===============================================================================
+*/
+
+#define main I2C_LessonMain
+#include "12_i2c_realistic.cpp"
+#undef main
+#include "fw_fuzz.h"
+
+static const I2CTiming *const I2C_FuzzTimings[] = {&I2C_STANDARD, &I2C_FAST, &I2C_FAST_PLUS};
+
+// --------------------------- Slave state machine -----------------------------
+/*
+A misbehaving master: every input byte sets SDA (bit 0) and SCL (bit 1)
+as the MCU's controller drives them, or (bit 2) lets time pass so a
+clock stretch can end. Whatever the sequence, the lines settle to the
+wired-AND of all outputs, a STOP always frees SDA, and a slave without
+clock stretching never touches SCL.
+*/
+FW_PROPERTY(SlaveAnyLineSequence) {
+    I2C_Reset(*I2C_FuzzTimings[in.below(3)]);
+    uint8_t address = (uint8_t)in.range(0x08, 0x77);
+    I2CRegisterDevice slave(address);
+    slave.stretchNs = in.below(4) * 500;
+    I2C.slaves.push_back(&slave);
+    I2CMaster &m = I2C_Master0;
+
+    while (!in.empty()) {
+        uint8_t op = in.u8();
+        bool oldSDA = I2C.SDA, oldSCL = I2C.SCL;
+        if (op & 4) {
+            I2C.nowNs += 1000;
+            I2C_Step();
+        } else {
+            m.sdaOut = op & 1;
+            m.sclOut = (op >> 1) & 1;
+            I2C_Resolve();
+        }
+        FW_FUZZ_CHECK_EQ(I2C.SDA, m.sdaOut && slave.sdaOut);
+        FW_FUZZ_CHECK_EQ(I2C.SCL, m.sclOut && slave.sclOut);
+        if (oldSCL && I2C.SCL && !oldSDA && I2C.SDA) {       // STOP
+            FW_FUZZ_CHECK(slave.sdaOut);
+            FW_FUZZ_CHECK(!I2C.busy);
+        }
+        if (!slave.stretchNs) FW_FUZZ_CHECK(slave.sclOut);
+    }
+    return true;
+}
+
+// --------------------------- Transactions -----------------------------
+// Register writes read back through a repeated START, at every speed
+// and with or without clock stretching; other addresses NACK
+FW_PROPERTY(RegisterWriteReadBack) {
+    I2C_Reset(*I2C_FuzzTimings[in.below(3)]);
+    I2CRegisterDevice slave(0x50);
+    slave.stretchNs = in.below(4) * 500;
+    I2C.slaves.push_back(&slave);
+
+    uint8_t reg = in.u8();
+    std::vector<uint8_t> data = in.bytes(32);
+    FW_FUZZ_CHECK(I2C_WriteRegisters(0x50, reg, data.data(), (int)data.size()));
+    std::vector<uint8_t> back(data.size() + 1, 0);
+    FW_FUZZ_CHECK(I2C_ReadRegisters(0x50, reg, back.data(), (int)data.size()));
+    FW_FUZZ_CHECK(std::equal(data.begin(), data.end(), back.begin()));
+    for (size_t i = 0; i < data.size(); i++)
+        FW_FUZZ_CHECK_EQ(slave.regs[(uint8_t)(reg + i)], data[i]);
+
+    uint8_t other = (uint8_t)in.range(0x08, 0x77);
+    if (other != 0x50) FW_FUZZ_CHECK(!I2CMaster_Read(other, back.data(), 1));
+    FW_FUZZ_CHECK(I2C_Master0.idle());
+    return true;
+}
+
+// Whatever gets queued, every accepted transaction completes once, in
+// order, and the queue never holds more than I2C_QUEUE_DEPTH
+static void I2C_FuzzDone(I2CTransaction &t) {
+    ((vector<I2CTransaction *> *)t.context)->push_back(&t);
+}
+
+FW_PROPERTY(AsyncQueueCompletesInOrder) {
+    I2C_Reset(*I2C_FuzzTimings[in.below(3)]);
+    I2CRegisterDevice slave(0x50);
+    I2C.slaves.push_back(&slave);
+
+    I2CTransaction txns[2 * I2C_QUEUE_DEPTH];
+    uint8_t wbuf[2 * I2C_QUEUE_DEPTH][4], rbuf[2 * I2C_QUEUE_DEPTH][4];
+    vector<I2CTransaction *> accepted, done;
+    int n = (int)in.below(2 * I2C_QUEUE_DEPTH + 1);
+    for (int i = 0; i < n; i++) {
+        for (int k = 0; k < 4; k++) wbuf[i][k] = in.u8();
+        uint8_t address = in.flag() ? 0x50 : 0x51;
+        txns[i] = I2CTransaction{address, wbuf[i], (int)in.below(5), rbuf[i], (int)in.below(5),
+                                 I2C_FuzzDone, &done, false};
+        if (I2C_Submit(&txns[i])) accepted.push_back(&txns[i]);
+        if (in.flag()) I2C_Step();                           // bus runs meanwhile
+        FW_FUZZ_CHECK(I2C_Async.count <= I2C_QUEUE_DEPTH);
+    }
+    while (I2C_Step()) {}
+    FW_FUZZ_CHECK_EQ(done.size(), accepted.size());
+    FW_FUZZ_CHECK(done == accepted);
+    for (I2CTransaction *t : done) FW_FUZZ_CHECK_EQ(t->ok, t->address == 0x50);
+    return true;
+}
+
+FW_FUZZ_MAIN()
@@ -0,0 +1,149 @@
+/*
+===============================================================================
+Purpose: Properties and fuzz target for the UART simulation
+         (10_uart_simulation.cpp): the frame parser on arbitrary byte
+         streams, frame round trips and error detection, and the
+         register/FIFO path against a reference model.
+Author: Sankalpa Hota
+How to compile & run (or `cmake --build build/release --target fuzz_uart`):
+  g++ -O2 -I. -fsanitize-coverage=trace-pc fuzz/fuzz_uart.cpp -o fuzz_uart -std=c++11 -pthread
+  ./fuzz_uart --props                       // property tests
+  ./fuzz_uart corpus_uart -max_total_time=60
+===============================================================================
+*/
+
+#define main UART_LessonMain
+#include "10_uart_simulation.cpp"
+#undef main
+#include "fw_fuzz.h"
+
+// --------------------------- Frame parser -----------------------------
+// Any byte stream: the parser stays inside its buffer (ASan builds),
+// and every frame it accepts is well formed and was started by a SOF
+FW_PROPERTY(FrameParserAnyStream) {
+    UART_FrameParser p;
+    unsigned long sofs = 0, accepted = 0;
+    while (!in.empty()) {
+        uint8_t b = in.u8();
+        if (b == UART_FRAME_SOF) sofs++;
+        if (!p.feed(b)) continue;
+        accepted++;
+        FW_FUZZ_CHECK(p.len <= UART_FRAME_MAX_LEN);
+        FW_FUZZ_CHECK_EQ(p.buf[0], p.len);
+        FW_FUZZ_CHECK_EQ(UART_Crc8(p.buf, 2 + p.len), b);
+    }
+    FW_FUZZ_CHECK_EQ(p.frames, accepted);
+    FW_FUZZ_CHECK(p.frames + p.crcErrors <= sofs);
+    return true;
+}
+
+FW_PROPERTY(FrameRoundTrip) {
+    uint8_t seq = in.u8();
+    std::vector<uint8_t> payload = in.bytes(UART_FRAME_MAX_LEN);
+    vector<uint8_t> frame;
+    UART_BuildFrame(frame, seq, payload.data(), (uint8_t)payload.size());
+
+    UART_FrameParser p;
+    for (size_t i = 0; i < frame.size(); i++)
+        FW_FUZZ_CHECK_EQ(p.feed(frame[i]), i + 1 == frame.size());
+    FW_FUZZ_CHECK_EQ(p.seq(), seq);
+    FW_FUZZ_CHECK_EQ((size_t)p.len, payload.size());
+    FW_FUZZ_CHECK(std::equal(payload.begin(), payload.end(), p.payload()));
+    return true;
+}
+
+// After any garbage, UART_FRAME_MAX_LEN + 3 idle (zero) bytes end
+// whatever frame the garbage started, and the next frame gets through
+FW_PROPERTY(FrameResyncAfterGarbage) {
+    std::vector<uint8_t> garbage = in.bytes(256);
+    uint8_t seq = in.u8();
+    std::vector<uint8_t> payload = in.bytes(UART_FRAME_MAX_LEN);
+    vector<uint8_t> frame;
+    UART_BuildFrame(frame, seq, payload.data(), (uint8_t)payload.size());
+
+    UART_FrameParser p;
+    for (uint8_t b : garbage) p.feed(b);
+    for (int i = 0; i < UART_FRAME_MAX_LEN + 3; i++) p.feed(0);
+    bool got = false;
+    for (uint8_t b : frame) got = p.feed(b);
+    FW_FUZZ_CHECK(got);
+    FW_FUZZ_CHECK_EQ(p.seq(), seq);
+    FW_FUZZ_CHECK(std::equal(payload.begin(), payload.end(), p.payload()));
+    return true;
+}
+
+// CRC-8 catches every single-bit error after LEN. (A flipped LEN makes
+// the parser take a payload byte as the CRC: caught only 255 times in
+// 256, which is why the property leaves LEN out.)
+FW_PROPERTY(FrameBitErrorRejected) {
+    uint8_t seq = in.u8();
+    std::vector<uint8_t> payload = in.bytes(UART_FRAME_MAX_LEN);
+    vector<uint8_t> frame;
+    UART_BuildFrame(frame, seq, payload.data(), (uint8_t)payload.size());
+    size_t bit = 16 + in.below((uint32_t)(frame.size() - 2) * 8);
+    frame[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+
+    UART_FrameParser p;
+    for (uint8_t b : frame) FW_FUZZ_CHECK(!p.feed(b));
+    FW_FUZZ_CHECK_EQ(p.crcErrors, 1ul);
+    return true;
+}
+
+// --------------------------- Register path -----------------------------
+// Writes, wire shifts and reads in any order behave like a bounded
+// queue: bytes come out in order, a full FIFO drops and counts
+FW_PROPERTY(RxFifoMatchesModel) {
+    UART_TxTimeMs = 0;
+    UART_Registers tx, rx;
+    int depth = 1 + (int)in.below(UART_RX_FIFO_MAX);
+    rx.rxBuffer.reset(depth);
+    std::deque<char> model;
+    unsigned long stored = 0, dropped = 0;
+    while (!in.empty()) {
+        uint8_t op = in.u8();
+        if (op & 1) {
+            char c = (char)in.u8();
+            UART_SendChar(tx, c);
+            UART_WireShiftByte(tx, rx);
+            if ((int)model.size() < depth) { model.push_back(c); stored++; }
+            else                           dropped++;
+        } else {
+            char want = model.empty() ? 0 : model.front();
+            if (!model.empty()) model.pop_front();
+            FW_FUZZ_CHECK_EQ(UART_ReadChar(rx), want);
+        }
+        FW_FUZZ_CHECK_EQ(rx.rxReady, !model.empty());
+        FW_FUZZ_CHECK_EQ(rx.rxBuffer.count, (int)model.size());
+    }
+    FW_FUZZ_CHECK_EQ(rx.rxBytes, stored);
+    FW_FUZZ_CHECK_EQ(rx.rxOverruns, dropped);
+    return true;
+}
+
+// With RTS/CTS the transmitter holds bytes back instead: nothing is
+// lost, nothing reordered, whatever the reader does
+FW_PROPERTY(FlowControlNeverOverruns) {
+    UART_TxTimeMs = 0;
+    UART_Registers tx, rx;
+    rx.rxBuffer.reset(3 + (int)in.below(UART_RX_FIFO_MAX - 2));
+    rx.flowControl = tx.flowControl = true;
+    UART_ConnectFlowControl(tx, rx);
+    std::vector<char> sent, received;
+    while (!in.empty()) {
+        uint8_t op = in.u8();
+        if (op & 1) {
+            char c = (char)in.u8();
+            UART_SendChar(tx, c);
+            sent.push_back(c);
+        } else if (rx.rxReady) {
+            received.push_back(UART_ReadChar(rx));
+        }
+        UART_WireShiftByte(tx, rx);
+    }
+    FW_FUZZ_CHECK_EQ(rx.rxOverruns, 0ul);
+    FW_FUZZ_CHECK(received.size() <= sent.size());
+    FW_FUZZ_CHECK(std::equal(received.begin(), received.end(), sent.begin()));
+    return true;
+}
+
+FW_FUZZ_MAIN()
@@ -0,0 +1,281 @@
+/*
+===============================================================================
+Purpose: Small in-tree microbenchmark harness for the simulators: host
+         cost per simulated operation, written as JSON so results can be
+         compared run to run.
+Author: Sankalpa Hota
+How to use:
+  #include "fw_bench.h"
+
+  int main(int argc, char **argv) {
+      FwBench_Init(argc, argv);           // --json= --baseline= --filter= --quick
+      FwBench_Run("UART/crc8_256B", [&] {
+          FwBench_Keep(UART_Crc8(buf, 256));
+      }, 256);                            // bytes per iteration (optional)
+      FwBench_Counter("sim_us", 87.0);    // extra value on the last result
+      return FwBench_Finish();            // table, JSON, baseline diff
+  }
+
+  bench_uart --json=bench_uart.json
+  bench_uart --baseline=old/bench_uart.json     // flags > 10% slower
+
+How it measures: the body is run in batches sized (by doubling) to take
+about FW_BENCH_MIN_NS; FW_BENCH_REPS batches are timed and the median
+ns per iteration is reported, with the fastest and slowest batch as a
+noise check. Timestamps come from fw_latency.h (rdtsc on x86), CPU time
+from std::clock(). Results depend on the machine: compare runs of the
+same build type on the same host.
+
+The JSON follows Google Benchmark's layout ("context" + "benchmarks",
+real_time/cpu_time in ns, bytes_per_second, items_per_second, extra
+counters as plain fields), so its tools/compare.py can read it too.
+FwBench_Finish() only reads back files in the layout it writes itself:
+one benchmark object per line.
+===============================================================================
+*/
+#ifndef FW_BENCH_H
+#define FW_BENCH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "fw_latency.h"
+
+#define FW_BENCH_MIN_NS     20000000ULL   // Target length of one timed batch
+#define FW_BENCH_QUICK_NS   2000000ULL    // Same, with --quick (smoke runs)
+#define FW_BENCH_REPS       5             // Timed batches per benchmark
+#define FW_BENCH_REGRESSION 10.0          // % slower than baseline to flag
+
+struct FwBenchResult {
+    std::string name;
+    uint64_t iterations;            // Per batch
+    double nsPerIter;               // Median batch
+    double minNs, maxNs;            // Fastest / slowest batch
+    double cpuNsPerIter;
+    double bytesPerIter, itemsPerIter;
+    std::vector<std::pair<std::string, double> > counters;
+};
+
+struct FwBenchState {
+    std::vector<FwBenchResult> results;
+    std::string jsonPath;
+    std::string baselinePath;
+    std::string filter;
+    uint64_t minNs = FW_BENCH_MIN_NS;
+};
+
+inline FwBenchState &FwBench_State() {
+    static FwBenchState state;
+    return state;
+}
+
+// Keeps the compiler from deleting a computation whose result is unused
+template <typename T>
+inline void FwBench_Keep(const T &value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile char sink;
+    sink = *(const volatile char *)&value;
+#endif
+}
+
+inline void FwBench_Init(int argc, char **argv) {
+    FwBenchState &s = FwBench_State();
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 7, "--json=") == 0)          s.jsonPath = arg.substr(7);
+        else if (arg.compare(0, 11, "--baseline=") == 0) s.baselinePath = arg.substr(11);
+        else if (arg.compare(0, 9, "--filter=") == 0)   s.filter = arg.substr(9);
+        else if (arg == "--quick")                      s.minNs = FW_BENCH_QUICK_NS;
+        else std::cerr << "[BENCH] ignoring unknown option " << arg << std::endl;
+    }
+    FwLat_Init();
+}
+
+inline double FwBench_CpuNs() { return (double)std::clock() * (1e9 / CLOCKS_PER_SEC); }
+
+// -----------------------------------------------------------------------------
+// Running
+// -----------------------------------------------------------------------------
+/*
+FwBench_Run(): time `body` (one iteration per call). bytesPerIter and
+itemsPerIter turn the time into bytes/s and items/s. Returns false if
+the filter skipped it.
+*/
+template <typename F>
+inline bool FwBench_Run(const char *name, F body, double bytesPerIter = 0,
+                        double itemsPerIter = 0) {
+    FwBenchState &s = FwBench_State();
+    if (!s.filter.empty() && std::string(name).find(s.filter) == std::string::npos) return false;
+
+    // Grow the batch until it takes long enough to time
+    uint64_t iters = 1;
+    while (true) {
+        uint64_t t0 = FwLat_NowNs();
+        for (uint64_t i = 0; i < iters; i++) body();
+        uint64_t ns = FwLat_NowNs() - t0;
+        if (ns >= s.minNs / 4 || iters >= (1ULL << 40)) {
+            if (ns) iters = std::max<uint64_t>(1, (uint64_t)((double)iters * s.minNs / ns));
+            break;
+        }
+        iters *= ns < s.minNs / 64 ? 8 : 2;
+    }
+
+    double perIter[FW_BENCH_REPS];
+    double cpu0 = FwBench_CpuNs();
+    for (int r = 0; r < FW_BENCH_REPS; r++) {
+        uint64_t t0 = FwLat_NowNs();
+        for (uint64_t i = 0; i < iters; i++) body();
+        perIter[r] = (double)(FwLat_NowNs() - t0) / (double)iters;
+    }
+    double cpu = (FwBench_CpuNs() - cpu0) / ((double)iters * FW_BENCH_REPS);
+    std::sort(perIter, perIter + FW_BENCH_REPS);
+
+    FwBenchResult res;
+    res.name = name;
+    res.iterations = iters;
+    res.nsPerIter = perIter[FW_BENCH_REPS / 2];
+    res.minNs = perIter[0];
+    res.maxNs = perIter[FW_BENCH_REPS - 1];
+    res.cpuNsPerIter = cpu;
+    res.bytesPerIter = bytesPerIter;
+    res.itemsPerIter = itemsPerIter;
+    s.results.push_back(res);
+    return true;
+}
+
+// Attach a value to the most recent result (e.g. simulated time per op)
+inline void FwBench_Counter(const char *name, double value) {
+    FwBenchState &s = FwBench_State();
+    if (!s.results.empty()) s.results.back().counters.push_back(std::make_pair(name, value));
+}
+
+// -----------------------------------------------------------------------------
+// Output
+// -----------------------------------------------------------------------------
+inline void FwBench_JsonNumber(std::ostream &out, const char *key, double v) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), ",\"%s\":%.6g", key, v);
+    out << buf;
+}
+
+inline void FwBench_WriteJson(std::ostream &out) {
+    FwBenchState &s = FwBench_State();
+    char date[32];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+    out << "{\"context\":{\"date\":\"" << date << "\",\"num_cpus\":"
+        << std::thread::hardware_concurrency() << ",\"clock\":\"" << FwLat_ClockName()
+#ifdef NDEBUG
+        << "\",\"library_build_type\":\"release\"},\n";
+#else
+        << "\",\"library_build_type\":\"debug\"},\n";
+#endif
+    out << "\"benchmarks\":[";
+    for (size_t i = 0; i < s.results.size(); i++) {
+        const FwBenchResult &r = s.results[i];
+        out << (i ? ",\n" : "\n") << "{\"name\":\"" << r.name << "\",\"run_name\":\"" << r.name
+            << "\",\"run_type\":\"iteration\",\"repetitions\":" << FW_BENCH_REPS
+            << ",\"iterations\":" << r.iterations;
+        FwBench_JsonNumber(out, "real_time", r.nsPerIter);
+        FwBench_JsonNumber(out, "cpu_time", r.cpuNsPerIter);
+        out << ",\"time_unit\":\"ns\"";
+        FwBench_JsonNumber(out, "real_time_min", r.minNs);
+        FwBench_JsonNumber(out, "real_time_max", r.maxNs);
+        if (r.bytesPerIter) FwBench_JsonNumber(out, "bytes_per_second", r.bytesPerIter * 1e9 / r.nsPerIter);
+        if (r.itemsPerIter) FwBench_JsonNumber(out, "items_per_second", r.itemsPerIter * 1e9 / r.nsPerIter);
+        for (size_t c = 0; c < r.counters.size(); c++)
+            FwBench_JsonNumber(out, r.counters[c].first.c_str(), r.counters[c].second);
+        out << '}';
+    }
+    out << "\n]}\n";
+}
+
+// name -> real_time from a file written by FwBench_WriteJson
+inline std::vector<std::pair<std::string, double> > FwBench_LoadBaseline(const std::string &path) {
+    std::vector<std::pair<std::string, double> > base;
+    std::ifstream in(path.c_str());
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t n = line.find("{\"name\":\""), t = line.find("\"real_time\":");
+        if (n == std::string::npos || t == std::string::npos) continue;
+        size_t end = line.find('"', n + 9);
+        base.push_back(std::make_pair(line.substr(n + 9, end - n - 9), atof(line.c_str() + t + 12)));
+    }
+    return base;
+}
+
+inline std::string FwBench_Rate(double perSecond, const char *unit) {
+    const char *prefix[] = {"", "k", "M", "G"};
+    int p = 0;
+    while (perSecond >= 1000 && p < 3) { perSecond /= 1000; p++; }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.1f %s%s/s", perSecond, prefix[p], unit);
+    return buf;
+}
+
+/*
+FwBench_Finish(): print the table, write --json, compare with
+--baseline. Returns the process exit code: 1 if any benchmark is more
+than FW_BENCH_REGRESSION % slower than its baseline, else 0.
+*/
+inline int FwBench_Finish() {
+    FwBenchState &s = FwBench_State();
+    std::vector<std::pair<std::string, double> > base;
+    if (!s.baselinePath.empty()) {
+        base = FwBench_LoadBaseline(s.baselinePath);
+        if (base.empty()) std::cerr << "[BENCH] no results in " << s.baselinePath << std::endl;
+    }
+
+    std::cout << std::left << std::setw(32) << "Benchmark" << std::right << std::setw(12)
+              << "ns/iter" << std::setw(24) << "min..max" << std::setw(16) << "rate";
+    if (!base.empty()) std::cout << std::setw(12) << "vs base";
+    std::cout << std::endl;
+
+    int regressions = 0;
+    for (const FwBenchResult &r : s.results) {
+        char spread[32];
+        snprintf(spread, sizeof(spread), "%.1f..%.1f", r.minNs, r.maxNs);
+        std::string rate = r.bytesPerIter ? FwBench_Rate(r.bytesPerIter * 1e9 / r.nsPerIter, "B")
+                         : r.itemsPerIter ? FwBench_Rate(r.itemsPerIter * 1e9 / r.nsPerIter, "op")
+                         : "";
+        std::cout << std::left << std::setw(32) << r.name << std::right << std::fixed
+                  << std::setprecision(1) << std::setw(12) << r.nsPerIter << std::setw(24)
+                  << spread << std::setw(16) << rate;
+        for (size_t i = 0; i < base.size(); i++) {
+            if (base[i].first != r.name || base[i].second <= 0) continue;
+            double pct = (r.nsPerIter / base[i].second - 1.0) * 100.0;
+            char diff[32];
+            snprintf(diff, sizeof(diff), "%+.1f%%", pct);
+            std::cout << std::setw(12) << diff;
+            if (pct > FW_BENCH_REGRESSION) { std::cout << "  SLOWER"; regressions++; }
+        }
+        for (size_t c = 0; c < r.counters.size(); c++)
+            std::cout << "  " << r.counters[c].first << "=" << std::setprecision(2)
+                      << r.counters[c].second;
+        std::cout << std::endl;
+    }
+
+    if (!s.jsonPath.empty()) {
+        std::ofstream out(s.jsonPath.c_str());
+        FwBench_WriteJson(out);
+        std::cout << "[BENCH] " << s.results.size() << " results written to " << s.jsonPath << std::endl;
+    }
+    if (regressions)
+        std::cout << "[BENCH] " << regressions << " benchmark(s) more than " << FW_BENCH_REGRESSION
+                  << "% slower than " << s.baselinePath << std::endl;
+    return regressions ? 1 : 0;
+}
+
+#endif // FW_BENCH_H
@@ -0,0 +1,253 @@
+/*
+===============================================================================
+Purpose: Run thousands of simulated devices in one process: a
+         work-stealing thread pool and a farm runner that advances every
+         device in lock-step epochs of simulated time.
+Author: Sankalpa Hota
+How to use:
+  #include "fw_farm.h"
+
+  FwPool pool;                                   // one worker per core
+  FwFarmStats st = FwFarm_Run(pool, devices.size(), epochs,
+      [&](size_t i, size_t epoch) {              // on some worker
+          Device &d = *devices[i];
+          I2C_Use(&d.i2c);                       // this device's peripherals
+          d.runFor(100);                         // 100 ms of its firmware
+      },
+      [&](size_t epoch) {                        // between epochs, one thread
+          return fleet.plan(epoch);              // false ends the run
+      });
+  FwFarm_Report(cout, st);
+
+FwPool: every worker owns a deque. It runs its own tasks newest first
+(the data they touch is still in its cache) and, when that runs dry,
+steals the oldest task of another worker, starting at a random one.
+submit() from inside a task goes to the running worker's own deque;
+from outside, tasks are dealt round-robin unless a worker is named.
+Each deque has its own mutex, so workers only meet when one steals.
+
+FwFarm_Run(): conservative time-stepped simulation. An epoch runs
+slice(device, epoch) once for every device, then waits for all of them
+(the barrier) and calls between(epoch) on the calling thread. Devices
+only see each other through what between() publishes, so the results
+are the same for any number of workers and any steal pattern. Device i
+starts every epoch in the deque of worker i * W / N: it tends to stay
+on one core, and stealing evens out devices that cost more this epoch.
+
+A slice must only touch its own device. Simulators with one global
+instance per peripheral select the device's instances first
+(SPI_Use, I2C_Use, LED_Use). The epochs already make a run repeatable,
+so the workers stay out of fw_sched.h's deterministic mode: they mark
+themselves FwSched_Unscheduled, and FwMutex and friends inside a slice
+are the std primitives even with FW_SCHED_SEED set.
+===============================================================================
+*/
+#ifndef FW_FARM_H
+#define FW_FARM_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "fw_sched.h"
+
+#define FW_FARM_MAX_WORKERS 256
+
+// -----------------------------------------------------------------------------
+// Work-stealing pool
+// -----------------------------------------------------------------------------
+struct FwPoolWorker {
+    std::mutex m;                                   // Guards q
+    std::deque<std::function<void()> > q;
+    // Written by the worker itself, read after FwPool::wait()
+    unsigned long executed = 0;                     // Tasks run
+    unsigned long stolen = 0;                       // ... taken from another deque
+    uint64_t busyNs = 0;                            // Time spent inside tasks
+};
+
+inline int &FwPool_Self() {                         // Worker index, -1 outside
+    static thread_local int self = -1;
+    return self;
+}
+
+class FwPool {
+public:
+    explicit FwPool(int workers = 0) {
+        if (workers <= 0) workers = (int)std::thread::hardware_concurrency();
+        workers = std::max(1, std::min(workers, FW_FARM_MAX_WORKERS));
+        for (int i = 0; i < workers; i++) w.emplace_back(new FwPoolWorker);
+        for (int i = 0; i < workers; i++) threads.emplace_back(&FwPool::loop, this, i);
+    }
+    ~FwPool() {
+        wait();
+        {
+            std::lock_guard<std::mutex> lk(idleMutex);
+            stopping = true;
+        }
+        idleCv.notify_all();
+        for (std::thread &t : threads) t.join();
+    }
+    FwPool(const FwPool &) = delete;
+    FwPool &operator=(const FwPool &) = delete;
+
+    int size() const { return (int)w.size(); }
+    const FwPoolWorker &worker(int i) const { return *w[i]; }
+
+    void submit(std::function<void()> task, int worker = -1) {
+        int n = size();
+        if (worker < 0) worker = FwPool_Self() >= 0 ? FwPool_Self() : (int)(nextWorker++ % n);
+        pending.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lk(w[worker % n]->m);
+            w[worker % n]->q.push_back(std::move(task));
+        }
+        queued.fetch_add(1, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lk(idleMutex);  // no lost wake-up
+        }
+        idleCv.notify_one();
+    }
+
+    // Returns once every submitted task (and what they submitted) has run
+    void wait() {
+        std::unique_lock<std::mutex> lk(idleMutex);
+        doneCv.wait(lk, [&] { return pending.load(std::memory_order_acquire) == 0; });
+    }
+
+    void resetStats() {
+        for (auto &p : w) { p->executed = p->stolen = 0; p->busyNs = 0; }
+    }
+
+private:
+    bool take(int self, std::function<void()> &task, bool &stolen, uint64_t &rng) {
+        {
+            FwPoolWorker &own = *w[self];
+            std::lock_guard<std::mutex> lk(own.m);
+            if (!own.q.empty()) {
+                task = std::move(own.q.back());
+                own.q.pop_back();
+                stolen = false;
+                return true;
+            }
+        }
+        int n = size();
+        rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+        int start = (int)((rng >> 33) % (uint64_t)n);
+        for (int k = 0; k < n; k++) {
+            int v = (start + k) % n;
+            if (v == self) continue;
+            std::lock_guard<std::mutex> lk(w[v]->m);
+            if (w[v]->q.empty()) continue;
+            task = std::move(w[v]->q.front());
+            w[v]->q.pop_front();
+            stolen = true;
+            return true;
+        }
+        return false;
+    }
+
+    void loop(int self) {
+        FwPool_Self() = self;
+        FwSched_Unscheduled() = true;               // plain threads, see above
+        FwPoolWorker &me = *w[self];
+        uint64_t rng = 0x9E3779B97F4A7C15ULL * (self + 1);
+        while (true) {
+            std::function<void()> task;
+            bool stolen = false;
+            if (!take(self, task, stolen, rng)) {
+                std::unique_lock<std::mutex> lk(idleMutex);
+                idleCv.wait(lk, [&] { return stopping || queued.load(std::memory_order_acquire) > 0; });
+                if (stopping && queued.load(std::memory_order_acquire) == 0) return;
+                continue;
+            }
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            auto t0 = std::chrono::steady_clock::now();
+            task();
+            me.busyNs += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - t0).count();
+            me.executed++;
+            if (stolen) me.stolen++;
+            if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lk(idleMutex);
+                doneCv.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<FwPoolWorker> > w;
+    std::vector<std::thread> threads;
+    std::atomic<long> pending{0};                   // Submitted, not finished
+    std::atomic<long> queued{0};                    // Waiting in some deque
+    std::atomic<unsigned long> nextWorker{0};
+    std::mutex idleMutex;
+    std::condition_variable idleCv, doneCv;
+    bool stopping = false;
+};
+
+// -----------------------------------------------------------------------------
+// Farm runner
+// -----------------------------------------------------------------------------
+struct FwFarmStats {
+    size_t devices = 0;
+    size_t epochs = 0;                              // Completed
+    unsigned long slices = 0;
+    unsigned long steals = 0;
+    double wallSec = 0;
+    std::vector<unsigned long> workerSlices, workerSteals;
+    std::vector<double> workerBusy;                 // Share of wall time
+};
+
+inline FwFarmStats FwFarm_Run(FwPool &pool, size_t devices, size_t epochs,
+                              const std::function<void(size_t, size_t)> &slice,
+                              const std::function<bool(size_t)> &between = nullptr) {
+    FwFarmStats st;
+    st.devices = devices;
+    int n = pool.size();
+    pool.wait();
+    pool.resetStats();
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t e = 0; e < epochs; e++) {
+        for (size_t i = 0; i < devices; i++)
+            pool.submit([&slice, i, e] { slice(i, e); }, (int)(i * n / devices));
+        pool.wait();                                // barrier
+        st.epochs++;
+        if (between && !between(e)) break;
+    }
+    st.wallSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    for (int k = 0; k < n; k++) {
+        const FwPoolWorker &wk = pool.worker(k);
+        st.workerSlices.push_back(wk.executed);
+        st.workerSteals.push_back(wk.stolen);
+        st.workerBusy.push_back(st.wallSec > 0 ? wk.busyNs / 1e9 / st.wallSec : 0);
+        st.slices += wk.executed;
+        st.steals += wk.stolen;
+    }
+    return st;
+}
+
+inline void FwFarm_Report(std::ostream &out, const FwFarmStats &st) {
+    char line[160];
+    snprintf(line, sizeof(line), "%zu devices x %zu epochs = %lu slices in %.2f s (%.0f slices/s), "
+             "%lu stolen (%.1f%%)\n", st.devices, st.epochs, st.slices, st.wallSec,
+             st.wallSec > 0 ? st.slices / st.wallSec : 0.0, st.steals,
+             st.slices ? 100.0 * st.steals / st.slices : 0.0);
+    out << line;
+    out << "Worker  Slices      Stolen      Busy %\n";
+    for (size_t k = 0; k < st.workerSlices.size(); k++) {
+        snprintf(line, sizeof(line), "%-7zu %-11lu %-11lu %.1f\n", k, st.workerSlices[k],
+                 st.workerSteals[k], 100.0 * st.workerBusy[k]);
+        out << line;
+    }
+}
+
+#endif // FW_FARM_H
@@ -0,0 +1,688 @@
+/*
+===============================================================================
+Purpose: Property-based and coverage-guided fuzz testing of the protocol
+         state machines and parsers: one set of properties, run either as
+         unit tests with random inputs that shrink to a minimal failing
+         case, or as an in-process fuzzer (standalone or libFuzzer).
+Author: Sankalpa Hota
+How to use:
+  #include "fw_fuzz.h"
+
+  // A property reads whatever it needs from `in` and checks an invariant
+  FW_PROPERTY(FrameRoundTrip) {
+      uint8_t seq = in.u8();
+      std::vector<uint8_t> payload = in.bytes(UART_FRAME_MAX_LEN);
+      ...
+      FW_FUZZ_CHECK_EQ(parser.seq(), seq);
+      return true;
+  }
+
+  FW_FUZZ_MAIN()     // main(), or LLVMFuzzerTestOneInput with FW_FUZZ_LIBFUZZER
+
+  ./fuzz_uart --props [--filter=Frame] [-runs=N] [-seed=N]   // property tests
+  ./fuzz_uart [corpus_dir] [-runs=N] [-max_total_time=S] [-max_len=N]
+  ./fuzz_uart crash-1a2b3c4d5e6f7081                         // replay a file
+
+Inputs are plain bytes. FwFuzzInput turns them into values (u8, below,
+bytes...); past the end every draw returns 0. That one idea serves both
+modes: the fuzzer mutates bytes and never needs to know the types, and
+the property runner shrinks a failing input by deleting and lowering
+bytes, which turns into shorter payloads and smaller numbers.
+
+With several properties in one binary the first input byte selects the
+property (modulo their count), so every crash file replays on its own.
+
+Property mode (--props) registers one fw_test.h case per property
+("Property.<name>"): FW_FUZZ_PROP_RUNS random inputs of growing length,
+seeded from the name (or -seed=), so runs are repeatable. A failure is
+shrunk, printed in hex and saved as crash-<hash> for replay.
+
+Fuzz mode mutates a corpus (flip, set, insert, erase, copy, splice) and
+keeps inputs that reach new code. Coverage comes from the compiler's
+-fsanitize-coverage=trace-pc hook, which this file implements (GCC and
+Clang, as the CMake build sets it up); without the flag the fuzzer runs
+blind. A failing property or a crash signal (also ASan reports) saves
+the input as <artifact_prefix>crash-<hash>. Built with Clang and
+-DFW_FUZZ_LIBFUZZER -fsanitize=fuzzer the same file is a libFuzzer
+target and libFuzzer's engine and options take over.
+
+Fuzzing runs millions of inputs in one process: a property must reset
+every simulator it touches (I2C_Reset, fresh objects) and never sleep
+or start threads.
+===============================================================================
+*/
+#ifndef FW_FUZZ_H
+#define FW_FUZZ_H
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "fw_test.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FW_FUZZ_POSIX 1
+#endif
+
+#define FW_FUZZ_MAX_LEN         1024    // Longest generated / mutated input
+#define FW_FUZZ_PROP_RUNS       2000    // Random inputs per property (--props)
+#define FW_FUZZ_SHRINK_RUNS     4000    // Property evaluations spent shrinking
+#define FW_FUZZ_MAX_MUTATIONS   8       // Stacked mutations per fuzz input
+#define FW_FUZZ_MAP_SIZE        16384   // Coverage map entries (power of 2)
+
+// -----------------------------------------------------------------------------
+// Input: bytes in, typed values out
+// -----------------------------------------------------------------------------
+struct FwFuzzInput {
+    const uint8_t *data;
+    size_t size;
+    size_t pos = 0;
+
+    FwFuzzInput(const uint8_t *d, size_t n) : data(d), size(n) {}
+
+    bool empty() const { return pos >= size; }
+    size_t remaining() const { return pos < size ? size - pos : 0; }
+
+    uint8_t u8() { return pos < size ? data[pos++] : 0; }
+    uint16_t u16() { uint16_t v = u8(); return (uint16_t)(v | (u8() << 8)); }
+    uint32_t u32() { uint32_t v = u16(); return v | ((uint32_t)u16() << 16); }
+    bool flag() { return u8() & 1; }
+
+    // 0..n-1 (n > 0), from as few bytes as the range needs
+    uint32_t below(uint32_t n) {
+        uint32_t v = n <= 0x100 ? u8() : n <= 0x10000 ? u16() : u32();
+        return v % n;
+    }
+    uint32_t range(uint32_t lo, uint32_t hi) { return lo + below(hi - lo + 1); }
+
+    // Length-prefixed byte string of at most maxLen bytes
+    std::vector<uint8_t> bytes(size_t maxLen) {
+        std::vector<uint8_t> out(below((uint32_t)maxLen + 1));
+        for (size_t i = 0; i < out.size(); i++) out[i] = u8();
+        return out;
+    }
+    // Everything not consumed yet
+    std::vector<uint8_t> rest() {
+        std::vector<uint8_t> out(data + (pos < size ? pos : size), data + size);
+        pos = size;
+        return out;
+    }
+};
+
+// -----------------------------------------------------------------------------
+// Registry and state
+// -----------------------------------------------------------------------------
+typedef bool (*FwFuzzPropertyFn)(FwFuzzInput &in);
+
+struct FwFuzzProperty {
+    const char *name;
+    FwFuzzPropertyFn fn;
+};
+
+struct FwFuzzState {
+    std::vector<FwFuzzProperty> props;
+    std::string failure;                // Message of the last failed check
+    std::string artifactPrefix;
+    std::string program = "fuzz";       // argv[0], for replay hints
+    uint64_t seed = 0;                  // 0: derived from the property name
+    long long runs = -1;                // Per property (--props) or total
+    size_t maxLen = FW_FUZZ_MAX_LEN;
+};
+
+inline FwFuzzState &FwFuzz_State() {
+    static FwFuzzState state;
+    return state;
+}
+
+// Coverage map and the input being run, shared with the trace-pc hook
+// and the crash handler (template statics: no init guard, no ODR trouble)
+template <int N>
+struct FwFuzzGlobalsT {
+    static uint8_t map[FW_FUZZ_MAP_SIZE];
+    static uintptr_t prevLoc;
+    static volatile bool tracing;
+    static const uint8_t *volatile current;
+    static volatile size_t currentSize;
+    static char artifactPrefix[256];
+};
+template <int N> uint8_t FwFuzzGlobalsT<N>::map[FW_FUZZ_MAP_SIZE];
+template <int N> uintptr_t FwFuzzGlobalsT<N>::prevLoc;
+template <int N> volatile bool FwFuzzGlobalsT<N>::tracing;
+template <int N> const uint8_t *volatile FwFuzzGlobalsT<N>::current;
+template <int N> volatile size_t FwFuzzGlobalsT<N>::currentSize;
+template <int N> char FwFuzzGlobalsT<N>::artifactPrefix[256];
+typedef FwFuzzGlobalsT<0> FwFuzzGlobals;
+
+/*
+The trace-pc hook: the compiler calls it at every basic block. Blocks
+are hashed into the map AFL-style (previous ^ current location), so the
+map counts edges rather than blocks. It must not be instrumented itself.
+*/
+#if defined(__clang__)
+#define FW_FUZZ_NO_COVERAGE __attribute__((no_sanitize("coverage")))
+#elif defined(__GNUC__) && __GNUC__ >= 12        // older GCC: no hook, fuzz blind
+#define FW_FUZZ_NO_COVERAGE __attribute__((no_sanitize_coverage))
+#endif
+#if defined(FW_FUZZ_NO_COVERAGE) && !defined(FW_FUZZ_LIBFUZZER)
+extern "C" __attribute__((weak)) FW_FUZZ_NO_COVERAGE void __sanitizer_cov_trace_pc() {
+    if (!FwFuzzGlobals::tracing) return;
+    uintptr_t pc = (uintptr_t)__builtin_return_address(0);
+    uintptr_t loc = (pc ^ (pc >> 14)) & (FW_FUZZ_MAP_SIZE - 1);
+    FwFuzzGlobals::map[loc ^ FwFuzzGlobals::prevLoc]++;
+    FwFuzzGlobals::prevLoc = loc >> 1;
+}
+#endif
+
+struct FwFuzzRegistrar {
+    FwFuzzRegistrar(const char *name, FwFuzzPropertyFn fn);
+};
+
+#define FW_PROPERTY(name)                                                         \
+    static bool FwProp_##name(FwFuzzInput &in);                                   \
+    static FwFuzzRegistrar FwProp_##name##_reg(#name, FwProp_##name);             \
+    static bool FwProp_##name(FwFuzzInput &in)
+
+// Checks inside a property: report and return false
+inline bool FwFuzz_Fail(const char *file, int line, const std::string &msg) {
+    FwFuzz_State().failure = std::string(file) + ":" + std::to_string(line) + ": " + msg;
+    return false;
+}
+
+#define FW_FUZZ_CHECK(c)                                                          \
+    do { if (!(c)) return FwFuzz_Fail(__FILE__, __LINE__, "check failed: " #c); } while (0)
+
+#define FW_FUZZ_CHECK_EQ(a, b)                                                    \
+    do {                                                                          \
+        if (!((a) == (b)))                                                        \
+            return FwFuzz_Fail(__FILE__, __LINE__, std::string("expected " #a " == " #b ", got ") + \
+                               FwTest_Str(a) + " vs " + FwTest_Str(b));           \
+    } while (0)
+
+// -----------------------------------------------------------------------------
+// Running one input
+// -----------------------------------------------------------------------------
+inline std::string FwFuzz_Hash(const uint8_t *data, size_t size) {
+    uint64_t h = 1469598103934665603ULL;                  // FNV-1a
+    for (size_t i = 0; i < size; i++) h = (h ^ data[i]) * 1099511628211ULL;
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+    return buf;
+}
+
+// Property `index` on raw property bytes (no selector byte)
+inline bool FwFuzz_RunProperty(size_t index, const uint8_t *data, size_t size) {
+    FwFuzzState &s = FwFuzz_State();
+    FwFuzzInput in(data, size);
+    s.failure.clear();
+    bool ok = s.props[index].fn(in);
+    if (!ok && s.failure.empty()) s.failure = "property returned false";
+    return ok;
+}
+
+// A fuzz input: selector byte (with more than one property), then the
+// property's bytes
+inline size_t FwFuzz_Select(const uint8_t *&data, size_t &size) {
+    size_t n = FwFuzz_State().props.size();
+    if (n <= 1) return 0;
+    if (size == 0) return 0;
+    size_t index = data[0] % n;
+    data++;
+    size--;
+    return index;
+}
+
+inline bool FwFuzz_RunInput(const uint8_t *data, size_t size) {
+    if (FwFuzz_State().props.empty()) return true;
+    FwFuzzGlobals::current = data;
+    FwFuzzGlobals::currentSize = size;
+    size_t index = FwFuzz_Select(data, size);
+    FwFuzzGlobals::prevLoc = 0;
+    FwFuzzGlobals::tracing = true;
+    bool ok = FwFuzz_RunProperty(index, data, size);
+    FwFuzzGlobals::tracing = false;
+    return ok;
+}
+
+// Input with its selector byte, as the fuzz driver would read it
+inline std::vector<uint8_t> FwFuzz_WithSelector(size_t index, const std::vector<uint8_t> &bytes) {
+    std::vector<uint8_t> out;
+    if (FwFuzz_State().props.size() > 1) out.push_back((uint8_t)index);
+    out.insert(out.end(), bytes.begin(), bytes.end());
+    return out;
+}
+
+inline std::string FwFuzz_Hex(const std::vector<uint8_t> &bytes, size_t max = 64) {
+    std::string out;
+    char buf[4];
+    for (size_t i = 0; i < bytes.size() && i < max; i++) {
+        snprintf(buf, sizeof(buf), "%02x", bytes[i]);
+        out += (i ? " " : "") + std::string(buf);
+    }
+    if (bytes.size() > max) out += " ...";
+    return out.empty() ? "(empty)" : out;
+}
+
+inline std::string FwFuzz_SaveArtifact(const std::vector<uint8_t> &input) {
+    std::string path = FwFuzz_State().artifactPrefix + "crash-" +
+                       FwFuzz_Hash(input.data(), input.size());
+    std::ofstream out(path.c_str(), std::ios::binary);
+    out.write((const char *)input.data(), (std::streamsize)input.size());
+    return path;
+}
+
+// -----------------------------------------------------------------------------
+// Shrinking
+// -----------------------------------------------------------------------------
+/*
+FwFuzz_Shrink(): make a failing input smaller while it still fails:
+delete chunks (halves first, down to single bytes), then lower each
+byte (to 0, to half, by one). Repeats until nothing helps or the budget
+of FW_FUZZ_SHRINK_RUNS evaluations is spent.
+*/
+inline void FwFuzz_Shrink(std::vector<uint8_t> &input,
+                          const std::function<bool(const std::vector<uint8_t> &)> &fails) {
+    int budget = FW_FUZZ_SHRINK_RUNS;
+    bool progress = true;
+    while (progress && budget > 0) {
+        progress = false;
+        for (size_t chunk = input.size() / 2 ? input.size() / 2 : 1; chunk > 0 && budget > 0; chunk /= 2) {
+            for (size_t at = 0; at + chunk <= input.size() && budget > 0; budget--) {
+                std::vector<uint8_t> t(input);
+                t.erase(t.begin() + at, t.begin() + at + chunk);
+                if (fails(t)) { input.swap(t); progress = true; }
+                else          at += chunk;
+            }
+        }
+        for (size_t i = 0; i < input.size() && budget > 0; i++) {
+            const uint8_t tries[3] = {0, (uint8_t)(input[i] / 2), (uint8_t)(input[i] - 1)};
+            for (int k = 0; k < 3 && input[i] && budget > 0; k++, budget--) {
+                if (tries[k] >= input[i]) continue;
+                std::vector<uint8_t> t(input);
+                t[i] = tries[k];
+                if (fails(t)) { input.swap(t); progress = true; break; }
+            }
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Property mode
+// -----------------------------------------------------------------------------
+inline uint64_t FwFuzz_Rand(uint64_t &state) {                 // splitmix64
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/*
+FwFuzz_CheckProperty(): the body of a "Property.<name>" test case.
+Inputs grow from a few bytes to maxLen over the runs, so simple cases
+are tried first; the first failure is shrunk and reported.
+*/
+inline void FwFuzz_CheckProperty(size_t index) {
+    FwFuzzState &s = FwFuzz_State();
+    const FwFuzzProperty &p = s.props[index];
+    uint64_t seed = s.seed;
+    if (!seed) {
+        std::string hash = FwFuzz_Hash((const uint8_t *)p.name, strlen(p.name));
+        seed = strtoull(hash.c_str(), nullptr, 16);
+    }
+    uint64_t rng = seed;
+    long long runs = s.runs > 0 ? s.runs : FW_FUZZ_PROP_RUNS;
+    std::vector<uint8_t> input;
+    for (long long r = 0; r < runs; r++) {
+        size_t limit = 8 + (size_t)((double)s.maxLen * (double)(r + 1) / (double)runs);
+        input.resize(FwFuzz_Rand(rng) % (limit + 1));
+        for (size_t i = 0; i < input.size(); i++) input[i] = (uint8_t)FwFuzz_Rand(rng);
+        if (FwFuzz_RunProperty(index, input.data(), input.size())) continue;
+
+        size_t originalSize = input.size();
+        FwFuzz_Shrink(input, [index](const std::vector<uint8_t> &t) {
+            return !FwFuzz_RunProperty(index, t.data(), t.size());
+        });
+        FwFuzz_RunProperty(index, input.data(), input.size());   // message of the minimal case
+        std::string path = FwFuzz_SaveArtifact(FwFuzz_WithSelector(index, input));
+        std::ostringstream msg;
+        msg << "property " << p.name << " failed on run " << r + 1 << " (seed " << seed << ")\n"
+            << "    " << s.failure << "\n"
+            << "    minimal input (" << input.size() << " of " << originalSize
+            << " bytes): " << FwFuzz_Hex(input) << "\n"
+            << "    replay: " << s.program << " " << path;
+        FwTest_Fail(__FILE__, __LINE__, msg.str());
+        return;
+    }
+}
+
+inline FwFuzzRegistrar::FwFuzzRegistrar(const char *name, FwFuzzPropertyFn fn) {
+    FwFuzzState &s = FwFuzz_State();
+    size_t index = s.props.size();
+    s.props.push_back(FwFuzzProperty{name, fn});
+    FwTest_State().cases.push_back(
+        FwTestCase{std::string("Property.") + name, [index] { FwFuzz_CheckProperty(index); }});
+}
+
+// -----------------------------------------------------------------------------
+// Fuzz mode
+// -----------------------------------------------------------------------------
+/*
+Crash handler: a signal (or an ASan report) in the middle of an input
+saves that input before the process dies. Only async-signal-safe calls.
+*/
+#ifdef FW_FUZZ_POSIX
+inline void FwFuzz_SaveCurrentRaw() {
+    const uint8_t *data = FwFuzzGlobals::current;
+    size_t size = FwFuzzGlobals::currentSize;
+    if (!data) return;
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < size; i++) h = (h ^ data[i]) * 1099511628211ULL;
+    char path[256 + 32];
+    size_t n = 0;
+    for (const char *p = FwFuzzGlobals::artifactPrefix; *p && n < 256; p++) path[n++] = *p;
+    const char *crash = "crash-";
+    while (*crash) path[n++] = *crash++;
+    for (int i = 15; i >= 0; i--) path[n++] = "0123456789abcdef"[(h >> (4 * i)) & 0xF];
+    path[n] = '\0';
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        ssize_t w = write(fd, data, size);
+        (void)w;
+        close(fd);
+    }
+    const char *msg = "[FUZZ] crash, input saved to ";
+    ssize_t w = write(2, msg, strlen(msg));
+    w = write(2, path, n);
+    w = write(2, "\n", 1);
+    (void)w;
+    FwFuzzGlobals::current = nullptr;
+}
+
+inline void FwFuzz_CrashSignal(int sig) {
+    FwFuzz_SaveCurrentRaw();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+#if defined(__SANITIZE_ADDRESS__)
+#define FW_FUZZ_ASAN 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define FW_FUZZ_ASAN 1
+#endif
+#endif
+#ifdef FW_FUZZ_ASAN
+extern "C" void __sanitizer_set_death_callback(void (*callback)(void));
+#endif
+
+inline void FwFuzz_InstallCrashHandler() {
+    const int sigs[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+    for (int sig : sigs) signal(sig, FwFuzz_CrashSignal);
+#ifdef FW_FUZZ_ASAN
+    __sanitizer_set_death_callback(FwFuzz_SaveCurrentRaw);
+#endif
+}
+#else
+inline void FwFuzz_InstallCrashHandler() {}
+#endif
+
+// Features of the last run: (edge, hit-count bucket) pairs not seen before
+inline size_t FwFuzz_NewFeatures(std::vector<uint8_t> &seen, size_t &total) {
+    static const uint8_t bucket[9] = {0, 1, 2, 3, 3, 4, 4, 4, 4};   // 1,2,3,4-7,8+
+    uint8_t *map = FwFuzzGlobals::map;
+    size_t found = 0;
+    for (size_t w = 0; w < FW_FUZZ_MAP_SIZE; w += 8) {
+        uint64_t word;
+        memcpy(&word, map + w, 8);
+        if (!word) continue;
+        for (size_t i = w; i < w + 8; i++) {
+            if (!map[i]) continue;
+            uint8_t b = map[i] >= 8 ? (map[i] >= 32 ? (map[i] >= 128 ? 7 : 6) : 5) : bucket[map[i]];
+            if (!(seen[i] & (1 << b))) { seen[i] |= (uint8_t)(1 << b); found++; }
+            map[i] = 0;
+        }
+    }
+    total += found;
+    return found;
+}
+
+inline void FwFuzz_Mutate(std::vector<uint8_t> &in, const std::vector<std::vector<uint8_t> > &corpus,
+                          uint64_t &rng, size_t maxLen) {
+    static const uint8_t interesting[] = {0x00, 0x01, 0x02, 0x7E, 0x7F, 0x80, 0x81, 0xFE, 0xFF, 0x10, 0x20, 0x40};
+    int count = 1 + (int)(FwFuzz_Rand(rng) % FW_FUZZ_MAX_MUTATIONS);
+    for (int m = 0; m < count; m++) {
+        uint64_t r = FwFuzz_Rand(rng);
+        size_t at = in.empty() ? 0 : (size_t)((r >> 8) % in.size());
+        switch (r % 9) {
+        case 0:                                             // flip one bit
+            if (!in.empty()) in[at] ^= (uint8_t)(1 << ((r >> 40) & 7));
+            break;
+        case 1:                                             // random byte
+            if (!in.empty()) in[at] = (uint8_t)(r >> 40);
+            break;
+        case 2:                                             // interesting byte
+            if (!in.empty()) in[at] = interesting[(r >> 40) % sizeof(interesting)];
+            break;
+        case 3:                                             // small add / subtract
+            if (!in.empty()) in[at] = (uint8_t)(in[at] + (int)((r >> 40) % 17) - 8);
+            break;
+        case 4: {                                           // insert random bytes
+            size_t n = 1 + (r >> 40) % 8;
+            for (size_t i = 0; i < n; i++) in.insert(in.begin() + at, (uint8_t)FwFuzz_Rand(rng));
+            break;
+        }
+        case 5: {                                           // erase a range
+            if (in.empty()) break;
+            size_t n = 1 + (r >> 40) % std::min<size_t>(in.size() - at, 16);
+            in.erase(in.begin() + at, in.begin() + at + n);
+            break;
+        }
+        case 6: {                                           // copy a chunk inside
+            if (in.size() < 2) break;
+            size_t from = (size_t)((r >> 24) % in.size());
+            size_t n = 1 + (r >> 40) % std::min<size_t>(in.size() - std::max(at, from), 16);
+            std::vector<uint8_t> chunk(in.begin() + from, in.begin() + from + n);
+            std::copy(chunk.begin(), chunk.end(), in.begin() + at);
+            break;
+        }
+        case 7: {                                           // splice another input
+            const std::vector<uint8_t> &other = corpus[(size_t)((r >> 24) % corpus.size())];
+            if (other.empty()) break;
+            size_t from = (size_t)((r >> 40) % other.size());
+            in.resize(at);
+            in.insert(in.end(), other.begin() + from, other.end());
+            break;
+        }
+        case 8:                                             // truncate
+            in.resize(at);
+            break;
+        }
+        if (in.size() > maxLen) in.resize(maxLen);
+    }
+}
+
+inline bool FwFuzz_ReadFile(const std::string &path, std::vector<uint8_t> &out) {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in) return false;
+    out.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+inline bool FwFuzz_IsDir(const std::string &path) {
+#ifdef FW_FUZZ_POSIX
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+inline std::vector<std::string> FwFuzz_ListDir(const std::string &dir) {
+    std::vector<std::string> files;
+#ifdef FW_FUZZ_POSIX
+    if (DIR *d = opendir(dir.c_str())) {
+        while (struct dirent *e = readdir(d))
+            if (e->d_name[0] != '.') files.push_back(dir + "/" + e->d_name);
+        closedir(d);
+    }
+#else
+    (void)dir;
+#endif
+    return files;
+}
+
+// A failing input: shrink it, save it, print it. Returns the exit code.
+inline int FwFuzz_ReportFailure(std::vector<uint8_t> input) {
+    FwFuzzState &s = FwFuzz_State();
+    FwFuzzGlobals::current = nullptr;
+    size_t originalSize = input.size();
+    FwFuzz_Shrink(input, [](const std::vector<uint8_t> &t) { return !FwFuzz_RunInput(t.data(), t.size()); });
+    FwFuzz_RunInput(input.data(), input.size());
+    const uint8_t *data = input.data();
+    size_t size = input.size();
+    size_t index = FwFuzz_Select(data, size);
+    std::cout << "[FUZZ] property " << s.props[index].name << " failed\n    " << s.failure
+              << "\n    minimal input (" << input.size() << " of " << originalSize
+              << " bytes): " << FwFuzz_Hex(input) << "\n    saved as "
+              << FwFuzz_SaveArtifact(input) << std::endl;
+    return 1;
+}
+
+/*
+FwFuzz_Main(): property tests (--props), replay of files, or fuzzing.
+Fuzz options use libFuzzer's spelling so scripts work with both:
+  -runs=N -max_total_time=S -seed=N -max_len=N -artifact_prefix=P
+Directories are corpora: read at start, new inputs are added to the
+first one. Plain files are replayed once each.
+*/
+inline int FwFuzz_Main(int argc, char **argv) {
+    FwFuzzState &s = FwFuzz_State();
+    s.program = argv[0];
+    bool props = false;
+    double maxSeconds = 0;
+    std::vector<char *> testArgs(1, argv[0]);
+    std::vector<std::string> dirs, files;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--props")                                  props = true;
+        else if (arg.compare(0, 6, "-runs=") == 0)             s.runs = atoll(arg.c_str() + 6);
+        else if (arg.compare(0, 16, "-max_total_time=") == 0)  maxSeconds = atof(arg.c_str() + 16);
+        else if (arg.compare(0, 6, "-seed=") == 0)             s.seed = strtoull(arg.c_str() + 6, nullptr, 10);
+        else if (arg.compare(0, 9, "-max_len=") == 0)          s.maxLen = (size_t)atol(arg.c_str() + 9);
+        else if (arg.compare(0, 17, "-artifact_prefix=") == 0) s.artifactPrefix = arg.substr(17);
+        else if (arg.compare(0, 2, "--") == 0)                 testArgs.push_back(argv[i]);
+        else if (arg[0] == '-') std::cerr << "[FUZZ] ignoring unknown option " << arg << std::endl;
+        else if (FwFuzz_IsDir(arg))                            dirs.push_back(arg);
+        else                                                   files.push_back(arg);
+    }
+    if (s.maxLen == 0) s.maxLen = 1;
+    snprintf(FwFuzzGlobals::artifactPrefix, sizeof(FwFuzzGlobals::artifactPrefix), "%s",
+             s.artifactPrefix.c_str());
+    if (props) return FwTest_Main((int)testArgs.size(), testArgs.data());
+    if (s.props.empty()) {
+        std::cerr << "[FUZZ] no properties registered" << std::endl;
+        return 1;
+    }
+    FwFuzz_InstallCrashHandler();
+
+    // Replay
+    if (!files.empty()) {
+        int failed = 0;
+        for (const std::string &f : files) {
+            std::vector<uint8_t> input;
+            if (!FwFuzz_ReadFile(f, input)) { std::cout << "[FUZZ] cannot read " << f << std::endl; failed++; continue; }
+            bool ok = FwFuzz_RunInput(input.data(), input.size());
+            std::cout << "[FUZZ] " << f << ": " << (ok ? "ok" : s.failure) << std::endl;
+            if (!ok) failed++;
+        }
+        return failed ? 1 : 0;
+    }
+
+    // Fuzz
+    uint64_t seed = s.seed ? s.seed : (uint64_t)time(nullptr) ^ ((uint64_t)clock() << 32);
+    uint64_t rng = seed;
+    std::cout << "[FUZZ] " << s.props.size() << " properties, seed " << seed
+              << " (rerun with -seed=" << seed << ")" << std::endl;
+
+    std::vector<std::vector<uint8_t> > corpus;
+    for (const std::string &d : dirs)
+        for (const std::string &f : FwFuzz_ListDir(d)) {
+            std::vector<uint8_t> input;
+            if (FwFuzz_ReadFile(f, input)) corpus.push_back(input);
+        }
+    for (size_t i = 0; i < s.props.size(); i++) corpus.push_back(FwFuzz_WithSelector(i, {}));
+
+    std::vector<uint8_t> seen(FW_FUZZ_MAP_SIZE, 0);
+    size_t features = 0;
+    for (const std::vector<uint8_t> &input : corpus) {
+        if (!FwFuzz_RunInput(input.data(), input.size())) return FwFuzz_ReportFailure(input);
+        FwFuzz_NewFeatures(seen, features);
+    }
+    if (!features)
+        std::cout << "[FUZZ] no coverage feedback (build with -fsanitize-coverage=trace-pc):"
+                     " mutating blindly" << std::endl;
+
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    unsigned long long execs = 0, nextPulse = 1024;
+    std::vector<uint8_t> input;
+    for (;;) {
+        if (s.runs >= 0 && execs >= (unsigned long long)s.runs) break;
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if ((execs & 255) == 0 && maxSeconds > 0 && secs >= maxSeconds) break;
+
+        input = corpus[(size_t)(FwFuzz_Rand(rng) % corpus.size())];
+        FwFuzz_Mutate(input, corpus, rng, s.maxLen);
+        execs++;
+        if (!FwFuzz_RunInput(input.data(), input.size())) return FwFuzz_ReportFailure(input);
+        bool isNew = FwFuzz_NewFeatures(seen, features) > 0;
+        if (isNew) {
+            corpus.push_back(input);
+            if (!dirs.empty()) {
+                std::ofstream out((dirs[0] + "/" + FwFuzz_Hash(input.data(), input.size())).c_str(),
+                                  std::ios::binary);
+                out.write((const char *)input.data(), (std::streamsize)input.size());
+            }
+        }
+        if (isNew || execs == nextPulse) {
+            if (execs == nextPulse) nextPulse *= 2;
+            secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            printf("[FUZZ] #%llu %s cov: %zu corp: %zu exec/s: %.0f\n", execs, isNew ? "NEW  " : "pulse",
+                   features, corpus.size(), secs > 0 ? execs / secs : 0.0);
+        }
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    printf("[FUZZ] #%llu DONE  cov: %zu corp: %zu exec/s: %.0f\n", execs, features, corpus.size(),
+           secs > 0 ? execs / secs : 0.0);
+    return 0;
+}
+
+#ifdef FW_FUZZ_LIBFUZZER
+#define FW_FUZZ_MAIN()                                                            \
+    extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {     \
+        if (!FwFuzz_RunInput(data, size)) {                                       \
+            fprintf(stderr, "[FUZZ] %s\n", FwFuzz_State().failure.c_str());       \
+            abort();                                                              \
+        }                                                                         \
+        return 0;                                                                 \
+    }
+#else
+#define FW_FUZZ_MAIN() \
+    int main(int argc, char **argv) { return FwFuzz_Main(argc, argv); }
+#endif
+
+#endif // FW_FUZZ_H
@@ -0,0 +1,440 @@
+/*
+===============================================================================
+Purpose: Simulated Cortex-M style interrupt controller (NVIC) with nested
+         interrupts and PRIMASK / BASEPRI critical sections.
+Author: Sankalpa Hota
+How to use:
+  #include "fw_irq.h"
+
+  void uartRxHandler() { CPU_Run(2000); }            // 2 us of ISR work
+  int uart = NVIC_Register("UART1_RX", 1, uartRxHandler, 86800);  // periodic
+
+  {
+      IRQ_CriticalSection cs("ring_pop");            // __disable_irq()
+      CPU_Run(500);
+  }                                                  // __enable_irq()
+  {
+      IRQ_BasepriSection bs(3, "fusion");            // mask prio >= 3 only
+      CPU_Run(50000);
+  }
+  NVIC_Report(cout);
+
+Everything runs on one simulated CPU in simulated time (nanoseconds), so
+results are deterministic. Code "executes" by calling CPU_Run(ns). While
+that time passes, interrupts become pending at their arrival times and
+preempt the running code if:
+  - PRIMASK is clear (no IRQ_CriticalSection open),
+  - BASEPRI is 0 or the IRQ's priority is numerically lower, and
+  - the IRQ's priority is numerically lower than the running handler's.
+Lower number = more urgent, as on Cortex-M. Handlers nest by recursion,
+just like exception stacking. Unmasking or returning from a handler
+takes any pending IRQ immediately.
+
+Measured:
+  per IRQ    arrival → handler latency histogram, overruns (arrived
+             again while still pending), nesting depth, and which
+             critical section or handler delayed the worst case
+  per site   how often and how long each critical section kept
+             interrupts masked
+
+While fw_trace.h is recording, handlers and critical sections appear as
+nested slices on the "NVIC" / "CPU" track, and each IRQ's wait from
+arrival to entry on its own track, with the code that blocked it.
+===============================================================================
+*/
+#ifndef FW_IRQ_H
+#define FW_IRQ_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <ostream>
+#include "fw_latency.h"
+#include "fw_trace.h"
+
+#define NVIC_MAX_IRQS    16
+#define NVIC_MAX_SITES   32
+#define NVIC_THREAD_PRIO 256     // Execution priority of thread mode
+#define NVIC_ENTRY_NS    120     // Exception entry: 12 cycles @ 100 MHz
+#define NVIC_EXIT_NS     100     // Exception return: 10 cycles
+#define NVIC_CLOCK_MHZ   100     // Core clock out of reset
+
+struct NVIC_Irq {
+    const char *name;
+    uint8_t priority;
+    void (*handler)();
+    bool pending;
+    uint64_t pendingSinceNs;     // Arrival time of the pending request
+    uint64_t nextArrivalNs;      // Next hardware event (UINT64_MAX = none)
+    uint64_t periodNs;           // 0 = one-shot
+    bool deferrable;             // Does not end WFI: waits for the next wake-up
+    const char *blockedBy;       // Why the pending request had to wait
+
+    // Statistics
+    unsigned long taken;
+    unsigned long overruns;      // Arrived while still pending: event lost
+    uint64_t maxLatencyNs;
+    const char *worstBlocker;    // blockedBy of the max-latency request
+    FwLatHistogram latency;
+};
+
+struct NVIC_Site {
+    const char *name;
+    const char *kind;            // "PRIMASK" or "BASEPRI"
+    unsigned long entries;
+    uint64_t totalNs;
+    uint64_t maxNs;
+};
+
+struct NVIC_Core {
+    uint64_t nowNs;
+
+    // Core clock: CPU_Run() work is given at maxClockMhz and takes
+    // maxClockMhz / clockMhz times longer at a lower clock
+    uint32_t clockMhz;
+    uint32_t maxClockMhz;
+
+    // PRIMASK: global mask with a nesting counter
+    unsigned primaskDepth;
+    const char *primaskSite;     // Outermost section
+    uint64_t primaskSinceNs;
+    uint64_t primaskNs;          // Total time masked
+
+    // BASEPRI: priority threshold (0 = off)
+    uint8_t basepri;
+    const char *basepriSite;
+    uint64_t basepriSinceNs;
+    uint64_t basepriNs;
+
+    // Active handlers, innermost last
+    int active[NVIC_MAX_IRQS];
+    int activeDepth;
+    int maxDepth;
+
+    NVIC_Irq irqs[NVIC_MAX_IRQS];
+    int irqCount;
+    NVIC_Site sites[NVIC_MAX_SITES];
+    int siteCount;
+
+    // Called before time moves on, in the context that spends it (used by
+    // fw_power.h for energy accounting). Survives NVIC_Reset().
+    void (*advanceHook)(uint64_t ns);
+};
+
+inline NVIC_Core &NVIC_State() {
+    static NVIC_Core core;
+    // Clocked from the start: CPU_Run() divides by clockMhz, and the
+    // first NVIC_Reset() may come after it
+    static bool clocked = (core.clockMhz = core.maxClockMhz = NVIC_CLOCK_MHZ, true);
+    (void)clocked;
+    return core;
+}
+#define NVIC NVIC_State()
+
+inline void NVIC_Reset() {
+    NVIC_Core &c = NVIC;
+    c.nowNs = 0;
+    c.clockMhz = c.maxClockMhz = NVIC_CLOCK_MHZ;
+    c.primaskDepth = 0; c.primaskSite = nullptr; c.primaskSinceNs = 0; c.primaskNs = 0;
+    c.basepri = 0; c.basepriSite = nullptr; c.basepriSinceNs = 0; c.basepriNs = 0;
+    c.activeDepth = 0; c.maxDepth = 0;
+    c.irqCount = 0;
+    c.siteCount = 0;
+}
+
+// Table sizes are compile-time limits: running out is a setup bug
+inline void NVIC_TableFull(const char *limit, int max) {
+    fprintf(stderr, "[NVIC] table full: %s is %d\n", limit, max);
+    abort();
+}
+
+// Returns the IRQ number. periodNs > 0 makes it fire periodically from phaseNs.
+inline int NVIC_Register(const char *name, uint8_t priority, void (*handler)(),
+                         uint64_t periodNs = 0, uint64_t phaseNs = 0) {
+    NVIC_Core &c = NVIC;
+    if (c.irqCount == NVIC_MAX_IRQS) NVIC_TableFull("NVIC_MAX_IRQS", NVIC_MAX_IRQS);
+    NVIC_Irq &q = c.irqs[c.irqCount];
+    q.name = name;
+    q.priority = priority;
+    q.handler = handler;
+    q.pending = false;
+    q.pendingSinceNs = 0;
+    q.periodNs = periodNs;
+    q.deferrable = false;
+    q.nextArrivalNs = periodNs ? c.nowNs + phaseNs : UINT64_MAX;
+    q.blockedBy = nullptr;
+    q.taken = q.overruns = 0;
+    q.maxLatencyNs = 0;
+    q.worstBlocker = nullptr;
+    q.latency.reset();
+    return c.irqCount++;
+}
+
+inline int NVIC_ExecPriority() {
+    NVIC_Core &c = NVIC;
+    return c.activeDepth ? c.irqs[c.active[c.activeDepth - 1]].priority : NVIC_THREAD_PRIO;
+}
+
+inline bool NVIC_CanTake(const NVIC_Irq &q) {
+    NVIC_Core &c = NVIC;
+    if (c.primaskDepth) return false;
+    if (c.basepri && q.priority >= c.basepri) return false;
+    return q.priority < NVIC_ExecPriority();
+}
+
+// Who is keeping this IRQ waiting right now (nullptr = nobody)
+inline const char *NVIC_Blocker(const NVIC_Irq &q) {
+    NVIC_Core &c = NVIC;
+    if (c.primaskDepth) return c.primaskSite;
+    if (c.basepri && q.priority >= c.basepri) return c.basepriSite;
+    if (q.priority >= NVIC_ExecPriority()) return c.irqs[c.active[c.activeDepth - 1]].name;
+    return nullptr;
+}
+
+inline void NVIC_Raise(NVIC_Irq &q, uint64_t atNs) {
+    if (q.pending) { q.overruns++; return; }
+    q.pending = true;
+    q.pendingSinceNs = atNs;
+    q.blockedBy = NVIC_Blocker(q);
+}
+
+// Software / peripheral request: set the pending bit now
+inline void NVIC_SetPending(int irq) { NVIC_Raise(NVIC.irqs[irq], NVIC.nowNs); }
+
+// One-shot hardware event at an absolute time
+inline void NVIC_ScheduleAt(int irq, uint64_t atNs) { NVIC.irqs[irq].nextArrivalNs = atNs; }
+
+// Deferrable IRQs are still taken while the core runs, but never wake it
+inline void NVIC_SetDeferrable(int irq, bool deferrable) { NVIC.irqs[irq].deferrable = deferrable; }
+
+// wakeOnly: skip deferrable IRQs (what ends a sleep)
+inline uint64_t NVIC_NextArrivalNs(bool wakeOnly = false) {
+    NVIC_Core &c = NVIC;
+    uint64_t t = UINT64_MAX;
+    for (int i = 0; i < c.irqCount; i++)
+        if (c.irqs[i].nextArrivalNs < t && !(wakeOnly && c.irqs[i].deferrable))
+            t = c.irqs[i].nextArrivalNs;
+    return t;
+}
+
+// Wall time that `workNs` of full-speed work takes at the current clock
+inline uint64_t CPU_WallNs(uint64_t workNs) {
+    NVIC_Core &c = NVIC;
+    return (workNs * c.maxClockMhz + c.clockMhz - 1) / c.clockMhz;
+}
+
+// Let time pass without taking interrupts (stacking, or inside a step)
+inline void NVIC_Advance(uint64_t ns) {
+    NVIC_Core &c = NVIC;
+    if (c.advanceHook && ns) c.advanceHook(ns);
+    c.nowNs += ns;
+    for (int i = 0; i < c.irqCount; i++) {
+        NVIC_Irq &q = c.irqs[i];
+        while (q.nextArrivalNs <= c.nowNs) {
+            NVIC_Raise(q, q.nextArrivalNs);
+            q.nextArrivalNs = q.periodNs ? q.nextArrivalNs + q.periodNs : UINT64_MAX;
+        }
+    }
+}
+
+// Take every pending IRQ that may preempt the current context
+inline void NVIC_Dispatch() {
+    NVIC_Core &c = NVIC;
+    while (true) {
+        int best = -1;
+        for (int i = 0; i < c.irqCount; i++) {
+            const NVIC_Irq &q = c.irqs[i];
+            if (q.pending && NVIC_CanTake(q) && (best < 0 || q.priority < c.irqs[best].priority))
+                best = i;
+        }
+        if (best < 0) return;
+
+        NVIC_Irq &q = c.irqs[best];
+        q.pending = false;
+        uint64_t entryNs = c.nowNs;
+        NVIC_Advance(CPU_WallNs(NVIC_ENTRY_NS));         // stacking
+        uint64_t latency = c.nowNs - q.pendingSinceNs;
+        if (FwTrace_On()) {
+            FwTrace_Complete(FwTrace_Track("NVIC", q.name), "pending", "irq", q.pendingSinceNs,
+                             latency, "blocked_by", q.blockedBy ? q.blockedBy : "-");
+            FwTrace_Begin(FwTrace_Track("NVIC", "CPU"), q.name, "isr", entryNs);
+        }
+        q.latency.record(latency);
+        if (latency > q.maxLatencyNs) { q.maxLatencyNs = latency; q.worstBlocker = q.blockedBy; }
+        q.taken++;
+
+        c.active[c.activeDepth++] = best;
+        if (c.activeDepth > c.maxDepth) c.maxDepth = c.activeDepth;
+        q.handler();                                     // may nest
+        NVIC_Advance(CPU_WallNs(NVIC_EXIT_NS));          // unstacking
+        c.activeDepth--;
+        if (FwTrace_On()) FwTrace_End(FwTrace_Track("NVIC", "CPU"), c.nowNs);
+    }
+}
+
+/*
+CPU_Run(): execute `ns` of work (timed at the full clock) in the
+current context. Interrupts that may preempt are taken at their arrival
+time; time spent in them does not count against `ns`, exactly as the
+interrupted code sees it. A handler may change the clock meanwhile.
+*/
+inline void CPU_Run(uint64_t ns) {
+    NVIC_Core &c = NVIC;
+    NVIC_Advance(0);
+    while (true) {
+        NVIC_Dispatch();
+        if (!ns) return;
+        uint64_t wall = CPU_WallNs(ns);
+        uint64_t next = NVIC_NextArrivalNs();
+        uint64_t step = (next - c.nowNs < wall) ? next - c.nowNs : wall;
+        uint64_t done = step == wall ? ns : step * c.clockMhz / c.maxClockMhz;
+        NVIC_Advance(step);
+        ns -= done;
+    }
+}
+
+/*
+CPU_SleepUntil(): WFI. The core stops until `untilNs` (a wake-up timer)
+or until any non-deferrable interrupt is pending, even one that is
+masked. Returns true if an interrupt ended the sleep early. Pending
+interrupts are not taken here: the caller accounts for its wake-up
+latency first.
+*/
+inline bool CPU_SleepUntil(uint64_t untilNs) {
+    NVIC_Core &c = NVIC;
+    NVIC_Advance(0);
+    for (int i = 0; i < c.irqCount; i++)
+        if (c.irqs[i].pending && !c.irqs[i].deferrable) return true;
+    uint64_t next = NVIC_NextArrivalNs(true);
+    if (next < untilNs) {
+        NVIC_Advance(next - c.nowNs);
+        return true;
+    }
+    if (untilNs > c.nowNs) NVIC_Advance(untilNs - c.nowNs);
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+// Critical sections
+// -----------------------------------------------------------------------------
+inline NVIC_Site &NVIC_SiteFor(const char *name, const char *kind) {
+    NVIC_Core &c = NVIC;
+    for (int i = 0; i < c.siteCount; i++)
+        if (c.sites[i].name == name) return c.sites[i];
+    if (c.siteCount == NVIC_MAX_SITES) NVIC_TableFull("NVIC_MAX_SITES", NVIC_MAX_SITES);
+    NVIC_Site &s = c.sites[c.siteCount++];
+    s.name = name; s.kind = kind;
+    s.entries = 0; s.totalNs = 0; s.maxNs = 0;
+    return s;
+}
+
+inline void NVIC_SiteRecord(const char *name, const char *kind, uint64_t ns) {
+    NVIC_Site &s = NVIC_SiteFor(name, kind);
+    s.entries++;
+    s.totalNs += ns;
+    if (ns > s.maxNs) s.maxNs = ns;
+}
+
+// __disable_irq() with a nesting counter: only the outermost unlock unmasks
+inline void IRQ_Lock(const char *site) {
+    NVIC_Core &c = NVIC;
+    if (c.primaskDepth++ == 0) {
+        c.primaskSite = site;
+        c.primaskSinceNs = c.nowNs;
+    }
+}
+
+inline void IRQ_Unlock() {
+    NVIC_Core &c = NVIC;
+    if (--c.primaskDepth) return;
+    c.primaskNs += c.nowNs - c.primaskSinceNs;
+    c.primaskSite = nullptr;
+    NVIC_Dispatch();                                     // pending IRQs fire now
+}
+
+// Raise BASEPRI (never lowers it, like BASEPRI_MAX); returns the old value
+inline uint8_t IRQ_RaiseBasepri(uint8_t level, const char *site) {
+    NVIC_Core &c = NVIC;
+    uint8_t old = c.basepri;
+    if (old == 0 || level < old) {
+        if (old == 0) c.basepriSinceNs = c.nowNs;
+        c.basepri = level;
+        c.basepriSite = site;
+    }
+    return old;
+}
+
+inline void IRQ_RestoreBasepri(uint8_t old, const char *oldSite) {
+    NVIC_Core &c = NVIC;
+    if (c.basepri == old) return;
+    if (old == 0) c.basepriNs += c.nowNs - c.basepriSinceNs;
+    c.basepri = old;
+    c.basepriSite = oldSite;
+    NVIC_Dispatch();
+}
+
+struct IRQ_CriticalSection {
+    explicit IRQ_CriticalSection(const char *s) : site(s), startNs(NVIC.nowNs) {
+        IRQ_Lock(site);
+        if (FwTrace_On()) FwTrace_Begin(FwTrace_Track("NVIC", "CPU"), site, "primask", startNs);
+    }
+    ~IRQ_CriticalSection() {
+        NVIC_SiteRecord(site, "PRIMASK", NVIC.nowNs - startNs);
+        if (FwTrace_On()) FwTrace_End(FwTrace_Track("NVIC", "CPU"), NVIC.nowNs);
+        IRQ_Unlock();
+    }
+    const char *site;
+    uint64_t startNs;
+};
+
+struct IRQ_BasepriSection {
+    IRQ_BasepriSection(uint8_t level, const char *s)
+        : site(s), startNs(NVIC.nowNs), oldSite(NVIC.basepriSite), old(IRQ_RaiseBasepri(level, s)) {
+        if (FwTrace_On()) FwTrace_Begin(FwTrace_Track("NVIC", "CPU"), site, "basepri", startNs);
+    }
+    ~IRQ_BasepriSection() {
+        NVIC_SiteRecord(site, "BASEPRI", NVIC.nowNs - startNs);
+        if (FwTrace_On()) FwTrace_End(FwTrace_Track("NVIC", "CPU"), NVIC.nowNs);
+        IRQ_RestoreBasepri(old, oldSite);
+    }
+    const char *site;
+    uint64_t startNs;
+    const char *oldSite;
+    uint8_t old;
+};
+
+// -----------------------------------------------------------------------------
+// Report
+// -----------------------------------------------------------------------------
+inline void NVIC_Report(std::ostream &os) {
+    NVIC_Core &c = NVIC;
+    double total = (double)c.nowNs;
+    os << std::left << std::setw(12) << "IRQ" << std::right << std::setw(5) << "prio"
+       << std::setw(8) << "taken" << std::setw(9) << "overrun" << std::setw(10) << "lat p50"
+       << std::setw(10) << "lat p99" << std::setw(10) << "lat max" << "   worst case blocked by" << std::endl;
+    for (int i = 0; i < c.irqCount; i++) {
+        const NVIC_Irq &q = c.irqs[i];
+        os << std::left << std::setw(12) << q.name << std::right << std::setw(5) << (int)q.priority
+           << std::setw(8) << q.taken << std::setw(9) << q.overruns << std::fixed << std::setprecision(2)
+           << std::setw(10) << q.latency.percentile(50) / 1e3
+           << std::setw(10) << q.latency.percentile(99) / 1e3
+           << std::setw(10) << q.maxLatencyNs / 1e3
+           << "   " << (q.worstBlocker ? q.worstBlocker : "-") << std::endl;
+    }
+    os << std::left << std::setw(24) << "Critical section" << std::setw(9) << "mask" << std::right
+       << std::setw(9) << "entries" << std::setw(10) << "max us" << std::setw(11) << "total us"
+       << std::setw(9) << "share" << std::endl;
+    for (int i = 0; i < c.siteCount; i++) {
+        const NVIC_Site &s = c.sites[i];
+        os << std::left << std::setw(24) << s.name << std::setw(9) << s.kind << std::right
+           << std::setw(9) << s.entries << std::fixed << std::setprecision(2)
+           << std::setw(10) << s.maxNs / 1e3 << std::setw(11) << s.totalNs / 1e3
+           << std::setw(8) << 100.0 * s.totalNs / total << "%" << std::endl;
+    }
+    os << "PRIMASK set " << std::setprecision(2) << 100.0 * c.primaskNs / total
+       << "% of the time, BASEPRI " << 100.0 * c.basepriNs / total
+       << "%, max nesting depth " << c.maxDepth << std::endl;
+}
+
+#endif // FW_IRQ_H
@@ -0,0 +1,285 @@
+/*
+===============================================================================
+Purpose: Interrupt latency and jitter instrumentation shared by the
+         interrupt and RTOS simulations (08, 09).
+Author: Sankalpa Hota
+How to use:
+  #include "fw_latency.h"
+
+  FwLatIrq timerIrq("TIM2");                 // one per interrupt source
+
+  void timerISR() {
+      uint64_t entry = FwLat_IsrEnter(timerIrq);
+      ... post work, remember `entry` with it ...
+      FwLat_IsrExit(timerIrq, entry);
+  }
+
+  // deferred handler (main loop / task)
+  FwLat_HandlerStart(timerIrq, entry);
+  ... handle ...
+  FwLat_HandlerDone(timerIrq, entry);
+
+  FwLat_PrintSummary(cout);                  // table
+  FwLat_DumpJson(file);                      // full histograms
+
+Timestamps come from the CPU cycle counter (rdtsc, calibrated once
+against steady_clock) on x86, steady_clock elsewhere or when built with
+-DFW_LATENCY_STEADY_CLOCK. All values are in nanoseconds.
+
+Histograms are HDR-style (log-linear): exact below 64 ns, then 32
+sub-buckets per power of two, so any recorded value is reported within
+~3%, from 1 ns up to ~78 hours, in a fixed 11 KB table. Recording is one
+relaxed atomic add per bucket, safe to call from an ISR.
+===============================================================================
+*/
+#ifndef FW_LATENCY_H
+#define FW_LATENCY_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(FW_LATENCY_STEADY_CLOCK)
+#include <x86intrin.h>
+#define FW_LATENCY_RDTSC 1
+#endif
+
+// -----------------------------------------------------------------------------
+// Clock
+// -----------------------------------------------------------------------------
+inline uint64_t FwLat_SteadyNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#ifdef FW_LATENCY_RDTSC
+struct FwLatClock {
+    uint64_t tsc0, ns0;
+    double nsPerTick;
+    FwLatClock() {
+        // Calibrate the (invariant) TSC against steady_clock over ~10 ms
+        uint64_t n0 = FwLat_SteadyNs(), t0 = __rdtsc();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        uint64_t n1 = FwLat_SteadyNs(), t1 = __rdtsc();
+        nsPerTick = (double)(n1 - n0) / (double)(t1 - t0);
+        tsc0 = t1;
+        ns0 = n1;
+    }
+};
+
+inline const FwLatClock &FwLat_Clock() {
+    static FwLatClock clock;        // calibrated on first use
+    return clock;
+}
+
+inline uint64_t FwLat_NowNs() {
+    const FwLatClock &c = FwLat_Clock();
+    return c.ns0 + (uint64_t)((double)(__rdtsc() - c.tsc0) * c.nsPerTick);
+}
+
+inline const char *FwLat_ClockName() { return "rdtsc"; }
+#else
+inline uint64_t FwLat_NowNs() { return FwLat_SteadyNs(); }
+inline const char *FwLat_ClockName() { return "steady_clock"; }
+#endif
+
+// Call once at startup so calibration never happens inside an ISR
+inline void FwLat_Init() { (void)FwLat_NowNs(); }
+
+// -----------------------------------------------------------------------------
+// Histogram
+// -----------------------------------------------------------------------------
+#define FWLAT_SUB_BITS   5                          // 32 sub-buckets per octave
+#define FWLAT_LINEAR     (2u << FWLAT_SUB_BITS)     // 0..63 recorded exactly
+#define FWLAT_MAX_BIT    47                         // values up to 2^48 - 1 ns
+#define FWLAT_BUCKETS    (FWLAT_LINEAR + (FWLAT_MAX_BIT - FWLAT_SUB_BITS) * (1u << FWLAT_SUB_BITS))
+
+struct FwLatHistogram {
+    std::atomic<uint64_t> counts[FWLAT_BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> minNs;
+    std::atomic<uint64_t> maxNs;
+
+    FwLatHistogram() { reset(); }
+
+    void reset() {
+        for (unsigned i = 0; i < FWLAT_BUCKETS; i++) counts[i].store(0, std::memory_order_relaxed);
+        total.store(0);
+        sum.store(0);
+        minNs.store(UINT64_MAX);
+        maxNs.store(0);
+    }
+
+    static unsigned indexOf(uint64_t v) {
+        if (v < FWLAT_LINEAR) return (unsigned)v;
+        if (v >> (FWLAT_MAX_BIT + 1)) v = (1ULL << (FWLAT_MAX_BIT + 1)) - 1;
+        int msb = 63 - __builtin_clzll(v);
+        int shift = msb - FWLAT_SUB_BITS;                        // >= 1
+        unsigned sub = (unsigned)(v >> shift) - (1u << FWLAT_SUB_BITS);   // 0..31
+        return FWLAT_LINEAR + (unsigned)(shift - 1) * (1u << FWLAT_SUB_BITS) + sub;
+    }
+
+    // Highest value that lands in bucket i
+    static uint64_t upperOf(unsigned i) {
+        if (i < FWLAT_LINEAR) return i;
+        unsigned shift = (i - FWLAT_LINEAR) / (1u << FWLAT_SUB_BITS) + 1;
+        uint64_t sub = (i - FWLAT_LINEAR) % (1u << FWLAT_SUB_BITS) + (1u << FWLAT_SUB_BITS);
+        return ((sub + 1) << shift) - 1;
+    }
+
+    void record(uint64_t ns) {
+        counts[indexOf(ns)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t m = minNs.load(std::memory_order_relaxed);
+        while (ns < m && !minNs.compare_exchange_weak(m, ns, std::memory_order_relaxed)) {}
+        m = maxNs.load(std::memory_order_relaxed);
+        while (ns > m && !maxNs.compare_exchange_weak(m, ns, std::memory_order_relaxed)) {}
+    }
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t min() const { return count() ? minNs.load() : 0; }
+    uint64_t max() const { return maxNs.load(); }
+    double mean() const { return count() ? (double)sum.load() / count() : 0.0; }
+
+    // Value at percentile p (0..100), within bucket precision
+    uint64_t percentile(double p) const {
+        uint64_t n = count();
+        if (!n) return 0;
+        uint64_t rank = (uint64_t)(p / 100.0 * n + 0.5);
+        if (rank < 1) rank = 1;
+        uint64_t seen = 0;
+        for (unsigned i = 0; i < FWLAT_BUCKETS; i++) {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                uint64_t v = upperOf(i);
+                return v < max() ? v : max();
+            }
+        }
+        return max();
+    }
+
+    void dumpJson(std::ostream &os) const {
+        os << "{\"count\": " << count() << ", \"min\": " << min() << ", \"max\": " << max()
+           << ", \"mean\": " << (uint64_t)mean()
+           << ", \"p50\": " << percentile(50) << ", \"p90\": " << percentile(90)
+           << ", \"p99\": " << percentile(99) << ", \"p999\": " << percentile(99.9)
+           << ", \"buckets\": [";
+        bool first = true;
+        for (unsigned i = 0; i < FWLAT_BUCKETS; i++) {
+            uint64_t c = counts[i].load(std::memory_order_relaxed);
+            if (!c) continue;
+            os << (first ? "" : ", ") << "[" << upperOf(i) << ", " << c << "]";
+            first = false;
+        }
+        os << "]}";
+    }
+};
+
+// -----------------------------------------------------------------------------
+// Per-IRQ statistics
+// -----------------------------------------------------------------------------
+/*
+For every interrupt source:
+  isr         ISR entry → ISR exit (time spent in interrupt context)
+  latency     ISR entry → deferred handler start
+  completion  ISR entry → deferred handler done
+  period      ISR entry → next ISR entry; max - min is the jitter
+*/
+struct FwLatIrq;
+
+inline std::vector<FwLatIrq *> &FwLat_Registry() {
+    static std::vector<FwLatIrq *> irqs;
+    return irqs;
+}
+
+struct FwLatIrq {
+    FwLatIrq(const char *n) : name(n), lastEntryNs(0) { FwLat_Registry().push_back(this); }
+    ~FwLatIrq() {
+        std::vector<FwLatIrq *> &r = FwLat_Registry();
+        for (size_t i = 0; i < r.size(); i++)
+            if (r[i] == this) { r.erase(r.begin() + i); break; }
+    }
+
+    const char *name;
+    FwLatHistogram isr;
+    FwLatHistogram latency;
+    FwLatHistogram completion;
+    FwLatHistogram period;
+    std::atomic<uint64_t> lastEntryNs;
+
+    void reset() {
+        isr.reset(); latency.reset(); completion.reset(); period.reset();
+        lastEntryNs.store(0);
+    }
+
+    // Peak-to-peak spread of the period (exact, not bucketed)
+    uint64_t jitterNs() const {
+        return period.count() < 2 ? 0 : period.max() - period.min();
+    }
+};
+
+inline uint64_t FwLat_IsrEnter(FwLatIrq &irq) {
+    uint64_t now = FwLat_NowNs();
+    uint64_t prev = irq.lastEntryNs.exchange(now, std::memory_order_relaxed);
+    if (prev) irq.period.record(now - prev);
+    return now;
+}
+
+inline void FwLat_IsrExit(FwLatIrq &irq, uint64_t entryNs) {
+    irq.isr.record(FwLat_NowNs() - entryNs);
+}
+
+inline void FwLat_HandlerStart(FwLatIrq &irq, uint64_t entryNs) {
+    irq.latency.record(FwLat_NowNs() - entryNs);
+}
+
+inline void FwLat_HandlerDone(FwLatIrq &irq, uint64_t entryNs) {
+    irq.completion.record(FwLat_NowNs() - entryNs);
+}
+
+// -----------------------------------------------------------------------------
+// Output
+// -----------------------------------------------------------------------------
+inline void FwLat_PrintSummary(std::ostream &os) {
+    os << std::left << std::setw(16) << "IRQ" << std::right << std::setw(7) << "count"
+       << std::setw(10) << "isr p99" << std::setw(11) << "lat p50" << std::setw(11) << "lat p99"
+       << std::setw(11) << "lat max" << std::setw(11) << "done p99" << std::setw(11) << "jitter"
+       << "   (us)" << std::endl;
+    for (const FwLatIrq *irq : FwLat_Registry()) {
+        os << std::left << std::setw(16) << irq->name << std::right << std::setw(7) << irq->isr.count()
+           << std::fixed << std::setprecision(1)
+           << std::setw(10) << irq->isr.percentile(99) / 1e3
+           << std::setw(11) << irq->latency.percentile(50) / 1e3
+           << std::setw(11) << irq->latency.percentile(99) / 1e3
+           << std::setw(11) << irq->latency.max() / 1e3
+           << std::setw(11) << irq->completion.percentile(99) / 1e3
+           << std::setw(11) << irq->jitterNs() / 1e3 << std::endl;
+    }
+}
+
+inline void FwLat_DumpJson(std::ostream &os) {
+    os << "{\n  \"clock\": \"" << FwLat_ClockName() << "\",\n  \"unit\": \"ns\",\n  \"irqs\": [";
+    bool first = true;
+    for (const FwLatIrq *irq : FwLat_Registry()) {
+        os << (first ? "\n" : ",\n") << "    {\"name\": \"" << irq->name << "\", \"jitter\": "
+           << irq->jitterNs() << ",\n     \"isr\": ";
+        irq->isr.dumpJson(os);
+        os << ",\n     \"latency\": ";
+        irq->latency.dumpJson(os);
+        os << ",\n     \"completion\": ";
+        irq->completion.dumpJson(os);
+        os << ",\n     \"period\": ";
+        irq->period.dumpJson(os);
+        os << "}";
+        first = false;
+    }
+    os << "\n  ]\n}\n";
+}
+
+#endif // FW_LATENCY_H
@@ -0,0 +1,660 @@
+/*
+===============================================================================
+Purpose: Buffered, asynchronous logging for the simulators: a log call
+         on a hot path (inside a lock, an ISR, a driver loop) only
+         copies a few words into a per-thread buffer.
+Author: Sankalpa Hota
+How to use:
+  #define FW_LOG_LEVEL FW_LOG_LEVEL_INFO     // optional, before the include
+  #include "fw_log.h"
+
+  FwLog_Start(cout);                        // background writer
+  FW_LOG_INFO("[UART] Sending char: %c", data);
+  FW_LOG_DEBUG("[LED] pin %u -> 0x%02x", pin, reg);   // gone below DEBUG
+  FwLog_Flush();                            // before printing directly again
+  FwLog_Stop();                             // drain, join the writer
+
+  FwLog_Start(wire, FWLOG_BINARY);          // ids + packed args instead
+  ...
+  FwLog_SizeReport(cout, 115200);           // text vs binary on the link,
+                                            // after FwLog_Start(.., true)
+  FwLog_WriteDictionary(dict);              // host side:
+  FwLog_Decode(wireBytes, FwLog_LoadDictionary(dict), cout);
+
+How it works:
+  - Each thread logs into its own ring of fixed-size records, so the hot
+    path takes no lock and shares no cache line with other threads: one
+    timestamp, the format pointer and up to FW_LOG_MAX_ARGS raw
+    arguments with their type tags, then a release store of the head.
+    When the ring is full the record is dropped and counted, never
+    waited for.
+  - Formatting is deferred: the writer thread turns records into text
+    (printf syntax) long after the call, merges all threads by
+    timestamp and writes with '\n', flushing once per batch, not per
+    line as endl does.
+  - Levels below FW_LOG_LEVEL compile to nothing, arguments included.
+  - Binary mode (FwLog_Start(out, FWLOG_BINARY)) sends no text at all,
+    in the style of defmt: each format string is a literal whose
+    address is fixed at link time, so the writer maps it to a small id
+    once and the wire carries only that id and the packed arguments
+    (varints, zigzag for signed), one COBS frame per record with a 0x00
+    delimiter for resync. The id -> format table goes to the host once
+    (FwLog_WriteDictionary), and the host turns frames back into the
+    same text with FwLog_Decode.
+
+Arguments must be integers, chars, floating point or pointers. A
+(const) char * is logged as a string but stored as a pointer, so it
+must outlive the drain: string literals and other static strings only.
+===============================================================================
+*/
+#ifndef FW_LOG_H
+#define FW_LOG_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <istream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "fw_latency.h"
+
+#define FW_LOG_LEVEL_TRACE 0
+#define FW_LOG_LEVEL_DEBUG 1
+#define FW_LOG_LEVEL_INFO  2
+#define FW_LOG_LEVEL_WARN  3
+#define FW_LOG_LEVEL_OFF   4
+
+#ifndef FW_LOG_LEVEL
+#define FW_LOG_LEVEL FW_LOG_LEVEL_DEBUG
+#endif
+
+#define FW_LOG_MAX_ARGS   6
+#define FW_LOG_RING       4096   // Records per thread (power of two)
+#define FW_LOG_DRAIN_MS   5      // Writer wake-up period
+
+enum FwLogType : uint8_t { FWLOG_INT, FWLOG_UINT, FWLOG_DOUBLE, FWLOG_CHAR, FWLOG_STR, FWLOG_PTR };
+enum FwLogOutput { FWLOG_TEXT, FWLOG_BINARY };
+
+// Signature letter of each type in the dictionary
+static const char FWLOG_TYPE_CODES[] = "iudcsp";
+
+struct FwLogRecord {
+    uint64_t tsNs;
+    const char *fmt;
+    uint8_t argc;
+    FwLogType types[FW_LOG_MAX_ARGS];
+    union Arg { int64_t i; uint64_t u; double d; const void *p; } args[FW_LOG_MAX_ARGS];
+};
+
+// Single producer (the owning thread), single consumer (the writer)
+struct FwLogBuffer {
+    FwLogRecord ring[FW_LOG_RING];
+    std::atomic<uint64_t> head;  // Written by the owner
+    std::atomic<uint64_t> tail;  // Written by the writer
+    std::atomic<uint64_t> dropped;
+    std::atomic<bool> inUse;     // Owned by a live thread
+    FwLogBuffer() : head(0), tail(0), dropped(0), inUse(true) {
+        memset(ring, 0, sizeof(ring));  // Fault the pages in now, not on the hot path
+    }
+};
+
+struct FwLogState {
+    std::mutex lock;             // Buffer registration and writer control only
+    std::mutex drainLock;        // One consumer at a time: the rings are SPSC
+    std::vector<FwLogRecord> batch;  // FwLog_Drain's scratch, kept for its capacity
+    std::vector<FwLogBuffer *> buffers;
+    std::ostream *out = nullptr;
+    std::thread writer;
+    std::condition_variable wake;
+    bool stopping = false;
+    uint64_t flushRequests = 0, flushesDone = 0;
+    std::condition_variable flushed;
+    FwLogOutput mode = FWLOG_TEXT;
+    // Binary mode dictionary: (format, signature) -> id, in id order
+    std::map<std::pair<const char *, std::string>, uint32_t> ids;
+    std::vector<std::pair<const char *, std::string> > formats;
+    // What went out and, with compareSizes, what the same records cost
+    // in the other mode (both are encoded, so it is opt-in). The
+    // counters belong to FwLog_Drain: read them under drainLock.
+    bool compareSizes = false;
+    unsigned long written = 0;
+    uint64_t textBytes = 0, wireBytes = 0;
+};
+
+inline FwLogState &FwLog_State() {
+    static FwLogState state;
+    return state;
+}
+
+/*
+Buffers stay registered after their thread exits, so its last records
+still get written. Once drained, the buffer goes to the next thread
+that logs: a program starting a thread per operation reuses a few
+rings instead of allocating one per thread.
+*/
+inline FwLogBuffer *FwLog_AcquireBuffer() {
+    FwLogState &s = FwLog_State();
+    std::lock_guard<std::mutex> lock(s.lock);
+    for (FwLogBuffer *b : s.buffers)
+        if (!b->inUse.load(std::memory_order_acquire) &&
+            b->tail.load(std::memory_order_acquire) == b->head.load(std::memory_order_relaxed)) {
+            b->inUse.store(true, std::memory_order_relaxed);
+            return b;
+        }
+    FwLogBuffer *b = new FwLogBuffer;
+    s.buffers.push_back(b);
+    return b;
+}
+
+struct FwLogThreadSlot {
+    FwLogBuffer *buf = nullptr;
+    ~FwLogThreadSlot() {                    // thread exit: hand the ring back
+        if (buf) buf->inUse.store(false, std::memory_order_release);
+    }
+};
+
+// This thread's buffer, taken on first use
+inline FwLogBuffer &FwLog_ThreadBuffer() {
+    static thread_local FwLogThreadSlot slot;
+    if (!slot.buf) slot.buf = FwLog_AcquireBuffer();
+    return *slot.buf;
+}
+
+// -----------------------------------------------------------------------------
+// Hot path: pack arguments
+// -----------------------------------------------------------------------------
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value>::type
+FwLog_Pack(FwLogRecord &r, T v) {
+    int n = r.argc++;
+    if (std::is_same<T, char>::value) { r.types[n] = FWLOG_CHAR; r.args[n].i = v; }
+    else if (std::is_signed<T>::value) { r.types[n] = FWLOG_INT; r.args[n].i = (int64_t)v; }
+    else { r.types[n] = FWLOG_UINT; r.args[n].u = (uint64_t)v; }
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value>::type
+FwLog_Pack(FwLogRecord &r, T v) {
+    r.types[r.argc] = FWLOG_DOUBLE;
+    r.args[r.argc++].d = v;
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_enum<T>::value>::type
+FwLog_Pack(FwLogRecord &r, T v) {
+    r.types[r.argc] = FWLOG_INT;
+    r.args[r.argc++].i = (int64_t)v;
+}
+
+inline void FwLog_Pack(FwLogRecord &r, const char *s) {
+    r.types[r.argc] = FWLOG_STR;
+    r.args[r.argc++].p = s;
+}
+
+// A char * is a string too, not a pointer to print with %p
+inline void FwLog_Pack(FwLogRecord &r, char *s) { FwLog_Pack(r, (const char *)s); }
+
+template <typename T>
+inline void FwLog_Pack(FwLogRecord &r, T *p) {
+    r.types[r.argc] = FWLOG_PTR;
+    r.args[r.argc++].p = p;
+}
+
+inline void FwLog_PackAll(FwLogRecord &) {}
+
+template <typename T, typename... Rest>
+inline void FwLog_PackAll(FwLogRecord &r, T v, Rest... rest) {
+    FwLog_Pack(r, v);
+    FwLog_PackAll(r, rest...);
+}
+
+template <typename... Args>
+inline void FwLog_Write(const char *fmt, Args... args) {
+    static_assert(sizeof...(Args) <= FW_LOG_MAX_ARGS, "too many log arguments");
+    FwLogBuffer &b = FwLog_ThreadBuffer();
+    uint64_t h = b.head.load(std::memory_order_relaxed);
+    if (h - b.tail.load(std::memory_order_acquire) == FW_LOG_RING) {
+        b.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    FwLogRecord &r = b.ring[h & (FW_LOG_RING - 1)];
+    r.tsNs = FwLat_NowNs();
+    r.fmt = fmt;
+    r.argc = 0;
+    FwLog_PackAll(r, args...);
+    b.head.store(h + 1, std::memory_order_release);
+}
+
+#if FW_LOG_LEVEL <= FW_LOG_LEVEL_TRACE
+#define FW_LOG_TRACE(...) FwLog_Write(__VA_ARGS__)
+#else
+#define FW_LOG_TRACE(...) ((void)0)
+#endif
+#if FW_LOG_LEVEL <= FW_LOG_LEVEL_DEBUG
+#define FW_LOG_DEBUG(...) FwLog_Write(__VA_ARGS__)
+#else
+#define FW_LOG_DEBUG(...) ((void)0)
+#endif
+#if FW_LOG_LEVEL <= FW_LOG_LEVEL_INFO
+#define FW_LOG_INFO(...) FwLog_Write(__VA_ARGS__)
+#else
+#define FW_LOG_INFO(...) ((void)0)
+#endif
+#if FW_LOG_LEVEL <= FW_LOG_LEVEL_WARN
+#define FW_LOG_WARN(...) FwLog_Write(__VA_ARGS__)
+#else
+#define FW_LOG_WARN(...) ((void)0)
+#endif
+
+// -----------------------------------------------------------------------------
+// Writer side: deferred formatting
+// -----------------------------------------------------------------------------
+// One conversion appended to `line`, however long it formats
+template <typename T>
+inline void FwLog_Append(std::string &line, const char *spec, T v) {
+    char buf[128];
+    int n = snprintf(buf, sizeof(buf), spec, v);
+    if (n < 0) return;
+    if (n < (int)sizeof(buf)) { line.append(buf, n); return; }
+    size_t at = line.size();
+    line.resize(at + n + 1);
+    snprintf(&line[at], n + 1, spec, v);
+    line.resize(at + n);
+}
+
+/*
+Walks the printf format; each conversion is re-issued to snprintf on
+its own with the length modifier replaced to match the stored type.
+*/
+inline void FwLog_Format(const FwLogRecord &r, std::string &line) {
+    char spec[32];
+    int arg = 0;
+    for (const char *f = r.fmt; *f; f++) {
+        if (*f != '%') { line += *f; continue; }
+        if (f[1] == '%') { line += '%'; f++; continue; }
+        size_t n = 0;
+        spec[n++] = *f++;
+        while (*f && strchr("-+ #0123456789.", *f) && n < sizeof(spec) - 4) spec[n++] = *f++;
+        while (*f && strchr("hljztL", *f)) f++;            // stored width wins
+        if (!*f) break;
+        char conv = *f;
+        if (arg >= r.argc) { line += "<?>"; continue; }
+        const FwLogRecord::Arg &a = r.args[arg];
+        switch (r.types[arg++]) {
+        case FWLOG_INT:
+        case FWLOG_UINT:
+        case FWLOG_CHAR:
+            if (conv == 'c') {
+                spec[n++] = 'c'; spec[n] = 0;
+                FwLog_Append(line, spec, (int)a.i);
+            } else if (strchr("fFeEgG", conv)) {
+                spec[n++] = conv; spec[n] = 0;
+                FwLog_Append(line, spec, (double)a.i);
+            } else {
+                spec[n++] = 'l'; spec[n++] = 'l'; spec[n++] = conv; spec[n] = 0;
+                FwLog_Append(line, spec, a.i);
+            }
+            break;
+        case FWLOG_DOUBLE:
+            spec[n++] = strchr("fFeEgG", conv) ? conv : 'g'; spec[n] = 0;
+            FwLog_Append(line, spec, a.d);
+            break;
+        case FWLOG_STR:
+            spec[n++] = 's'; spec[n] = 0;
+            FwLog_Append(line, spec, a.p ? (const char *)a.p : "(null)");
+            break;
+        case FWLOG_PTR:
+            spec[n++] = 'p'; spec[n] = 0;
+            FwLog_Append(line, spec, a.p);
+            break;
+        }
+    }
+    line += '\n';
+}
+
+// -----------------------------------------------------------------------------
+// Writer side: binary encoding
+// -----------------------------------------------------------------------------
+inline void FwLog_PutVarint(std::string &out, uint64_t v) {
+    while (v >= 0x80) { out += char(v | 0x80); v >>= 7; }
+    out += char(v);
+}
+
+inline std::string FwLog_Signature(const FwLogRecord &r) {
+    std::string sig;
+    for (int i = 0; i < r.argc; i++) sig += FWLOG_TYPE_CODES[r.types[i]];
+    return sig;
+}
+
+// Id of this call site's format; new ones are added to the dictionary
+inline uint32_t FwLog_Intern(const FwLogRecord &r) {
+    FwLogState &s = FwLog_State();
+    std::pair<const char *, std::string> key(r.fmt, FwLog_Signature(r));
+    std::lock_guard<std::mutex> lock(s.lock);
+    std::map<std::pair<const char *, std::string>, uint32_t>::iterator it = s.ids.find(key);
+    if (it != s.ids.end()) return it->second;
+    uint32_t id = (uint32_t)s.formats.size();
+    s.ids[key] = id;
+    s.formats.push_back(key);
+    return id;
+}
+
+// Frame payload: id, then each argument in its packed form
+inline void FwLog_Encode(const FwLogRecord &r, uint32_t id, std::string &payload) {
+    FwLog_PutVarint(payload, id);
+    for (int i = 0; i < r.argc; i++) {
+        const FwLogRecord::Arg &a = r.args[i];
+        switch (r.types[i]) {
+        case FWLOG_INT:    FwLog_PutVarint(payload, ((uint64_t)a.i << 1) ^ (uint64_t)(a.i >> 63)); break;
+        case FWLOG_UINT:   FwLog_PutVarint(payload, a.u); break;
+        case FWLOG_CHAR:   payload += char(a.i); break;
+        case FWLOG_DOUBLE: payload.append((const char *)&a.d, sizeof(a.d)); break;
+        case FWLOG_PTR:    FwLog_PutVarint(payload, (uint64_t)(uintptr_t)a.p); break;
+        case FWLOG_STR: {
+            const char *str = a.p ? (const char *)a.p : "(null)";
+            size_t len = strlen(str);
+            FwLog_PutVarint(payload, len);
+            payload.append(str, len);
+            break;
+        }
+        }
+    }
+}
+
+// COBS: no 0x00 inside the frame, one 0x00 after it
+inline void FwLog_CobsEncode(const std::string &in, std::string &out) {
+    size_t code = out.size();
+    out += char(1);
+    for (char c : in) {
+        if (c != 0) { out += c; out[code]++; }
+        if (c == 0 || (uint8_t)out[code] == 0xFF) { code = out.size(); out += char(1); }
+    }
+    out += char(0);
+}
+
+// Take everything logged so far, oldest first across threads, and write it
+inline void FwLog_Drain() {
+    FwLogState &s = FwLog_State();
+    // Flush or Stop with no writer running can race the writer or each
+    // other; a second consumer would take the same records twice
+    std::lock_guard<std::mutex> drain(s.drainLock);
+    std::vector<FwLogRecord> &batch = s.batch;
+    std::vector<FwLogBuffer *> buffers;
+    std::ostream *out;
+    FwLogOutput mode;
+    bool compare;
+    {
+        std::lock_guard<std::mutex> lock(s.lock);
+        buffers = s.buffers;
+        out = s.out;
+        mode = s.mode;
+        compare = s.compareSizes;
+    }
+    batch.clear();
+    for (FwLogBuffer *b : buffers) {
+        uint64_t t = b->tail.load(std::memory_order_relaxed);
+        uint64_t h = b->head.load(std::memory_order_acquire);
+        for (; t != h; t++) batch.push_back(b->ring[t & (FW_LOG_RING - 1)]);
+        b->tail.store(t, std::memory_order_release);
+    }
+    if (batch.empty() || !out) return;
+    std::stable_sort(batch.begin(), batch.end(),
+                     [](const FwLogRecord &a, const FwLogRecord &b) { return a.tsNs < b.tsNs; });
+    // Only the active mode's work, unless sizes are being compared
+    bool doText = mode == FWLOG_TEXT || compare, doWire = mode == FWLOG_BINARY || compare;
+    std::string text, wire, payload;
+    for (const FwLogRecord &r : batch) {
+        if (doText) {
+            size_t before = text.size();
+            FwLog_Format(r, text);
+            s.textBytes += text.size() - before;
+        }
+        if (doWire) {
+            payload.clear();
+            FwLog_Encode(r, FwLog_Intern(r), payload);
+            size_t before = wire.size();
+            FwLog_CobsEncode(payload, wire);
+            s.wireBytes += wire.size() - before;
+        }
+    }
+    const std::string &bytes = mode == FWLOG_TEXT ? text : wire;
+    out->write(bytes.data(), bytes.size());
+    out->flush();
+    s.written += batch.size();
+}
+
+inline void FwLog_WriterLoop() {
+    FwLogState &s = FwLog_State();
+    std::unique_lock<std::mutex> lock(s.lock);
+    while (true) {
+        s.wake.wait_for(lock, std::chrono::milliseconds(FW_LOG_DRAIN_MS));
+        uint64_t requested = s.flushRequests;
+        bool stop = s.stopping;
+        lock.unlock();
+        FwLog_Drain();
+        lock.lock();
+        s.flushesDone = requested;
+        s.flushed.notify_all();
+        if (stop) return;
+    }
+}
+
+// compareSizes: also encode every record the other way, for FwLog_SizeReport.
+// Returns false, changing nothing, if a writer is already running.
+inline bool FwLog_Start(std::ostream &out, FwLogOutput mode = FWLOG_TEXT, bool compareSizes = false) {
+    FwLogState &s = FwLog_State();
+    if (s.writer.joinable()) return false;
+    s.out = &out;
+    s.mode = mode;
+    s.compareSizes = compareSizes;
+    s.stopping = false;
+    s.writer = std::thread(FwLog_WriterLoop);
+    return true;
+}
+
+// Send later records to another stream; returns the previous one
+inline std::ostream *FwLog_Redirect(std::ostream &out) {
+    FwLogState &s = FwLog_State();
+    std::lock_guard<std::mutex> lock(s.lock);
+    std::ostream *prev = s.out;
+    s.out = &out;
+    return prev;
+}
+
+// Returns once everything logged before the call has been written
+inline void FwLog_Flush() {
+    FwLogState &s = FwLog_State();
+    if (!s.writer.joinable()) { FwLog_Drain(); return; }
+    std::unique_lock<std::mutex> lock(s.lock);
+    uint64_t ticket = ++s.flushRequests;
+    s.wake.notify_one();
+    s.flushed.wait(lock, [&] { return s.flushesDone >= ticket; });
+}
+
+inline void FwLog_Stop() {
+    FwLogState &s = FwLog_State();
+    if (!s.writer.joinable()) { FwLog_Drain(); return; }
+    {
+        std::lock_guard<std::mutex> lock(s.lock);
+        s.stopping = true;
+        s.wake.notify_one();
+    }
+    s.writer.join();
+}
+
+/*
+FwLog_SizeReport() compares what was logged so far as text (what cout
+with endl used to send) with its binary encoding, in bytes per call and
+in time on a `baud` 8N1 link (10 bits per byte). Needs
+FwLog_Start(out, mode, true).
+*/
+inline void FwLog_SizeReport(std::ostream &out, double baud) {
+    FwLogState &s = FwLog_State();
+    std::lock_guard<std::mutex> drain(s.drainLock);
+    std::lock_guard<std::mutex> lock(s.lock);
+    if (!s.compareSizes) {
+        out << "[LOG] size comparison off: start the log with FwLog_Start(out, mode, true)" << std::endl;
+        return;
+    }
+    double calls = s.written ? (double)s.written : 1.0;
+    char line[160];
+    snprintf(line, sizeof(line), "[LOG] %lu calls: text %llu B (%.1f B/call, %.2f ms), "
+             "binary %llu B (%.1f B/call, %.2f ms), %.1fx smaller\n",
+             s.written, (unsigned long long)s.textBytes, s.textBytes / calls,
+             s.textBytes * 10e3 / baud, (unsigned long long)s.wireBytes, s.wireBytes / calls,
+             s.wireBytes * 10e3 / baud, s.wireBytes ? (double)s.textBytes / s.wireBytes : 0.0);
+    out << line << std::flush;
+}
+
+inline uint64_t FwLog_Dropped() {
+    FwLogState &s = FwLog_State();
+    std::lock_guard<std::mutex> lock(s.lock);
+    uint64_t n = 0;
+    for (FwLogBuffer *b : s.buffers) n += b->dropped.load();
+    return n;
+}
+
+// -----------------------------------------------------------------------------
+// Host side: dictionary and decoder
+// -----------------------------------------------------------------------------
+/*
+The dictionary is plain text, one format per line in id order:
+  <signature or -> <format with \\, \n and \t escaped>
+It is what the host needs besides the wire bytes, like the string
+section of a defmt ELF.
+*/
+inline void FwLog_WriteDictionary(std::ostream &out) {
+    FwLogState &s = FwLog_State();
+    std::lock_guard<std::mutex> lock(s.lock);
+    for (const std::pair<const char *, std::string> &f : s.formats) {
+        out << (f.second.empty() ? "-" : f.second) << ' ';
+        for (const char *c = f.first; *c; c++) {
+            if (*c == '\\') out << "\\\\";
+            else if (*c == '\n') out << "\\n";
+            else if (*c == '\t') out << "\\t";
+            else out << *c;
+        }
+        out << '\n';
+    }
+}
+
+struct FwLogDictEntry {
+    std::string sig;
+    std::string fmt;
+};
+
+inline std::vector<FwLogDictEntry> FwLog_LoadDictionary(std::istream &in) {
+    std::vector<FwLogDictEntry> dict;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t sp = line.find(' ');
+        if (sp == std::string::npos) continue;
+        FwLogDictEntry e;
+        e.sig = line.substr(0, sp) == "-" ? "" : line.substr(0, sp);
+        for (size_t i = sp + 1; i < line.size(); i++) {
+            if (line[i] != '\\' || i + 1 == line.size()) { e.fmt += line[i]; continue; }
+            char c = line[++i];
+            e.fmt += c == 'n' ? '\n' : c == 't' ? '\t' : c;
+        }
+        dict.push_back(e);
+    }
+    return dict;
+}
+
+inline bool FwLog_GetVarint(const std::string &in, size_t &pos, uint64_t &v) {
+    v = 0;
+    for (int shift = 0; pos < in.size() && shift < 64; shift += 7) {
+        uint8_t b = (uint8_t)in[pos++];
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+// One COBS-decoded payload back to text; false if it does not parse
+inline bool FwLog_DecodeFrame(const std::string &payload, const std::vector<FwLogDictEntry> &dict,
+                              std::string &text) {
+    size_t pos = 0;
+    uint64_t id, v;
+    if (!FwLog_GetVarint(payload, pos, id) || id >= dict.size()) return false;
+    const FwLogDictEntry &e = dict[id];
+    if (e.sig.size() > FW_LOG_MAX_ARGS) return false;
+    FwLogRecord r;
+    std::string strs[FW_LOG_MAX_ARGS];
+    r.fmt = e.fmt.c_str();
+    r.argc = (uint8_t)e.sig.size();
+    for (int i = 0; i < r.argc; i++) {
+        const char *code = strchr(FWLOG_TYPE_CODES, e.sig[i]);
+        if (!code) return false;
+        r.types[i] = (FwLogType)(code - FWLOG_TYPE_CODES);
+        switch (r.types[i]) {
+        case FWLOG_INT:
+            if (!FwLog_GetVarint(payload, pos, v)) return false;
+            r.args[i].i = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+            break;
+        case FWLOG_UINT:
+            if (!FwLog_GetVarint(payload, pos, r.args[i].u)) return false;
+            break;
+        case FWLOG_CHAR:
+            if (pos >= payload.size()) return false;
+            r.args[i].i = payload[pos++];
+            break;
+        case FWLOG_DOUBLE:
+            if (pos + sizeof(double) > payload.size()) return false;
+            memcpy(&r.args[i].d, payload.data() + pos, sizeof(double));
+            pos += sizeof(double);
+            break;
+        case FWLOG_PTR:
+            if (!FwLog_GetVarint(payload, pos, v)) return false;
+            r.args[i].p = (const void *)(uintptr_t)v;
+            break;
+        case FWLOG_STR:
+            if (!FwLog_GetVarint(payload, pos, v) || pos + v > payload.size()) return false;
+            strs[i] = payload.substr(pos, v);
+            r.args[i].p = strs[i].c_str();
+            pos += v;
+            break;
+        }
+    }
+    if (pos != payload.size()) return false;
+    FwLog_Format(r, text);
+    return true;
+}
+
+/*
+FwLog_Decode() turns a captured wire back into text. A corrupt frame
+prints as a marker and decoding resumes at the next 0x00 delimiter.
+Returns the number of frames decoded.
+*/
+inline unsigned long FwLog_Decode(const std::string &wire, const std::vector<FwLogDictEntry> &dict,
+                                  std::ostream &out) {
+    unsigned long frames = 0;
+    std::string text, payload;
+    size_t start = 0;
+    for (size_t end; (end = wire.find('\0', start)) != std::string::npos; start = end + 1) {
+        payload.clear();
+        bool ok = end > start;
+        for (size_t i = start; ok && i < end; ) {         // COBS decode
+            uint8_t code = (uint8_t)wire[i++];
+            if (i + code - 1 > end) { ok = false; break; }
+            payload.append(wire, i, code - 1);
+            i += code - 1;
+            if (code != 0xFF && i < end) payload += char(0);
+        }
+        if (ok && FwLog_DecodeFrame(payload, dict, text)) frames++;
+        else text += "<corrupt log frame>\n";
+    }
+    out.write(text.data(), text.size());
+    return frames;
+}
+
+#endif // FW_LOG_H
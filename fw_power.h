@@ -0,0 +1,636 @@
+/*
+===============================================================================
+Purpose: Low-power states, tickless idle, per-peripheral energy
+         accounting, DVFS and a clock / power-domain tree for the
+         simulated CPU of fw_irq.h (used by 16).
+Author: Sankalpa Hota
+How to use:
+  #include "fw_power.h"
+
+  PWR_Reset();
+  PWR_AllowDeepest(PWR_STOP2);             // deepest state the board allows
+  PWR_SetMaxWakeLatency(10000);            // an IRQ must be served within 10 us
+
+  int pd  = PWR_AddClock("PD_PERIPH", -1, 0.02, 20000);   // domain, 20 us power-up
+  int clk = PWR_AddClock("GPIO_CLK", pd, 0.005);
+  PWR_SetAutoGate(clk, 2000000);           // gate 2 ms after the last user
+
+  int led = PWR_AddPeripheral("LED", clk); // state 0 is the first one added
+  PWR_AddState(led, "off", 0);
+  PWR_AddState(led, "on", 5.0);            // mA
+
+  PWR_SetGovernor(PWR_GovOndemand, 10000000, 80);   // after NVIC_Register()s
+
+  while (running) {
+      const char *prev = PWR_SetTask("blink");
+      {
+          PWR_ClockRequest on(clk);        // ungates GPIO_CLK and PD_PERIPH
+          PWR_SetState(led, 1);            // charged to "blink" from now on
+          CPU_Run(20000);
+      }
+      PWR_SetTask(prev);
+      PWR_Idle(nextTimerDeadlineNs());     // tickless: sleep until then
+  }
+
+  PWR_Report(cout);                        // CPU state and clock residency
+  PWR_ClockReport(cout);                   // clock tree: enables, on time, energy
+  PWR_EnergyReport(cout);                  // mJ per peripheral per task
+  PWR_DumpJson(file);                      // the same, for CI
+
+PWR_Idle() picks the deepest state that is allowed, wakes up fast enough
+and pays off in the idle time left (entry + exit + target residency),
+then sleeps. It programs the wake-up timer `exitNs` early so the
+deadline is met, and any interrupt (even a masked one) ends the sleep
+early. The interrupt that woke the core is taken after the exit
+latency, so that latency shows up in its NVIC histogram.
+
+A periodic-tick RTOS is the same loop with a SysTick IRQ registered and
+PWR_Idle(PWR_NO_DEADLINE): every tick wakes the core. SysTick is clocked
+by the core clock, which STOP modes switch off, so such a kernel can
+only use SLEEP. A tickless kernel instead wakes on a low-power timer
+(LPTIM / RTC) that keeps running in STOP; it must then advance its tick
+count by the time slept, which here is simply NVIC.nowNs.
+
+Energy: every peripheral (the CPU is peripheral 0) draws the current of
+its state at PWR_VDD, integrated over simulated time through the NVIC
+advance hook. CPU energy goes to whoever runs: the active handler, else
+the current task, "idle" while in PWR_Idle(). Any other peripheral's
+energy goes to the task or handler that put it in its current state, so
+an LED left on is charged to the code that switched it on.
+
+DVFS: the core runs at one of PWR_OPP_COUNT operating points (clock +
+voltage). CPU_Run() work is timed at the top clock and stretches at a
+lower one; run current falls with the clock and with the square of the
+voltage, so the 24 MHz point (low-voltage range) costs the least energy
+per cycle. A governor is a function from load (busy share of the last
+sample period) to an OPP; it runs from a deferrable timer IRQ, which
+samples while the core is busy but never wakes it. Each switch costs
+PWR_OPP_SWITCH_NS at RUN current.
+
+Clocks and power domains form a tree. Every node is reference counted:
+drivers take a reference around each transaction (PWR_ClockRequest),
+an enabled node holds one on its parent, and only the last put can
+gate it, so one driver cannot switch off what another still uses.
+After the last put a node stays on for its auto-gate timeout, so
+back-to-back transactions do not pay the ungating latency each time.
+Nodes are energy-accounted peripherals ("gated" / "on"). A held clock
+can limit the idle state (SPI/I2C kernel clocks stop in STOP), and
+driving a peripheral whose clock is gated counts as a fault.
+===============================================================================
+*/
+#ifndef FW_POWER_H
+#define FW_POWER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <ostream>
+#include "fw_irq.h"
+
+#define PWR_NO_DEADLINE  UINT64_MAX
+#define PWR_VDD          3.3     // Supply voltage (V)
+#define PWR_MAX_PERIPHS  16
+#define PWR_MAX_CLOCKS   8
+#define PWR_MAX_STATES   4
+#define PWR_MAX_OWNERS   16
+#define PWR_CPU          0       // Peripheral number of the core
+#define PWR_OPP_COUNT    4
+#define PWR_OPP_SWITCH_NS 30000  // Voltage range change + PLL relock
+#define PWR_GOV_PRIO     15      // Lowest: any real IRQ preempts the governor
+
+enum PWR_Mode { PWR_RUN, PWR_SLEEP, PWR_STOP1, PWR_STOP2, PWR_MODES };
+
+struct PWR_State {
+    const char *name;
+    double currentMa;
+    uint64_t entryNs;            // Saving context, stopping clocks
+    uint64_t exitNs;             // Regulator and clocks back: wake-up latency
+    uint64_t residencyNs;        // Minimum stay for the transition to pay off
+};
+
+// Roughly an STM32L4 at 80 MHz
+static const PWR_State PWR_STATES[PWR_MODES] = {
+    {"RUN",   10.0,    0,     0,      0},
+    {"SLEEP", 2.7,     100,   200,    0},        // WFI, clocks on
+    {"STOP1", 0.0091,  2000,  6000,   50000},    // Main regulator in low-power
+    {"STOP2", 0.0017,  3000,  8500,   200000},   // Most of the core powered off
+};
+
+// Operating points, fastest first: I = 0.4 mA + 0.12 mA/MHz x (V / 1.2 V)^2
+struct PWR_Opp {
+    const char *name;
+    uint32_t mhz;
+    double volts;
+    double runMa;
+    double sleepMa;              // WFI: clocks still running
+};
+
+static const PWR_Opp PWR_OPPS[PWR_OPP_COUNT] = {
+    {"80 MHz", 80, 1.2, 10.0, 2.7},
+    {"48 MHz", 48, 1.2, 6.16, 1.7},
+    {"24 MHz", 24, 1.0, 2.40, 0.7},
+    {"16 MHz", 16, 1.0, 1.73, 0.5},
+};
+
+// Picks the OPP for the load (0..1) seen over the last sample period
+typedef int (*PWR_Governor)(double load);
+
+struct PWR_Peripheral {
+    const char *name;
+    const char *stateNames[PWR_MAX_STATES];
+    double currentMa[PWR_MAX_STATES];
+    int stateCount;
+    int state;
+    int owner;                   // Who set the current state
+    int clock;                   // Clock it needs when not in state 0 (-1 = none)
+    double energyUj[PWR_MAX_OWNERS];
+};
+
+struct PWR_Clock {
+    int periph;                  // Energy accounting: state 0 gated, 1 on
+    int parent;                  // -1 = root
+    int refs;
+    uint64_t enableNs;           // Ungating stall (power-up, PLL lock...)
+    uint64_t autoGateNs;         // Stay on this long after the last put
+    uint64_t gateAtNs;           // Pending auto-gate (UINT64_MAX = none)
+    int holdMode;                // Deepest idle state while referenced
+    unsigned long enables;
+};
+
+struct PWR_Core {
+    int deepest;                 // Deepest mode allowed
+    uint64_t maxWakeNs;          // Wake-up latency budget
+    uint64_t residencyNs[PWR_MODES];
+    unsigned long entries[PWR_MODES];
+    unsigned long wakeups;
+    unsigned long irqWakeups;    // Ended early by an interrupt
+    uint64_t startNs;            // NVIC time at PWR_Reset()
+
+    const char *task;            // Thread-mode context
+    const char *owners[PWR_MAX_OWNERS];
+    int ownerCount;
+    bool ownerOverflow;          // Owners past the table share "other"
+    PWR_Peripheral periphs[PWR_MAX_PERIPHS];
+    int periphCount;
+    PWR_Clock clocks[PWR_MAX_CLOCKS];
+    int clockCount;
+    unsigned long clockErrors;   // Put without a matching get
+    unsigned long gatedAccesses; // Peripheral driven with its clock gated
+    uint64_t clockStallNs;       // Spent waiting for clocks to ungate
+    double modeUj[PWR_MODES];    // CPU energy by mode
+    bool idling;                 // Inside PWR_Idle(), outside handlers
+
+    // DVFS
+    int opp;
+    int userOpp;                 // For PWR_GovUserspace
+    unsigned upThreshold;        // Percent, for PWR_GovOndemand
+    PWR_Governor governor;
+    uint64_t busyNs;             // CPU running anything but idle
+    uint64_t windowStartNs, windowBusyNs;
+    uint64_t oppNs[PWR_OPP_COUNT];
+    unsigned long oppSwitches;
+};
+
+inline PWR_Core &PWR_StateCore() {
+    static PWR_Core core;
+    return core;
+}
+#define PWR PWR_StateCore()
+
+// -----------------------------------------------------------------------------
+// Energy accounting
+// -----------------------------------------------------------------------------
+// The last slot is kept for "other": the report must not show one
+// owner's energy under another's name
+inline int PWR_OwnerId(const char *name) {
+    PWR_Core &p = PWR;
+    for (int i = 0; i < p.ownerCount && i < PWR_MAX_OWNERS - 1; i++)
+        if (p.owners[i] == name) return i;
+    if (p.ownerCount >= PWR_MAX_OWNERS - 1) {
+        p.owners[PWR_MAX_OWNERS - 1] = "other";
+        p.ownerCount = PWR_MAX_OWNERS;
+        p.ownerOverflow = true;
+        return PWR_MAX_OWNERS - 1;
+    }
+    p.owners[p.ownerCount] = name;
+    return p.ownerCount++;
+}
+
+// Table sizes are compile-time limits: running out is a setup bug
+inline void PWR_TableFull(const char *limit, int max) {
+    fprintf(stderr, "[PWR] table full: %s is %d\n", limit, max);
+    abort();
+}
+
+// Whoever the CPU is running for right now
+inline const char *PWR_Context() {
+    NVIC_Core &c = NVIC;
+    return c.activeDepth ? c.irqs[c.active[c.activeDepth - 1]].name : PWR.task;
+}
+
+inline void PWR_Charge(uint64_t ns) {
+    PWR_Core &p = PWR;
+    int running = PWR_OwnerId(PWR_Context());
+    for (int i = 0; i < p.periphCount; i++) {
+        PWR_Peripheral &d = p.periphs[i];
+        double ma = d.currentMa[d.state];
+        if (i == PWR_CPU && d.state == PWR_RUN) ma = PWR_OPPS[p.opp].runMa;
+        if (i == PWR_CPU && d.state == PWR_SLEEP) ma = PWR_OPPS[p.opp].sleepMa;
+        double uj = ma * PWR_VDD * ns * 1e-6;
+        d.energyUj[i == PWR_CPU ? running : d.owner] += uj;
+        if (i == PWR_CPU) p.modeUj[d.state] += uj;
+    }
+    if (p.periphs[PWR_CPU].state == PWR_RUN) {
+        p.oppNs[p.opp] += ns;
+        if (!p.idling || NVIC.activeDepth) p.busyNs += ns;
+    }
+}
+
+inline int PWR_AddPeripheral(const char *name, int clock = -1) {
+    PWR_Core &p = PWR;
+    if (p.periphCount == PWR_MAX_PERIPHS) PWR_TableFull("PWR_MAX_PERIPHS", PWR_MAX_PERIPHS);
+    PWR_Peripheral &d = p.periphs[p.periphCount];
+    d.name = name;
+    d.stateCount = 0;
+    d.state = 0;
+    d.clock = clock;
+    d.owner = PWR_OwnerId(PWR_Context());
+    for (int i = 0; i < PWR_MAX_OWNERS; i++) d.energyUj[i] = 0;
+    return p.periphCount++;
+}
+
+inline int PWR_AddState(int periph, const char *name, double currentMa) {
+    PWR_Peripheral &d = PWR.periphs[periph];
+    if (d.stateCount == PWR_MAX_STATES) PWR_TableFull("PWR_MAX_STATES", PWR_MAX_STATES);
+    d.stateNames[d.stateCount] = name;
+    d.currentMa[d.stateCount] = currentMa;
+    return d.stateCount++;
+}
+
+// Charged to `owner` from now on (default: the running task or handler)
+inline void PWR_SetState(int periph, int state, const char *owner = nullptr) {
+    PWR_Peripheral &d = PWR.periphs[periph];
+    if (state && d.clock >= 0 && !PWR.periphs[PWR.clocks[d.clock].periph].state) PWR.gatedAccesses++;
+    d.state = state;
+    d.owner = PWR_OwnerId(owner ? owner : PWR_Context());
+}
+
+// Name the thread-mode context for accounting; returns the previous one
+inline const char *PWR_SetTask(const char *task) {
+    const char *prev = PWR.task;
+    PWR.task = task;
+    return prev;
+}
+
+inline double PWR_PeripheralUj(int periph) {
+    const PWR_Peripheral &d = PWR.periphs[periph];
+    double uj = 0;
+    for (int o = 0; o < PWR.ownerCount; o++) uj += d.energyUj[o];
+    return uj;
+}
+
+inline double PWR_EnergyUj() {
+    double uj = 0;
+    for (int i = 0; i < PWR.periphCount; i++) uj += PWR_PeripheralUj(i);
+    return uj;
+}
+
+// -----------------------------------------------------------------------------
+// Clock gating and power domains
+// -----------------------------------------------------------------------------
+// onMa: draw while ungated (clock tree, domain leakage). Starts gated.
+inline int PWR_AddClock(const char *name, int parent, double onMa, uint64_t enableNs = 0,
+                        int holdMode = PWR_MODES - 1) {
+    PWR_Core &p = PWR;
+    if (p.clockCount == PWR_MAX_CLOCKS) PWR_TableFull("PWR_MAX_CLOCKS", PWR_MAX_CLOCKS);
+    int periph = PWR_AddPeripheral(name, parent);
+    PWR_AddState(periph, "gated", 0);
+    PWR_AddState(periph, "on", onMa);
+    PWR_Clock &k = p.clocks[p.clockCount];
+    k.periph = periph;
+    k.parent = parent;
+    k.refs = 0;
+    k.enableNs = enableNs;
+    k.autoGateNs = 0;
+    k.gateAtNs = UINT64_MAX;
+    k.holdMode = holdMode;
+    k.enables = 0;
+    return p.clockCount++;
+}
+
+inline void PWR_SetAutoGate(int clock, uint64_t ns) { PWR.clocks[clock].autoGateNs = ns; }
+
+inline bool PWR_ClockOn(int clock) { return PWR.periphs[PWR.clocks[clock].periph].state != 0; }
+
+inline void PWR_ClockGet(int clock) {
+    PWR_Core &p = PWR;
+    PWR_Clock &k = p.clocks[clock];
+    if (k.refs++) return;
+    k.gateAtNs = UINT64_MAX;                         // still on: cancel the auto-gate
+    if (PWR_ClockOn(clock)) return;
+    if (k.parent >= 0) PWR_ClockGet(k.parent);       // an enabled child holds its parent
+    if (k.enableNs) {
+        NVIC_Advance(k.enableNs);                    // the driver stalls meanwhile
+        p.clockStallNs += k.enableNs;
+    }
+    PWR_SetState(k.periph, 1);
+    k.enables++;
+}
+
+inline void PWR_ClockPut(int clock, uint64_t atNs = NVIC.nowNs);
+
+// atNs: when it happens (the advance hook gates ahead of NVIC.nowNs)
+inline void PWR_ClockGate(int clock, uint64_t atNs) {
+    PWR_Clock &k = PWR.clocks[clock];
+    k.gateAtNs = UINT64_MAX;
+    PWR_SetState(k.periph, 0);
+    if (k.parent >= 0) PWR_ClockPut(k.parent, atNs);
+}
+
+inline void PWR_ClockPut(int clock, uint64_t atNs) {
+    PWR_Clock &k = PWR.clocks[clock];
+    if (!k.refs) { PWR.clockErrors++; return; }
+    if (--k.refs) return;
+    if (k.autoGateNs) k.gateAtNs = atNs + k.autoGateNs;
+    else PWR_ClockGate(clock, atNs);
+}
+
+// Held around a transaction: PWR_ClockRequest on(uartClk);
+struct PWR_ClockRequest {
+    explicit PWR_ClockRequest(int c) : clock(c) { PWR_ClockGet(clock); }
+    ~PWR_ClockRequest() { PWR_ClockPut(clock); }
+    int clock;
+};
+
+/*
+Advance hook: charge energy, gating clocks whose auto-gate timeout runs
+out on the way. Gating is bookkeeping only, so it may happen while the
+core sleeps, as with autonomous peripheral clock requests.
+*/
+inline void PWR_Integrate(uint64_t ns) {
+    PWR_Core &p = PWR;
+    uint64_t t = NVIC.nowNs, end = ns > UINT64_MAX - t ? UINT64_MAX : t + ns;   // PWR_NO_DEADLINE
+    while (true) {
+        int next = -1;
+        for (int i = 0; i < p.clockCount; i++) {
+            uint64_t at = p.clocks[i].gateAtNs;
+            if (at == UINT64_MAX || at > end) continue;          // no auto-gate pending
+            if (next < 0 || at < p.clocks[next].gateAtNs) next = i;
+        }
+        if (next < 0) break;
+        uint64_t at = p.clocks[next].gateAtNs > t ? p.clocks[next].gateAtNs : t;
+        PWR_Charge(at - t);
+        t = at;
+        PWR_ClockGate(next, t);
+    }
+    PWR_Charge(end - t);
+}
+
+// Clears all statistics and peripherals; the CPU is re-added as PWR_CPU
+inline void PWR_Reset() {
+    PWR_Core &p = PWR;
+    p.deepest = PWR_MODES - 1;
+    p.maxWakeNs = UINT64_MAX;
+    for (int m = 0; m < PWR_MODES; m++) { p.residencyNs[m] = 0; p.entries[m] = 0; p.modeUj[m] = 0; }
+    p.wakeups = p.irqWakeups = 0;
+    p.startNs = NVIC.nowNs;
+    p.task = "main";
+    p.ownerCount = 0;
+    p.ownerOverflow = false;
+    p.periphCount = 0;
+    p.clockCount = 0;
+    p.clockErrors = p.gatedAccesses = 0;
+    p.clockStallNs = 0;
+    p.idling = false;
+    int cpu = PWR_AddPeripheral("CPU");
+    for (int m = 0; m < PWR_MODES; m++) PWR_AddState(cpu, PWR_STATES[m].name, PWR_STATES[m].currentMa);
+    p.opp = p.userOpp = 0;
+    p.upThreshold = 80;
+    p.governor = nullptr;
+    p.busyNs = p.windowStartNs = p.windowBusyNs = 0;
+    for (int o = 0; o < PWR_OPP_COUNT; o++) p.oppNs[o] = 0;
+    p.oppSwitches = 0;
+    NVIC.clockMhz = NVIC.maxClockMhz = PWR_OPPS[0].mhz;
+    NVIC.advanceHook = PWR_Integrate;
+}
+
+// -----------------------------------------------------------------------------
+// DVFS
+// -----------------------------------------------------------------------------
+inline void PWR_SetOpp(int opp) {
+    PWR_Core &p = PWR;
+    if (opp == p.opp) return;
+    NVIC_Advance(PWR_OPP_SWITCH_NS);                 // code stalls meanwhile
+    p.opp = opp;
+    NVIC.clockMhz = PWR_OPPS[opp].mhz;
+    p.oppSwitches++;
+}
+
+inline int PWR_GovPerformance(double) { return 0; }
+inline int PWR_GovPowersave(double) { return PWR_OPP_COUNT - 1; }
+inline int PWR_GovUserspace(double) { return PWR.userOpp; }
+
+// Above upThreshold: top speed. Otherwise the slowest OPP that would
+// have kept the load just under upThreshold.
+inline int PWR_GovOndemand(double load) {
+    PWR_Core &p = PWR;
+    if (load * 100 > p.upThreshold) return 0;
+    double needMhz = load * PWR_OPPS[p.opp].mhz * 100 / p.upThreshold;
+    int opp = 0;
+    for (int o = 1; o < PWR_OPP_COUNT; o++)
+        if (PWR_OPPS[o].mhz >= needMhz) opp = o;
+    return opp;
+}
+
+inline void PWR_GovernorTick() {
+    PWR_Core &p = PWR;
+    uint64_t windowNs = NVIC.nowNs - p.windowStartNs;
+    double load = windowNs ? (double)(p.busyNs - p.windowBusyNs) / windowNs : 1.0;
+    p.windowStartNs = NVIC.nowNs;
+    p.windowBusyNs = p.busyNs;
+    PWR_SetOpp(p.governor(load));
+}
+
+// Registers the governor's sample timer; call after NVIC_Reset() and PWR_Reset()
+inline int PWR_SetGovernor(PWR_Governor gov, uint64_t sampleNs, unsigned upThreshold = 80) {
+    PWR_Core &p = PWR;
+    p.governor = gov;
+    p.upThreshold = upThreshold;
+    p.windowStartNs = NVIC.nowNs;
+    p.windowBusyNs = p.busyNs;
+    int irq = NVIC_Register("DVFS_GOV", PWR_GOV_PRIO, PWR_GovernorTick, sampleNs, sampleNs);
+    if (irq >= 0) NVIC_SetDeferrable(irq, true);
+    return irq;
+}
+
+inline double PWR_AverageMhz() {
+    PWR_Core &p = PWR;
+    double ns = 0, mhzNs = 0;
+    for (int o = 0; o < PWR_OPP_COUNT; o++) { ns += p.oppNs[o]; mhzNs += PWR_OPPS[o].mhz * (double)p.oppNs[o]; }
+    return ns ? mhzNs / ns : PWR_OPPS[p.opp].mhz;
+}
+
+// -----------------------------------------------------------------------------
+// Sleep states and tickless idle
+// -----------------------------------------------------------------------------
+// E.g. a peripheral that needs its clock during idle limits this to SLEEP
+inline void PWR_AllowDeepest(int mode) { PWR.deepest = mode; }
+
+inline void PWR_SetMaxWakeLatency(uint64_t ns) { PWR.maxWakeNs = ns; }
+
+// Deepest mode worth entering for `idleNs` of idle time (PWR_RUN = none)
+inline int PWR_SelectMode(uint64_t idleNs) {
+    PWR_Core &p = PWR;
+    int mode = PWR_RUN;
+    int deepest = p.deepest;
+    for (int i = 0; i < p.clockCount; i++)
+        if (p.clocks[i].refs && p.clocks[i].holdMode < deepest) deepest = p.clocks[i].holdMode;
+    for (int m = PWR_SLEEP; m <= deepest; m++) {
+        const PWR_State &s = PWR_STATES[m];
+        if (s.exitNs <= p.maxWakeNs && s.entryNs + s.exitNs + s.residencyNs <= idleNs) mode = m;
+    }
+    return mode;
+}
+
+/*
+PWR_Idle(): idle until `deadlineNs` (next timer expiry) or the first
+interrupt, whichever comes first. Returns the mode used. Interrupts
+that woke the core have been handled when it returns.
+*/
+inline int PWR_Idle(uint64_t deadlineNs) {
+    NVIC_Core &c = NVIC;
+    PWR_Core &p = PWR;
+    uint64_t idleNs = deadlineNs > c.nowNs ? deadlineNs - c.nowNs : 0;
+    int mode = PWR_SelectMode(idleNs);
+    const char *task = PWR_SetTask("idle");
+    p.idling = true;
+    if (mode == PWR_RUN) {                           // too short: busy-wait
+        // With no deadline, poll until the next IRQ that would end a WFI
+        if (deadlineNs == PWR_NO_DEADLINE) {
+            uint64_t next = NVIC_NextArrivalNs(true);
+            idleNs = next > c.nowNs ? next - c.nowNs : 0;
+        }
+        // Work at the full clock; saturated, so CPU_WallNs cannot wrap either
+        uint64_t most = (UINT64_MAX - c.clockMhz) / c.maxClockMhz;
+        CPU_Run(idleNs > most / c.clockMhz ? most
+                                           : (idleNs * c.clockMhz + c.maxClockMhz - 1) / c.maxClockMhz);
+        p.idling = false;
+        PWR_SetTask(task);
+        return mode;
+    }
+
+    const PWR_State &s = PWR_STATES[mode];
+    NVIC_Advance(s.entryNs);
+    uint64_t sleptFrom = c.nowNs;
+    uint64_t wakeAt = deadlineNs == PWR_NO_DEADLINE ? deadlineNs : deadlineNs - s.exitNs;
+    PWR_SetState(PWR_CPU, mode);
+    bool early = CPU_SleepUntil(wakeAt);
+    PWR_SetState(PWR_CPU, PWR_RUN);
+    p.residencyNs[mode] += c.nowNs - sleptFrom;
+    p.entries[mode]++;
+    p.wakeups++;
+    if (early) p.irqWakeups++;
+    NVIC_Advance(s.exitNs);                          // pending IRQs still wait
+    p.idling = false;
+    PWR_SetTask(task);
+    CPU_Run(0);                                      // take them now
+    return mode;
+}
+
+inline double PWR_AveragePowerMw() {
+    uint64_t ns = NVIC.nowNs - PWR.startNs;
+    return ns ? PWR_EnergyUj() / (ns * 1e-6) : 0;
+}
+
+inline double PWR_WakeupsPerSec() {
+    uint64_t ns = NVIC.nowNs - PWR.startNs;
+    return ns ? PWR.wakeups * 1e9 / ns : 0;
+}
+
+// -----------------------------------------------------------------------------
+// Reports
+// -----------------------------------------------------------------------------
+inline void PWR_Report(std::ostream &os) {
+    PWR_Core &p = PWR;
+    double total = (double)(NVIC.nowNs - p.startNs);
+    uint64_t runNs = NVIC.nowNs - p.startNs;
+    for (int m = PWR_SLEEP; m < PWR_MODES; m++) runNs -= p.residencyNs[m];
+
+    os << std::left << std::setw(8) << "Mode" << std::right << std::setw(10) << "entries"
+       << std::setw(12) << "time ms" << std::setw(9) << "share" << std::setw(12) << "energy uJ" << std::endl;
+    for (int m = 0; m < PWR_MODES; m++) {
+        uint64_t ns = m == PWR_RUN ? runNs : p.residencyNs[m];
+        os << std::left << std::setw(8) << PWR_STATES[m].name << std::right << std::setw(10)
+           << (m == PWR_RUN ? 0 : p.entries[m]) << std::fixed << std::setprecision(2)
+           << std::setw(12) << ns / 1e6 << std::setw(8) << 100.0 * ns / total << "%"
+           << std::setw(12) << p.modeUj[m] << std::endl;
+    }
+    if (p.governor) {
+        os << "RUN time by clock:";
+        for (int o = 0; o < PWR_OPP_COUNT; o++)
+            os << " " << PWR_OPPS[o].name << " " << std::setprecision(1) << 100.0 * p.oppNs[o] / runNs << "%";
+        os << ", " << p.oppSwitches << " switches" << std::endl;
+    }
+    os << std::setprecision(1) << PWR_WakeupsPerSec() << " wake-ups/s (" << p.irqWakeups
+       << " by interrupt), average " << std::setprecision(3) << PWR_AveragePowerMw() << " mW" << std::endl;
+}
+
+inline void PWR_ClockReport(std::ostream &os) {
+    PWR_Core &p = PWR;
+    os << std::left << std::setw(12) << "Clock" << std::setw(12) << "parent" << std::right
+       << std::setw(6) << "refs" << std::setw(9) << "enables" << std::setw(12) << "energy uJ" << std::endl;
+    for (int i = 0; i < p.clockCount; i++) {
+        const PWR_Clock &k = p.clocks[i];
+        os << std::left << std::setw(12) << p.periphs[k.periph].name << std::setw(12)
+           << (k.parent >= 0 ? p.periphs[p.clocks[k.parent].periph].name : "-") << std::right
+           << std::setw(6) << k.refs << std::setw(9) << k.enables << std::fixed << std::setprecision(2)
+           << std::setw(12) << PWR_PeripheralUj(k.periph) << std::endl;
+    }
+    os << "Ungating stalls " << std::setprecision(2) << p.clockStallNs / 1e3 << " us, unbalanced puts "
+       << p.clockErrors << ", accesses with the clock gated " << p.gatedAccesses << std::endl;
+}
+
+// Energy in mJ: one row per peripheral, one column per task / handler
+inline void PWR_EnergyReport(std::ostream &os) {
+    PWR_Core &p = PWR;
+    os << std::left << std::setw(12) << "mJ" << std::right;
+    for (int o = 0; o < p.ownerCount; o++) os << std::setw(14) << p.owners[o];
+    os << std::setw(10) << "total" << std::endl;
+    for (int i = 0; i < p.periphCount; i++) {
+        const PWR_Peripheral &d = p.periphs[i];
+        os << std::left << std::setw(12) << d.name << std::right << std::fixed << std::setprecision(4);
+        for (int o = 0; o < p.ownerCount; o++) os << std::setw(14) << d.energyUj[o] / 1e3;
+        os << std::setw(10) << PWR_PeripheralUj(i) / 1e3 << std::endl;
+    }
+    os << std::left << std::setw(12) << "total" << std::right;
+    for (int o = 0; o < p.ownerCount; o++) {
+        double uj = 0;
+        for (int i = 0; i < p.periphCount; i++) uj += p.periphs[i].energyUj[o];
+        os << std::setw(14) << uj / 1e3;
+    }
+    os << std::setw(10) << PWR_EnergyUj() / 1e3 << std::endl;
+    if (p.ownerOverflow)
+        os << "(more than " << PWR_MAX_OWNERS - 1 << " tasks/handlers: the rest are under \"other\")" << std::endl;
+}
+
+inline void PWR_DumpJson(std::ostream &os) {
+    PWR_Core &p = PWR;
+    os << "{\n  \"unit\": \"uJ\",\n  \"vdd\": " << PWR_VDD << ",\n  \"duration_ns\": "
+       << NVIC.nowNs - p.startNs << ",\n  \"total\": " << PWR_EnergyUj() << ",\n  \"peripherals\": [";
+    for (int i = 0; i < p.periphCount; i++) {
+        const PWR_Peripheral &d = p.periphs[i];
+        os << (i ? ",\n" : "\n") << "    {\"name\": \"" << d.name << "\", \"total\": "
+           << PWR_PeripheralUj(i) << ", \"by_owner\": {";
+        bool first = true;
+        for (int o = 0; o < p.ownerCount; o++) {
+            if (!d.energyUj[o]) continue;
+            os << (first ? "" : ", ") << "\"" << p.owners[o] << "\": " << d.energyUj[o];
+            first = false;
+        }
+        os << "}}";
+    }
+    os << "\n  ]\n}\n";
+}
+
+#endif // FW_POWER_H
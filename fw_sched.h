@@ -0,0 +1,571 @@
+/*
+===============================================================================
+Purpose: Deterministic execution of the threaded simulations: a seeded
+         scheduler that runs one simulated thread at a time on a virtual
+         clock, and a record/replay log of its decisions, so a failing
+         run can be repeated exactly.
+Author: Sankalpa Hota
+How to use:
+  #include "fw_sched.h"
+
+  FwMutex uartLock;                          // instead of std::mutex
+  FwCondVar ready;                           // instead of condition_variable
+  FwThread wire(UART_TransferWire, ref(a), ref(b), ref(stop));   // std::thread
+  FwSleepFor(chrono::milliseconds(150));     // this_thread::sleep_for
+  FwClock::time_point t = FwClock::now();    // steady_clock::now
+  wire.join();
+
+  ./uart_demo                                // normal: real threads, real time
+  FW_SCHED_SEED=42 ./uart_demo               // deterministic, seed 42
+  FW_SCHED_SEED=42 FW_SCHED_RECORD=run.sched ./uart_demo
+  FW_SCHED_REPLAY=run.sched ./uart_demo      // same decisions again
+
+Without FW_SCHED_* in the environment (and no FwSched_Start) the
+wrappers are the std primitives plus one pointer test.
+
+Deterministic mode: every FwThread is still an OS thread, but only the
+one holding the baton runs. It hands the baton on at scheduling points:
+FwYield, FwSleepFor/Until, FwMutex::lock, FwCondVar waits, FwThread
+start, join and exit. The next thread is drawn from the runnable ones
+with a seeded PRNG, so a seed is one interleaving, and different seeds
+explore different ones. Code between two points runs atomically.
+Time is virtual (FwClock): sleeping costs nothing; when nobody can run
+the clock jumps to the next wake-up, and FwYield advances it by
+FW_SCHED_YIELD_NS so spin loops end. A run that can make no progress
+(every thread blocked: deadlock) or passes FW_SCHED_MAX_MS of virtual
+time is reported with each thread's state and ends with exit code
+FW_SCHED_FAIL_EXIT.
+
+The record log is text, one line per decision with more than one
+candidate: "<thread> <runnable count>". Replay follows it and stops
+with a report where the run diverges (a code change added or removed a
+scheduling point), which is what bisecting a regression needs.
+
+Only what goes through these wrappers is deterministic: real clocks,
+std::mutex, unsynchronised spinning without FwYield and threads not
+started as FwThread are outside the scheduler (and must say so with
+FwSched_Unscheduled before using a wrapper). Names of the form
+"thread N" number threads in creation order, main is "main".
+===============================================================================
+*/
+#ifndef FW_SCHED_H
+#define FW_SCHED_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#define FW_SCHED_YIELD_NS   1000            // Virtual time one FwYield takes
+#define FW_SCHED_MAX_MS     3600000ULL      // Default virtual time limit (1 h)
+#define FW_SCHED_FAIL_EXIT  3               // Exit code of a deadlock / limit / divergence
+
+// -----------------------------------------------------------------------------
+// Scheduler state
+// -----------------------------------------------------------------------------
+enum FwSchedThreadState { FWSCHED_RUNNABLE, FWSCHED_BLOCKED, FWSCHED_DONE };
+
+struct FwSchedThread {
+    int id;
+    std::string name;
+    FwSchedThreadState state = FWSCHED_RUNNABLE;
+    const void *waitOn = nullptr;       // Mutex, condition variable or thread
+    const char *waitWhat = "";          // For reports
+    uint64_t wakeNs = UINT64_MAX;       // Sleep / timed wait deadline
+    uint64_t waitSeq = 0;               // Condition variable FIFO order
+    bool timedOut = false;
+    std::condition_variable baton;      // Signalled when scheduled
+};
+
+struct FwSchedState {
+    std::mutex m;                       // Guards everything below
+    std::vector<FwSchedThread *> threads;
+    FwSchedThread *current = nullptr;   // Holder of the baton
+    std::vector<FwSchedThread *> runnable;
+    uint64_t nowNs = 0;                 // Virtual time
+    uint64_t limitNs = FW_SCHED_MAX_MS * 1000000ULL;
+    uint64_t rng = 0;
+    uint64_t seed = 0;
+    uint64_t waitSeq = 0;
+    unsigned long long decisions = 0;   // Choices among > 1 runnable thread
+    FILE *record = nullptr;
+    std::string recordPath;
+    std::vector<std::pair<int, int> > replay;   // (thread, runnable count)
+    size_t replayPos = 0;
+    bool replaying = false;
+};
+
+inline FwSchedThread *&FwSched_Self() {
+    static thread_local FwSchedThread *self = nullptr;
+    return self;
+}
+
+inline FwSchedState *FwSched_FromEnv();
+
+// Set before main() from the environment, or by FwSched_Start()
+template <int N>
+struct FwSchedGlobalsT {
+    static FwSchedState *state;
+};
+template <int N> FwSchedState *FwSchedGlobalsT<N>::state = FwSched_FromEnv();
+typedef FwSchedGlobalsT<0> FwSchedGlobals;
+
+inline bool FwSched_On() { return FwSchedGlobals::state != nullptr; }
+
+/*
+A thread that is deliberately left out of deterministic mode (the
+workers of fw_farm.h's FwPool, whose results do not depend on the
+interleaving) calls FwSched_Unscheduled() = true once. The wrappers then
+use the std primitives and real time on that thread, instead of
+aborting as they do for a stray std::thread. Such a thread must not
+share a mutex or condition variable with FwThreads.
+*/
+inline bool &FwSched_Unscheduled() {
+    static thread_local bool unscheduled = false;
+    return unscheduled;
+}
+
+// Wrappers take the std path: scheduler off, or this thread opted out
+inline bool FwSched_Native() { return !FwSched_On() || FwSched_Unscheduled(); }
+
+// -----------------------------------------------------------------------------
+// Starting and stopping
+// -----------------------------------------------------------------------------
+inline uint64_t FwSched_Rand(uint64_t &state) {                // splitmix64
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+inline FwSchedState *FwSched_Create(uint64_t seed, const char *recordPath, const char *replayPath) {
+    FwSchedState *s = new FwSchedState;        // never freed: threads may outlive main()
+    s->seed = s->rng = seed;
+    if (const char *e = getenv("FW_SCHED_MAX_MS")) s->limitNs = strtoull(e, nullptr, 10) * 1000000ULL;
+    if (replayPath && *replayPath) {
+        FILE *f = fopen(replayPath, "r");
+        if (!f) { fprintf(stderr, "[SCHED] cannot read %s\n", replayPath); exit(FW_SCHED_FAIL_EXIT); }
+        char line[128];
+        while (fgets(line, sizeof(line), f)) {
+            int tid, n;
+            if (line[0] == '#') {
+                unsigned long long recSeed;
+                if (sscanf(line, "# fw_sched seed=%llu", &recSeed) == 1) s->seed = s->rng = recSeed;
+                continue;
+            }
+            if (sscanf(line, "%d %d", &tid, &n) == 2) s->replay.push_back(std::make_pair(tid, n));
+        }
+        fclose(f);
+        s->replaying = true;
+    }
+    if (recordPath && *recordPath) {
+        s->record = fopen(recordPath, "w");
+        if (!s->record) { fprintf(stderr, "[SCHED] cannot write %s\n", recordPath); exit(FW_SCHED_FAIL_EXIT); }
+        setvbuf(s->record, nullptr, _IOLBF, 0);      // a crash keeps every decision
+        fprintf(s->record, "# fw_sched seed=%llu\n", (unsigned long long)s->seed);
+        s->recordPath = recordPath;
+    }
+    FwSchedThread *main = new FwSchedThread;
+    main->id = 0;
+    main->name = "main";
+    s->threads.push_back(main);
+    s->current = main;
+    FwSched_Self() = main;
+    return s;
+}
+
+/*
+FwSched_Start(): switch this process to deterministic mode, with the
+calling thread as "main". Call it before starting any FwThread.
+recordPath / replayPath may be null. Returns false if already on.
+*/
+inline bool FwSched_Start(uint64_t seed, const char *recordPath = nullptr,
+                          const char *replayPath = nullptr) {
+    if (FwSched_On()) return false;
+    FwSchedGlobals::state = FwSched_Create(seed, recordPath, replayPath);
+    return true;
+}
+
+// Back to real threads. Only once every other FwThread has finished.
+inline bool FwSched_Stop() {
+    FwSchedState *s = FwSchedGlobals::state;
+    if (!s) return true;
+    {
+        std::lock_guard<std::mutex> lk(s->m);
+        for (FwSchedThread *t : s->threads)
+            if (t != FwSched_Self() && t->state != FWSCHED_DONE) return false;
+        if (s->record) fclose(s->record);
+        s->record = nullptr;
+    }
+    FwSchedGlobals::state = nullptr;
+    FwSched_Self() = nullptr;
+    return true;
+}
+
+inline FwSchedState *FwSched_FromEnv() {
+    const char *seed = getenv("FW_SCHED_SEED");
+    const char *record = getenv("FW_SCHED_RECORD");
+    const char *replay = getenv("FW_SCHED_REPLAY");
+    if (!seed && !record && !replay) return nullptr;
+    uint64_t s = seed ? strtoull(seed, nullptr, 10)
+                      : (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+    FwSchedState *state = FwSched_Create(s, record, replay);
+    fprintf(stderr, "[SCHED] deterministic mode, %s%llu%s%s\n",
+            state->replaying ? "replaying " : "seed ",
+            state->replaying ? (unsigned long long)state->replay.size() : (unsigned long long)state->seed,
+            state->replaying ? " decisions" : "", record ? (std::string(", recording to ") + record).c_str() : "");
+    return state;
+}
+
+inline uint64_t FwSched_NowNs() {
+    FwSchedState *s = FwSchedGlobals::state;
+    return s ? s->nowNs : 0;
+}
+
+// -----------------------------------------------------------------------------
+// Switching (all called with s.m held by the running thread)
+// -----------------------------------------------------------------------------
+inline void FwSched_Fail(FwSchedState &s, const std::string &why) {
+    std::cout.flush();
+    fprintf(stderr, "[SCHED] %s after %llu decisions, t=%.3f ms (virtual)\n", why.c_str(),
+            s.decisions, s.nowNs / 1e6);
+    static const char *states[] = {"runnable", "blocked", "done"};
+    for (FwSchedThread *t : s.threads) {
+        fprintf(stderr, "[SCHED]   %-10s %s", t->name.c_str(), states[t->state]);
+        if (t->state == FWSCHED_BLOCKED) {
+            fprintf(stderr, " in %s", t->waitWhat);
+            if (t->wakeNs != UINT64_MAX) fprintf(stderr, " until t=%.3f ms", t->wakeNs / 1e6);
+        }
+        fprintf(stderr, "\n");
+    }
+    if (!s.recordPath.empty())
+        fprintf(stderr, "[SCHED] replay: FW_SCHED_REPLAY=%s\n", s.recordPath.c_str());
+    else if (!s.replaying)
+        fprintf(stderr, "[SCHED] rerun: FW_SCHED_SEED=%llu\n", (unsigned long long)s.seed);
+    if (s.record) fflush(s.record);
+    fflush(stderr);
+    std::_Exit(FW_SCHED_FAIL_EXIT);
+}
+
+inline void FwSched_WakeDue(FwSchedState &s) {
+    for (FwSchedThread *t : s.threads) {
+        if (t->state != FWSCHED_BLOCKED || t->wakeNs > s.nowNs) continue;
+        t->state = FWSCHED_RUNNABLE;
+        t->timedOut = t->waitOn != nullptr;            // timed wait expired
+        t->wakeNs = UINT64_MAX;
+    }
+}
+
+inline void FwSched_Wake(FwSchedState &s, const void *waitOn) {
+    for (FwSchedThread *t : s.threads) {
+        if (t->state != FWSCHED_BLOCKED || t->waitOn != waitOn) continue;
+        t->state = FWSCHED_RUNNABLE;
+        t->wakeNs = UINT64_MAX;
+    }
+}
+
+inline void FwSched_Block(FwSchedThread *me, const void *waitOn, const char *what,
+                          uint64_t wakeNs = UINT64_MAX) {
+    me->state = FWSCHED_BLOCKED;
+    me->waitOn = waitOn;
+    me->waitWhat = what;
+    me->wakeNs = wakeNs;
+    me->timedOut = false;
+}
+
+inline size_t FwSched_Decide(FwSchedState &s) {
+    size_t n = s.runnable.size();
+    if (n == 1) return 0;
+    s.decisions++;
+    size_t pick;
+    if (s.replaying && s.replayPos < s.replay.size()) {
+        std::pair<int, int> d = s.replay[s.replayPos++];
+        for (pick = 0; pick < n && s.runnable[pick]->id != d.first; pick++) {}
+        if ((int)n != d.second || pick == n) {
+            char why[160];
+            snprintf(why, sizeof(why), "replay diverged: recorded thread %d of %d runnable, "
+                     "now %zu runnable", d.first, d.second, n);
+            FwSched_Fail(s, why);
+        }
+    } else {
+        if (s.replaying) {
+            fprintf(stderr, "[SCHED] replay log ended, continuing with seed %llu\n",
+                    (unsigned long long)s.seed);
+            s.replaying = false;
+        }
+        pick = (size_t)(FwSched_Rand(s.rng) % n);
+    }
+    if (s.record) fprintf(s.record, "%d %zu\n", s.runnable[pick]->id, n);
+    return pick;
+}
+
+inline FwSchedThread *FwSched_Pick(FwSchedState &s) {
+    s.runnable.clear();
+    for (FwSchedThread *t : s.threads)
+        if (t->state == FWSCHED_RUNNABLE) s.runnable.push_back(t);
+    if (s.runnable.empty()) {                          // idle: jump to the next wake-up
+        uint64_t wake = UINT64_MAX;
+        for (FwSchedThread *t : s.threads)
+            if (t->state == FWSCHED_BLOCKED && t->wakeNs < wake) wake = t->wakeNs;
+        if (wake == UINT64_MAX) FwSched_Fail(s, "deadlock: every thread is blocked");
+        if (wake > s.limitNs) FwSched_Fail(s, "virtual time limit reached");
+        if (wake > s.nowNs) s.nowNs = wake;
+        FwSched_WakeDue(s);
+        for (FwSchedThread *t : s.threads)
+            if (t->state == FWSCHED_RUNNABLE) s.runnable.push_back(t);
+    }
+    return s.runnable[FwSched_Decide(s)];
+}
+
+// Pass the baton on; returns when this thread has it again
+inline void FwSched_Switch(FwSchedState &s, std::unique_lock<std::mutex> &lk) {
+    FwSchedThread *me = FwSched_Self();
+    FwSchedThread *next = FwSched_Pick(s);
+    s.current = next;
+    if (next != me) next->baton.notify_one();
+    if (me->state == FWSCHED_DONE) return;
+    while (s.current != me) me->baton.wait(lk);
+}
+
+inline FwSchedState &FwSched_Running() {
+    FwSchedState &s = *FwSchedGlobals::state;
+    if (!FwSched_Self()) {
+        fprintf(stderr, "[SCHED] a thread not started as FwThread used a scheduler primitive\n");
+        abort();
+    }
+    return s;
+}
+
+// Scheduling point: any runnable thread (this one included) goes next
+inline void FwSched_Point(FwSchedState &s, std::unique_lock<std::mutex> &lk) {
+    FwSched_Switch(s, lk);
+}
+
+// -----------------------------------------------------------------------------
+// Time
+// -----------------------------------------------------------------------------
+// steady_clock in normal mode, the virtual clock in deterministic mode
+struct FwClock {
+    typedef std::chrono::steady_clock::duration duration;
+    typedef duration::rep rep;
+    typedef duration::period period;
+    typedef std::chrono::steady_clock::time_point time_point;
+    static const bool is_steady = true;
+
+    static time_point now() {
+        if (FwSched_Native()) return std::chrono::steady_clock::now();
+        return time_point(std::chrono::duration_cast<duration>(std::chrono::nanoseconds(FwSched_NowNs())));
+    }
+};
+
+inline uint64_t FwSched_ToVirtualNs(FwClock::time_point t) {
+    long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+    return ns < 0 ? 0 : (uint64_t)ns;
+}
+
+inline void FwYield() {
+    if (FwSched_Native()) { std::this_thread::yield(); return; }
+    FwSchedState &s = FwSched_Running();
+    std::unique_lock<std::mutex> lk(s.m);
+    s.nowNs += FW_SCHED_YIELD_NS;
+    if (s.nowNs > s.limitNs) FwSched_Fail(s, "virtual time limit reached (spinning in FwYield)");
+    FwSched_WakeDue(s);
+    FwSched_Point(s, lk);
+}
+
+inline void FwSleepUntil(FwClock::time_point t) {
+    if (FwSched_Native()) { std::this_thread::sleep_until(t); return; }
+    FwSchedState &s = FwSched_Running();
+    std::unique_lock<std::mutex> lk(s.m);
+    uint64_t wake = FwSched_ToVirtualNs(t);
+    if (wake > s.nowNs) FwSched_Block(FwSched_Self(), nullptr, "sleep", wake);
+    FwSched_Point(s, lk);
+}
+
+template <typename Rep, typename Period>
+inline void FwSleepFor(const std::chrono::duration<Rep, Period> &d) {
+    if (FwSched_Native()) { std::this_thread::sleep_for(d); return; }
+    FwSleepUntil(FwClock::now() + std::chrono::duration_cast<FwClock::duration>(d));
+}
+
+// -----------------------------------------------------------------------------
+// Mutex and condition variable
+// -----------------------------------------------------------------------------
+class FwMutex {
+public:
+    void lock() {
+        if (FwSched_Native()) { native.lock(); return; }
+        FwSchedState &s = FwSched_Running();
+        std::unique_lock<std::mutex> lk(s.m);
+        FwSched_Point(s, lk);
+        acquire(s, lk);
+    }
+    bool try_lock() {
+        if (FwSched_Native()) return native.try_lock();
+        FwSchedState &s = FwSched_Running();
+        std::lock_guard<std::mutex> lk(s.m);
+        if (owner) return false;
+        owner = FwSched_Self();
+        return true;
+    }
+    void unlock() {
+        if (FwSched_Native()) { native.unlock(); return; }
+        FwSchedState &s = FwSched_Running();
+        std::lock_guard<std::mutex> lk(s.m);
+        release(s);
+    }
+
+private:
+    friend class FwCondVar;
+    void acquire(FwSchedState &s, std::unique_lock<std::mutex> &lk) {
+        while (owner) {
+            FwSched_Block(FwSched_Self(), this, "mutex");
+            FwSched_Switch(s, lk);
+        }
+        owner = FwSched_Self();
+    }
+    void release(FwSchedState &s) {
+        owner = nullptr;
+        FwSched_Wake(s, this);
+    }
+
+    std::mutex native;                  // Normal mode
+    FwSchedThread *owner = nullptr;     // Deterministic mode
+};
+
+class FwCondVar {
+public:
+    void notify_one() {
+        if (FwSched_Native()) { native.notify_one(); return; }
+        FwSchedState &s = FwSched_Running();
+        std::lock_guard<std::mutex> lk(s.m);
+        FwSchedThread *first = nullptr;                // longest waiting
+        for (FwSchedThread *t : s.threads)
+            if (t->state == FWSCHED_BLOCKED && t->waitOn == this && (!first || t->waitSeq < first->waitSeq))
+                first = t;
+        if (first) { first->state = FWSCHED_RUNNABLE; first->wakeNs = UINT64_MAX; }
+    }
+    void notify_all() {
+        if (FwSched_Native()) { native.notify_all(); return; }
+        FwSchedState &s = FwSched_Running();
+        std::lock_guard<std::mutex> lk(s.m);
+        FwSched_Wake(s, this);
+    }
+
+    void wait(std::unique_lock<FwMutex> &lock) {
+        if (FwSched_Native()) {
+            std::unique_lock<std::mutex> inner(lock.mutex()->native, std::adopt_lock);
+            native.wait(inner);
+            inner.release();
+            return;
+        }
+        waitVirtual(lock, UINT64_MAX);
+    }
+    template <typename Pred>
+    void wait(std::unique_lock<FwMutex> &lock, Pred pred) {
+        while (!pred()) wait(lock);
+    }
+
+    std::cv_status wait_until(std::unique_lock<FwMutex> &lock, FwClock::time_point t) {
+        if (FwSched_Native()) {
+            std::unique_lock<std::mutex> inner(lock.mutex()->native, std::adopt_lock);
+            std::cv_status st = native.wait_until(inner, t);
+            inner.release();
+            return st;
+        }
+        return waitVirtual(lock, FwSched_ToVirtualNs(t));
+    }
+    template <typename Pred>
+    bool wait_until(std::unique_lock<FwMutex> &lock, FwClock::time_point t, Pred pred) {
+        while (!pred())
+            if (wait_until(lock, t) == std::cv_status::timeout) return pred();
+        return true;
+    }
+    template <typename Rep, typename Period, typename Pred>
+    bool wait_for(std::unique_lock<FwMutex> &lock, const std::chrono::duration<Rep, Period> &d, Pred pred) {
+        return wait_until(lock, FwClock::now() + std::chrono::duration_cast<FwClock::duration>(d), pred);
+    }
+
+private:
+    std::cv_status waitVirtual(std::unique_lock<FwMutex> &lock, uint64_t wakeNs) {
+        FwSchedState &s = FwSched_Running();
+        std::unique_lock<std::mutex> lk(s.m);
+        FwSchedThread *me = FwSched_Self();
+        if (wakeNs <= s.nowNs) return std::cv_status::timeout;
+        lock.mutex()->release(s);
+        FwSched_Block(me, this, "condition variable", wakeNs);
+        me->waitSeq = s.waitSeq++;
+        FwSched_Switch(s, lk);
+        bool timedOut = me->timedOut;
+        lock.mutex()->acquire(s, lk);
+        return timedOut ? std::cv_status::timeout : std::cv_status::no_timeout;
+    }
+
+    std::condition_variable native;
+};
+
+// -----------------------------------------------------------------------------
+// Threads
+// -----------------------------------------------------------------------------
+class FwThread {
+public:
+    template <typename F, typename... Args>
+    explicit FwThread(F &&f, Args &&... args) {
+        std::function<void()> body = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+        if (FwSched_Native()) { thread = std::thread(body); return; }
+
+        FwSchedState &s = FwSched_Running();
+        std::unique_lock<std::mutex> lk(s.m);
+        FwSchedThread *t = new FwSchedThread;           // kept for reports, never freed
+        t->id = (int)s.threads.size();
+        t->name = "thread " + std::to_string(t->id);
+        s.threads.push_back(t);
+        rec = t;
+        thread = std::thread([t, body] { FwThread::run(t, body); });
+        FwSched_Point(s, lk);                           // the new thread may go first
+    }
+    FwThread(const FwThread &) = delete;
+    FwThread &operator=(const FwThread &) = delete;
+
+    bool joinable() const { return thread.joinable(); }
+    void detach() { thread.detach(); }
+    void join() {
+        if (rec && FwSched_On()) {
+            FwSchedState &s = FwSched_Running();
+            std::unique_lock<std::mutex> lk(s.m);
+            while (rec->state != FWSCHED_DONE) {
+                FwSched_Block(FwSched_Self(), rec, "join");
+                FwSched_Switch(s, lk);
+            }
+        }
+        thread.join();
+    }
+
+private:
+    static void run(FwSchedThread *t, const std::function<void()> &body) {
+        FwSchedState &s = *FwSchedGlobals::state;
+        FwSched_Self() = t;
+        {
+            std::unique_lock<std::mutex> lk(s.m);
+            while (s.current != t) t->baton.wait(lk);
+        }
+        body();
+        std::unique_lock<std::mutex> lk(s.m);
+        t->state = FWSCHED_DONE;
+        FwSched_Wake(s, t);                             // joiners
+        FwSched_Switch(s, lk);
+    }
+
+    std::thread thread;
+    FwSchedThread *rec = nullptr;
+};
+
+#endif // FW_SCHED_H
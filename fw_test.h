@@ -0,0 +1,527 @@
+/*
+===============================================================================
+Purpose: In-tree unit test runner for the simulators: fixtures that reset
+         peripheral state, parameterized tests, and execution sharded
+         across CPU cores.
+Author: Sankalpa Hota
+How to use:
+  #include "fw_test.h"
+
+  FW_TEST(Crc8, EmptyIsZero) {
+      FW_EXPECT_EQ(UART_Crc8(nullptr, 0), 0);
+  }
+
+  struct UartFixture : FwTestFixture {        // new object for every test
+      UART_Registers uart;
+      void setUp() override { uart.rxBuffer.reset(16); }
+  };
+  FW_TEST_F(UartFixture, ReadEmptyReturnsZero) {
+      FW_ASSERT_EQ(UART_ReadChar(uart), 0);   // ASSERT stops the test
+  }
+
+  struct UartBaud : FwTestWithParam<uint32_t> {};
+  FW_TEST_P(UartBaud, CharTime) {
+      FW_EXPECT_GT(param(), 0u);
+  }
+  FW_INSTANTIATE(Common, UartBaud, std::vector<uint32_t>{9600, 115200});
+
+  int main(int argc, char **argv) { return FwTest_Main(argc, argv); }
+
+  ./test_uart [--filter=UartBaud] [--jobs=N] [--shard=i/n] [--list] [--verbose]
+
+Each case runs in a fresh fixture: setUp(), the body, tearDown().
+FW_EXPECT_* records a failure and continues, FW_ASSERT_* also returns
+from the test body. An exception escaping a test is a failure.
+
+Sharding: --jobs=N (default: one per core) forks N worker processes;
+worker j runs cases j, j+N, j+2N... and reports over a pipe. Separate
+processes keep the lessons' global peripherals apart, and a test that
+crashes only takes its worker down: that case is reported with the
+signal, and the rest of its shard runs in a new worker. Workers send
+their stdout to /dev/null; use --jobs=1 to see what a test prints.
+--shard=i/n (or GTEST_SHARD_INDEX / GTEST_TOTAL_SHARDS) runs only every
+n-th case, for spreading one binary over several machines or ctest runs.
+===============================================================================
+*/
+#ifndef FW_TEST_H
+#define FW_TEST_H
+
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define FW_TEST_FORK 1
+#endif
+
+#define FW_TEST_MAX_JOBS 64
+
+// -----------------------------------------------------------------------------
+// Registry
+// -----------------------------------------------------------------------------
+struct FwTestCase {
+    std::string name;                   // Suite.Test, or Prefix/Suite.Test/param
+    std::function<void()> run;          // Fixture, setUp, body, tearDown
+};
+
+struct FwTestState {
+    std::vector<FwTestCase> cases;
+    std::vector<std::function<void()> > expanders;   // FW_INSTANTIATE, run at start
+    std::string failures;               // Messages of the running case
+    bool verbose = false;
+};
+
+inline FwTestState &FwTest_State() {
+    static FwTestState state;
+    return state;
+}
+
+struct FwTestFixture {
+    virtual ~FwTestFixture() {}
+    virtual void setUp() {}
+    virtual void tearDown() {}
+    virtual void body() = 0;
+};
+
+template <typename P>
+struct FwTestWithParam : FwTestFixture {
+    typedef P ParamType;
+    const P &param() const { return *paramPtr; }
+    const P *paramPtr = nullptr;
+};
+
+inline void FwTest_Fail(const char *file, int line, const std::string &msg) {
+    std::ostringstream os;
+    os << "  " << file << ":" << line << ": " << msg << "\n";
+    FwTest_State().failures += os.str();
+}
+
+inline void FwTest_Execute(FwTestFixture &t) {
+    const char *phase = "setUp()";
+    try {
+        t.setUp();
+        phase = "test body";
+        if (FwTest_State().failures.empty()) t.body();
+        phase = "tearDown()";
+        t.tearDown();
+    } catch (const std::exception &e) {
+        FwTest_State().failures += std::string("  uncaught exception in ") + phase + ": " + e.what() + "\n";
+    } catch (...) {
+        FwTest_State().failures += std::string("  uncaught exception in ") + phase + "\n";
+    }
+}
+
+template <typename T>
+inline void FwTest_RunPlain() {
+    T t;
+    FwTest_Execute(t);
+}
+
+struct FwTestRegistrar {
+    FwTestRegistrar(const char *name, void (*run)()) {
+        FwTest_State().cases.push_back(FwTestCase{name, run});
+    }
+};
+
+// Parameterized tests of one fixture, expanded by each FW_INSTANTIATE
+template <typename F>
+struct FwTestParamTests {
+    typedef F *(*Factory)();
+    static std::vector<std::pair<const char *, Factory> > &list() {
+        static std::vector<std::pair<const char *, Factory> > tests;
+        return tests;
+    }
+};
+
+template <typename T, typename F>
+inline F *FwTest_New() { return new T; }
+
+template <typename F>
+struct FwTestParamRegistrar {
+    FwTestParamRegistrar(const char *name, typename FwTestParamTests<F>::Factory make) {
+        FwTestParamTests<F>::list().push_back(std::make_pair(name, make));
+    }
+};
+
+// -----------------------------------------------------------------------------
+// Printing values in failure messages and parameter names
+// -----------------------------------------------------------------------------
+template <typename A, typename B>
+inline std::ostream &operator<<(std::ostream &os, const std::pair<A, B> &p) {
+    return os << p.first << "_" << p.second;
+}
+
+template <typename T>
+struct FwTestPrintable {
+    template <typename U>
+    static auto check(int) -> decltype(std::declval<std::ostream &>() << std::declval<const U &>(),
+                                       std::true_type());
+    template <typename U>
+    static std::false_type check(...);
+    static const bool value = decltype(check<T>(0))::value;
+};
+
+template <typename T>
+inline typename std::enable_if<FwTestPrintable<T>::value, std::string>::type
+FwTest_Str(const T &v) {
+    std::ostringstream os;
+    os << v;
+    return os.str();
+}
+
+template <typename T>
+inline typename std::enable_if<!FwTestPrintable<T>::value, std::string>::type
+FwTest_Str(const T &) {
+    return "<" + std::to_string(sizeof(T)) + "-byte object>";
+}
+
+// Bytes are shown as numbers, chars with their code as well
+inline std::string FwTest_Str(const uint8_t &v) { return std::to_string((unsigned)v); }
+inline std::string FwTest_Str(const int8_t &v) { return std::to_string((int)v); }
+inline std::string FwTest_Str(const char &v) {
+    char buf[16];
+    if (v >= 32 && v < 127) snprintf(buf, sizeof(buf), "'%c' (%d)", v, (int)v);
+    else snprintf(buf, sizeof(buf), "%d", (int)(unsigned char)v);
+    return buf;
+}
+inline std::string FwTest_Str(const bool &v) { return v ? "true" : "false"; }
+
+// Parameter names become part of the case name: keep them filter-friendly
+template <typename T>
+inline std::string FwTest_ParamName(const T &v, size_t index) {
+    std::string s = FwTest_Str(v);
+    if (s.empty() || s[0] == '<') return std::to_string(index);
+    for (char &c : s)
+        if (!isalnum((unsigned char)c) && c != '-' && c != '.') c = '_';
+    return s;
+}
+
+template <typename F>
+struct FwTestInstantiation {
+    typedef typename F::ParamType P;
+    FwTestInstantiation(const char *prefix, const char *fixture, const std::vector<P> &values) {
+        std::shared_ptr<std::vector<P> > vals(new std::vector<P>(values));
+        std::string base = std::string(prefix) + "/" + fixture + ".";
+        FwTest_State().expanders.push_back([vals, base] {
+            for (const auto &test : FwTestParamTests<F>::list()) {
+                for (size_t i = 0; i < vals->size(); i++) {
+                    typename FwTestParamTests<F>::Factory make = test.second;
+                    const P *param = &(*vals)[i];
+                    FwTest_State().cases.push_back(FwTestCase{
+                        base + test.first + "/" + FwTest_ParamName(*param, i),
+                        [vals, make, param] {
+                            std::unique_ptr<F> t(make());
+                            t->paramPtr = param;
+                            FwTest_Execute(*t);
+                        }});
+                }
+            }
+        });
+    }
+};
+
+// Parameter generators
+inline std::vector<int> FwTest_Range(int begin, int end, int step = 1) {
+    std::vector<int> v;
+    for (int i = begin; i < end; i += step) v.push_back(i);
+    return v;
+}
+
+template <typename A, typename B>
+inline std::vector<std::pair<A, B> > FwTest_Combine(const std::vector<A> &a, const std::vector<B> &b) {
+    std::vector<std::pair<A, B> > v;
+    for (const A &x : a)
+        for (const B &y : b) v.push_back(std::make_pair(x, y));
+    return v;
+}
+
+// -----------------------------------------------------------------------------
+// Test and assertion macros
+// -----------------------------------------------------------------------------
+#define FW_TEST_CLASS(suite, name) suite##_##name##_Test
+
+#define FW_TEST(suite, name)                                                      \
+    struct FW_TEST_CLASS(suite, name) : FwTestFixture { void body() override; };  \
+    static FwTestRegistrar suite##_##name##_reg(#suite "." #name,                 \
+                                                FwTest_RunPlain<FW_TEST_CLASS(suite, name)>); \
+    void FW_TEST_CLASS(suite, name)::body()
+
+#define FW_TEST_F(fixture, name)                                                  \
+    struct FW_TEST_CLASS(fixture, name) : fixture { void body() override; };      \
+    static FwTestRegistrar fixture##_##name##_reg(#fixture "." #name,             \
+                                                  FwTest_RunPlain<FW_TEST_CLASS(fixture, name)>); \
+    void FW_TEST_CLASS(fixture, name)::body()
+
+#define FW_TEST_P(fixture, name)                                                  \
+    struct FW_TEST_CLASS(fixture, name) : fixture { void body() override; };      \
+    static FwTestParamRegistrar<fixture> fixture##_##name##_reg(                  \
+        #name, FwTest_New<FW_TEST_CLASS(fixture, name), fixture>);                \
+    void FW_TEST_CLASS(fixture, name)::body()
+
+#define FW_INSTANTIATE(prefix, fixture, values)                                   \
+    static FwTestInstantiation<fixture> prefix##_##fixture##_inst(#prefix, #fixture, values)
+
+#define FW_TEST_CMP(NAME, OP)                                                     \
+    template <typename A, typename B>                                             \
+    inline bool FwTest_##NAME(const A &a, const B &b, const char *ea, const char *eb, \
+                              const char *file, int line) {                       \
+        if (a OP b) return true;                                                  \
+        FwTest_Fail(file, line, std::string("expected ") + ea + " " #OP " " + eb + \
+                    ", got " + FwTest_Str(a) + " vs " + FwTest_Str(b));           \
+        return false;                                                             \
+    }
+FW_TEST_CMP(EQ, ==)
+FW_TEST_CMP(NE, !=)
+FW_TEST_CMP(LT, <)
+FW_TEST_CMP(LE, <=)
+FW_TEST_CMP(GT, >)
+FW_TEST_CMP(GE, >=)
+
+inline bool FwTest_Bool(bool v, bool want, const char *e, const char *file, int line) {
+    if (v == want) return true;
+    FwTest_Fail(file, line, std::string("expected ") + e + " to be " + (want ? "true" : "false"));
+    return false;
+}
+
+inline bool FwTest_NEAR(double a, double b, double tol, const char *ea, const char *eb,
+                        const char *file, int line) {
+    if (a - b <= tol && b - a <= tol) return true;
+    FwTest_Fail(file, line, std::string("expected ") + ea + " within " + FwTest_Str(tol) +
+                " of " + eb + ", got " + FwTest_Str(a) + " vs " + FwTest_Str(b));
+    return false;
+}
+
+#define FW_EXPECT_TRUE(c)   ((void)FwTest_Bool(!!(c), true, #c, __FILE__, __LINE__))
+#define FW_EXPECT_FALSE(c)  ((void)FwTest_Bool(!!(c), false, #c, __FILE__, __LINE__))
+#define FW_EXPECT_EQ(a, b)  ((void)FwTest_EQ((a), (b), #a, #b, __FILE__, __LINE__))
+#define FW_EXPECT_NE(a, b)  ((void)FwTest_NE((a), (b), #a, #b, __FILE__, __LINE__))
+#define FW_EXPECT_LT(a, b)  ((void)FwTest_LT((a), (b), #a, #b, __FILE__, __LINE__))
+#define FW_EXPECT_LE(a, b)  ((void)FwTest_LE((a), (b), #a, #b, __FILE__, __LINE__))
+#define FW_EXPECT_GT(a, b)  ((void)FwTest_GT((a), (b), #a, #b, __FILE__, __LINE__))
+#define FW_EXPECT_GE(a, b)  ((void)FwTest_GE((a), (b), #a, #b, __FILE__, __LINE__))
+#define FW_EXPECT_NEAR(a, b, tol) ((void)FwTest_NEAR((a), (b), (tol), #a, #b, __FILE__, __LINE__))
+
+#define FW_ASSERT_TRUE(c)   do { if (!FwTest_Bool(!!(c), true, #c, __FILE__, __LINE__)) return; } while (0)
+#define FW_ASSERT_FALSE(c)  do { if (!FwTest_Bool(!!(c), false, #c, __FILE__, __LINE__)) return; } while (0)
+#define FW_ASSERT_EQ(a, b)  do { if (!FwTest_EQ((a), (b), #a, #b, __FILE__, __LINE__)) return; } while (0)
+#define FW_ASSERT_NE(a, b)  do { if (!FwTest_NE((a), (b), #a, #b, __FILE__, __LINE__)) return; } while (0)
+#define FW_ASSERT_LT(a, b)  do { if (!FwTest_LT((a), (b), #a, #b, __FILE__, __LINE__)) return; } while (0)
+#define FW_ASSERT_LE(a, b)  do { if (!FwTest_LE((a), (b), #a, #b, __FILE__, __LINE__)) return; } while (0)
+#define FW_ASSERT_GT(a, b)  do { if (!FwTest_GT((a), (b), #a, #b, __FILE__, __LINE__)) return; } while (0)
+#define FW_ASSERT_GE(a, b)  do { if (!FwTest_GE((a), (b), #a, #b, __FILE__, __LINE__)) return; } while (0)
+
+#define FW_FAIL(msg)        do { FwTest_Fail(__FILE__, __LINE__, (msg)); return; } while (0)
+
+// -----------------------------------------------------------------------------
+// Running
+// -----------------------------------------------------------------------------
+struct FwTestResult {
+    bool ran = false;
+    bool passed = false;
+    std::string failures;
+};
+
+// Run one case in this process
+inline void FwTest_RunCase(const FwTestCase &c, FwTestResult &r) {
+    FwTestState &s = FwTest_State();
+    if (s.verbose) std::cout << "[ RUN  ] " << c.name << std::endl;
+    s.failures.clear();
+    c.run();
+    r.ran = true;
+    r.passed = s.failures.empty();
+    r.failures = s.failures;
+    if (s.verbose) std::cout << (r.passed ? "[  OK  ] " : "[ FAIL ] ") << c.name << std::endl;
+}
+
+#ifdef FW_TEST_FORK
+inline void FwTest_WriteAll(int fd, const std::string &data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = write(fd, data.data() + off, data.size() - off);
+        if (n <= 0) return;
+        off += (size_t)n;
+    }
+}
+
+/*
+One round of workers over `todo` (indices into cases). Worker j sends
+"P <i>\n" per passed case and "F <i> <len>\n<messages>" per failed one.
+A worker that dies leaves its current case without a report: that case
+is failed with the signal, and the cases after it come back in `rest`.
+*/
+inline void FwTest_RunWorkers(const std::vector<FwTestCase> &cases, const std::vector<size_t> &todo,
+                              int jobs, std::vector<FwTestResult> &results, std::vector<size_t> &rest) {
+    if (jobs < 1 || jobs > FW_TEST_MAX_JOBS) jobs = jobs < 1 ? 1 : FW_TEST_MAX_JOBS;
+    std::cout.flush();
+    pid_t pid[FW_TEST_MAX_JOBS];
+    int fd[FW_TEST_MAX_JOBS];
+    std::string buf[FW_TEST_MAX_JOBS];
+    for (int j = 0; j < jobs; j++) {
+        int p[2];
+        if (pipe(p) != 0) { perror("pipe"); exit(2); }
+        pid[j] = fork();
+        if (pid[j] == 0) {
+            close(p[0]);
+            int devnull = open("/dev/null", O_WRONLY);
+            if (devnull >= 0) { dup2(devnull, 1); close(devnull); }
+            for (size_t k = j; k < todo.size(); k += jobs) {
+                FwTestResult r;
+                FwTest_RunCase(cases[todo[k]], r);
+                std::ostringstream os;
+                if (r.passed) os << "P " << todo[k] << "\n";
+                else os << "F " << todo[k] << " " << r.failures.size() << "\n" << r.failures;
+                FwTest_WriteAll(p[1], os.str());
+            }
+            close(p[1]);
+            _exit(0);
+        }
+        close(p[1]);
+        fd[j] = p[0];
+    }
+
+    // Collect until every pipe is closed
+    int live = jobs;
+    while (live) {
+        struct pollfd pfd[FW_TEST_MAX_JOBS];
+        for (int j = 0; j < jobs; j++) { pfd[j].fd = fd[j]; pfd[j].events = POLLIN; }
+        if (poll(pfd, (nfds_t)jobs, -1) < 0) continue;
+        for (int j = 0; j < jobs; j++) {
+            if (fd[j] < 0 || !(pfd[j].revents & (POLLIN | POLLHUP))) continue;
+            char chunk[4096];
+            ssize_t n = read(fd[j], chunk, sizeof(chunk));
+            if (n <= 0) { close(fd[j]); fd[j] = -1; live--; continue; }
+            buf[j].append(chunk, (size_t)n);
+        }
+    }
+
+    for (int j = 0; j < jobs; j++) {
+        int status = 0;
+        waitpid(pid[j], &status, 0);
+        size_t pos = 0, k = j;
+        bool garbled = false;
+        while (pos < buf[j].size() && k < todo.size()) {
+            size_t eol = buf[j].find('\n', pos);
+            if (eol == std::string::npos) break;
+            char kind = 0;
+            unsigned long idx = 0, len = 0;
+            int got = sscanf(buf[j].c_str() + pos, "%c %lu %lu", &kind, &idx, &len);
+            // "P <case>" or "F <case> <len>", for the case this worker ran next
+            garbled = !((kind == 'P' && got >= 2) || (kind == 'F' && got == 3)) ||
+                      idx != todo[k] || (kind == 'F' && eol + 1 + len > buf[j].size());
+            if (garbled) break;
+            FwTestResult &r = results[idx];
+            r.ran = true;
+            r.passed = kind == 'P';
+            pos = eol + 1;
+            if (kind == 'F') { r.failures = buf[j].substr(pos, len); pos += len; }
+            k += jobs;
+        }
+        if (k >= todo.size()) continue;
+        // The worker died in case todo[k], or its report of it is unreadable
+        FwTestResult &r = results[todo[k]];
+        r.ran = true;
+        r.passed = false;
+        std::ostringstream os;
+        if (garbled) os << "  unreadable result from the worker\n";
+        else if (WIFSIGNALED(status)) os << "  worker killed by signal " << WTERMSIG(status)
+                                    << " (" << strsignal(WTERMSIG(status)) << ")\n";
+        else os << "  worker exited with status " << WEXITSTATUS(status) << "\n";
+        r.failures = os.str();
+        for (k += jobs; k < todo.size(); k += jobs) rest.push_back(todo[k]);
+    }
+}
+#endif
+
+inline bool FwTest_Matches(const std::string &name, const std::string &filter) {
+    return filter.empty() || name.find(filter) != std::string::npos;
+}
+
+/*
+FwTest_Main(): expand the parameterized tests, select by --filter and
+--shard, run, print failures and a summary. Returns 0 if all passed.
+*/
+inline int FwTest_Main(int argc, char **argv) {
+    FwTestState &s = FwTest_State();
+    std::string filter;
+    bool list = false;
+    int jobs = (int)std::thread::hardware_concurrency();
+    unsigned shard = 0, shards = 1;
+    if (const char *e = getenv("GTEST_TOTAL_SHARDS")) shards = (unsigned)atoi(e);
+    if (const char *e = getenv("GTEST_SHARD_INDEX")) shard = (unsigned)atoi(e);
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 9, "--filter=") == 0)     filter = arg.substr(9);
+        else if (arg.compare(0, 7, "--jobs=") == 0)  jobs = atoi(arg.c_str() + 7);
+        else if (arg.compare(0, 8, "--shard=") == 0) sscanf(arg.c_str() + 8, "%u/%u", &shard, &shards);
+        else if (arg == "--list")                    list = true;
+        else if (arg == "--verbose")                 s.verbose = true;
+        else std::cerr << "[TEST] ignoring unknown option " << arg << std::endl;
+    }
+    if (shards == 0 || shard >= shards) { shard = 0; shards = 1; }
+
+    for (size_t i = 0; i < s.expanders.size(); i++) s.expanders[i]();
+    s.expanders.clear();
+
+    std::vector<size_t> todo;
+    for (size_t i = 0, n = 0; i < s.cases.size(); i++)
+        if (FwTest_Matches(s.cases[i].name, filter) && n++ % shards == shard) todo.push_back(i);
+    if (list) {
+        for (size_t i : todo) std::cout << s.cases[i].name << "\n";
+        return 0;
+    }
+
+    if (jobs < 1) jobs = 1;
+    if (jobs > FW_TEST_MAX_JOBS) jobs = FW_TEST_MAX_JOBS;
+    if ((size_t)jobs > todo.size()) jobs = todo.empty() ? 1 : (int)todo.size();
+
+    std::vector<FwTestResult> results(s.cases.size());
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+#ifdef FW_TEST_FORK
+    if (jobs > 1) {
+        std::vector<size_t> rest = todo;
+        while (!rest.empty()) {
+            std::vector<size_t> round;
+            round.swap(rest);
+            FwTest_RunWorkers(s.cases, round, std::min(jobs, (int)round.size()), results, rest);
+        }
+    } else
+#endif
+    {
+        jobs = 1;
+        for (size_t i : todo) FwTest_RunCase(s.cases[i], results[i]);
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    size_t failed = 0;
+    for (size_t i : todo) {
+        if (results[i].passed) continue;
+        failed++;
+        std::cout << "[ FAIL ] " << s.cases[i].name << "\n" << results[i].failures;
+    }
+    std::cout << "[TEST] " << todo.size() << " cases, " << todo.size() - failed << " passed, "
+              << failed << " failed in " << std::fixed;
+    std::cout.precision(2);
+    std::cout << secs << " s (" << jobs << (jobs == 1 ? " job" : " jobs");
+    if (shards > 1) std::cout << ", shard " << shard << "/" << shards;
+    std::cout << ")" << std::endl;
+    return failed ? 1 : 0;
+}
+
+#endif // FW_TEST_H
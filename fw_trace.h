@@ -0,0 +1,264 @@
+/*
+===============================================================================
+Purpose: Timeline tracing for the simulators: task and ISR activity,
+         critical sections, mutex waits and bus transactions, exported
+         as Chrome trace-event JSON.
+Author: Sankalpa Hota
+How to use:
+  #include "fw_trace.h"
+
+  FwTrace_Start();
+  int cpu = FwTrace_Track("NVIC", "CPU");            // process, thread
+  FwTrace_Begin(cpu, "UART1_RX", "isr", NVIC.nowNs); // simulated time
+  FwTrace_End(cpu, NVIC.nowNs);
+  FwTrace_Complete(bus, "wait for bus", "spi", releasedNs, waitedNs);
+  FwTrace_Instant(bus, "contention", "spi", nowNs);
+
+  {
+      FwTraceScope s(task, "send", "task");          // real time
+      FwTraceLock<mutex> lock(uartMutex, "uartMutex", task);  // waits shown
+  }
+  FwTrace_Stop();
+  ofstream f("trace_09.json");
+  FwTrace_WriteJson(f);
+
+Open the file in ui.perfetto.dev or chrome://tracing. Each process is
+one time domain: the simulators pass their simulated clock in ns, real
+threads use FwTrace_NowNs() (fw_latency.h clock, 0 = FwTrace_Start()).
+Slices on one track must nest, as on a call stack; an ISR that
+preempts a critical section shows up inside it.
+
+Names, categories and string arguments are stored as pointers: use
+literals or other strings that outlive the export. While tracing is
+stopped every call returns after one relaxed load. At most
+FW_TRACE_MAX_EVENTS are kept; later ones are counted as dropped.
+===============================================================================
+*/
+#ifndef FW_TRACE_H
+#define FW_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include "fw_latency.h"
+
+#define FW_TRACE_MAX_EVENTS 2000000
+#define FW_TRACE_MAX_TRACKS 64
+
+struct FwTraceEvent {
+    uint64_t tsNs;
+    uint64_t durNs;             // 'X' only
+    const char *name;
+    const char *cat;
+    char ph;                    // 'B', 'E', 'X' or 'i'
+    uint8_t track;
+    const char *argName;        // Optional single argument
+    const char *argStr;         // String value, or nullptr for argInt
+    int64_t argInt;
+};
+
+struct FwTraceTrack {
+    const char *process;
+    const char *thread;
+};
+
+struct FwTraceState {
+    std::atomic<bool> enabled;
+    std::mutex lock;
+    std::vector<FwTraceEvent> events;
+    FwTraceTrack tracks[FW_TRACE_MAX_TRACKS];
+    int trackCount = 0;
+    unsigned long dropped = 0;
+    uint64_t originNs = 0;
+    FwTraceState() : enabled(false) {}
+};
+
+inline FwTraceState &FwTrace_State() {
+    static FwTraceState state;
+    return state;
+}
+
+inline bool FwTrace_On() { return FwTrace_State().enabled.load(std::memory_order_relaxed); }
+
+// Real-time timestamp for thread-based simulations
+inline uint64_t FwTrace_NowNs() { return FwLat_NowNs() - FwTrace_State().originNs; }
+
+// Drop the previous trace and start recording
+inline void FwTrace_Start() {
+    FwTraceState &s = FwTrace_State();
+    std::lock_guard<std::mutex> lock(s.lock);
+    s.events.clear();
+    s.trackCount = 0;
+    s.dropped = 0;
+    s.originNs = FwLat_NowNs();
+    s.enabled = true;
+}
+
+inline void FwTrace_Stop() { FwTrace_State().enabled = false; }
+
+// -----------------------------------------------------------------------------
+// Recording
+// -----------------------------------------------------------------------------
+// Track for (process, thread), created on first use; the last one is
+// shared once FW_TRACE_MAX_TRACKS are in use
+inline int FwTrace_Track(const char *process, const char *thread) {
+    FwTraceState &s = FwTrace_State();
+    std::lock_guard<std::mutex> lock(s.lock);
+    for (int i = 0; i < s.trackCount; i++)
+        if (!strcmp(s.tracks[i].process, process) && !strcmp(s.tracks[i].thread, thread)) return i;
+    if (s.trackCount == FW_TRACE_MAX_TRACKS) return FW_TRACE_MAX_TRACKS - 1;
+    s.tracks[s.trackCount] = FwTraceTrack{process, thread};
+    return s.trackCount++;
+}
+
+inline void FwTrace_Add(const FwTraceEvent &e) {
+    FwTraceState &s = FwTrace_State();
+    std::lock_guard<std::mutex> lock(s.lock);
+    if (s.events.size() >= FW_TRACE_MAX_EVENTS) { s.dropped++; return; }
+    s.events.push_back(e);
+}
+
+inline void FwTrace_Begin(int track, const char *name, const char *cat, uint64_t tsNs,
+                          const char *argName = nullptr, const char *argStr = nullptr,
+                          int64_t argInt = 0) {
+    if (!FwTrace_On()) return;
+    FwTrace_Add(FwTraceEvent{tsNs, 0, name, cat, 'B', (uint8_t)track, argName, argStr, argInt});
+}
+
+inline void FwTrace_End(int track, uint64_t tsNs) {
+    if (!FwTrace_On()) return;
+    FwTrace_Add(FwTraceEvent{tsNs, 0, nullptr, nullptr, 'E', (uint8_t)track, nullptr, nullptr, 0});
+}
+
+// A slice whose length is known when it ends (waits, transfers)
+inline void FwTrace_Complete(int track, const char *name, const char *cat, uint64_t startNs,
+                             uint64_t durNs, const char *argName = nullptr,
+                             const char *argStr = nullptr, int64_t argInt = 0) {
+    if (!FwTrace_On()) return;
+    FwTrace_Add(FwTraceEvent{startNs, durNs, name, cat, 'X', (uint8_t)track, argName, argStr, argInt});
+}
+
+inline void FwTrace_Instant(int track, const char *name, const char *cat, uint64_t tsNs,
+                            const char *argName = nullptr, const char *argStr = nullptr,
+                            int64_t argInt = 0) {
+    if (!FwTrace_On()) return;
+    FwTrace_Add(FwTraceEvent{tsNs, 0, name, cat, 'i', (uint8_t)track, argName, argStr, argInt});
+}
+
+// Slice around a scope of real-time code
+struct FwTraceScope {
+    FwTraceScope(int t, const char *name, const char *cat) : track(t) {
+        FwTrace_Begin(track, name, cat, FwTrace_NowNs());
+    }
+    ~FwTraceScope() { FwTrace_End(track, FwTrace_NowNs()); }
+    int track;
+};
+
+// lock_guard that records a "mutex wait" slice when the lock was taken
+template <typename M>
+struct FwTraceLock {
+    FwTraceLock(M &m, const char *mutexName, int track) : mtx(m) {
+        if (mtx.try_lock()) return;
+        uint64_t t0 = FwTrace_NowNs();
+        mtx.lock();
+        FwTrace_Complete(track, "mutex wait", "mutex", t0, FwTrace_NowNs() - t0, "mutex", mutexName);
+    }
+    ~FwTraceLock() { mtx.unlock(); }
+    M &mtx;
+};
+
+// -----------------------------------------------------------------------------
+// Export
+// -----------------------------------------------------------------------------
+inline void FwTrace_JsonString(std::ostream &out, const char *s) {
+    out << '"';
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c < 0x20) {                                  // JSON forbids raw control chars
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out << esc;
+            continue;
+        }
+        if (c == '"' || c == '\\') out << '\\';
+        out << *s;
+    }
+    out << '"';
+}
+
+inline void FwTrace_JsonUs(std::ostream &out, uint64_t ns) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%llu.%03u", (unsigned long long)(ns / 1000), (unsigned)(ns % 1000));
+    out << buf;
+}
+
+/*
+Chrome trace-event format ("JSON Object Format"): one process per
+distinct process name, one thread per track, named by metadata events;
+timestamps in microseconds with ns precision.
+*/
+inline void FwTrace_WriteJson(std::ostream &out) {
+    FwTraceState &s = FwTrace_State();
+    std::lock_guard<std::mutex> lock(s.lock);
+    int pid[FW_TRACE_MAX_TRACKS];
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    for (int i = 0, processes = 0; i < s.trackCount; i++) {
+        pid[i] = 0;
+        for (int j = 0; j < i && !pid[i]; j++)
+            if (!strcmp(s.tracks[j].process, s.tracks[i].process)) pid[i] = pid[j];
+        if (!pid[i]) {
+            pid[i] = ++processes;
+            out << (first ? "\n" : ",\n") << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":"
+                << pid[i] << ",\"args\":{\"name\":";
+            FwTrace_JsonString(out, s.tracks[i].process);
+            out << "}}";
+            first = false;
+        }
+        out << ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid[i] << ",\"tid\":" << i + 1
+            << ",\"args\":{\"name\":";
+        FwTrace_JsonString(out, s.tracks[i].thread);
+        out << "}}";
+    }
+    for (const FwTraceEvent &e : s.events) {
+        out << (first ? "\n" : ",\n") << "{\"ph\":\"" << e.ph << "\",\"pid\":" << pid[e.track]
+            << ",\"tid\":" << e.track + 1 << ",\"ts\":";
+        first = false;
+        FwTrace_JsonUs(out, e.tsNs);
+        if (e.ph == 'E') { out << '}'; continue; }
+        out << ",\"name\":";
+        FwTrace_JsonString(out, e.name);
+        out << ",\"cat\":";
+        FwTrace_JsonString(out, e.cat);
+        if (e.ph == 'X') { out << ",\"dur\":"; FwTrace_JsonUs(out, e.durNs); }
+        if (e.ph == 'i') out << ",\"s\":\"t\"";
+        if (e.argName) {
+            out << ",\"args\":{";
+            FwTrace_JsonString(out, e.argName);
+            out << ':';
+            if (e.argStr) FwTrace_JsonString(out, e.argStr);
+            else out << e.argInt;
+            out << '}';
+        }
+        out << '}';
+    }
+    out << "\n]}\n";
+}
+
+inline unsigned long FwTrace_EventCount() {
+    FwTraceState &s = FwTrace_State();
+    std::lock_guard<std::mutex> lock(s.lock);
+    return s.events.size();
+}
+
+inline unsigned long FwTrace_Dropped() {
+    FwTraceState &s = FwTrace_State();
+    std::lock_guard<std::mutex> lock(s.lock);
+    return s.dropped;
+}
+
+#endif // FW_TRACE_H
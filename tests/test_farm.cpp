@@ -0,0 +1,228 @@
+/*
+===============================================================================
+Purpose: Unit tests for the device farm: the work-stealing pool and
+         epoch runner (fw_farm.h), per-device peripheral instances used
+         from many threads at once, and the fleet simulation
+         (18_device_farm.cpp) giving the same result on any number of
+         workers.
+Author: Sankalpa Hota
+How to compile & run (or `ctest -L unit`):
+  g++ -O2 -I. tests/test_farm.cpp -o test_farm -std=c++11 -pthread
+  ./test_farm [--filter=Fleet] [--jobs=N] [--verbose]
+===============================================================================
+*/
+
+#define main Farm_LessonMain
+#include "18_device_farm.cpp"
+#undef main
+#include "fw_test.h"
+
+// -----------------------------------------------------------------------------
+// SECTION 1: Work-stealing pool
+// -----------------------------------------------------------------------------
+FW_TEST(FarmPool, EveryTaskRunsExactlyOnce) {
+    FwPool pool(4);
+    std::vector<std::atomic<int> > runs(10000);
+    for (auto &r : runs) r = 0;
+    for (size_t i = 0; i < runs.size(); i++) pool.submit([&runs, i] { runs[i]++; });
+    pool.wait();
+    for (size_t i = 0; i < runs.size(); i++) FW_ASSERT_EQ(runs[i].load(), 1);
+    unsigned long executed = 0;
+    for (int k = 0; k < pool.size(); k++) executed += pool.worker(k).executed;
+    FW_EXPECT_EQ(executed, 10000ul);
+}
+
+// Tasks submitted from a task land on the running worker; wait() covers them
+FW_TEST(FarmPool, NestedSubmitsAreWaitedFor) {
+    FwPool pool(3);
+    std::atomic<int> leaves(0);
+    for (int i = 0; i < 50; i++)
+        pool.submit([&] {
+            for (int j = 0; j < 20; j++) pool.submit([&] { leaves++; });
+        });
+    pool.wait();
+    FW_EXPECT_EQ(leaves.load(), 1000);
+}
+
+// All work queued on worker 0: the others only get some by stealing
+FW_TEST(FarmPool, IdleWorkersSteal) {
+    FwPool pool(4);
+    std::atomic<int> done(0);
+    for (int i = 0; i < 400; i++)
+        pool.submit([&] {
+            this_thread::sleep_for(chrono::microseconds(200));
+            done++;
+        }, 0);
+    pool.wait();
+    FW_EXPECT_EQ(done.load(), 400);
+    unsigned long stolen = 0;
+    for (int k = 0; k < pool.size(); k++) stolen += pool.worker(k).stolen;
+    FW_EXPECT_GT(stolen, 0ul);
+    FW_EXPECT_EQ(pool.worker(0).stolen, 0ul);
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 2: Epoch runner
+// -----------------------------------------------------------------------------
+// Every slice of epoch e sees every device done with epoch e-1
+FW_TEST(FarmRun, EpochsAreBarriers) {
+    FwPool pool(4);
+    const size_t devices = 64;
+    std::vector<std::atomic<size_t> > epochOf(devices);
+    for (auto &e : epochOf) e = 0;
+    std::atomic<int> early(0);
+    std::vector<size_t> between;
+    FwFarmStats st = FwFarm_Run(pool, devices, 20,
+        [&](size_t i, size_t e) {
+            for (size_t j = 0; j < devices; j++)
+                if (epochOf[j].load() < e) early++;
+            epochOf[i] = e + 1;
+        },
+        [&](size_t e) { between.push_back(e); return true; });
+    FW_EXPECT_EQ(early.load(), 0);
+    FW_EXPECT_EQ(st.epochs, 20u);
+    FW_EXPECT_EQ(st.slices, 20ul * devices);
+    FW_EXPECT_EQ(between.size(), 20u);
+    FW_EXPECT_EQ(between.back(), 19u);
+}
+
+FW_TEST(FarmRun, BetweenCanEndTheRun) {
+    FwPool pool(2);
+    FwFarmStats st = FwFarm_Run(pool, 10, 100, [](size_t, size_t) {},
+                                [](size_t e) { return e < 4; });
+    FW_EXPECT_EQ(st.epochs, 5u);
+    FW_EXPECT_EQ(st.slices, 50ul);
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 3: Per-device peripherals
+// -----------------------------------------------------------------------------
+// Each thread drives its own I2C bus, IMU and SPI bus through the
+// global names; none sees another's traffic or touches the defaults
+FW_TEST(FarmPeripherals, ThreadsUseTheirOwnInstances) {
+    const int n = 8;
+    std::vector<unique_ptr<I2CPeripheral> > i2c;
+    std::vector<unique_ptr<SPIPeripheral> > spi;
+    std::vector<unique_ptr<I2CSensorDevice> > imu;
+    for (int t = 0; t < n; t++) {
+        i2c.emplace_back(new I2CPeripheral);
+        spi.emplace_back(new SPIPeripheral);
+        imu.emplace_back(new I2CSensorDevice(FARM_SENSOR_ADDR));
+        i2c[t]->bus.slaves.push_back(imu[t].get());
+    }
+    unsigned long defaultCompleted = I2C_Master0.completed;
+    uint64_t defaultSpiNs = SPI_NowNs;
+    std::atomic<int> wrong(0);
+    std::vector<thread> threads;
+    for (int t = 0; t < n; t++)
+        threads.emplace_back([&, t] {
+            I2C_Use(i2c[t].get());
+            SPI_Use(spi[t].get());
+            for (int k = 0; k < 50 + t; k++) {
+                uint8_t v = (uint8_t)(t * 16 + k), back = 0;
+                if (!I2C_WriteRegisters(FARM_SENSOR_ADDR, 0x20, &v, 1)) wrong++;
+                if (!I2C_ReadRegisters(FARM_SENSOR_ADDR, 0x20, &back, 1) || back != v) wrong++;
+                uint8_t out = v, in = 0;
+                SPIMaster(&out, &in, 1);
+            }
+            if (&I2C != &i2c[t]->bus || &SPI != &spi[t]->bus) wrong++;
+        });
+    for (thread &th : threads) th.join();
+    FW_EXPECT_EQ(wrong.load(), 0);
+    for (int t = 0; t < n; t++) {
+        FW_EXPECT_EQ(i2c[t]->master0.completed, 2ul * (50 + t));
+        FW_EXPECT_EQ(spi[t]->bus.edges, 16ul * (50 + t));
+        FW_EXPECT_EQ(imu[t]->regs[0x20], (uint8_t)(t * 16 + 49 + t));
+    }
+    FW_EXPECT_EQ(I2C_Master0.completed, defaultCompleted);
+    FW_EXPECT_EQ(SPI_NowNs, defaultSpiNs);
+    FW_EXPECT_EQ(&I2C, &I2C_DefaultBus);         // this thread never switched
+}
+
+FW_TEST(FarmPeripherals, NullSelectsTheDefaults) {
+    SPIPeripheral spi;
+    LED_REGS led = {0, 0};
+    SPI_Use(&spi);
+    LED_Use(&led);
+    LED.DATA = 1;
+    FW_EXPECT_EQ(&SPI, &spi.bus);
+    SPI_Use(nullptr);
+    LED_Use(nullptr);
+    FW_EXPECT_EQ(&SPI, &SPI_Default.bus);
+    FW_EXPECT_EQ(&LED, &LED_Default);
+    FW_EXPECT_EQ(led.DATA, 1u);
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 4: The fleet
+// -----------------------------------------------------------------------------
+FW_TEST(Fleet, RolloutCompletesCanariesFirst) {
+    FarmResult r = Farm_Run(300, 30, 2);
+    FW_EXPECT_EQ(r.updated, 300u);
+    FW_EXPECT_GT(r.canaryDoneMs, (uint64_t)FARM_ROLLOUT_MS);
+    FW_EXPECT_GT(r.rolloutDoneMs, r.canaryDoneMs);
+    FW_EXPECT_LT(r.rolloutDoneMs, 30000ull);
+    FW_EXPECT_EQ(r.sensorErrors, 0ul);
+    FW_EXPECT_EQ(r.nacks, r.noisyNacks);         // only noisy cables retry
+    FW_EXPECT_EQ(r.transfers, r.updated + r.nacks + r.timeouts);
+}
+
+// Same fleet, 1 and 4 workers: every number but the wall time matches
+FW_TEST(Fleet, ResultDoesNotDependOnWorkers) {
+    FarmResult a = Farm_Run(200, 8, 1), b = Farm_Run(200, 8, 4);
+    FW_EXPECT_EQ(a.farm.epochs, b.farm.epochs);
+    FW_EXPECT_EQ(a.updated, b.updated);
+    FW_EXPECT_EQ(a.canaryDoneMs, b.canaryDoneMs);
+    FW_EXPECT_EQ(a.rolloutDoneMs, b.rolloutDoneMs);
+    FW_EXPECT_EQ(a.telemetry, b.telemetry);
+    FW_EXPECT_EQ(a.transfers, b.transfers);
+    FW_EXPECT_EQ(a.nacks, b.nacks);
+    FW_EXPECT_EQ(a.timeouts, b.timeouts);
+    FW_EXPECT_EQ(a.crcErrors, b.crcErrors);
+    FW_EXPECT_EQ(a.flashPages, b.flashPages);
+}
+
+// The END frame never arrives: the device stays silent, no NACK. The
+// server must time the transfer out and send the image again.
+FW_TEST(Fleet, LostEndFrameIsResent) {
+    UART_TxTimeMs = 0;
+    FarmFleet fleet;
+    Farm_BuildUpdate(fleet);
+    unique_ptr<FarmDevice> d(new FarmDevice(1));   // a quiet cable
+    FW_ASSERT_FALSE(d->noisy);
+    d->reportedVersion = 1;
+    d->granted = true;
+    Farm_Slice(*d, fleet);                           // queues the image
+    FW_ASSERT_TRUE(d->streaming);
+
+    vector<uint8_t> end;
+    UART_BuildFrame(end, 0, fleet.frames.back().data(), (uint8_t)fleet.frames.back().size());
+    string queued;
+    for (; !d->gateway.txBuffer.empty(); d->gateway.txBuffer.pop()) queued += d->gateway.txBuffer.front();
+    FW_ASSERT_GT(queued.size(), end.size());
+    queued.resize(queued.size() - end.size());       // END is the last frame
+    for (char c : queued) d->gateway.txBuffer.push(c);
+
+    for (int i = 0; i < 100 && d->reportedVersion != fleet.targetVersion; i++) Farm_Slice(*d, fleet);
+    FW_EXPECT_EQ(d->version, fleet.targetVersion);
+    FW_EXPECT_EQ(d->reportedVersion, fleet.targetVersion);
+    FW_EXPECT_FALSE(d->streaming);
+    FW_EXPECT_EQ(d->timeouts, 1ul);
+    FW_EXPECT_EQ(d->transfers, 2ul);
+    FW_EXPECT_EQ(d->nacks, 0ul);
+    FW_EXPECT_GE(d->updatedAtMs, (uint64_t)FARM_STREAM_TIMEOUT_MS);
+}
+
+// FW_SCHED_SEED on: the workers use the UART's FwMutex outside the
+// scheduler instead of aborting, and nothing changes
+FW_TEST(Fleet, RunsWithTheSchedulerOn) {
+    FarmResult plain = Farm_Run(50, 4, 2);
+    FW_ASSERT_TRUE(FwSched_Start(1));
+    FarmResult sched = Farm_Run(50, 4, 2);
+    FwSched_Stop();
+    FW_EXPECT_EQ(sched.updated, plain.updated);
+    FW_EXPECT_EQ(sched.telemetry, plain.telemetry);
+    FW_EXPECT_EQ(sched.transfers, plain.transfers);
+}
+
+int main(int argc, char **argv) { return FwTest_Main(argc, argv); }
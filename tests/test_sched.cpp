@@ -0,0 +1,273 @@
+/*
+===============================================================================
+Purpose: Unit tests for the deterministic scheduler (fw_sched.h): seeds
+         reproduce interleavings, record/replay, the virtual clock,
+         mutexes and condition variables under it, deadlock and
+         divergence reports, and the UART wire thread
+         (10_uart_simulation.cpp) run deterministically.
+Author: Sankalpa Hota
+How to compile & run (or `ctest -L unit`):
+  g++ -O2 -I. tests/test_sched.cpp -o test_sched -std=c++11 -pthread
+  ./test_sched [--filter=Replay] [--jobs=N] [--verbose]
+===============================================================================
+*/
+
+#define main UART_LessonMain
+#include "10_uart_simulation.cpp"
+#undef main
+#include <set>
+#include "fw_test.h"
+
+// -----------------------------------------------------------------------------
+// SECTION 1: Helpers
+// -----------------------------------------------------------------------------
+// Every test starts the scheduler itself (FW_SCHED_* must not be set)
+struct SchedFixture : FwTestFixture {
+    std::string log;
+    void setUp() override {
+        log = "sched_" + std::to_string((long)getpid()) + ".log";
+    }
+    void tearDown() override {
+        FwSched_Stop();
+        remove(log.c_str());
+    }
+};
+
+// Three threads append their letter under a mutex, yielding in between:
+// the string is the interleaving
+static std::string Sched_Interleaving(uint64_t seed, const char *record = nullptr,
+                                      const char *replay = nullptr) {
+    if (!FwSched_Start(seed, record, replay)) return "scheduler already on";
+    std::string order;
+    FwMutex m;
+    auto worker = [&](char c) {
+        for (int i = 0; i < 6; i++) {
+            { lock_guard<FwMutex> lock(m); order += c; }
+            FwYield();
+        }
+    };
+    FwThread a(worker, 'a'), b(worker, 'b'), c(worker, 'c');
+    a.join();
+    b.join();
+    c.join();
+    FwSched_Stop();
+    return order;
+}
+
+#if FW_TEST_FORK
+// Runs fn in a child process (the scheduler ends a failed run with
+// _Exit) and returns its exit code
+static int Sched_ExitCode(const std::function<void()> &fn) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, 2);
+        fn();
+        FwSched_Stop();
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+#endif
+
+// -----------------------------------------------------------------------------
+// SECTION 2: Seeds, record and replay
+// -----------------------------------------------------------------------------
+FW_TEST_F(SchedFixture, SameSeedSameInterleaving) {
+    for (uint64_t seed = 0; seed < 10; seed++) {
+        std::string first = Sched_Interleaving(seed);
+        FW_ASSERT_EQ(first.size(), 18u);
+        FW_EXPECT_EQ(Sched_Interleaving(seed), first);
+    }
+}
+
+FW_TEST_F(SchedFixture, SeedsExploreDifferentInterleavings) {
+    std::set<std::string> seen;
+    for (uint64_t seed = 0; seed < 20; seed++) seen.insert(Sched_Interleaving(seed));
+    FW_EXPECT_GT(seen.size(), 10u);
+}
+
+// The replay follows the log, not the seed: the header naming the
+// seed is dropped and a different one passed
+FW_TEST_F(SchedFixture, ReplayFollowsRecordedDecisions) {
+    std::string recorded = Sched_Interleaving(1, log.c_str());
+    std::string lines, line;
+    {
+        std::ifstream in(log.c_str());
+        std::getline(in, line);
+        FW_ASSERT_EQ(line, std::string("# fw_sched seed=1"));
+        while (std::getline(in, line)) lines += line + "\n";
+    }
+    FW_ASSERT_FALSE(lines.empty());
+    { std::ofstream out(log.c_str()); out << lines; }
+    FW_EXPECT_EQ(Sched_Interleaving(99, nullptr, log.c_str()), recorded);
+    FW_EXPECT_NE(Sched_Interleaving(99), recorded);
+}
+
+#if FW_TEST_FORK
+// The log holds a decision the program never asks for
+FW_TEST_F(SchedFixture, ReplayDivergenceIsReported) {
+    { std::ofstream out(log.c_str()); out << "7 5\n"; }
+    std::string path = log;
+    FW_EXPECT_EQ(Sched_ExitCode([&] { Sched_Interleaving(0, nullptr, path.c_str()); }),
+                 FW_SCHED_FAIL_EXIT);
+}
+#endif
+
+// -----------------------------------------------------------------------------
+// SECTION 3: Virtual time, mutexes, condition variables
+// -----------------------------------------------------------------------------
+FW_TEST_F(SchedFixture, SleepersWakeInDeadlineOrderWithoutRealWaiting) {
+    FW_ASSERT_TRUE(FwSched_Start(3));
+    chrono::steady_clock::time_point real0 = chrono::steady_clock::now();
+    FwMutex m;
+    std::vector<std::pair<int, long long> > woke;
+    auto sleeper = [&](int ms) {
+        FwSleepFor(chrono::milliseconds(ms));
+        long long at = chrono::duration_cast<chrono::milliseconds>(FwClock::now().time_since_epoch()).count();
+        lock_guard<FwMutex> lock(m);
+        woke.push_back(std::make_pair(ms, at));
+    };
+    FwThread a(sleeper, 3000), b(sleeper, 1000), c(sleeper, 2000);
+    a.join();
+    b.join();
+    c.join();
+    FW_ASSERT_EQ(woke.size(), 3u);
+    for (int i = 0; i < 3; i++) {
+        FW_EXPECT_EQ(woke[i].first, 1000 * (i + 1));
+        FW_EXPECT_EQ(woke[i].second, 1000LL * (i + 1));
+    }
+    FW_EXPECT_LT(chrono::steady_clock::now() - real0, chrono::seconds(1));
+}
+
+FW_TEST_F(SchedFixture, MutexExcludesAcrossYields) {
+    for (uint64_t seed = 0; seed < 10; seed++) {
+        FW_ASSERT_TRUE(FwSched_Start(seed));
+        FwMutex m;
+        int inside = 0, maxInside = 0, total = 0;
+        auto worker = [&] {
+            for (int i = 0; i < 20; i++) {
+                lock_guard<FwMutex> lock(m);
+                inside++;
+                maxInside = std::max(maxInside, inside);
+                FwYield();                      // others run, but not in here
+                total++;
+                inside--;
+            }
+        };
+        FwThread a(worker), b(worker), c(worker);
+        a.join();
+        b.join();
+        c.join();
+        FwSched_Stop();
+        FW_EXPECT_EQ(maxInside, 1);
+        FW_EXPECT_EQ(total, 60);
+    }
+}
+
+FW_TEST_F(SchedFixture, CondVarTimedWaitTimesOutOnVirtualClock) {
+    FW_ASSERT_TRUE(FwSched_Start(0));
+    FwMutex m;
+    FwCondVar cv;
+    unique_lock<FwMutex> lock(m);
+    FW_EXPECT_FALSE(cv.wait_for(lock, chrono::milliseconds(5), [] { return false; }));
+    FW_EXPECT_EQ(FwSched_NowNs(), 5000000ull);
+}
+
+FW_TEST_F(SchedFixture, CondVarNotifyWakesBeforeTimeout) {
+    FW_ASSERT_TRUE(FwSched_Start(0));
+    FwMutex m;
+    FwCondVar cv;
+    bool ready = false;
+    FwThread producer([&] {
+        FwSleepFor(chrono::milliseconds(3));
+        lock_guard<FwMutex> lock(m);
+        ready = true;
+        cv.notify_one();
+    });
+    {
+        unique_lock<FwMutex> lock(m);
+        FW_EXPECT_TRUE(cv.wait_for(lock, chrono::milliseconds(10), [&] { return ready; }));
+        FW_EXPECT_EQ(FwSched_NowNs(), 3000000ull);
+    }
+    producer.join();
+}
+
+#if FW_TEST_FORK
+FW_TEST_F(SchedFixture, LockOrderDeadlockIsReported) {
+    FW_EXPECT_EQ(Sched_ExitCode([] {
+        FwSched_Start(0);
+        FwMutex a, b;
+        FwThread t1([&] { lock_guard<FwMutex> la(a); FwSleepFor(chrono::milliseconds(1)); lock_guard<FwMutex> lb(b); });
+        FwThread t2([&] { lock_guard<FwMutex> lb(b); FwSleepFor(chrono::milliseconds(1)); lock_guard<FwMutex> la(a); });
+        t1.join();
+        t2.join();
+    }), FW_SCHED_FAIL_EXIT);
+}
+
+// Both threads spin on a flag nobody sets: every yield is runnable, so
+// only the time limit can end it
+FW_TEST_F(SchedFixture, YieldSpinLivelockHitsTheTimeLimit) {
+    FW_EXPECT_EQ(Sched_ExitCode([] {
+        setenv("FW_SCHED_MAX_MS", "5", 1);
+        FwSched_Start(0);
+        std::atomic<bool> go(false);
+        FwThread t1([&] { while (!go) FwYield(); });
+        FwThread t2([&] { while (!go) FwYield(); });
+        t1.join();
+        t2.join();
+    }), FW_SCHED_FAIL_EXIT);
+}
+#endif
+
+// Without the scheduler the wrappers are the std primitives
+FW_TEST(Sched, OffRunsRealThreads) {
+    FW_ASSERT_FALSE(FwSched_On());
+    FwMutex m;
+    FwCondVar cv;
+    int n = 0;
+    FwThread t([&] { lock_guard<FwMutex> lock(m); n++; cv.notify_one(); });
+    {
+        unique_lock<FwMutex> lock(m);
+        FW_EXPECT_TRUE(cv.wait_for(lock, chrono::seconds(10), [&] { return n == 1; }));
+    }
+    t.join();
+    FW_EXPECT_EQ(n, 1);
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 4: The UART wire thread, deterministically
+// -----------------------------------------------------------------------------
+// The demo's firmware/wire exchange: what arrives, and when on the
+// virtual clock, is a function of the seed
+static std::string Sched_UartRun(uint64_t seed) {
+    if (!FwSched_Start(seed)) return "scheduler already on";
+    UART_Registers uart0, uart1;
+    atomic<bool> stop(false);
+    FwThread wire(UART_TransferWire, ref(uart0), ref(uart1), ref(stop));
+    std::string got;
+    for (const char *p = "Hi!"; *p; p++) {
+        UART_SendChar(uart0, *p);
+        got += std::to_string(FwSched_NowNs() / 1000000) + ":";
+    }
+    FwSleepFor(chrono::milliseconds(500));
+    for (int i = 0; i < 3; i++) got += UART_ReadChar(uart1);
+    stop = true;
+    wire.join();
+    got += "@" + std::to_string(FwSched_NowNs() / 1000000);
+    FwSched_Stop();
+    return got;
+}
+
+FW_TEST_F(SchedFixture, UartWireRunIsReproducible) {
+    UART_TxTimeMs = 100;
+    for (uint64_t seed = 0; seed < 5; seed++) {
+        std::string first = Sched_UartRun(seed);
+        FW_EXPECT_EQ(first.substr(0, 15), std::string("100:200:300:Hi!"));
+        FW_EXPECT_EQ(Sched_UartRun(seed), first);
+    }
+}
+
+int main(int argc, char **argv) { return FwTest_Main(argc, argv); }
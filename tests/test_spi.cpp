@@ -0,0 +1,212 @@
+/*
+===============================================================================
+Purpose: Unit tests for the SPI simulation (11_spi_realistic.cpp): the
+         bit-accurate master and slave in all four SPI modes, the NOR
+         flash command set in every read mode, and the multi-slave
+         controller.
+Author: Sankalpa Hota
+How to compile & run (or `ctest -L unit`):
+  g++ -O2 -I. tests/test_spi.cpp -o test_spi -std=c++11 -pthread
+  ./test_spi [--filter=Mode] [--jobs=N] [--verbose]
+===============================================================================
+*/
+
+#define main SPI_LessonMain
+#include "11_spi_realistic.cpp"
+#undef main
+#include "fw_test.h"
+
+// -----------------------------------------------------------------------------
+// SECTION 1: Bit-accurate master/slave, every byte in every mode
+// -----------------------------------------------------------------------------
+// Resets the global bus, as a power-on would, and wires an echo slave
+struct SPIModeByte : FwTestWithParam<std::pair<int, int> > {
+    SPIShiftSlave echo;
+    void setUp() override {
+        SPI = SPIBus();
+        SPI_NowNs = 0;
+        SPI.mode = param().first;
+        SPI.slave = &echo;
+    }
+    void tearDown() override { SPI.slave = nullptr; }
+};
+
+FW_TEST_P(SPIModeByte, EchoArrivesOneByteLater) {
+    uint8_t out[2] = {(uint8_t)param().second, (uint8_t)~param().second}, in[2] = {};
+    SPIMaster(out, in, 2);
+    FW_EXPECT_EQ(in[0], 0);                     // nothing received yet
+    FW_EXPECT_EQ(in[1], out[0]);
+    FW_EXPECT_EQ(echo.lastReceived, out[1]);
+    FW_EXPECT_EQ(echo.bytesReceived, 2ul);
+}
+
+FW_TEST_P(SPIModeByte, ClockIdlesAtCpolAndTakesSixteenEdgesPerByte) {
+    uint8_t out = (uint8_t)param().second, in = 0;
+    SPIMaster(&out, &in, 1);
+    FW_EXPECT_EQ(SPI.SCLK, SPI_CPOL());
+    FW_EXPECT_EQ(SPI.edges, 16ul);
+    FW_EXPECT_EQ(SPI_NowNs, 8 * 1000000000ULL / SPI_ClockHz);
+    FW_EXPECT_TRUE(SPI.CS);                     // released
+    FW_EXPECT_EQ(SPI.MISO, 1);                  // tri-stated (pulled up)
+}
+
+FW_INSTANTIATE(AllModes, SPIModeByte, FwTest_Combine(FwTest_Range(0, 4), FwTest_Range(0, 256)));
+
+// -----------------------------------------------------------------------------
+// SECTION 2: NOR flash model
+// -----------------------------------------------------------------------------
+#define TEST_FLASH_SIZE (1024 * 1024)
+
+// A fresh, erased 1 MB chip per test; the backing file is per process
+// so parallel workers never share one
+struct FlashTest : FwTestFixture {
+    SPIFlash flash;
+    char path[64];
+    void setUp() override {
+        SPI_NowNs = 0;
+        snprintf(path, sizeof(path), "test_spi_flash_%d.bin", (int)getpid());
+        remove(path);
+        FW_ASSERT_TRUE(flash.open(path, TEST_FLASH_SIZE));
+    }
+    void tearDown() override {
+        flash.close();
+        remove(path);
+    }
+    uint8_t readByte(uint32_t addr) {
+        uint8_t b;
+        QSPI_Read(flash, QSPI_MODES[0], addr, &b, 1);
+        return b;
+    }
+};
+
+FW_TEST_F(FlashTest, JedecIdEncodesCapacity) {
+    FW_EXPECT_EQ(Flash_ReadJedecId(flash), 0xEF4014u);   // Winbond, 2^20 bytes
+}
+
+FW_TEST_F(FlashTest, NewChipReadsErased) {
+    for (uint32_t a = 0; a < TEST_FLASH_SIZE; a += 65537) FW_EXPECT_EQ(readByte(a), 0xFF);
+}
+
+FW_TEST_F(FlashTest, ProgramOnlyClearsBits) {
+    uint8_t v = 0x0F;
+    Flash_Write(flash, 100, &v, 1);
+    v = 0xF0;
+    Flash_Write(flash, 100, &v, 1);
+    FW_EXPECT_EQ(readByte(100), 0x00);
+    Flash_EraseSector(flash, 0);
+    FW_EXPECT_EQ(readByte(100), 0xFF);
+}
+
+FW_TEST_F(FlashTest, ProgramWithoutWriteEnableIsIgnored) {
+    SPI_Select(flash);
+    Flash_SendAddress(flash, FLASH_CMD_PP, 0);
+    SPI_TransferByte(flash, 0x00);
+    SPI_Deselect(flash);
+    Flash_WaitReady(flash);
+    FW_EXPECT_EQ(readByte(0), 0xFF);
+}
+
+FW_TEST_F(FlashTest, BusyUntilPageProgramTimeHasPassed) {
+    uint8_t v = 0x12;
+    Flash_Command(flash, FLASH_CMD_WREN);
+    SPI_Select(flash);
+    Flash_SendAddress(flash, FLASH_CMD_PP, 0);
+    SPI_TransferByte(flash, v);
+    SPI_Deselect(flash);
+    uint64_t start = SPI_NowNs;
+    FW_EXPECT_TRUE(flash.busy());
+    FW_EXPECT_GT(Flash_WaitReady(flash), 1ul);
+    FW_EXPECT_GE(SPI_NowNs - start, FLASH_T_PP_NS);
+    FW_EXPECT_EQ(readByte(0), 0x12);
+}
+
+// Every read mode returns the same data; quad modes need QE first
+struct FlashReadMode : FwTestWithParam<int> {
+    SPIFlash flash;
+    char path[64];
+    vector<uint8_t> image;
+    void setUp() override {
+        SPI_NowNs = 0;
+        snprintf(path, sizeof(path), "test_spi_flash_%d.bin", (int)getpid());
+        remove(path);
+        FW_ASSERT_TRUE(flash.open(path, TEST_FLASH_SIZE));
+        image.resize(3 * FLASH_PAGE_SIZE + 17);             // crosses page boundaries
+        for (size_t i = 0; i < image.size(); i++) image[i] = (uint8_t)(i * 31 + (i >> 8));
+        Flash_Write(flash, 250, image.data(), (uint32_t)image.size());
+    }
+    void tearDown() override {
+        flash.close();
+        remove(path);
+    }
+};
+
+FW_TEST_P(FlashReadMode, ReadsBackProgrammedData) {
+    const QSPI_Mode &m = QSPI_MODES[param()];
+    Flash_EnableQuad(flash);
+    vector<uint8_t> back(image.size());
+    QSPI_LineMismatches = 0;
+    QSPI_Read(flash, m, 250, back.data(), (uint32_t)back.size());
+    FW_EXPECT_TRUE(back == image);
+    FW_EXPECT_EQ(QSPI_LineMismatches, 0ul);
+}
+
+FW_TEST_P(FlashReadMode, QuadModesIgnoredWithoutQuadEnable) {
+    const QSPI_Mode &m = QSPI_MODES[param()];
+    if (m.dataLines < 4) return;
+    uint8_t b = 0;
+    QSPI_Read(flash, m, 250, &b, 1);
+    FW_EXPECT_NE(b, image[0]);
+}
+
+FW_INSTANTIATE(AllModes, FlashReadMode, FwTest_Range(0, (int)(sizeof(QSPI_MODES) / sizeof(QSPI_MODES[0]))));
+
+// -----------------------------------------------------------------------------
+// SECTION 3: Multi-slave controller
+// -----------------------------------------------------------------------------
+struct SPIControllerTest : FwTestFixture {
+    SPIController ctrl;
+    ShiftRegisterDevice leds, relays;
+    void setUp() override {
+        SPI_NowNs = 0;
+        FW_ASSERT_TRUE(SPI_Attach(ctrl, 0, leds, "leds"));
+        FW_ASSERT_TRUE(SPI_Attach(ctrl, 1, relays, "relays"));
+    }
+};
+
+FW_TEST_F(SPIControllerTest, OneChipSelectNoContention) {
+    SPI_AssertCS(ctrl, 0);
+    SPI_BusTransfer(ctrl, 0xA5);
+    SPI_ReleaseCS(ctrl, 0);
+    FW_EXPECT_EQ(leds.outputs, 0xA5);          // latched on CS rising edge
+    FW_EXPECT_EQ(relays.outputs, 0);
+    FW_EXPECT_EQ(ctrl.contentionErrors, 0ul);
+    FW_EXPECT_EQ(ctrl.transactionsPerCs[0], 1ul);
+}
+
+FW_TEST_F(SPIControllerTest, TwoChipSelectsAreContention) {
+    SPI_AssertCS(ctrl, 0);
+    SPI_AssertCS(ctrl, 1);
+    SPI_BusTransfer(ctrl, 0x3C);
+    SPI_ReleaseCS(ctrl, 1);
+    SPI_ReleaseCS(ctrl, 0);
+    FW_EXPECT_EQ(ctrl.contentionErrors, 1ul);
+}
+
+FW_TEST_F(SPIControllerTest, SecondDeviceOnSameChipSelectRejected) {
+    ShiftRegisterDevice extra;
+    FW_EXPECT_FALSE(SPI_Attach(ctrl, 0, extra, "extra"));
+    FW_EXPECT_FALSE(SPI_Attach(ctrl, SPI_MAX_CS, extra, "extra"));
+}
+
+// Out-of-range and unattached lines are ignored, not dereferenced
+FW_TEST_F(SPIControllerTest, InvalidChipSelectIgnored) {
+    for (int cs : {-1, 2, SPI_MAX_CS}) {
+        SPI_AssertCS(ctrl, cs);
+        SPI_ReleaseCS(ctrl, cs);
+    }
+    FW_EXPECT_EQ(SPI_NowNs, 0ull);
+    FW_EXPECT_EQ(ctrl.busyNs, 0ull);
+    for (int cs = 0; cs < SPI_MAX_CS; cs++) FW_EXPECT_FALSE(ctrl.csActive[cs]);
+}
+
+int main(int argc, char **argv) { return FwTest_Main(argc, argv); }
@@ -0,0 +1,184 @@
+/*
+===============================================================================
+Purpose: Unit tests for the UART simulation (10_uart_simulation.cpp):
+         FIFOs, flow control, bit-level framing at every standard baud
+         rate, the frame protocol and the two-node link.
+Author: Sankalpa Hota
+How to compile & run (or `ctest -L unit`):
+  g++ -O2 -I. tests/test_uart.cpp -o test_uart -std=c++11 -pthread
+  ./test_uart [--filter=Baud] [--jobs=N] [--verbose]
+===============================================================================
+*/
+
+#define main UART_LessonMain
+#include "10_uart_simulation.cpp"
+#undef main
+#include "fw_test.h"
+
+static const std::vector<uint32_t> UART_TestBauds = {
+    1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600};
+
+// -----------------------------------------------------------------------------
+// SECTION 1: Registers, FIFO and flow control
+// -----------------------------------------------------------------------------
+struct UARTPair : FwTestFixture {
+    UART_Registers a, b;
+    void setUp() override {
+        a.rxBuffer.reset(16);
+        b.rxBuffer.reset(16);
+    }
+};
+
+FW_TEST_F(UARTPair, FifoKeepsOrder) {
+    for (char c = 'a'; c <= 'p'; c++) FW_ASSERT_TRUE(b.rxBuffer.push(c));
+    FW_EXPECT_FALSE(b.rxBuffer.push('q'));                  // 16 deep
+    for (char c = 'a'; c <= 'p'; c++) FW_EXPECT_EQ(UART_ReadChar(b), c);
+    FW_EXPECT_EQ(UART_ReadChar(b), 0);
+}
+
+FW_TEST_F(UARTPair, FifoResetClampsDepth) {
+    b.rxBuffer.reset(1000);
+    FW_EXPECT_EQ(b.rxBuffer.depth, UART_RX_FIFO_MAX);
+    for (int d : {0, -4}) {                                 // never a zero modulus
+        b.rxBuffer.reset(d);
+        FW_EXPECT_EQ(b.rxBuffer.depth, 1);
+        FW_EXPECT_TRUE(b.rxBuffer.push('x'));
+        FW_EXPECT_FALSE(b.rxBuffer.push('y'));
+        FW_EXPECT_EQ(UART_ReadChar(b), 'x');
+    }
+}
+
+FW_TEST_F(UARTPair, RtsDropsAtMarginAndReturnsBelowWatermark) {
+    b.flowControl = true;
+    UART_ConnectFlowControl(a, b);
+    a.flowControl = true;
+    for (int i = 0; i < 14; i++) {                          // free space 2 = margin
+        a.txBuffer.push('x');
+        UART_WireShiftByte(a, b);
+    }
+    FW_EXPECT_FALSE(b.RTS);
+    a.txBuffer.push('y');
+    FW_EXPECT_FALSE(UART_WireShiftByte(a, b));              // CTS off: held back
+    FW_EXPECT_EQ(b.rxBytes, 14ul);
+    while (b.rxBuffer.count >= b.rxWatermark) UART_ReadChar(b);
+    FW_EXPECT_TRUE(b.RTS);
+    UART_WireShiftByte(a, b);
+    FW_EXPECT_EQ(b.rxBytes, 15ul);
+    FW_EXPECT_EQ(b.rxOverruns, 0ul);
+}
+
+static int UART_TestWatermarkHits = 0;
+static void UART_TestWatermarkISR(UART_Registers &) { UART_TestWatermarkHits++; }
+
+FW_TEST_F(UARTPair, WatermarkInterruptOncePerCrossing) {
+    UART_TestWatermarkHits = 0;
+    b.rxWatermarkISR = UART_TestWatermarkISR;
+    for (int i = 0; i < 12; i++) {
+        a.txBuffer.push('w');
+        UART_TransferWireOneWay(a, b);
+    }
+    FW_EXPECT_EQ(UART_TestWatermarkHits, 1);
+    FW_EXPECT_EQ(b.rxWatermarkIrqs, 1ul);
+}
+
+// -----------------------------------------------------------------------------
+// SECTION 2: Bit-level framing, every byte at every baud rate
+// -----------------------------------------------------------------------------
+struct UARTBaud : FwTestWithParam<uint32_t> {};
+
+FW_TEST_P(UARTBaud, CharTimeIsTenBits) {
+    UART_Registers u;
+    u.baudRate = param();
+    FW_EXPECT_EQ(UART_CharTimeNs(u), 10ULL * 1000000000ULL / param());
+}
+
+FW_TEST_P(UARTBaud, IdealLinkCompletesEveryTransaction) {
+    UART_LinkConfig cfg = {"test", param(), param(), 0, 0.0};
+    UART_LinkResult r = UART_RunLinkBenchmark(cfg, 5, 16, 16, 1000);
+    FW_EXPECT_EQ(r.completed, 5ul);
+    FW_EXPECT_EQ(r.failed + r.retries + r.framingErrors + r.crcErrors, 0ul);
+}
+
+FW_INSTANTIATE(Std, UARTBaud, UART_TestBauds);
+
+// (baud, byte): the receiver samples what the transmitter sent
+struct UARTByte : FwTestWithParam<std::pair<uint32_t, int> > {
+    UART_Cable cable;
+};
+
+FW_TEST_P(UARTByte, SameBaudRoundTrips) {
+    uint32_t baud = param().first;
+    char data = (char)param().second;
+    for (int follows = 0; follows < 2; follows++) {
+        UART_WireFrame f = UART_SampleFrame(cable, data, baud, baud, follows);
+        FW_EXPECT_EQ(f.data, data);
+        FW_EXPECT_FALSE(f.framingError);
+    }
+}
+
+FW_TEST_P(UARTByte, ThreePercentMismatchStillDecodes) {
+    uint32_t baud = param().first;
+    char data = (char)param().second;
+    uint32_t fast = baud + baud * 3 / 100, slow = baud - baud * 3 / 100;
+    FW_EXPECT_EQ(UART_SampleFrame(cable, data, baud, fast, true).data, data);
+    FW_EXPECT_EQ(UART_SampleFrame(cable, data, baud, slow, true).data, data);
+    FW_EXPECT_FALSE(UART_SampleFrame(cable, data, baud, slow, true).framingError);
+}
+
+// A receiver 6% slow samples the stop bit inside the next start bit
+FW_TEST_P(UARTByte, SixPercentSlowReceiverSeesFramingError) {
+    uint32_t baud = param().first;
+    UART_WireFrame f = UART_SampleFrame(cable, (char)param().second, baud,
+                                        baud - baud * 6 / 100, true);
+    FW_EXPECT_TRUE(f.framingError);
+}
+
+FW_INSTANTIATE(AllBytes, UARTByte, FwTest_Combine(UART_TestBauds, FwTest_Range(0, 256)));
+
+// -----------------------------------------------------------------------------
+// SECTION 3: Frame protocol
+// -----------------------------------------------------------------------------
+struct UARTFrameLen : FwTestWithParam<int> {
+    vector<uint8_t> frame;
+    uint8_t payload[UART_FRAME_MAX_LEN];
+    UART_FrameParser parser;
+    void setUp() override {
+        for (int i = 0; i < UART_FRAME_MAX_LEN; i++) payload[i] = (uint8_t)(i * 37 + param());
+        UART_BuildFrame(frame, (uint8_t)param(), payload, (uint8_t)param());
+    }
+    int feedAll() {
+        int complete = 0;
+        for (uint8_t byte : frame) complete += parser.feed(byte);
+        return complete;
+    }
+};
+
+FW_TEST_P(UARTFrameLen, ParsesBack) {
+    FW_ASSERT_EQ(frame.size(), (size_t)param() + 4);
+    FW_ASSERT_EQ(feedAll(), 1);
+    FW_EXPECT_EQ(parser.seq(), (uint8_t)param());
+    FW_EXPECT_EQ(parser.len, (uint8_t)param());
+    FW_EXPECT_EQ(memcmp(parser.payload(), payload, param()), 0);
+}
+
+FW_TEST_P(UARTFrameLen, CorruptedByteIsCrcError) {
+    frame[frame.size() / 2 + 1] ^= 0x10;                    // payload or CRC byte
+    FW_EXPECT_EQ(feedAll(), 0);
+    FW_EXPECT_EQ(parser.frames, 0ul);
+}
+
+FW_TEST_P(UARTFrameLen, ResyncsAfterGarbage) {
+    const uint8_t junk[] = {0x00, 0x55, 0xFF, UART_FRAME_SOF, 0xF0};   // bad LEN
+    for (uint8_t byte : junk) parser.feed(byte);
+    FW_EXPECT_EQ(feedAll(), 1);
+}
+
+FW_INSTANTIATE(Len, UARTFrameLen, FwTest_Range(0, UART_FRAME_MAX_LEN + 1));
+
+FW_TEST(UARTCrc8, KnownValues) {
+    const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    FW_EXPECT_EQ(UART_Crc8(check, sizeof(check)), 0xF4);   // CRC-8/SMBUS check value
+    FW_EXPECT_EQ(UART_Crc8(check, 0), 0);
+}
+
+int main(int argc, char **argv) { return FwTest_Main(argc, argv); }